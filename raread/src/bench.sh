@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# Benchmark for 'raread' - Linux version
+#
+# Reads each diskette type from a plain file and from an emulated drive,
+# using --stats to time each run, and reports tracks per second, processor
+# time per track and image bytes per track.
+# The results are compared with the baseline in bench.base; the script
+# fails if any case is more than $SLACK percent slower, or uses more than
+# $CPUSLACK percent more processor time per track, than its baseline.
+#
+# Usage:	sh bench.sh		run and compare with the baseline
+#		sh bench.sh -u		run and save as the new baseline
+#
+# Usually run as 'make -f makefile.gcc bench' (or 'baseline'). The
+# baseline belongs to the machine it was made on; make a new one after
+# moving to another.
+#
+PROG=${PROG:-./raread}
+BASE=${BASE:-bench.base}
+SLACK=${SLACK:-30}
+CPUSLACK=${CPUSLACK:-50}
+#
+# Runs of each plain file case; the best time and the least processor
+# time are kept, as one run is too quick to time reliably
+#
+REPS=${REPS:-20}
+#
+# Emulated drive, turning ten times faster than a real one so that the
+# whole benchmark takes well under a minute
+#
+EMU=rpm=3000,step=0,settle=2
+#
+#-----------------------------------------------------------------------------
+#
+update=no
+if [ "$1" = "-u" ]; then
+	update=yes
+elif [ $# -ne 0 ]; then
+	echo "usage: sh bench.sh [-u]" >&2
+	exit 2
+fi
+
+if [ $update = no -a ! -f "$BASE" ]; then
+	echo "no baseline in $BASE; make one with 'sh bench.sh -u'" >&2
+	exit 2
+fi
+
+tmp=`mktemp -d` || exit 2
+trap 'rm -rf "$tmp"' 0
+trap 'exit 2' 1 2 15
+
+#
+# Make a file of random data; name, sectors per track, tracks
+#
+mkfile() {
+	dd if=/dev/urandom of="$tmp/$1" bs=512 count=`expr $2 \* $3` \
+		2>/dev/null || exit 2
+}
+
+#
+# Get a number from the report of the last run
+#
+field() {
+	sed -n "s/^  \"$1\": \\([0-9.]*\\),\$/\\1/p" "$tmp/stats.json"
+}
+
+#
+# Run one case; name, flags, drive, runs
+#
+runcase() {
+	best=
+	i=0
+	while [ $i -lt $4 ]; do
+		rm -f "$tmp/out.img"
+		if ! $PROG $2 --stats "$tmp/stats.json" "$3" "$tmp/out.img" \
+		   >/dev/null 2>&1; then
+			echo "$1: raread failed" >&2
+			exit 1
+		fi
+		tracks=`awk '/"read_track"/ { getline; gsub(/[^0-9]/, "");
+			print; exit }' "$tmp/stats.json"`
+		line="`field elapsed_ms` `field cpu_ms`"
+		best=`echo "$best" "$line" | awk '{
+			if(NF == 4) {
+				if($3 < $1) $1 = $3
+				if($4 < $2) $2 = $4
+			}
+			print $1, $2 }'`
+		i=`expr $i + 1`
+	done
+	bytes=`wc -c < "$tmp/out.img"`
+	echo "$1 $tracks $best $bytes" | awk '{
+		printf "%s %.1f %.1f %d\n", $1, $2 * 1000 / $3,
+			$4 * 1000 / $2, $5 / $2 }' >> "$tmp/results"
+}
+
+: > "$tmp/results"
+mkfile dd.img 9 160
+mkfile hd.img 18 160
+mkfile ed.img 36 160
+
+for t in dd hd ed; do
+	runcase file-$t "" "$tmp/$t.img" $REPS
+	runcase emu-$t "" "emu:$tmp/$t.img,$EMU" 1
+done
+
+if [ $update = yes ]; then
+	(
+		echo "# Baseline for raread benchmark (bench.sh)"
+		echo "# case tracks/s cpu-us/track"
+		awk '{ print $1, $2, $3 }' "$tmp/results"
+	) > "$BASE"
+	echo "baseline saved in $BASE"
+	exit 0
+fi
+
+awk -v slack=$SLACK -v cpuslack=$CPUSLACK '
+	FNR == NR {
+		if($1 !~ /^#/) { rate[$1] = $2; cpu[$1] = $3 }
+		next
+	}
+	FNR == 1 {
+		printf "%-12s %10s %10s %12s %10s\n", "case", "tracks/s",
+			"baseline", "cpu-us/track", "baseline"
+	}
+	{
+		verdict = ""
+		if(!($1 in rate)) {
+			verdict = "no baseline"
+		} else {
+			if($2 < rate[$1] * (100 - slack) / 100)
+				verdict = "SLOWER"
+			if($3 > cpu[$1] * (100 + cpuslack) / 100) {
+				if(verdict != "") verdict = verdict ", "
+				verdict = verdict "MORE CPU"
+			}
+			if(verdict != "") failed = 1
+		}
+		printf "%-12s %10.1f %10s %12.1f %10s  %d bytes/track  %s\n",
+			$1, $2, rate[$1], $3, cpu[$1], $4, verdict
+	}
+	END { exit failed }' "$BASE" "$tmp/results"
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Checks for 'raread' - Linux version
+#
+# Reads images from emulated drives set up to fail in known ways, and
+# checks that what comes out is right. Each check is reported as it is
+# run; the script fails if any check fails.
+#
+# Usage:	sh check.sh
+#
+# Usually run as 'make -f makefile.gcc check'.
+#
+PROG=${PROG:-./raread}
+#
+# Seeds for the random faults; each gives a different set of faults, but
+# the same one on every run
+#
+SEEDS=${SEEDS:-"1 2 3"}
+#
+#-----------------------------------------------------------------------------
+#
+if [ $# -ne 0 ]; then
+	echo "usage: sh check.sh" >&2
+	exit 2
+fi
+
+tmp=`mktemp -d` || exit 2
+trap 'rm -rf "$tmp"' 0
+trap 'exit 2' 1 2 15
+
+failed=0
+
+#
+# Make a file of random data; name, sectors per track, tracks
+#
+mkfile() {
+	dd if=/dev/urandom of="$tmp/$1" bs=512 count=`expr $2 \* $3` \
+		2>/dev/null || exit 2
+}
+
+#
+# Report the result of one check; name, then the command that checks it
+#
+check() {
+	name=$1
+	shift
+	if "$@" >/dev/null 2>&1; then
+		echo "$name: ok"
+	else
+		echo "$name: FAILED"
+		failed=1
+	fi
+}
+
+mkfile hd.img 18 160
+
+#
+# Voting between passes. The drive gives random faults, and keeps the
+# outcome of the last track it read (as the floppy driver and the system
+# cache do); unless that is dropped before each pass, every pass of a
+# track gets the faults of the first, and the sectors are lost
+#
+vote() {
+	rm -f "$tmp/out.img"
+	$PROG -h -p 3 "emu:$tmp/hd.img,fast,cache,faults=300,seed=$1" \
+		"$tmp/out.img" && cmp "$tmp/hd.img" "$tmp/out.img"
+}
+
+for s in $SEEDS; do
+	check "vote, seed $s" vote $s
+done
+
+#
+# Resuming twice. Each run is stopped part way by a diskette change, and
+# the last line of the journal then cut short, as if the run had been
+# killed while writing it; the image must still come out right in the end
+#
+cutshort() {
+	size=`wc -c < "$tmp/out.jnl"`
+	head -c `expr $size - 4` "$tmp/out.jnl" > "$tmp/cut.jnl" &&
+		mv "$tmp/cut.jnl" "$tmp/out.jnl"
+}
+
+resume() {
+	rm -f "$tmp/out.img" "$tmp/out.jnl"
+	for n in 50 50; do
+		if $PROG -h --resume "emu:$tmp/hd.img,fast,change=$n" \
+		   "$tmp/out.img" || [ ! -f "$tmp/out.jnl" ]; then
+			return 1
+		fi
+		cutshort || return 1
+	done
+	$PROG -h --resume "emu:$tmp/hd.img,fast" "$tmp/out.img" &&
+		cmp "$tmp/hd.img" "$tmp/out.img" && [ ! -f "$tmp/out.jnl" ]
+}
+
+check "resume, journal cut short twice" resume
+
+exit $failed
@@ -0,0 +1,97 @@
+/*
+ * File: elevator.c
+ *
+ * Diskette raw image utilities
+ *
+ * Ordering of work on a set of tracks
+ *
+ */
+
+/*
+ * When only some of the tracks of a diskette are to be read or written,
+ * the time taken is mostly spent moving the heads. The tracks are
+ * therefore done in 'elevator' order: both heads of a cylinder are done
+ * before stepping to the next, and the heads sweep across the diskette
+ * just once, in one direction. The sweep starts from whichever end of
+ * the set is nearer to where the heads are, so that a second pass over
+ * a diskette works back from where the first one finished, instead of
+ * stepping all the way back to cylinder 0 first.
+ *
+ * Tracks are numbered as usual, from zero, as cylinder*heads + head.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdlib.h>
+
+#include "elevator.h"
+
+/* Forward references */
+
+static	INT	compare_tracks(const void *, const void *);
+static	VOID	reverse_tracks(PUINT, UINT);
+
+
+/*
+ * Put the 'n' tracks in 'trk' into elevator order, for a diskette with
+ * 'heads' heads whose heads are on cylinder 'cyl'.
+ *
+ */
+
+VOID order_tracks(PUINT trk, UINT n, UINT heads, UINT cyl)
+{	UINT lo, hi;			/* Lowest and highest cylinders */
+	UINT i, j;
+
+	if(n == 0) return;
+	qsort((PVOID) trk, (size_t) n, sizeof(UINT), compare_tracks);
+
+	lo = trk[0] / heads;
+	hi = trk[n-1] / heads;
+	if((cyl > lo ? cyl - lo : lo - cyl) <= (cyl > hi ? cyl - hi : hi - cyl))
+		return;			/* Sweep upwards */
+
+	/* Sweep downwards; reverse the order of the cylinders, but keep the
+	   heads of each cylinder in order */
+
+	reverse_tracks(trk, n);
+	for(i = 0; i < n; i = j) {
+		for(j = i + 1; j < n && trk[j] / heads == trk[i] / heads; j++)
+			;
+		reverse_tracks(trk + i, j - i);
+	}
+}
+
+
+/*
+ * Compare two track numbers, for sorting into ascending order.
+ *
+ */
+
+static INT compare_tracks(const void *a, const void *b)
+{	UINT x = *(const UINT *) a;
+	UINT y = *(const UINT *) b;
+
+	return(x < y ? -1 : x > y ? 1 : 0);
+}
+
+
+/*
+ * Reverse the order of 'n' track numbers.
+ *
+ */
+
+static VOID reverse_tracks(PUINT trk, UINT n)
+{	UINT i, x;
+
+	for(i = 0; i < n / 2; i++) {
+		x = trk[i];
+		trk[i] = trk[n-1-i];
+		trk[n-1-i] = x;
+	}
+}
+
+/*
+ * End of file: elevator.c
+ *
+ */
@@ -0,0 +1,22 @@
+/*
+ * File: elevator.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for ordering work on a set of tracks
+ *
+ */
+
+#ifndef	_ELEVATOR_H
+#define	_ELEVATOR_H
+
+/* External references */
+
+extern	VOID	order_tracks(PUINT, UINT, UINT, UINT);
+
+#endif
+
+/*
+ * End of file: elevator.h
+ *
+ */
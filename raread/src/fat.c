@@ -0,0 +1,177 @@
+/*
+ * File: fat.c
+ *
+ * Diskette raw image utilities
+ *
+ * Decoding of FAT file systems
+ *
+ */
+
+/*
+ * Most diskettes hold a FAT (FAT12) file system, and a mostly empty one
+ * at that. The BIOS parameter block in the boot sector gives the
+ * diskette geometry and the layout of the file system; the FAT then shows
+ * which clusters are in use. From these, a bitmap of the tracks that hold
+ * anything of value (boot sector, FATs, root directory and allocated
+ * clusters) can be built, and the remaining tracks need not be copied.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diskio.h"
+#include "fat.h"
+
+/* Offsets of fields in the boot sector */
+
+#define	BS_BYTESPERSEC	11		/* Bytes per sector (2) */
+#define	BS_SECPERCLUS	13		/* Sectors per cluster (1) */
+#define	BS_RESERVED	14		/* Reserved sectors (2) */
+#define	BS_NFATS	16		/* Number of FATs (1) */
+#define	BS_ROOTENTS	17		/* Root directory entries (2) */
+#define	BS_TOTSEC16	19		/* Total sectors, if < 65536 (2) */
+#define	BS_MEDIA	21		/* Media descriptor (1) */
+#define	BS_FATSECS	22		/* Sectors per FAT (2) */
+#define	BS_SECPERTRK	24		/* Sectors per track (2) */
+#define	BS_HEADS	26		/* Number of heads (2) */
+#define	BS_TOTSEC32	32		/* Total sectors, if >= 65536 (4) */
+
+/* Miscellaneous definitions */
+
+#define	DIRENTSIZE	32		/* Size of a directory entry */
+#define	FAT12MAX	4085		/* Clusters beyond which FAT16 used */
+#define	FIRSTCLUS	2		/* Number of first data cluster */
+
+#define	GET16(p)	((UINT) (p)[0] | ((UINT) (p)[1] << 8))
+#define	GET32(p)	((ULONG) GET16(p) | ((ULONG) GET16((p)+2) << 16))
+
+/* Forward references */
+
+static	ULONG	fat_entry(PBPB, PUCHAR, ULONG);
+static	VOID	mark_tracks(PUCHAR, ULONG, ULONG, UINT, UINT);
+
+
+/*
+ * Decode the BIOS parameter block in the boot sector 'bs'.
+ * Returns TRUE if it describes a plausible FAT file system, else FALSE.
+ *
+ */
+
+BOOL read_bpb(PUCHAR bs, PBPB bp)
+{	ULONG fatend;			/* First sector after the FATs */
+
+	if(GET16(bs+BS_BYTESPERSEC) != BLKSIZE) return(FALSE);
+	if(bs[BS_MEDIA] < 0xf0) return(FALSE);
+
+	bp->spc = bs[BS_SECPERCLUS];
+	bp->reserved = GET16(bs+BS_RESERVED);
+	bp->nfats = bs[BS_NFATS];
+	bp->rootsecs = (GET16(bs+BS_ROOTENTS)*DIRENTSIZE + BLKSIZE - 1) /
+			BLKSIZE;
+	bp->fatsecs = GET16(bs+BS_FATSECS);
+	bp->total = GET16(bs+BS_TOTSEC16);
+	if(bp->total == 0) bp->total = GET32(bs+BS_TOTSEC32);
+	bp->sectors = GET16(bs+BS_SECPERTRK);
+	bp->heads = GET16(bs+BS_HEADS);
+
+	if(bp->spc == 0 || (bp->spc & (bp->spc - 1)) != 0) return(FALSE);
+	if(bp->reserved == 0 || bp->nfats == 0 || bp->fatsecs == 0)
+		return(FALSE);
+	if(bp->rootsecs == 0) return(FALSE);	/* FAT32 */
+	if(bp->sectors == 0 || bp->heads == 0) return(FALSE);
+
+	fatend = bp->reserved + (ULONG) bp->nfats*bp->fatsecs;
+	bp->datasec = fatend + bp->rootsecs;
+	if(bp->total <= bp->datasec) return(FALSE);
+	bp->clusters = (bp->total - bp->datasec) / bp->spc;
+
+	return(TRUE);
+}
+
+
+/*
+ * Build a bitmap of the tracks that are in use, given the first FAT
+ * ('fat', which must hold FATSIZE bytes) and a track length of 'sectors'
+ * sectors; 'tracks' is the total number of tracks. Returns a pointer to
+ * the bitmap (to be freed with 'free'), or NULL if there is no memory.
+ *
+ */
+
+PUCHAR fat_tracks(PUCHAR fat, PBPB bp, UINT sectors, UINT tracks)
+{	PUCHAR map;
+	ULONG c;
+	ULONG v;			/* FAT entry */
+	ULONG bad;			/* FAT entry for a bad cluster */
+
+	map = (PUCHAR) calloc((tracks + 7) / 8, 1);
+	if(map == (PUCHAR) NULL) return((PUCHAR) NULL);
+
+	/* Boot sector, FATs and root directory */
+
+	mark_tracks(map, 0L, bp->datasec, sectors, tracks);
+
+	/* Allocated clusters; a bad cluster has nothing worth writing */
+
+	bad = bp->clusters < FAT12MAX ? 0xff7L : 0xfff7L;
+	for(c = FIRSTCLUS; c < bp->clusters + FIRSTCLUS; c++) {
+		v = fat_entry(bp, fat, c);
+		if(v == 0L || v == bad) continue;
+		mark_tracks(
+			map,
+			bp->datasec + (c - FIRSTCLUS)*bp->spc,
+			(ULONG) bp->spc,
+			sectors,
+			tracks);
+	}
+
+	return(map);
+}
+
+
+/*
+ * Return the FAT entry for cluster 'c'. An entry that lies outside the
+ * FAT is treated as in use.
+ *
+ */
+
+static ULONG fat_entry(PBPB bp, PUCHAR fat, ULONG c)
+{	ULONG off;
+	UINT v;
+
+	if(bp->clusters < FAT12MAX) {
+		off = c + c/2;
+		if(off + 1 >= FATSIZE(bp)) return(1L);
+		v = GET16(fat+off);
+		return((ULONG) ((c & 1) ? v >> 4 : v & 0xfff));
+	}
+
+	off = c*2;
+	if(off + 1 >= FATSIZE(bp)) return(1L);
+
+	return((ULONG) GET16(fat+off));
+}
+
+
+/*
+ * Mark, in a track bitmap, the tracks holding 'count' sectors starting at
+ * sector 'first'.
+ *
+ */
+
+static VOID mark_tracks(PUCHAR map, ULONG first, ULONG count,
+			UINT sectors, UINT tracks)
+{	ULONG t;
+
+	for(t = first/sectors; t <= (first + count - 1)/sectors; t++) {
+		if(t >= tracks) break;
+		map[t/8] |= (UCHAR) (1 << (t%8));
+	}
+}
+
+/*
+ * End of file: fat.c
+ *
+ */
@@ -0,0 +1,297 @@
+/*
+ * File: hash.c
+ *
+ * Diskette raw image utilities
+ *
+ * Checksums and hashes
+ *
+ */
+
+/*
+ * Two digests are kept for image data: a CRC32C (Castagnoli) checksum,
+ * which is cheap and good at spotting damage, and a SHA-256 hash, which
+ * identifies content beyond reasonable doubt. The CRC uses the SSE4.2
+ * CRC32 instruction where the compiler and processor allow it, and a
+ * table otherwise; both give the same result. Both functions may be
+ * called repeatedly to add data a piece at a time.
+ * Checksums, and other 32-bit numbers, are kept in files least
+ * significant byte first; get_word and put_word convert them.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <string.h>
+
+#include "hash.h"
+
+#if	defined(LINUX) && defined(__GNUC__) && defined(__x86_64__)
+#define	HWCRC				/* Hardware CRC32C may be available */
+#endif
+
+/* Miscellaneous definitions */
+
+#define	CRCPOLY		0x82f63b78L	/* CRC32C polynomial (reversed) */
+
+#define	ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define	GET32BE(p)	(((WORD32) (p)[0] << 24) | ((WORD32) (p)[1] << 16) | \
+			 ((WORD32) (p)[2] << 8) | (WORD32) (p)[3])
+
+/* Forward references */
+
+static	WORD32	crc_table(WORD32, PUCHAR, ULONG);
+#ifdef	HWCRC
+static	WORD32	crc_hw(WORD32, PUCHAR, ULONG);
+#endif
+static	VOID	sha256_block(PSHA256, PUCHAR);
+
+/* Local storage */
+
+static	BOOL	crcinit = FALSE;	/* TRUE when CRC setup done */
+static	WORD32	crctab[256];		/* CRC lookup table */
+#ifdef	HWCRC
+static	BOOL	hwcrc;			/* TRUE if CRC32 instruction usable */
+#endif
+
+static	WORD32	shak[64] = {		/* SHA-256 round constants */
+	0x428a2f98L, 0x71374491L, 0xb5c0fbcfL, 0xe9b5dba5L,
+	0x3956c25bL, 0x59f111f1L, 0x923f82a4L, 0xab1c5ed5L,
+	0xd807aa98L, 0x12835b01L, 0x243185beL, 0x550c7dc3L,
+	0x72be5d74L, 0x80deb1feL, 0x9bdc06a7L, 0xc19bf174L,
+	0xe49b69c1L, 0xefbe4786L, 0x0fc19dc6L, 0x240ca1ccL,
+	0x2de92c6fL, 0x4a7484aaL, 0x5cb0a9dcL, 0x76f988daL,
+	0x983e5152L, 0xa831c66dL, 0xb00327c8L, 0xbf597fc7L,
+	0xc6e00bf3L, 0xd5a79147L, 0x06ca6351L, 0x14292967L,
+	0x27b70a85L, 0x2e1b2138L, 0x4d2c6dfcL, 0x53380d13L,
+	0x650a7354L, 0x766a0abbL, 0x81c2c92eL, 0x92722c85L,
+	0xa2bfe8a1L, 0xa81a664bL, 0xc24b8b70L, 0xc76c51a3L,
+	0xd192e819L, 0xd6990624L, 0xf40e3585L, 0x106aa070L,
+	0x19a4c116L, 0x1e376c08L, 0x2748774cL, 0x34b0bcb5L,
+	0x391c0cb3L, 0x4ed8aa4aL, 0x5b9cca4fL, 0x682e6ff3L,
+	0x748f82eeL, 0x78a5636fL, 0x84c87814L, 0x8cc70208L,
+	0x90befffaL, 0xa4506cebL, 0xbef9a3f7L, 0xc67178f2L
+};
+
+
+/*
+ * Add 'len' bytes at 'buf' to the CRC32C value 'crc' (zero to start).
+ * Returns the updated value.
+ *
+ */
+
+WORD32 crc32c(WORD32 crc, PUCHAR buf, ULONG len)
+{	INT i, j;
+	WORD32 c;
+
+	if(crcinit == FALSE) {
+		for(i = 0; i < 256; i++) {
+			c = i;
+			for(j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ CRCPOLY : c >> 1;
+			crctab[i] = c;
+		}
+#ifdef	HWCRC
+		hwcrc = __builtin_cpu_supports("sse4.2");
+#endif
+		crcinit = TRUE;
+	}
+
+	crc = ~crc;
+#ifdef	HWCRC
+	if(hwcrc)
+		crc = crc_hw(crc, buf, len);
+	else
+#endif
+	crc = crc_table(crc, buf, len);
+
+	return(~crc);
+}
+
+
+/*
+ * Table driven CRC32C, one byte at a time.
+ *
+ */
+
+static WORD32 crc_table(WORD32 crc, PUCHAR buf, ULONG len)
+{	while(len-- != 0)
+		crc = crctab[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return(crc);
+}
+
+
+#ifdef	HWCRC
+/*
+ * CRC32C using the SSE4.2 CRC32 instruction, eight bytes at a time.
+ *
+ */
+
+__attribute__((target("sse4.2")))
+static WORD32 crc_hw(WORD32 crc, PUCHAR buf, ULONG len)
+{	unsigned long long c = crc, v;
+
+	while(len != 0 && ((ULONG) buf & 7) != 0) {
+		c = __builtin_ia32_crc32qi((WORD32) c, *buf++);
+		len--;
+	}
+	while(len >= 8) {
+		memcpy(&v, buf, 8);
+		c = __builtin_ia32_crc32di(c, v);
+		buf += 8;
+		len -= 8;
+	}
+	while(len-- != 0)
+		c = __builtin_ia32_crc32qi((WORD32) c, *buf++);
+
+	return((WORD32) c);
+}
+#endif
+
+
+/*
+ * Start a SHA-256 computation.
+ *
+ */
+
+VOID sha256_init(PSHA256 sp)
+{	sp->h[0] = 0x6a09e667L;
+	sp->h[1] = 0xbb67ae85L;
+	sp->h[2] = 0x3c6ef372L;
+	sp->h[3] = 0xa54ff53aL;
+	sp->h[4] = 0x510e527fL;
+	sp->h[5] = 0x9b05688cL;
+	sp->h[6] = 0x1f83d9abL;
+	sp->h[7] = 0x5be0cd19L;
+	sp->lo = sp->hi = 0;
+	sp->used = 0;
+}
+
+
+/*
+ * Add 'len' bytes at 'buf' to a SHA-256 computation.
+ *
+ */
+
+VOID sha256_update(PSHA256 sp, PUCHAR buf, ULONG len)
+{	UINT n;
+
+	if(sp->lo + (WORD32) len < sp->lo) sp->hi++;
+	sp->lo += (WORD32) len;
+
+	if(sp->used != 0) {
+		n = 64 - sp->used;
+		if((ULONG) n > len) n = (UINT) len;
+		memcpy(sp->buf + sp->used, buf, n);
+		sp->used += n;
+		buf += n;
+		len -= n;
+		if(sp->used < 64) return;
+		sha256_block(sp, sp->buf);
+		sp->used = 0;
+	}
+	while(len >= 64) {
+		sha256_block(sp, buf);
+		buf += 64;
+		len -= 64;
+	}
+	memcpy(sp->buf, buf, (UINT) len);
+	sp->used = (UINT) len;
+}
+
+
+/*
+ * Finish a SHA-256 computation, and store the digest (SHA256LEN bytes)
+ * at 'digest'.
+ *
+ */
+
+VOID sha256_final(PSHA256 sp, PUCHAR digest)
+{	WORD32 lo = sp->lo << 3;	/* Length in bits */
+	WORD32 hi = (sp->hi << 3) | (sp->lo >> 29);
+	INT i;
+
+	sp->buf[sp->used++] = 0x80;
+	if(sp->used > 56) {
+		memset(sp->buf + sp->used, '\0', 64 - sp->used);
+		sha256_block(sp, sp->buf);
+		sp->used = 0;
+	}
+	memset(sp->buf + sp->used, '\0', 56 - sp->used);
+	for(i = 0; i < 4; i++) {
+		sp->buf[56+i] = (UCHAR) (hi >> (24 - 8*i));
+		sp->buf[60+i] = (UCHAR) (lo >> (24 - 8*i));
+	}
+	sha256_block(sp, sp->buf);
+
+	for(i = 0; i < 8; i++) {
+		digest[4*i] = (UCHAR) (sp->h[i] >> 24);
+		digest[4*i+1] = (UCHAR) (sp->h[i] >> 16);
+		digest[4*i+2] = (UCHAR) (sp->h[i] >> 8);
+		digest[4*i+3] = (UCHAR) sp->h[i];
+	}
+}
+
+
+/*
+ * Fetch a 32-bit number, stored least significant byte first.
+ *
+ */
+
+WORD32 get_word(PUCHAR p)
+{	return((WORD32) p[0] | ((WORD32) p[1] << 8) |
+		((WORD32) p[2] << 16) | ((WORD32) p[3] << 24));
+}
+
+
+/*
+ * Store a 32-bit number, least significant byte first.
+ *
+ */
+
+VOID put_word(PUCHAR p, WORD32 n)
+{	p[0] = (UCHAR) (n & 0xff);
+	p[1] = (UCHAR) ((n >> 8) & 0xff);
+	p[2] = (UCHAR) ((n >> 16) & 0xff);
+	p[3] = (UCHAR) ((n >> 24) & 0xff);
+}
+
+
+/*
+ * Process one 64 byte block of SHA-256 input.
+ *
+ */
+
+static VOID sha256_block(PSHA256 sp, PUCHAR p)
+{	WORD32 w[64];
+	WORD32 a, b, c, d, e, f, g, h, t1, t2;
+	INT i;
+
+	for(i = 0; i < 16; i++)
+		w[i] = GET32BE(p + 4*i);
+	for(i = 16; i < 64; i++) {
+		t1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+		t2 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+		w[i] = t1 + w[i-7] + t2 + w[i-16];
+	}
+
+	a = sp->h[0]; b = sp->h[1]; c = sp->h[2]; d = sp->h[3];
+	e = sp->h[4]; f = sp->h[5]; g = sp->h[6]; h = sp->h[7];
+
+	for(i = 0; i < 64; i++) {
+		t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+			((e & f) ^ (~e & g)) + shak[i] + w[i];
+		t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	sp->h[0] += a; sp->h[1] += b; sp->h[2] += c; sp->h[3] += d;
+	sp->h[4] += e; sp->h[5] += f; sp->h[6] += g; sp->h[7] += h;
+}
+
+/*
+ * End of file: hash.c
+ *
+ */
@@ -0,0 +1,46 @@
+/*
+ * File: hash.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for checksums and hashes
+ *
+ */
+
+#ifndef	_HASH_H
+#define	_HASH_H
+
+/* Miscellaneous definitions */
+
+#define	SHA256LEN	32		/* Length of SHA-256 digest */
+
+#ifdef	DUAL
+typedef	unsigned long	WORD32;		/* Exactly 32 bits */
+#else
+typedef	unsigned int	WORD32;		/* Exactly 32 bits */
+#endif
+
+/* State of a SHA-256 computation */
+
+typedef	struct _SHA256 {
+	WORD32		h[8];		/* Intermediate hash value */
+	WORD32		lo, hi;		/* Number of bytes hashed so far */
+	UCHAR		buf[64];	/* Partial block */
+	UINT		used;		/* Bytes in partial block */
+} SHA256, *PSHA256;
+
+/* External references */
+
+extern	WORD32	crc32c(WORD32, PUCHAR, ULONG);
+extern	WORD32	get_word(PUCHAR);
+extern	VOID	put_word(PUCHAR, WORD32);
+extern	VOID	sha256_final(PSHA256, PUCHAR);
+extern	VOID	sha256_init(PSHA256);
+extern	VOID	sha256_update(PSHA256, PUCHAR, ULONG);
+
+#endif
+
+/*
+ * End of file: hash.h
+ *
+ */
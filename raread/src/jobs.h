@@ -0,0 +1,73 @@
+/*
+ * File: jobs.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for job files
+ *
+ */
+
+#ifndef	_JOBS_H
+#define	_JOBS_H
+
+/* Miscellaneous definitions */
+
+#define	MAXDRIVES	26		/* Maximum drives sharing jobs */
+
+/* One job; a diskette to be written from, or read into, an image file */
+
+typedef	struct _JOB {
+	struct _JOB	*next;		/* Next job, or NULL */
+	UINT		number;		/* Job number, from 1 */
+	UINT		line;		/* Line number in job file */
+	INT		type;		/* Diskette type, or TY_UNKNOWN */
+	PUCHAR		file;		/* Name of image file */
+	PUCHAR		manifest;	/* Name of manifest file, or NULL */
+} JOB, *PJOB;
+
+/* Function called to do one job on an open drive */
+
+typedef	BOOL	(*PJOBFN)(PJOB, PDISK);
+
+/* The queue of jobs, shared by all the drives */
+
+typedef	struct _JOBQUEUE {
+	PJOB		next;		/* Next job to be done, or NULL */
+	UINT		count;		/* Number of jobs */
+	PJOBFN		fn;		/* Function doing each job */
+	BOOL		prompt;		/* Ask for each diskette, even first */
+	BOOL		stop;		/* Operator has asked to stop */
+#ifdef	THREADS
+	BOOL		threaded;	/* TRUE if drives have threads */
+	SEM		lock;		/* Held while taking a job */
+#endif
+} JOBQUEUE, *PJOBQUEUE;
+
+/* One drive taking jobs from the queue */
+
+typedef	struct _JOBDRIVE {
+	PUCHAR		drive;		/* Drive name */
+	PDISK		dp;		/* Open disk, or NULL */
+	PJOBQUEUE	qp;		/* Queue that jobs are taken from */
+	UINT		done;		/* Jobs done successfully */
+	UINT		failed;		/* Jobs that failed */
+	ULONG		kbytes;		/* Kilobytes transferred */
+	ULONG		ms;		/* Time spent on jobs (ms) */
+#ifdef	THREADS
+	TID		tid;		/* Thread for drive */
+#endif
+} JOBDRIVE, *PJOBDRIVE;
+
+/* External references */
+
+extern	BOOL	ask_disk(PUCHAR, PUCHAR, PUCHAR);
+extern	VOID	free_jobs(PJOB);
+extern	PJOB	read_jobs(PUCHAR, INT, PUINT);
+extern	BOOL	run_jobs(PJOB, UINT, PUCHAR [], UINT, BOOL, PJOBFN);
+
+#endif
+
+/*
+ * End of file: jobs.h
+ *
+ */
@@ -0,0 +1,53 @@
+/*
+ * File: journal.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for transfer journals
+ *
+ */
+
+#ifndef	_JOURNAL_H
+#define	_JOURNAL_H
+
+/* Miscellaneous definitions */
+
+#define	JNEXT		".jnl"		/* Extension of journal file */
+
+/* Direction of the transfer being journalled */
+
+#define	JN_READ		0		/* Diskette to image */
+#define	JN_WRITE	1		/* Image to diskette */
+
+/* The journal of a transfer; it records each track as it is completed,
+   so that an interrupted transfer can be resumed */
+
+typedef	struct _JOURNAL {
+	PUCHAR		name;		/* Name of journal file */
+	FILE		*fp;		/* Journal file, once started */
+	INT		dir;		/* JN_READ or JN_WRITE */
+	UINT		cyls;		/* Number of cylinders, or 0 if new */
+	UINT		heads;		/* Number of heads */
+	UINT		sectors;	/* Sectors per track */
+	UINT		done;		/* Tracks completed, from the first */
+	ULONG		length;		/* Bytes of complete lines in file */
+	WORD32		*crc;		/* CRC32C of each completed track */
+	BOOL		failed;		/* Journal could not be written */
+} JOURNAL, *PJOURNAL;
+
+/* External references */
+
+extern	BOOL	end_journal(PJOURNAL, BOOL);
+extern	BOOL	journal_disk(PJOURNAL, PDISK);
+extern	BOOL	journal_match(PJOURNAL, UINT, PUCHAR);
+extern	VOID	journal_track(PJOURNAL, PUCHAR);
+extern	INT	journal_type(PJOURNAL);
+extern	PJOURNAL load_journal(PUCHAR, INT);
+extern	BOOL	start_journal(PJOURNAL, PDISK);
+
+#endif
+
+/*
+ * End of file: journal.h
+ *
+ */
@@ -0,0 +1,37 @@
+/*
+ * File: manifest.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for track hash manifests
+ *
+ */
+
+#ifndef	_MANIFEST_H
+#define	_MANIFEST_H
+
+#include "hash.h"
+
+/* A manifest being built */
+
+typedef	struct _MANIFEST {
+	FILE		*fp;		/* Manifest file */
+	PUCHAR		name;		/* Name of manifest file */
+	UINT		heads;		/* Number of heads */
+	UINT		tracks;		/* Number of tracks listed so far */
+	WORD32		crc;		/* CRC32C of whole image */
+	SHA256		sha;		/* SHA-256 of whole image */
+} MANIFEST, *PMANIFEST;
+
+/* External references */
+
+extern	BOOL	close_manifest(PMANIFEST);
+extern	PMANIFEST open_manifest(PUCHAR, UINT, UINT, UINT);
+extern	VOID	manifest_track(PMANIFEST, PUCHAR, ULONG);
+
+#endif
+
+/*
+ * End of file: manifest.h
+ *
+ */
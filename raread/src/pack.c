@@ -0,0 +1,696 @@
+/*
+ * File: pack.c
+ *
+ * Diskette raw image utilities
+ *
+ * Pack files of deduplicated images
+ *
+ */
+
+/*
+ * A pack file holds any number of diskette images. Each image is kept as
+ * a list of the SHA-256 hashes of its tracks; the tracks themselves are
+ * stored only once, however many images they appear in, and compressed
+ * where that helps. So boot tracks, common system files and blank tracks
+ * take no more room for the thousandth image than for the first.
+ *
+ * The file is the eight characters 'RAWPACK1' followed by records, each
+ * being a 12 byte header, then a key, then data:
+ *
+ *	type	1 byte	'T' for a track, 'I' for an image
+ *	info	1 byte	how a track is stored (PM_xxx); sectors per track
+ *			of an image
+ *	keylen	2 bytes	length of key: a track's key is its SHA-256, an
+ *			image's is its name
+ *	datalen	4 bytes	length of data: the stored track, or the SHA-256
+ *			of each track of the image in turn
+ *	crc	4 bytes	CRC32C of the rest of the header and the key
+ *
+ * with numbers least significant byte first. Records are only ever added
+ * at the end, and an image record only after all of its tracks, so an
+ * interrupted run leaves at most a partial record at the end; this is
+ * ignored, and cut off before anything more is added. An image added
+ * under the name of one already in the pack replaces it.
+ *
+ * When a pack is opened, the record headers and keys are read (the data
+ * is skipped) to build hash tables of the tracks and images in it. After
+ * that, any track of any image is found with two seeks and no searching.
+ * Each track is checked against its SHA-256 as it is read back.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef	ZLIB
+#include <zlib.h>
+#endif
+
+#include "diskio.h"
+#include "pack.h"
+
+/* Miscellaneous definitions */
+
+#define	PACKMAGIC	"RAWPACK1"	/* Start of every pack file */
+#define	MAGICLEN	8		/* Length of this */
+#define	RECLEN		12		/* Length of record header */
+#define	MAXNAME		1024		/* Longest image name */
+#define	INITSIZE	256		/* Initial size of hash tables */
+
+#define	RT_TRACK	'T'		/* Record types */
+#define	RT_IMAGE	'I'
+
+/* Forward references */
+
+static	BOOL	add_image(PPACK, PUCHAR, UINT, UINT, ULONG);
+static	BOOL	add_stored(PPACK, PUCHAR, UINT, ULONG, ULONG);
+static	PPKTRACK find_track(PPACK, PUCHAR);
+static	VOID	free_pack(PPACK);
+static	VOID	grow_images(PPACK);
+static	VOID	grow_tracks(PPACK);
+static	WORD32	name_hash(PUCHAR);
+static	BOOL	read_index(PPACK, BOOL);
+static	BOOL	write_record(PPACK, UINT, UINT, PUCHAR, UINT, PUCHAR, ULONG);
+
+
+/*
+ * Open the pack file 'name', and build its index. If 'write' is TRUE,
+ * images are to be added, and the file is created if it does not exist.
+ * Returns pointer to the pack, or NULL on failure (already reported).
+ *
+ */
+
+PPACK open_pack(PUCHAR name, BOOL write)
+{	PPACK pk;
+	UCHAR magic[MAGICLEN];
+
+	pk = (PPACK) calloc(1, sizeof(PACK));
+	if(pk != (PPACK) NULL) {
+		pk->tsize = INITSIZE;
+		pk->isize = INITSIZE;
+		pk->blen = MAXTRACK;
+		pk->track = (PPKTRACK *) calloc(INITSIZE, sizeof(PPKTRACK));
+		pk->image = (PPKIMAGE *) calloc(INITSIZE, sizeof(PPKIMAGE));
+		pk->buf = (PUCHAR) malloc((size_t) pk->blen);
+		if(pk->track == (PPKTRACK *) NULL ||
+		   pk->image == (PPKIMAGE *) NULL ||
+		   pk->buf == (PUCHAR) NULL) {
+			free_pack(pk);
+			pk = (PPACK) NULL;
+		}
+	}
+	if(pk == (PPACK) NULL) {
+		error("cannot allocate memory for pack file");
+		return((PPACK) NULL);
+	}
+	pk->name = name;
+
+	pk->fp = fopen(name, write == TRUE ? "r+b" : "rb");
+	if(pk->fp == (FILE *) NULL && write == TRUE) {
+		pk->fp = fopen(name, "w+b");
+		if(pk->fp != (FILE *) NULL &&
+		   fwrite(PACKMAGIC, 1, MAGICLEN, pk->fp) != MAGICLEN) {
+			error("error writing pack file '%s'", name);
+			free_pack(pk);
+			return((PPACK) NULL);
+		}
+	}
+	if(pk->fp == (FILE *) NULL) {
+		error("cannot open pack file '%s'", name);
+		free_pack(pk);
+		return((PPACK) NULL);
+	}
+
+	rewind(pk->fp);
+	if(fread(magic, 1, MAGICLEN, pk->fp) != MAGICLEN ||
+	   memcmp(magic, PACKMAGIC, MAGICLEN) != 0) {
+		error("'%s' is not a pack file", name);
+		free_pack(pk);
+		return((PPACK) NULL);
+	}
+	if(read_index(pk, write) == FALSE) {
+		free_pack(pk);
+		return((PPACK) NULL);
+	}
+
+	return(pk);
+}
+
+
+/*
+ * Read the headers and keys of all the records in a pack file, adding
+ * each track and image to the hash tables. A partial record at the end
+ * is ignored; if images are to be added, it is cut off.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL read_index(PPACK pk, BOOL write)
+{	UCHAR hdr[RECLEN];		/* Record header */
+	UCHAR key[MAXNAME+1];		/* Record key */
+	UINT keylen;
+	ULONG datalen;
+	ULONG off = MAGICLEN;		/* Offset of current record */
+	ULONG size;			/* Size of file */
+	BOOL ok;
+
+	if(fseek(pk->fp, 0L, SEEK_END) != 0) {
+		error("error reading pack file '%s'", pk->name);
+		return(FALSE);
+	}
+	size = (ULONG) ftell(pk->fp);
+
+	for(;;) {
+		if(fseek(pk->fp, (LONG) off, SEEK_SET) != 0 ||
+		   fread(hdr, 1, RECLEN, pk->fp) != RECLEN)
+			break;			/* End, or partial header */
+		keylen = (UINT) hdr[2] | ((UINT) hdr[3] << 8);
+		datalen = (ULONG) get_word(hdr + 4);
+		if(keylen > MAXNAME || datalen > size ||
+		   off + RECLEN + keylen + datalen > size)
+			break;			/* Partial record */
+
+		ok = fread(key, 1, keylen, pk->fp) == keylen &&
+		     crc32c(crc32c(0, hdr, 8), key, (ULONG) keylen) ==
+			get_word(hdr + 8) ? TRUE : FALSE;
+		if(ok == TRUE) {
+			switch(hdr[0]) {
+				case RT_TRACK:
+					ok = keylen == SHA256LEN &&
+					     datalen <= MAXTRACK &&
+					     add_stored(
+						pk,
+						key,
+						(UINT) hdr[1],
+						off + RECLEN + keylen,
+						datalen) == TRUE ? TRUE : FALSE;
+					break;
+
+				case RT_IMAGE:
+					key[keylen] = '\0';
+					ok = keylen != 0 &&
+					     hdr[1] != 0 &&
+					     hdr[1] <= MAXTRACK/BLKSIZE &&
+					     datalen != 0 &&
+					     datalen % SHA256LEN == 0 &&
+					     datalen/SHA256LEN <= MAXPTRACKS &&
+					     add_image(
+						pk,
+						key,
+						(UINT) (datalen/SHA256LEN),
+						(UINT) hdr[1],
+						off + RECLEN + keylen) == TRUE ?
+						TRUE : FALSE;
+					break;
+
+				default:
+					ok = FALSE;
+					break;
+			}
+		}
+		if(ok == FALSE) {
+			error(
+				"pack file '%s' is damaged at offset %lu",
+				pk->name,
+				off);
+			return(FALSE);
+		}
+		off += RECLEN + keylen + datalen;
+	}
+
+	pk->end = off;
+	if(write == TRUE && off != size &&
+	   (fflush(pk->fp) != 0 ||
+	    truncate_file(fileno(pk->fp), off) == FALSE)) {
+		error("cannot remove partial record from pack file '%s'",
+			pk->name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Look up an image in a pack by name.
+ * Returns pointer to the image, or NULL if it is not there.
+ *
+ */
+
+PPKIMAGE find_packed(PPACK pk, PUCHAR name)
+{	PPKIMAGE ip;
+
+	ip = pk->image[name_hash(name) % pk->isize];
+	while(ip != (PPKIMAGE) NULL && strcmp(ip->name, name) != 0)
+		ip = ip->next;
+
+	return(ip);
+}
+
+
+/*
+ * Look up a track in a pack by its SHA-256.
+ * Returns pointer to the track, or NULL if it is not there.
+ *
+ */
+
+static PPKTRACK find_track(PPACK pk, PUCHAR sha)
+{	PPKTRACK tp;
+
+	tp = pk->track[get_word(sha) % pk->tsize];
+	while(tp != (PPKTRACK) NULL && memcmp(tp->sha, sha, SHA256LEN) != 0)
+		tp = tp->next;
+
+	return(tp);
+}
+
+
+/*
+ * Read track 't' of an image in a pack into 'buf', and check it.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL packed_track(PPACK pk, PPKIMAGE ip, UINT t, PUCHAR buf)
+{	UCHAR want[SHA256LEN];		/* SHA-256 from image */
+	UCHAR got[SHA256LEN];		/* SHA-256 of data read */
+	SHA256 sha;
+	PPKTRACK tp;
+	ULONG off = ip->off + (ULONG) t*SHA256LEN;
+	ULONG tlen = (ULONG) ip->sectors*BLKSIZE;
+#ifdef	ZLIB
+	uLongf zlen;
+#endif
+	BOOL ok = TRUE;
+
+	if(fseek(pk->fp, (LONG) off, SEEK_SET) != 0 ||
+	   fread(want, 1, SHA256LEN, pk->fp) != SHA256LEN) {
+		error("error reading pack file '%s'", pk->name);
+		return(FALSE);
+	}
+	tp = find_track(pk, want);
+	if(tp == (PPKTRACK) NULL) {
+		error(
+			"track %d of image '%s' is missing from pack file '%s'",
+			t,
+			ip->name,
+			pk->name);
+		return(FALSE);
+	}
+	if(tp->method == PM_STORED && tp->len != tlen)
+		ok = FALSE;
+	else if(fseek(pk->fp, (LONG) tp->off, SEEK_SET) != 0 ||
+	   fread(
+		tp->method == PM_STORED ? buf : pk->buf,
+		1,
+		(size_t) tp->len,
+		pk->fp) != tp->len) {
+		error("error reading pack file '%s'", pk->name);
+		return(FALSE);
+	}
+
+	switch(tp->method) {
+		case PM_STORED:
+			break;
+
+#ifdef	ZLIB
+		case PM_DEFLATE:
+			zlen = (uLongf) tlen;
+			ok = uncompress(buf, &zlen, pk->buf, (uLong) tp->len) ==
+				Z_OK && zlen == tlen ? TRUE : FALSE;
+			break;
+#endif
+
+		default:
+			error(
+				"pack file '%s' is compressed in a way not"
+				" supported by this version",
+				pk->name);
+			return(FALSE);
+	}
+	if(ok == TRUE) {
+		sha256_init(&sha);
+		sha256_update(&sha, buf, tlen);
+		sha256_final(&sha, got);
+		ok = memcmp(got, want, SHA256LEN) == 0 ? TRUE : FALSE;
+	}
+	if(ok == FALSE)
+		error(
+			"track %d of image '%s' is damaged in pack file '%s'",
+			t,
+			ip->name,
+			pk->name);
+
+	return(ok);
+}
+
+
+/*
+ * Start adding an image called 'name' to a pack. Its tracks are then
+ * given in turn to add_track, and end_packed finishes it.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL start_packed(PPACK pk, PUCHAR name)
+{	if(name[0] == '\0' || strlen(name) > MAXNAME) {
+		error("invalid name '%s' for image in pack file", name);
+		return(FALSE);
+	}
+	pk->adding = name;
+	pk->sectors = 0;
+	pk->added = 0;
+	pk->fresh = 0;
+	pk->stored = 0L;
+
+	return(TRUE);
+}
+
+
+/*
+ * Add the next track, 'len' bytes at 'buf', of the image being added to
+ * a pack. The track is stored only if it is not in the pack already.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL add_track(PPACK pk, PUCHAR buf, ULONG len)
+{	SHA256 sha;
+	PUCHAR hash;
+	PUCHAR data = buf;		/* Data to be stored */
+	ULONG slen = len;		/* Length of this */
+	UINT method = PM_STORED;	/* How stored */
+#ifdef	ZLIB
+	uLongf zlen;
+#endif
+
+	if(pk->added == MAXPTRACKS) {
+		error("too many tracks for pack file");
+		return(FALSE);
+	}
+	hash = pk->list[pk->added++];
+	sha256_init(&sha);
+	sha256_update(&sha, buf, len);
+	sha256_final(&sha, hash);
+	pk->sectors = (UINT) (len / BLKSIZE);
+	if(find_track(pk, hash) != (PPKTRACK) NULL)
+		return(TRUE);			/* Already there */
+
+	/* A new track; compress it, unless that would not save anything */
+
+#ifdef	ZLIB
+	zlen = (uLongf) pk->blen;
+	if(compress2(pk->buf, &zlen, buf, (uLong) len, Z_BEST_COMPRESSION) ==
+		Z_OK && zlen < len) {
+		data = pk->buf;
+		slen = (ULONG) zlen;
+		method = PM_DEFLATE;
+	}
+#endif
+	if(write_record(pk, RT_TRACK, method, hash, SHA256LEN, data, slen) ==
+		FALSE)
+		return(FALSE);
+	pk->fresh++;
+	pk->stored += slen;
+
+	return(add_stored(pk, hash, method, pk->end - slen, slen));
+}
+
+
+/*
+ * Finish adding an image to a pack. If 'ok' is TRUE, the image record is
+ * written and the savings reported; otherwise the image is abandoned,
+ * although any new tracks stay in the pack for later images to use.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL end_packed(PPACK pk, BOOL ok)
+{	PUCHAR name = pk->adding;
+
+	pk->adding = (PUCHAR) NULL;
+	if(ok == FALSE || pk->added == 0) return(ok);
+
+	if(write_record(
+		pk,
+		RT_IMAGE,
+		pk->sectors,
+		name,
+		(UINT) strlen(name),
+		(PUCHAR) pk->list,
+		(ULONG) pk->added*SHA256LEN) == FALSE ||
+	   add_image(
+		pk,
+		name,
+		pk->added,
+		pk->sectors,
+		pk->end - (ULONG) pk->added*SHA256LEN) == FALSE)
+		return(FALSE);
+	if(fflush(pk->fp) != 0) {
+		error("error writing pack file '%s'", pk->name);
+		return(FALSE);
+	}
+
+	error(
+		"%d of %d tracks already in pack file '%s'; %lu bytes added",
+		pk->added - pk->fresh,
+		pk->added,
+		pk->name,
+		pk->stored + (ULONG) pk->added*SHA256LEN);
+
+	return(TRUE);
+}
+
+
+/*
+ * Write a record at the end of a pack file.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL write_record(PPACK pk, UINT type, UINT info, PUCHAR key,
+			UINT keylen, PUCHAR data, ULONG datalen)
+{	UCHAR hdr[RECLEN];		/* Record header */
+
+	hdr[0] = (UCHAR) type;
+	hdr[1] = (UCHAR) info;
+	hdr[2] = (UCHAR) (keylen & 0xff);
+	hdr[3] = (UCHAR) (keylen >> 8);
+	put_word(hdr + 4, (WORD32) datalen);
+	put_word(hdr + 8, crc32c(crc32c(0, hdr, 8), key, (ULONG) keylen));
+
+	if(fseek(pk->fp, (LONG) pk->end, SEEK_SET) != 0 ||
+	   fwrite(hdr, 1, RECLEN, pk->fp) != RECLEN ||
+	   fwrite(key, 1, keylen, pk->fp) != keylen ||
+	   fwrite(data, 1, (size_t) datalen, pk->fp) != datalen) {
+		error("error writing pack file '%s'", pk->name);
+		return(FALSE);
+	}
+	pk->end += RECLEN + keylen + datalen;
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a stored track to the index of a pack; 'off' is the offset of its
+ * data. If the track is already there, the first copy is kept.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL add_stored(PPACK pk, PUCHAR sha, UINT method, ULONG off,
+			ULONG len)
+{	PPKTRACK tp;
+	UINT h;
+
+	if(find_track(pk, sha) != (PPKTRACK) NULL) return(TRUE);
+
+	tp = (PPKTRACK) malloc(sizeof(PKTRACK));
+	if(tp == (PPKTRACK) NULL) {
+		error("cannot allocate memory for pack file index");
+		return(FALSE);
+	}
+	memcpy(tp->sha, sha, SHA256LEN);
+	tp->off = off;
+	tp->len = len;
+	tp->method = method;
+	h = (UINT) (get_word(sha) % pk->tsize);
+	tp->next = pk->track[h];
+	pk->track[h] = tp;
+	if(++pk->ntracks > pk->tsize) grow_tracks(pk);
+
+	return(TRUE);
+}
+
+
+/*
+ * Add an image to the index of a pack; 'off' is the offset of its list
+ * of track hashes. An image of the same name is replaced.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL add_image(PPACK pk, PUCHAR name, UINT tracks, UINT sectors,
+			ULONG off)
+{	PPKIMAGE ip;
+	UINT h;
+
+	ip = find_packed(pk, name);
+	if(ip == (PPKIMAGE) NULL) {
+		ip = (PPKIMAGE) malloc(sizeof(PKIMAGE));
+		if(ip != (PPKIMAGE) NULL) {
+			ip->name = (PUCHAR) malloc(strlen(name) + 1);
+			if(ip->name == (PUCHAR) NULL) {
+				free((PPKIMAGE) ip);
+				ip = (PPKIMAGE) NULL;
+			}
+		}
+		if(ip == (PPKIMAGE) NULL) {
+			error("cannot allocate memory for pack file index");
+			return(FALSE);
+		}
+		strcpy(ip->name, name);
+		h = (UINT) (name_hash(name) % pk->isize);
+		ip->next = pk->image[h];
+		pk->image[h] = ip;
+		if(++pk->nimages > pk->isize) grow_images(pk);
+	}
+	ip->off = off;
+	ip->tracks = tracks;
+	ip->sectors = sectors;
+
+	return(TRUE);
+}
+
+
+/*
+ * Double the size of the hash table of tracks, once it has filled up.
+ * If there is not enough memory, the table is left as it is; it still
+ * works, but more slowly.
+ *
+ */
+
+static VOID grow_tracks(PPACK pk)
+{	PPKTRACK *table;
+	PPKTRACK tp, next;
+	UINT size = pk->tsize*2;
+	UINT i, h;
+
+	table = (PPKTRACK *) calloc(size, sizeof(PPKTRACK));
+	if(table == (PPKTRACK *) NULL) return;
+
+	for(i = 0; i < pk->tsize; i++) {
+		for(tp = pk->track[i]; tp != (PPKTRACK) NULL; tp = next) {
+			next = tp->next;
+			h = (UINT) (get_word(tp->sha) % size);
+			tp->next = table[h];
+			table[h] = tp;
+		}
+	}
+	free((PPKTRACK *) pk->track);
+	pk->track = table;
+	pk->tsize = size;
+}
+
+
+/*
+ * Double the size of the hash table of images, as for grow_tracks.
+ *
+ */
+
+static VOID grow_images(PPACK pk)
+{	PPKIMAGE *table;
+	PPKIMAGE ip, next;
+	UINT size = pk->isize*2;
+	UINT i, h;
+
+	table = (PPKIMAGE *) calloc(size, sizeof(PPKIMAGE));
+	if(table == (PPKIMAGE *) NULL) return;
+
+	for(i = 0; i < pk->isize; i++) {
+		for(ip = pk->image[i]; ip != (PPKIMAGE) NULL; ip = next) {
+			next = ip->next;
+			h = (UINT) (name_hash(ip->name) % size);
+			ip->next = table[h];
+			table[h] = ip;
+		}
+	}
+	free((PPKIMAGE *) pk->image);
+	pk->image = table;
+	pk->isize = size;
+}
+
+
+/*
+ * Hash an image name, for the table of images.
+ *
+ */
+
+static WORD32 name_hash(PUCHAR name)
+{	return(crc32c(0, name, (ULONG) strlen(name)));
+}
+
+
+/*
+ * Close a pack file.
+ * Returns TRUE if all was well, else FALSE (already reported).
+ *
+ */
+
+BOOL close_pack(PPACK pk)
+{	BOOL res = TRUE;
+
+	if(fclose(pk->fp) != 0) {
+		error("error writing pack file '%s'", pk->name);
+		res = FALSE;
+	}
+	pk->fp = (FILE *) NULL;
+	free_pack(pk);
+
+	return(res);
+}
+
+
+/*
+ * Free a pack and its index, closing the file if it is still open.
+ *
+ */
+
+static VOID free_pack(PPACK pk)
+{	PPKTRACK tp, tnext;
+	PPKIMAGE ip, inext;
+	UINT i;
+
+	if(pk->fp != (FILE *) NULL) (VOID) fclose(pk->fp);
+	if(pk->track != (PPKTRACK *) NULL) {
+		for(i = 0; i < pk->tsize; i++) {
+			for(tp = pk->track[i]; tp != (PPKTRACK) NULL;
+			    tp = tnext) {
+				tnext = tp->next;
+				free((PPKTRACK) tp);
+			}
+		}
+		free((PPKTRACK *) pk->track);
+	}
+	if(pk->image != (PPKIMAGE *) NULL) {
+		for(i = 0; i < pk->isize; i++) {
+			for(ip = pk->image[i]; ip != (PPKIMAGE) NULL;
+			    ip = inext) {
+				inext = ip->next;
+				free((PUCHAR) ip->name);
+				free((PPKIMAGE) ip);
+			}
+		}
+		free((PPKIMAGE *) pk->image);
+	}
+	if(pk->buf != (PUCHAR) NULL) free((PUCHAR) pk->buf);
+	free((PPACK) pk);
+}
+
+/*
+ * End of file: pack.c
+ *
+ */
@@ -0,0 +1,81 @@
+/*
+ * File: pack.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for pack files of deduplicated images
+ *
+ */
+
+#ifndef	_PACK_H
+#define	_PACK_H
+
+#include "hash.h"
+
+/* Miscellaneous definitions */
+
+#define	MAXPTRACKS	256		/* Maximum tracks in a packed image */
+
+/* How a track is stored */
+
+#define	PM_STORED	0		/* As it is */
+#define	PM_DEFLATE	1		/* Compressed with deflate (zlib) */
+
+/* A track held in a pack file */
+
+typedef	struct _PKTRACK {
+	struct _PKTRACK	*next;		/* Next in hash chain */
+	UCHAR		sha[SHA256LEN];	/* SHA-256 of track */
+	ULONG		off;		/* Offset of stored data */
+	ULONG		len;		/* Length of stored data */
+	UINT		method;		/* How stored (PM_xxx) */
+} PKTRACK, *PPKTRACK;
+
+/* An image held in a pack file */
+
+typedef	struct _PKIMAGE {
+	struct _PKIMAGE	*next;		/* Next in hash chain */
+	PUCHAR		name;		/* Name of image */
+	ULONG		off;		/* Offset of list of track hashes */
+	UINT		tracks;		/* Number of tracks */
+	UINT		sectors;	/* Sectors per track */
+} PKIMAGE, *PPKIMAGE;
+
+/* An open pack file */
+
+typedef	struct _PACK {
+	FILE		*fp;		/* Pack file */
+	PUCHAR		name;		/* Name of pack file */
+	ULONG		end;		/* Offset of end of last good record */
+	PPKTRACK	*track;		/* Hash table of tracks */
+	UINT		tsize;		/* Size of track table */
+	UINT		ntracks;	/* Number of tracks */
+	PPKIMAGE	*image;		/* Hash table of images */
+	UINT		isize;		/* Size of image table */
+	UINT		nimages;	/* Number of images */
+	PUCHAR		buf;		/* Compressed data buffer */
+	ULONG		blen;		/* Size of buffer */
+	PUCHAR		adding;		/* Name of image being added, or NULL */
+	UINT		sectors;	/* Its sectors per track */
+	UINT		added;		/* Its tracks so far */
+	UINT		fresh;		/* Of which, new to the pack */
+	ULONG		stored;		/* Bytes stored for the new tracks */
+	UCHAR		list[MAXPTRACKS][SHA256LEN];/* Its track hashes */
+} PACK, *PPACK;
+
+/* External references */
+
+extern	BOOL	add_track(PPACK, PUCHAR, ULONG);
+extern	BOOL	close_pack(PPACK);
+extern	BOOL	end_packed(PPACK, BOOL);
+extern	PPKIMAGE find_packed(PPACK, PUCHAR);
+extern	PPACK	open_pack(PUCHAR, BOOL);
+extern	BOOL	packed_track(PPACK, PPKIMAGE, UINT, PUCHAR);
+extern	BOOL	start_packed(PPACK, PUCHAR);
+
+#endif
+
+/*
+ * End of file: pack.h
+ *
+ */
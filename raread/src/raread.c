@@ -5,7 +5,7 @@
  *
  * OS/2 version; works with 720KB, 1.44MB and 2.88MB diskettes
  *
- * Can be built as 16 bit bound executable
+ * Can be built as 16 bit bound executable, or for Linux
  *
  * Bob Eager   November 2000
  *
@@ -14,7 +14,7 @@
 /* Program version information */
 
 #define	VERSION		2
-#define	EDIT		1
+#define	EDIT		18
 
 #define	AUTHOR		"Bob Eager (rde@tavi.co.uk)"
 
@@ -23,25 +23,58 @@
  *	1.0	- Initial version.
  *	2.0	- First dual mode capable version.
  *	2.1	- Fixed error with IOCTL in real mode.
+ *	2.2	- Diskette access moved to a separate device layer.
+ *		- Linux version, using O_DIRECT on diskette and other
+ *		  block devices, or plain files.
+ *	2.3	- Optional overlap of image file writing with diskette
+ *		  reading (-b flag).
+ *	2.4	- Added --sparse flag, to read only the tracks in use by
+ *		  the FAT file system, leaving holes in the image file.
+ *	2.5	- Added -z flag, to compress the image file with gzip or
+ *		  zstd while reading.
+ *	2.6	- Added -m flag, to write a manifest of track hashes.
+ *	2.7	- Added -r and -t flags, to recover damaged tracks by retrying
+ *		  and reading sector by sector, within a time limit.
+ *	2.8	- Added -l flag, to rescue a damaged diskette over several
+ *		  runs, keeping the state of each sector in a map file.
+ *	2.9	- Added -p and --merge, to choose each sector by vote between
+ *		  several reads or captured images.
+ *	2.10	- Added -j flag, to read a series of diskettes listed in
+ *		  a job file without reopening the drive.
+ *	2.11	- Several drives may be given with -j; each takes the next
+ *		  job when it is free.
+ *	2.12	- Added --resume flag, to keep a journal of the tracks
+ *		  read, and carry on from it after an interruption.
+ *	2.13	- An image file of '-' is written to the standard output.
+ *	2.14	- Added --stats flag, to time each operation and write a
+ *		  report in JSON; progress display limited in rate.
+ *	2.15	- Added emulated drives (Linux), with realistic timing
+ *		  and injected faults, for testing without hardware.
+ *	2.16	- Added benchmark (bench.sh); --stats report gives
+ *		  processor time.
+ *	2.17	- Rescue passes (-l) take their tracks in elevator order,
+ *		  starting from the nearer end.
+ *	2.18	- Added --pack flag, to add the image to a pack file that
+ *		  stores each different track only once, compressed.
  *
  */
 
 #ifdef	DUAL
 #define	MODE		"16-bit dual mode"
 #define	NOTMODE		"32-bit OS/2-only"
-#define	APIRET		USHORT
+#else
+#ifdef	LINUX
+#define	MODE		"Linux"
+#define	NOTMODE		"OS/2"
 #else
 #define	MODE		"32-bit"
 #define	NOTMODE		"16-bit dual mode (DOS and OS/2)"
 #endif
+#endif
 
 /* Includes */
 
-#define	INCL_DOSDEVICES
-#define	INCL_DOSERRORS
-#define	INCL_DOSFILEMGR
-#define	INCL_DOSDEVIOCTL
-#include <os2.h>
+#include "sysdep.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -51,46 +84,142 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-/* Miscellaneous definitions */
-
-#ifdef	DUAL
-#define	BLKSIZE		512L		/* Number of bytes in a disk block */
-#define	DD_MAX		720L*2L*BLKSIZE	/* Maximum size of 720K image */
-#define	HD_MAX		1440L*2L*BLKSIZE/* Maximum size of 1.44MB image */
-#else
-#define	BLKSIZE		512		/* Number of bytes in a disk block */
-#define	DD_MAX		720*2*BLKSIZE	/* Maximum size of 720K image */
-#define	HD_MAX		1440*2*BLKSIZE	/* Maximum size of 1.44MB image */
-#endif
-
-#define	TY_UNKNOWN	0		/* Diskette type unknown */
-#define	TY_DD		1		/* DD diskette specified */
-#define	TY_HD		2		/* HD diskette specified */
-#define	TY_ED		3		/* ED diskette specified */
+#include "codec.h"
+#include "diskio.h"
+#include "elevator.h"
+#include "fat.h"
+#include "hash.h"
+#include "jobs.h"
+#include "journal.h"
+#include "manifest.h"
+#include "pack.h"
+#include "recover.h"
+#include "rescue.h"
+#include "vote.h"
+#include "trkpipe.h"
+#include "timing.h"
 
 /* Forward references */
 
-static	VOID	close_disk(HFILE);
-static	VOID	error(PUCHAR, ...);
-static	HFILE	open_disk(PUCHAR);
-static	BOOL	process_disk(FILE *, HFILE, INT);
+static	BOOL	check_drive(PUCHAR);
+static	PUCHAR	flag_value(INT, PUCHAR [], PINT);
+static	FILE	*open_image(PUCHAR);
+static	BOOL	get_geometry(PDISK, INT, PUINT);
+#ifndef	DUAL
+static	VOID	hold_tracks(PUCHAR *, PUINT *, APIRET **, UINT, ULONG);
+#endif
+static	BOOL	process_disk(FILE *, PDISK, INT, PUCHAR);
+static	BOOL	process_jobs(PUCHAR [], UINT, INT);
+static	BOOL	process_merge(PUCHAR [], UINT, FILE *, INT);
+static	BOOL	process_rescue(FILE *, PDISK, INT);
+static	BOOL	read_job(PJOB, PDISK);
+static	PUCHAR	read_map(PDISK);
+static	BOOL	resume_image(FILE *, PDISK, PMANIFEST);
+static	VOID	send_track(PTRKPIPE, PTRACK, UINT, BOOL, BOOL, PMANIFEST);
 static	VOID	usage(VOID);
+static	BOOL	write_image(PTRACK, PVOID);
+static	BOOL	write_packed(PTRACK, PVOID);
 
 /* Local storage */
 
-static	PUCHAR	progname;		/* Pointer to program name */
+PUCHAR	progname;			/* Pointer to program name */
+static	UINT	nbufs = 0;		/* Track buffers, or 0 for default */
+static	BOOL	sparse = FALSE;		/* Only read tracks in use */
+static	INT	codec = CODEC_NONE;	/* Compression for image file */
+static	PUCHAR	manifest = (PUCHAR) NULL;/* Name of manifest file, if any */
+static	BOOL	recover = FALSE;	/* Recover damaged tracks */
+static	UINT	retries = DEFRETRIES;	/* Retries of a failing read */
+static	ULONG	budget = 0;		/* Time allowed for recovery */
+static	PUCHAR	mapfile = (PUCHAR) NULL;/* Name of rescue map, if any */
+static	UINT	passes = 1;		/* Reads of each track, for voting */
+static	PUCHAR	report = (PUCHAR) NULL;	/* Name of voting report, if any */
+static	BOOL	merge = FALSE;		/* Merge captured images */
+static	PUCHAR	jobfile = (PUCHAR) NULL;/* Name of job file, if any */
+static	BOOL	quiet = FALSE;		/* No progress display */
+static	BOOL	piped = FALSE;		/* Image file is the standard output */
+static	BOOL	resume = FALSE;		/* Resume an interrupted read */
+static	PJOURNAL journal = (PJOURNAL) NULL;/* Journal of tracks read */
+static	PUCHAR	statsfile = (PUCHAR) NULL;/* Name of report file, if any */
+static	PTIMING	timing = (PTIMING) NULL;/* Timing of run, if wanted */
+static	PUCHAR	packfile = (PUCHAR) NULL;/* Name of pack file, if any */
+static	PPACK	pack = (PPACK) NULL;	/* Pack file, if any */
 
 /* Help text */
 
 static	const	PUCHAR helpinfo[] = {
 "%s: make image file from 3.5 inch diskette",
-"Synopsis: %s [-dhe] drive imagefile",
+#ifdef	THREADS
+"Synopsis: %s [-dhe] [-b buffers] [-c report] [-l mapfile] [-m manifest]",
+"                [-p passes] [-r retries] [-t seconds] [-z method] [--sparse]",
+"                [--pack file] [--resume] [--stats file] drive imagefile",
+#else
+"Synopsis: %s [-dhe] [-c report] [-l mapfile] [-m manifest] [-p passes]",
+"                [-r retries] [-t seconds] [-z method] [--resume] [--sparse]",
+"                [--pack file] [--stats file] drive imagefile",
+#endif
+"          %s --merge [-dhe] [-c report] [-m manifest] [-z method]",
+"                capture... imagefile",
+"          %s -j jobfile [-dhe] [-p passes] [-r retries] [-t seconds]",
+"                [-z method] [--sparse] drive...",
 " where:",
 "    -d           forces DD (720K) diskette type",
 "    -h           forces HD (1.44MB) diskette type",
 "    -e           forces ED (2.88MB) diskette type",
+#ifdef	THREADS
+"    -b buffers   sets the number of track buffers (default 2); with more",
+"                 than one, the image file is written while the diskette",
+"                 is being read (default 8 to the standard output)",
+#endif
+"    -c report    writes a report of the vote for each sector (with -p",
+"                 or --merge) to the file 'report'",
+"    -j jobfile   reads a series of diskettes, one for each line of",
+"                 'jobfile', keeping the drive open throughout",
+#ifdef	THREADS
+"                 (with several drives, each takes the next job when free)",
+#endif
+"    -l mapfile   rescues a damaged diskette over several runs, keeping the",
+"                 state of each sector in 'mapfile'; each run reads only",
+"                 the sectors not yet read",
+"    -m manifest  writes the CRC32C and SHA-256 of each track, and of the",
+"                 whole image, to the file 'manifest'",
+"    -p passes    reads each track the given number of times, and chooses",
+"                 each sector by majority vote",
+"    -r retries   recovers damaged tracks, retrying each failing read up",
+"                 to the given number of times (default 3), then reading",
+"                 sector by sector; unreadable sectors are marked and listed",
+"    -t seconds   limits the time spent on the diskette, after which damaged",
+"                 tracks are no longer retried (implies -r)",
+#if	defined(ZLIB) || defined(ZSTD)
+"    -z method    compresses the image file, using the given method",
+#if	defined(ZLIB) && defined(ZSTD)
+"                 (gzip or zstd)",
+#else
+#ifdef	ZLIB
+"                 (gzip)",
+#else
+"                 (zstd)",
+#endif
+#endif
+#endif
+"    --pack file  adds the image to the pack file 'file', under the name",
+"                 'imagefile', storing only the tracks not already there",
+"    --resume     keeps a journal of the tracks read, so that an interrupted",
+"                 run can be resumed by giving the same command again",
+"    --sparse     reads only those tracks in use by the FAT file system",
+"                 on the diskette; the rest are left as holes in the",
+"                 image file, which reads back as zeros",
+"    --stats file times each diskette and image file operation, and",
+"                 writes the counts, errors and times to 'file' in JSON",
+"                 at the end",
+"    --merge      builds the image by voting between several images of the",
+"                 same diskette ('capture...') made earlier",
+#ifdef	LINUX
+"    drive        is the drive (a: or b:), device or file to be read from",
+#else
 "    drive        is the drive to be read from",
-"    imagefile    is the name of the file to contain the diskette image",
+#endif
+"    imagefile    is the name of the file to contain the diskette image,",
+"                 or '-' to write it to the standard output",
 " ",
 "Examples:  %s a: boot.img",
 "           %s -e a: bigboot.img",
@@ -109,14 +238,16 @@ VOID main(INT argc, PUCHAR argv[])
 	INT q = 1;			/* First real arg index */
 	PUCHAR p;			/* Temporary */
 	PUCHAR file;			/* Pointer to image file name */
-	PUCHAR drv;			/* Pointer to original drive name */
-	UCHAR drive[3];			/* Drive name */
-	HFILE dfd;			/* Disk file handle */
+	PUCHAR drive;			/* Drive name */
+	UINT ndrives;			/* Number of drives to be read */
+	UINT i;
+	PDISK dp;			/* Disk being read */
 	UINT type = TY_UNKNOWN;		/* Diskette type */
+	BOOL ok;
 
 	/* Derive program name for use in messages */
 
-	progname = strrchr(argv[0], '\\');
+	progname = strrchr(argv[0], PATHSEP);
 	if(progname != (PUCHAR) NULL)
 		progname++;
 	else
@@ -127,14 +258,8 @@ VOID main(INT argc, PUCHAR argv[])
 
 	/* Check and parse arguments */
 
-	if(argc < 3 || argc > 4) {
-		usage();
-		exit(EXIT_FAILURE);
-	}
-
-	if(argv[1][0] == '-') {		/* Flag */
-		q++;
-		switch(argv[1][1]) {
+	while(q < argc && argv[q][0] == '-' && argv[q][1] != '\0') {
+		switch(argv[q][1]) {	/* Flag */
 			case 'D':
 			case 'd':
 				type = TY_DD;
@@ -149,300 +274,429 @@ VOID main(INT argc, PUCHAR argv[])
 			case 'e':
 				type = TY_ED;
 				break;
+#ifdef	THREADS
+
+			case 'B':
+			case 'b':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				nbufs = atoi(p);
+				if(nbufs < 1 || nbufs > MAXBUFS) {
+					error(
+						"number of buffers must be"
+						" between 1 and %d",
+						MAXBUFS);
+					exit(EXIT_FAILURE);
+				}
+				break;
+#endif
+
+			case 'J':
+			case 'j':
+				jobfile = flag_value(argc, argv, &q);
+				if(jobfile == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'L':
+			case 'l':
+				mapfile = flag_value(argc, argv, &q);
+				if(mapfile == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'C':
+			case 'c':
+				report = flag_value(argc, argv, &q);
+				if(report == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'P':
+			case 'p':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				passes = atoi(p);
+				if(passes < 2 || passes > MAXREADS) {
+					error(
+						"number of passes must be"
+						" between 2 and %d",
+						MAXREADS);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'M':
+			case 'm':
+				manifest = flag_value(argc, argv, &q);
+				if(manifest == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'R':
+			case 'r':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				retries = atoi(p);
+				if(retries > MAXRETRIES) {
+					error(
+						"number of retries must be"
+						" between 0 and %d",
+						MAXRETRIES);
+					exit(EXIT_FAILURE);
+				}
+				recover = TRUE;
+				break;
+
+			case 'T':
+			case 't':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				budget = (ULONG) atol(p);
+				if(budget == 0) {
+					error("time limit must be at least one second");
+					exit(EXIT_FAILURE);
+				}
+				recover = TRUE;
+				break;
+
+			case 'Z':
+			case 'z':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				codec = find_codec(strlwr(p));
+				if(codec < 0) {
+					error(
+						"compression method '%s' is not"
+						" supported by this version",
+						p);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case '-':		/* Long flag */
+				if(strcmp(argv[q], "--sparse") == 0) {
+					sparse = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--merge") == 0) {
+					merge = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--resume") == 0) {
+					resume = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--stats") == 0 &&
+				   q + 1 < argc) {
+					statsfile = argv[++q];
+					break;
+				}
+				if(strcmp(argv[q], "--pack") == 0 &&
+				   q + 1 < argc) {
+					packfile = argv[++q];
+					break;
+				}
+				usage();
+				exit(EXIT_FAILURE);
 
 			default:
 				usage();
 				exit(EXIT_FAILURE);
 		}
+		q++;
 	}
 
-	file = argv[q+1];
-
-	/* Open image file */
-
-	fp = fopen(file, "wb");
-	if(fp == (FILE *) NULL) {
-		error("cannot open file '%s'", file);
+	if(resume == TRUE &&
+	   (jobfile != (PUCHAR) NULL || mapfile != (PUCHAR) NULL ||
+	    passes != 1 || merge == TRUE || codec != CODEC_NONE ||
+	    sparse == TRUE)) {
+		error(
+			"--resume cannot be used with -j, -l, -p, -z, --merge"
+			" or --sparse");
 		exit(EXIT_FAILURE);
 	}
 
-	/* Check and open diskette */
-
-	drv = argv[q];
-	if ((strlen(drv) != 2) ||
-		!isalpha(drv[0]) ||
-		(drv[1] != ':')) {
-		usage();
+	if(packfile != (PUCHAR) NULL &&
+	   (jobfile != (PUCHAR) NULL || mapfile != (PUCHAR) NULL ||
+	    merge == TRUE || codec != CODEC_NONE || resume == TRUE)) {
+		error(
+			"--pack cannot be used with -j, -l, -z, --merge or"
+			" --resume");
 		exit(EXIT_FAILURE);
 	}
-	strcpy(drive, drv);
-	(void) strupr(drive);
 
-	dfd = open_disk(drive);
-	if(dfd == (HFILE) NULL)
+	if(statsfile != (PUCHAR) NULL &&
+	   (jobfile != (PUCHAR) NULL || merge == TRUE)) {
+		error("--stats cannot be used with -j or --merge");
 		exit(EXIT_FAILURE);
+	}
 
-	/* Create the image */
-
-	if(process_disk(fp, dfd, type) == FALSE)	/* Read the disk */
-		exit(EXIT_FAILURE);
-
-	/* Tidy up and exit */
-
-	close_disk(dfd);		/* Close the drive */
-
-	exit(EXIT_SUCCESS);
-}
-
-
-/*
- * Perform open actions for the disk
- * Returns handle if disk was successfully opened, otherwise NULL.
- *
- */
+	if(merge == TRUE) {
+		if(argc - q < 3 || argc - q > MAXREADS + 1) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		if(jobfile != (PUCHAR) NULL || mapfile != (PUCHAR) NULL ||
+		   recover == TRUE || passes != 1 || sparse == TRUE) {
+			error(
+				"--merge cannot be used with -j, -l, -p, -r, -t"
+				" or --sparse");
+			exit(EXIT_FAILURE);
+		}
+		file = argv[argc-1];
+		fp = open_image(file);
+		if(fp == (FILE *) NULL) {
+			error("cannot open file '%s'", file);
+			exit(EXIT_FAILURE);
+		}
+		if(process_merge(&argv[q], argc - q - 1, fp, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-static HFILE open_disk(PUCHAR drive)
-{	APIRET rc;
-	UCHAR dbuf[36];			/* DosDevIOCtl data buffer */
-	UCHAR parblk[2] = { 0, 0};	/* DosDevIOCtl parameter block */
-#ifdef DUAL
-	USHORT action;			/* For returned action taken */
-	USHORT openflags;		/* For DosOpen */
+	ndrives = jobfile != (PUCHAR) NULL ? argc - q : argc - q - 1;
+#ifdef	THREADS
+	if(ndrives < 1 || ndrives > (jobfile != (PUCHAR) NULL ? MAXDRIVES : 1)) {
 #else
-	ULONG action;			/* For returned action taken */
-	ULONG openflags;		/* For DosOpen */
-	ULONG plen = sizeof(parblk);	/* Output length for parameters */
-	ULONG dlen = sizeof(dbuf);	/* Output length for data */
-#endif
-	HFILE dfd;			/* Handle for disk */
-
-	openflags = OPEN_ACCESS_READONLY |
-		    OPEN_FLAGS_DASD |
-#ifndef	DUAL
-		    OPEN_FLAGS_FAIL_ON_ERROR |
-#endif
-		    OPEN_SHARE_DENYREADWRITE;
-#ifdef	DUAL
-	if(_osmode == OS2_MODE)
-		openflags |= OPEN_FLAGS_FAIL_ON_ERROR;
+	if(ndrives != 1) {
 #endif
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if(passes != 1 && (mapfile != (PUCHAR) NULL || recover == TRUE)) {
+		error("-p cannot be used with -l, -r or -t");
+		exit(EXIT_FAILURE);
+	}
+	if(jobfile != (PUCHAR) NULL &&
+	   (mapfile != (PUCHAR) NULL || manifest != (PUCHAR) NULL ||
+	    report != (PUCHAR) NULL)) {
+		error(
+			"-j cannot be used with -c, -l or -m; give a manifest"
+			" for each job instead");
+		exit(EXIT_FAILURE);
+	}
 
-	/* Open the disk */
-
-	rc = DosOpen(
-		drive,			/* drive name */
-		&dfd,			/* to return handle */
-		&action,		/* to return action taken */
-		0L,			/* file size - not used */
-		0,			/* file attribute - not used */
-		OPEN_ACTION_OPEN_IF_EXISTS |
-		OPEN_ACTION_FAIL_IF_NEW,/* open action */
-		openflags,		/* open flags */
-#ifdef	DUAL
-		0L);			/* reserved - must be zero */
-#else
-		(PEAOP2) 0);		/* extended attributes - not used */
-#endif
+	/* Check drive names */
 
-	if(rc != 0) {
-		switch(rc) {
-			case ERROR_NOT_READY:
-				error("drive %s is not ready", drive);
-				break;
+	for(i = 0; i < ndrives; i++) {
+		if(check_drive(argv[q+i]) == FALSE) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	drive = argv[q];
 
-			case ERROR_PATH_NOT_FOUND:
-				error("%s is not a valid drive name", drive);
-				break;
+	if(jobfile != (PUCHAR) NULL) {	/* A series of diskettes */
+		if(process_jobs(&argv[q], ndrives, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-			case ERROR_DISK_CHANGE:
-			case ERROR_INVALID_DRIVE:
-				error("drive %s does not exist", drive);
-				break;
+	file = argv[q+1];
 
-			case ERROR_DRIVE_LOCKED:
-				error("drive %s is in use", drive);
-				break;
+	if(strcmp(file, "-") == 0 &&
+	   (mapfile != (PUCHAR) NULL || resume == TRUE)) {
+		error("-l and --resume need a named image file");
+		exit(EXIT_FAILURE);
+	}
 
-			case ERROR_ACCESS_DENIED:
-				error(
-					"access to drive %s denied", drive);
-				break;
+	/* Load any journal, which fixes the diskette type if a previous run
+	   got under way */
 
-			default:
+	if(resume == TRUE) {
+		journal = load_journal(file, JN_READ);
+		if(journal == (PJOURNAL) NULL)
+			exit(EXIT_FAILURE);
+		i = journal_type(journal);
+		if(i != TY_UNKNOWN) {
+			if(type != TY_UNKNOWN && type != i) {
 				error(
-					"can't open drive %s, rc = %d",
-					drive,
-					rc);
+					"diskette type does not match journal"
+					" file '%s'",
+					journal->name);
+				exit(EXIT_FAILURE);
+			}
+			type = i;
 		}
-		return((HFILE) NULL);
 	}
 
-	/* Check that we are dealing with the right kind of media */
-
-	parblk[0] = 0;
-	parblk[1] = 0;
-#ifdef DUAL
-	if(_osmode == OS2_MODE) {
-		rc = DosDevIOCtl(
-			&dbuf,		/* data block */
-			&parblk[0],	/* parameter block */
-			DSK_GETDEVICEPARAMS,/* device function - get device details */
-			IOCTL_DISK,	/* device category - logical drive */
-			dfd);		/* handle from DosOpen */
+	/* Open image file. When rescuing, an existing image is added to,
+	   unless the rescue is only just starting; likewise when resuming.
+	   When packing, there is no image file; the image is added to the
+	   pack under the name given. */
+
+	if(packfile != (PUCHAR) NULL) {
+		pack = open_pack(packfile, TRUE);
+		if(pack == (PPACK) NULL || start_packed(pack, file) == FALSE)
+			exit(EXIT_FAILURE);
+		fp = (FILE *) NULL;
+	} else if(mapfile != (PUCHAR) NULL) {
+		if(manifest != (PUCHAR) NULL || codec != CODEC_NONE ||
+		   sparse == TRUE) {
+			error("-l cannot be used with -m, -z or --sparse");
+			exit(EXIT_FAILURE);
+		}
+		fp = fopen(mapfile, "r");
+		if(fp != (FILE *) NULL) {
+			fclose(fp);
+			fp = fopen(file, "r+b");
+		} else {
+			fp = fopen(file, "w+b");
+		}
+	} else if(journal != (PJOURNAL) NULL && journal->done != 0) {
+		fp = fopen(file, "r+b");
 	} else {
-		rc = 0;
+		fp = open_image(file);
 	}
-#else
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_GETDEVICEPARAMS,	/* device function - get device details */
-		&parblk[0],		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		dlen,			/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
-		
-	if(rc != 0) {
-		error(
-			"cannot get device details for %s, rc = %d",
-			drive,
-			rc);
-		(VOID) DosClose(dfd);
-		return((HFILE) NULL);
+	if(fp == (FILE *) NULL && pack == (PPACK) NULL) {
+		error("cannot open file '%s'", file);
+		exit(EXIT_FAILURE);
 	}
 
-#ifdef	DUAL
-	if(_osmode == OS2_MODE) {
-#endif
-		if(dbuf[33] != 2 && dbuf[33] != 7 && dbuf[33] != 9) {
-			error("drive %s is not a valid diskette drive", drive);
-			(VOID) DosClose(dfd);
-			return((HFILE) NULL);
-		}
-#ifdef	DUAL
+	/* Start timing if a report is wanted; the clock starts here */
+
+	if(statsfile != (PUCHAR) NULL) {
+		timing = open_timing();
+		if(timing == (PTIMING) NULL)
+			exit(EXIT_FAILURE);
 	}
-#endif
 
-	/* Lock the disk against access by other processes */
+	/* Open diskette */
 
-#ifdef	DUAL
-	rc = DosDevIOCtl(
-		&dbuf,			/* data block */
-		&parblk,		/* parameter block */
-		DSK_LOCKDRIVE,		/* device function - lock drive */
-		IOCTL_DISK,		/* device category - logical drive */
-		dfd);			/* handle from DosOpen */
-#else
-	plen = 1;			/* Re-initialise */
-	dlen = 1;
-
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_LOCKDRIVE,		/* device function - lock drive */
-		&parblk,		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		dlen,			/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
+	dp = open_disk(drive, FALSE);
+	if(dp == (PDISK) NULL)
+		exit(EXIT_FAILURE);
+	dp->tm = timing;
 
-	if(rc != 0) {
-		switch(rc) {
-			case ERROR_DRIVE_LOCKED:
-				error("drive %s is locked", drive);
-				break;
+	/* Create the image */
 
-			default:
-				error(
-					"can't lock drive %s, rc = %d",
-					drive,
-					rc);
+	if(mapfile != (PUCHAR) NULL) {
+		ok = process_rescue(fp, dp, type);
+	} else {
+		ok = process_disk(fp, dp, type, manifest);
+		if(journal != (PJOURNAL) NULL &&
+		   end_journal(journal, ok) == FALSE) ok = FALSE;
+		if(pack != (PPACK) NULL) {
+			if(end_packed(pack, ok) == FALSE) ok = FALSE;
+			if(close_pack(pack) == FALSE) ok = FALSE;
 		}
-		(VOID) DosClose(dfd);
-		return((HFILE) NULL);
 	}
-	return(dfd);
+	if(timing != (PTIMING) NULL &&
+	   write_timing(
+		timing,
+		statsfile,
+		dp,
+		file,
+		nbufs == 0 ? DEFBUFS : nbufs,
+		ok) == FALSE)
+		ok = FALSE;
+	if(ok == FALSE)
+		exit(EXIT_FAILURE);
+
+	/* Tidy up and exit */
+
+	close_disk(dp);			/* Close the drive */
+
+	exit(EXIT_SUCCESS);
 }
 
 
 /*
- * Perform close actions for the disk
+ * Check a drive name, converting it to upper case.
+ * Returns TRUE if valid, else FALSE.
  *
  */
 
-static VOID close_disk(HFILE dfd)
-{	APIRET rc;
-	UCHAR dbuf;			/* DosDevIOCtl data buffer */
-	UCHAR parblk = 0;		/* DosDevIOCtl parameter block */
-#ifndef	DUAL
-	ULONG plen = sizeof(parblk);	/* Output length for parameters */
-	ULONG dlen = sizeof(dbuf);	/* Output length for data */
+static BOOL check_drive(PUCHAR drv)
+{
+#ifdef	LINUX
+	return(drv[0] != '\0' ? TRUE : FALSE);	/* Any device or file name */
+#else
+	if ((strlen(drv) != 2) ||
+		!isalpha(drv[0]) ||
+		(drv[1] != ':')) {
+		return(FALSE);
+	}
+	(void) strupr(drv);
+
+	return(TRUE);
 #endif
+}
 
-	/* Unlock the disk to allow access by other processes */
 
-#ifdef	DUAL
-	rc = DosDevIOCtl(
-		&dbuf,			/* data block */
-		&parblk,		/* parameter block */
-		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
-		IOCTL_DISK,		/* device category - logical drive */
-		dfd);			/* handle from DosOpen */
-#else
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
-		&parblk,		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		sizeof(dbuf),		/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
+/*
+ * Get the value for a flag that requires one. This may be attached to the
+ * flag itself, or be the next argument, in which case the argument index
+ * is advanced. Returns NULL if there is no value.
+ *
+ */
 
-	if(rc != 0)
-		error("can't unlock drive, rc = %d", rc);
+static PUCHAR flag_value(INT argc, PUCHAR argv[], PINT q)
+{	if(argv[*q][2] != '\0') return(&argv[*q][2]);
+	if(*q + 1 >= argc) return((PUCHAR) NULL);
+
+	return(argv[++*q]);
+}
+
+
+/*
+ * Open the image file for writing; '-' is the standard output. In that
+ * case there is no progress display (which would be mixed with the
+ * image), and more track buffers are used by default, so that the drive
+ * is not held up by whatever is reading the image.
+ * Returns the file pointer, or NULL on failure.
+ *
+ */
 
-	/* Close the disk */
+static FILE *open_image(PUCHAR file)
+{	if(strcmp(file, "-") != 0)
+		return(fopen(file, "wb"));
 
-	rc = DosClose(dfd);
-	if(rc != 0)
-		error("can't close drive, rc = %d", rc);
+	binary_mode(fileno(stdout));
+	quiet = TRUE;
+	piped = TRUE;
+	if(nbufs == 0) nbufs = PIPEBUFS;
+
+	return(stdout);
 }
 
 
 /*
- * Process the disk. This simply means that tracks are copied from
- * successive tracks and heads, to the image file.
+ * Work out the number of sectors per track for a diskette, from the type
+ * flag or from a media sense.
+ * Returns TRUE on success, FALSE on failure.
  *
  */
 
-static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
+static BOOL get_geometry(PDISK dp, INT type, PUINT psectors)
 {	APIRET rc;
-	UINT i;
-	size_t n;
-	UINT curcyl, curhead;		/* Current position while writing */
-	UINT cyls, heads, sectors;	/* Drive geometry */
-	UCHAR dpb;			/* DosDevIOCtl data buffer */
-	PTRACKLAYOUT parblk;		/* DosDevIOCtl parameter block */ 
-#ifdef	DUAL
-	UINT plen;			/* Length for parameters */
-#else
-	UCHAR mspar = 0;		/* DosDevIOCTL parameter block */
-	ULONG plen;			/* Length for parameters */
-	ULONG dlen;			/* Length for data */
-#endif
-	PUCHAR buf;			/* Pointer to track buffer */
-	BOOL res = TRUE;		/* Final function result */
+	UINT sectors;			/* Sectors per track */
+	UINT mtype;			/* Sensed media type */
 
-	cyls = 80;			/* Always this */
-	heads = 2;			/* Always this */
 	switch(type) {
 		case TY_DD:
 			sectors = 9;
@@ -457,160 +711,821 @@ static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
 			break;
 
 		case TY_UNKNOWN:
-#ifdef	DUAL
-			dpb = 0;			/* Cannot sense media */
-#else
-			plen = sizeof(mspar);
-			dlen = sizeof(dpb);
-			rc = DosDevIOCtl(
-				dfd,			/* handle from DosOpen */
-				IOCTL_DISK,		/* device category - logical drive */
-				DSK_QUERYMEDIASENSE,	/* device function - get media type */
-				&mspar,			/* parameter block */
-				plen,			/* input length of parameter block */
-				&plen,			/* output length of parameter block */
-				&dpb,			/* data block */
-				dlen,			/* input length of data block */
-				&dlen);			/* output length of data block */
+			rc = sense_disk(dp, &mtype);
 			if(rc != 0) {
 				error("cannot get media sense information"
 				", rc = %d",
 				rc);
 				return(FALSE);
 			}
-#endif
-			switch(dpb) {
+			switch(mtype) {
 				default:
-				case 0:			/* Media size not known */
+				case TY_UNKNOWN:	/* Media size not known */
 					error("cannot determine diskette size;"
 					      " use -d, -e or -h flag");
 					return(FALSE);
 
-				case 1:
+				case TY_DD:
 					sectors = 9;
 					break;
 
-				case 2:
+				case TY_HD:
 					sectors = 18;
 					break;
 
-				case 3:
+				case TY_ED:
 					sectors = 36;
 					break;
 			}
 	}
+	*psectors = sectors;
+
+	return(TRUE);
+}
+
+
+/*
+ * Process the disk. This simply means that tracks are copied from
+ * successive tracks and heads, to the image file. The image file is
+ * written by the track pipeline, so that with more than one buffer the
+ * previous track is being written while the next one is read.
+ * If only tracks in use are wanted, the others are passed down the
+ * pipeline as holes. Any manifest is built as each track is read.
+ * If recovery is wanted, a track that cannot be read is retried, and then
+ * read by sectors; the image is still made if some sectors are lost, but
+ * the result is failure. Retrying is left until the end of the sweep, the
+ * rest of the diskette being held in memory meanwhile, so that the failing
+ * tracks are all retried in one sweep back across the diskette rather
+ * than each stopping the heads where it is. With several passes, each
+ * track is read that many times, and each sector chosen by vote.
+ * When resuming, the tracks already read are checked against the journal
+ * and the diskette, and reading carries on from the first track not done.
+ *
+ */
+
+static BOOL process_disk(FILE *fp, PDISK dp, INT type, PUCHAR mname)
+{	APIRET rc;
+	UINT curcyl, curhead;		/* Current position while writing */
+	UINT cyls, heads, sectors;	/* Drive geometry */
+	PSTREAM sp = (PSTREAM) NULL;	/* Stream writing image file */
+	PTRKPIPE pp;			/* Pipeline writing image file */
+	PTRACK t;			/* Current track */
+	PUCHAR buf;			/* Where it is read to */
+	BOOL hole;			/* TRUE if not in use, so not read */
+	PUCHAR map = (PUCHAR) NULL;	/* Bitmap of tracks in use */
+	PMANIFEST mp = (PMANIFEST) NULL;/* Manifest being built */
+	RECOVERY rec;			/* Recovery of damaged tracks */
+#ifndef	DUAL
+	ULONG tlen;			/* Bytes per track */
+	PUCHAR held = (PUCHAR) NULL;	/* Tracks held back after a failure */
+	UINT first = 0;			/* First of these */
+	PUINT failed = (PUINT) NULL;	/* Failing tracks, to be retried */
+	UINT nfailed = 0;		/* Number of these */
+	APIRET *why = (APIRET *) NULL;	/* First error of each held track */
+	UINT i;
+#endif
+	PVOTE vp = (PVOTE) NULL;	/* Voting between reads */
+	UINT trk = 0;			/* Current track number */
+	UINT skipped = 0;		/* Tracks not in use */
+	BOOL res = TRUE;		/* Final function result */
+	BOOL ok;
+
+	cyls = 80;			/* Always this */
+	heads = 2;			/* Always this */
+	if(get_geometry(dp, type, &sectors) == FALSE)
+		return(FALSE);
 	error(
 		"%d cylinders, %d heads, %d sectors per track",
 		cyls, heads, sectors);
+#ifndef	DUAL
+	tlen = (ULONG) sectors*BLKSIZE;
+#endif
 
 	/* We now have the file, and the diskette geometry. Create the image
 	   from the diskette. */
 
-	/* First allocate the parameter block and track table, as well
-	   as the track buffer. */
+	/* First set up the geometry (which builds the track table), and
+	   start the pipeline that writes the image file. */
 
-	plen = sizeof(TRACKLAYOUT)+(sectors-1)*sizeof(USHORT)*2;
-	parblk = (PTRACKLAYOUT) malloc(plen);
-	if(parblk == (PTRACKLAYOUT) NULL) {
-		error("cannot allocate memory for track table");
+	if(set_geometry(dp, cyls, heads, sectors) == FALSE)
 		return(FALSE);
+	if(journal != (PJOURNAL) NULL && start_journal(journal, dp) == FALSE)
+		return(FALSE);
+	if(sparse == TRUE) {
+		map = read_map(dp);
+		if(map == (PUCHAR) NULL)
+			return(FALSE);
 	}
-#ifdef	DUAL
-	buf = (PUCHAR) malloc((INT) (sectors*BLKSIZE));
-#else
-	buf = (PUCHAR) malloc(sectors*BLKSIZE);
-#endif
-	if(buf == (PUCHAR) NULL) {
-		error("cannot allocate memory for track buffer");
-		free((PTRACKLAYOUT) parblk);
+	if(passes > 1) {
+		vp = open_vote(passes, report);
+		if(vp == (PVOTE) NULL) {
+			if(map != (PUCHAR) NULL) free((PUCHAR) map);
+			return(FALSE);
+		}
+	}
+	if(mname != (PUCHAR) NULL) {
+		mp = open_manifest(mname, cyls, heads, sectors);
+		if(mp == (PMANIFEST) NULL) {
+			if(vp != (PVOTE) NULL) (VOID) close_vote(vp);
+			if(map != (PUCHAR) NULL) free((PUCHAR) map);
+			return(FALSE);
+		}
+	}
+	if(journal != (PJOURNAL) NULL && resume_image(fp, dp, mp) == FALSE) {
+		if(mp != (PMANIFEST) NULL) (VOID) close_manifest(mp);
+		return(FALSE);
+	}
+	if(pack == (PPACK) NULL) {
+		sp = open_outstream(
+			fp,
+			codec,
+			(ULONG) cyls*heads*sectors*BLKSIZE);
+		if(sp == (PSTREAM) NULL) {
+			if(mp != (PMANIFEST) NULL) (VOID) close_manifest(mp);
+			if(vp != (PVOTE) NULL) (VOID) close_vote(vp);
+			if(map != (PUCHAR) NULL) free((PUCHAR) map);
+			return(FALSE);
+		}
+	}
+	pp = open_pipe(
+		dp,
+		nbufs == 0 ? DEFBUFS : nbufs,
+		TP_SINK,
+		pack != (PPACK) NULL ? write_packed : write_image,
+		pack != (PPACK) NULL ? (PVOID) pack : (PVOID) sp);
+	if(pp == (PTRKPIPE) NULL) {
+		if(sp != (PSTREAM) NULL) (VOID) close_stream(sp);
+		if(mp != (PMANIFEST) NULL) (VOID) close_manifest(mp);
+		if(vp != (PVOTE) NULL) (VOID) close_vote(vp);
+		if(map != (PUCHAR) NULL) free((PUCHAR) map);
 		return(FALSE);
 	}
 
 	/* Now enter the main reading loop. A whole track is done
 	   at a time. */
 
-	curcyl = 0;
-	curhead = 0;
+	if(journal != (PJOURNAL) NULL) trk = journal->done;
+	curcyl = trk / heads;
+	curhead = trk % heads;
+	init_recovery(&rec, retries, budget);
 
-	for(;;) {
-		parblk->bCommand = 1;		/* Read contiguous track */
-		parblk->usHead = (USHORT) curhead;
-		parblk->usCylinder = (USHORT) curcyl;
-		parblk->usFirstSector = 0;
-		parblk->cSectors = (USHORT) sectors;
-
-		for(i = 1; i <= (USHORT) sectors; i++) {
-			parblk->TrackTable[i-1].usSectorNumber = i;
-			parblk->TrackTable[i-1].usSectorSize = BLKSIZE;
+	while(curcyl < cyls) {
+		if(pipe_failed(pp) == TRUE) break;	/* Image write failed */
+#ifndef	DUAL
+		if(held != (PUCHAR) NULL)	/* Holding back the rest */
+			buf = held + (ULONG) (trk - first)*tlen;
+		else
+#endif
+		{
+			t = pipe_get(pp);	/* Empty track buffer */
+			buf = t->buf;
 		}
 
-		fprintf(
-			stdout,
-			"%s: cyl: %2d; head: %1d\r",
-			progname,
-			curcyl,
-			curhead);
-		fflush(stdout);
+		if(quiet == FALSE) {
+			show_progress(curcyl, curhead);
+		}
 
-#ifdef	DUAL
-		rc = DosDevIOCtl(
-			(PVOID) buf,
-			(PVOID) parblk,
-			DSK_READTRACK,
-			IOCTL_DISK,
-			dfd);
-#else
-		dlen = sectors*BLKSIZE;
-		rc = DosDevIOCtl(
-			dfd,
-			IOCTL_DISK,
-			DSK_READTRACK,
-			(PVOID) parblk,
-			plen,
-			&plen,
-			(PVOID) buf,
-			dlen,
-			&dlen);
+		hole = map != (PUCHAR) NULL &&
+			(map[trk/8] & (1 << (trk%8))) == 0 ? TRUE : FALSE;
+		if(hole == TRUE) {		/* Not in use */
+			skipped++;
+			rc = 0;
+		} else if(vp != (PVOTE) NULL) {
+			rc = read_vote(vp, dp, curcyl, curhead, buf);
+		} else {
+			rc = read_track(dp, curcyl, curhead, buf);
+#ifndef	DUAL
+			if(rc != 0 && recover == TRUE &&
+			   fatal_error(rc) == FALSE) {
+				if(held == (PUCHAR) NULL)
+					hold_tracks(
+						&held,
+						&failed,
+						&why,
+						cyls*heads - trk,
+						tlen);
+				if(held != (PUCHAR) NULL) {
+					if(nfailed == 0) first = trk;
+					why[trk - first] = rc;
+					failed[nfailed++] = trk;
+					rc = 0;	/* Retried after the sweep */
+				}
+			}
 #endif
-
+			if(rc != 0 && recover == TRUE)
+				rc = recover_track(
+					&rec,
+					dp,
+					curcyl,
+					curhead,
+					buf,
+					rc);
+		}
 		if(rc != 0) {
 			error(
 				"\nerror reading cylinder %d, head %d; rc=%d",
 				curcyl,
 				curhead,
 				rc);
+			t->last = TRUE;		/* Flush what we have */
+			pipe_put(pp, t);
 			res = FALSE;
 			break;
 		}
-		n = fwrite(buf, (INT) BLKSIZE, sectors, fp);/* Write image track */
-		if((n != sectors) && ferror(fp)) {
-			error("\nerror writing image file");
-			res = FALSE;
-			break;
-		}
+		trk++;
 
 		curhead++;
 		if(curhead >= heads) {
 			curhead = 0;
 			curcyl++;
 		}
+#ifndef	DUAL
+		if(held != (PUCHAR) NULL) continue;
+#endif
+		send_track(pp, t, sectors, hole, curcyl >= cyls, mp);
 		if(curcyl >= cyls) break;
 	}
-	if(res == TRUE) fputc('\n', stdout);
 
-	free((PUCHAR) buf);
-	free((PTRACKLAYOUT) parblk);
+#ifndef	DUAL
+	/* If a track failed, the rest of the diskette was held back while
+	   the sweep carried on. Retry the failing tracks now, in a single
+	   sweep back across the diskette, and then send the held tracks
+	   down the pipeline in order, starting with the buffer already
+	   taken for the first of them. */
+
+	if(held != (PUCHAR) NULL && res == TRUE && curcyl >= cyls) {
+		order_tracks(failed, nfailed, heads, cyls - 1);
+		for(i = 0; i < nfailed && res == TRUE; i++) {
+			curcyl = failed[i] / heads;
+			curhead = failed[i] % heads;
+			if(quiet == FALSE) {
+				show_progress(curcyl, curhead);
+			}
+			buf = held + (ULONG) (failed[i] - first)*tlen;
+			rc = recover_track(
+				&rec,
+				dp,
+				curcyl,
+				curhead,
+				buf,
+				why[failed[i] - first]);
+			if(rc != 0) {
+				error(
+					"\nerror reading cylinder %d, head %d;"
+					" rc=%d",
+					curcyl,
+					curhead,
+					rc);
+				res = FALSE;
+			}
+		}
+		for(trk = first; trk < cyls*heads && res == TRUE; trk++) {
+			if(trk != first) {
+				if(pipe_failed(pp) == TRUE) break;
+				t = pipe_get(pp);
+			}
+			memcpy(t->buf, held + (ULONG) (trk - first)*tlen,
+				(size_t) tlen);
+			hole = map != (PUCHAR) NULL &&
+				(map[trk/8] & (1 << (trk%8))) == 0 ?
+					TRUE : FALSE;
+			send_track(
+				pp,
+				t,
+				sectors,
+				hole,
+				trk + 1 >= cyls*heads ? TRUE : FALSE,
+				mp);
+		}
+		if(res == FALSE) {
+			t->last = TRUE;		/* Flush what we have */
+			pipe_put(pp, t);
+		}
+	} else if(held != (PUCHAR) NULL && res == TRUE) {
+		t->last = TRUE;			/* Image write failed */
+		pipe_put(pp, t);
+	}
+	if(held != (PUCHAR) NULL) free_buffer(held);
+	if(failed != (PUINT) NULL) free((PUINT) failed);
+	if(why != (APIRET *) NULL) free((APIRET *) why);
+#endif
+
+	ok = close_pipe(pp);
+	if(sp != (PSTREAM) NULL && close_stream(sp) == FALSE && res == TRUE)
+		ok = FALSE;
+	if(ok == FALSE) {
+		error("\nerror writing image file");
+		res = FALSE;
+	}
+	if(res == TRUE) {
+		if(quiet == FALSE) end_progress();
+		if(map != (PUCHAR) NULL) {
+			error(
+				"%d of %d tracks not in use, not read",
+				skipped,
+				cyls*heads);
+		}
+	}
+	report_recovery(&rec);
+	if(rec.nbad != 0) res = FALSE;	/* Image is incomplete */
+	end_recovery(&rec);
+	if(vp != (PVOTE) NULL) {
+		report_vote(vp);
+		if(vp->count[VS_BAD] != 0) res = FALSE;
+		if(close_vote(vp) == FALSE) res = FALSE;
+	}
+	if(mp != (PMANIFEST) NULL && close_manifest(mp) == FALSE)
+		res = FALSE;
+	if(map != (PUCHAR) NULL) free((PUCHAR) map);
+
+	return(res);
+}
+
+
+/*
+ * Pass a track that has been read (or skipped, if 'hole' is TRUE) down
+ * the pipeline to be written to the image file, adding it to any
+ * manifest. 'last' is TRUE for the last track of the diskette.
+ *
+ */
+
+static VOID send_track(PTRKPIPE pp, PTRACK t, UINT sectors, BOOL hole,
+			BOOL last, PMANIFEST mp)
+{	t->hole = hole;
+	t->count = sectors;
+	if(mp != (PMANIFEST) NULL) {
+		if(hole == TRUE)		/* Reads back as zeros */
+#ifdef	DUAL
+			memset(t->buf, '\0', (INT) (sectors*BLKSIZE));
+#else
+			memset(t->buf, '\0', sectors*BLKSIZE);
+#endif
+		manifest_track(mp, t->buf, sectors*BLKSIZE);
+	}
+	t->last = last;
+	pipe_put(pp, t);		/* Write image track */
+}
+
+
+#ifndef	DUAL
+
+/*
+ * Allocate room to hold back the remaining 'n' tracks of a diskette, of
+ * 'tlen' bytes each, a list of those of them that fail, and the error
+ * from the first read of each. If there is not enough memory, nothing is
+ * allocated, and failing tracks are simply recovered on the spot.
+ *
+ */
+
+static VOID hold_tracks(PUCHAR *held, PUINT *failed, APIRET **why, UINT n,
+			ULONG tlen)
+{	*failed = (PUINT) malloc(n*sizeof(UINT));
+	*why = (APIRET *) malloc(n*sizeof(APIRET));
+	*held = *failed == (PUINT) NULL || *why == (APIRET *) NULL ?
+		(PUCHAR) NULL : alloc_buffer((ULONG) n*tlen);
+	if(*held == (PUCHAR) NULL) {
+		if(*failed != (PUINT) NULL) free((PUINT) *failed);
+		if(*why != (APIRET *) NULL) free((APIRET *) *why);
+		*failed = (PUINT) NULL;
+		*why = (APIRET *) NULL;
+	}
+}
+
+#endif
+
+
+/*
+ * Read a series of diskettes, as listed in the job file, using the
+ * drives given. Each drive is opened and locked only once, and track
+ * buffers are kept from one diskette to the next; see jobs.c.
+ * Returns TRUE if every job was done successfully, else FALSE.
+ *
+ */
+
+static BOOL process_jobs(PUCHAR drives[], UINT ndrives, INT type)
+{	PJOB first;			/* Jobs to be done */
+	UINT count;			/* Number of jobs */
+	BOOL res;
+
+	first = read_jobs(jobfile, type, &count);
+	if(first == (PJOB) NULL)
+		return(FALSE);
+
+	quiet = ndrives > 1 ? TRUE : FALSE;	/* Displays would be mixed */
+	res = run_jobs(first, count, drives, ndrives, FALSE, read_job);
+	free_jobs(first);
+
+	return(res);
+}
+
+
+/*
+ * Do one job from the job file; read the diskette in 'dp' into the image
+ * file named in the job. This may be called from several threads at once.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL read_job(PJOB jp, PDISK dp)
+{	FILE *fp;			/* File pointer for image file */
+	BOOL res;
+
+	fp = fopen(jp->file, "wb");
+	if(fp == (FILE *) NULL) {
+		error("cannot open file '%s'", jp->file);
+		return(FALSE);
+	}
+
+	res = process_disk(fp, dp, jp->type, jp->manifest);
+	if(fclose(fp) != 0 && res == TRUE) {
+		error("error writing image file '%s'", jp->file);
+		res = FALSE;
+	}
+
+	return(res);
+}
+
+
+/*
+ * Process the disk, when rescuing a damaged diskette over several runs.
+ * Only the sectors not read by earlier runs are read; see rescue.c.
+ * Returns TRUE if the image is now complete, else FALSE.
+ *
+ */
+
+static BOOL process_rescue(FILE *fp, PDISK dp, INT type)
+{	UINT cyls, heads, sectors;	/* Drive geometry */
+	RECOVERY rec;			/* Recovery of damaged tracks */
+	BOOL res;
+
+	cyls = 80;			/* Always this */
+	heads = 2;			/* Always this */
+	if(get_geometry(dp, type, &sectors) == FALSE)
+		return(FALSE);
+	error(
+		"%d cylinders, %d heads, %d sectors per track",
+		cyls, heads, sectors);
+	if(set_geometry(dp, cyls, heads, sectors) == FALSE)
+		return(FALSE);
+
+	init_recovery(&rec, retries, budget);
+	res = rescue_disk(fp, dp, mapfile, &rec, recover);
+	end_recovery(&rec);
 
 	return(res);
 }
 
 
+/*
+ * Build an image by voting between several images of the same diskette,
+ * captured earlier (possibly compressed). The geometry comes from the type
+ * flag, or from the size of the first capture.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+static BOOL process_merge(PUCHAR files[], UINT n, FILE *fp, INT type)
+{	PSTREAM in[MAXREADS];		/* Captured images */
+	PSTREAM sp = (PSTREAM) NULL;	/* Stream writing image file */
+	PVOTE vp;			/* Voting between captures */
+	PMANIFEST mp = (PMANIFEST) NULL;/* Manifest being built */
+	PUCHAR out = (PUCHAR) NULL;	/* Merged track */
+	FILE *ifp;
+	UINT cyls, heads, sectors;	/* Diskette geometry */
+	ULONG tlen;			/* Bytes per track */
+	ULONG size;
+	UINT i, t, s;
+	BOOL res = TRUE;
+
+	vp = open_vote(n, report);
+	if(vp == (PVOTE) NULL)
+		return(FALSE);
+	for(i = 0; i < n && res == TRUE; i++) {
+		in[i] = (PSTREAM) NULL;
+		ifp = fopen(files[i], "rb");
+		if(ifp == (FILE *) NULL) {
+			error("cannot open file '%s'", files[i]);
+			res = FALSE;
+			break;
+		}
+		in[i] = open_instream(ifp);
+		if(in[i] == (PSTREAM) NULL) {
+			fclose(ifp);
+			res = FALSE;
+		}
+	}
+	n = i;				/* Number opened */
+
+	/* Work out the geometry */
+
+	cyls = 80;			/* Always this */
+	heads = 2;			/* Always this */
+	switch(type) {
+		case TY_DD:
+			sectors = 9;
+			break;
+
+		case TY_HD:
+			sectors = 18;
+			break;
+
+		case TY_ED:
+			sectors = 36;
+			break;
+
+		default:
+			size = res == TRUE ? in[0]->size : NOSIZE;
+			if(size == DD_MAX)
+				sectors = 9;
+			else if(size == HD_MAX)
+				sectors = 18;
+			else if(size == ED_MAX)
+				sectors = 36;
+			else {
+				if(res == TRUE)
+					error(
+						"cannot determine diskette size;"
+						" use -d, -e or -h flag");
+				res = FALSE;
+			}
+	}
+	tlen = sectors*BLKSIZE;
+
+	if(res == TRUE) {
+		error(
+			"%d cylinders, %d heads, %d sectors per track",
+			cyls, heads, sectors);
+		out = alloc_buffer(tlen);
+		if(out == (PUCHAR) NULL) {
+			error("cannot allocate memory for track buffer");
+			res = FALSE;
+		}
+	}
+	if(res == TRUE && manifest != (PUCHAR) NULL) {
+		mp = open_manifest(manifest, cyls, heads, sectors);
+		if(mp == (PMANIFEST) NULL) res = FALSE;
+	}
+	if(res == TRUE) {
+		sp = open_outstream(fp, codec, (ULONG) cyls*heads*tlen);
+		if(sp == (PSTREAM) NULL) res = FALSE;
+	}
+
+	/* Vote on each track in turn */
+
+	for(t = 0; t < cyls*heads && res == TRUE; t++) {
+		for(i = 0; i < n; i++) {
+			for(s = 0; s < sectors; s++)	/* In case short */
+				fill_bad(vp->buf[i] + s*BLKSIZE);
+			(VOID) read_stream(in[i], vp->buf[i], tlen);
+			if(in[i]->error == TRUE) {
+				error("error reading file '%s'", files[i]);
+				res = FALSE;
+				break;
+			}
+			capture_track(vp, i, sectors);
+		}
+		if(res == FALSE) break;
+		merge_track(vp, t / heads, t % heads, sectors, out);
+		if(mp != (PMANIFEST) NULL) manifest_track(mp, out, tlen);
+		if(write_stream(sp, out, tlen) == FALSE) {
+			error("error writing image file");
+			res = FALSE;
+		}
+	}
+
+	if(sp != (PSTREAM) NULL && close_stream(sp) == FALSE && res == TRUE) {
+		error("error writing image file");
+		res = FALSE;
+	}
+	if(res == TRUE) {
+		report_vote(vp);
+		if(vp->count[VS_BAD] != 0) res = FALSE;
+	}
+	if(mp != (PMANIFEST) NULL && close_manifest(mp) == FALSE)
+		res = FALSE;
+	if(close_vote(vp) == FALSE) res = FALSE;
+	if(out != (PUCHAR) NULL) free_buffer(out);
+	for(i = 0; i < n; i++) {
+		if(in[i] != (PSTREAM) NULL) {
+			ifp = in[i]->fp;
+			(VOID) close_stream(in[i]);
+			fclose(ifp);
+		}
+	}
+
+	return(res);
+}
+
+
+/*
+ * Read the boot sector and first FAT of the diskette, and build a bitmap
+ * of the tracks in use. The diskette geometry must already be set.
+ * Returns a pointer to the bitmap (to be freed with 'free'), or NULL on
+ * failure.
+ *
+ */
+
+static PUCHAR read_map(PDISK dp)
+{	APIRET rc;
+	BPB bpb;			/* File system layout */
+	BOOL fat;			/* TRUE if FAT file system found */
+	PUCHAR buf;			/* Start of diskette */
+	PUCHAR map = (PUCHAR) NULL;	/* Bitmap of tracks in use */
+	ULONG tlen = dp->sectors*BLKSIZE;
+	UINT n;				/* Tracks needed for first FAT */
+	UINT t;
+
+	/* First the boot sector... */
+
+	buf = alloc_track(dp);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for track buffer");
+		return((PUCHAR) NULL);
+	}
+	rc = read_track(dp, 0, 0, buf);
+	fat = rc == 0 ? read_bpb(buf, &bpb) : FALSE;
+	free_track(dp, buf);
+	if(rc != 0) {
+		error("error reading cylinder 0, head 0; rc=%d", rc);
+		return((PUCHAR) NULL);
+	}
+	if(fat == FALSE) {
+		error(
+			"diskette does not contain a FAT file system;"
+			" cannot use --sparse");
+		return((PUCHAR) NULL);
+	}
+
+	/* ...then enough tracks to hold the first FAT */
+
+	n = (UINT) ((bpb.reserved*BLKSIZE + FATSIZE(&bpb) + tlen - 1) / tlen);
+	buf = alloc_buffer(n*tlen);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for FAT");
+		return((PUCHAR) NULL);
+	}
+	for(t = 0; t < n; t++) {
+		rc = read_track(dp, t / dp->heads, t % dp->heads, buf + t*tlen);
+		if(rc != 0) {
+			error(
+				"error reading cylinder %d, head %d; rc=%d",
+				t / dp->heads,
+				t % dp->heads,
+				rc);
+			break;
+		}
+	}
+
+	if(t == n) {
+		map = fat_tracks(
+			buf + bpb.reserved*BLKSIZE,
+			&bpb,
+			dp->sectors,
+			dp->cyls*dp->heads);
+		if(map == (PUCHAR) NULL)
+			error("cannot allocate memory for track map");
+	}
+	free_buffer(buf);
+
+	return(map);
+}
+
+
+/*
+ * When resuming, check the tracks already in the image file against the
+ * journal, adding them to any manifest, and leave the file positioned
+ * after them. Then check that the diskette is the same one.
+ * Returns TRUE if all is well, else FALSE (already reported).
+ *
+ */
+
+static BOOL resume_image(FILE *fp, PDISK dp, PMANIFEST mp)
+{	PUCHAR buf;
+	size_t len = (size_t) dp->sectors*BLKSIZE;
+	UINT t;
+	BOOL res = TRUE;
+
+	if(journal->done == 0) return(TRUE);
+
+	buf = alloc_track(dp);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for track buffer");
+		return(FALSE);
+	}
+	rewind(fp);
+	for(t = 0; t < journal->done; t++) {
+		if(fread(buf, 1, len, fp) != len ||
+		   journal_match(journal, t, buf) == FALSE) {
+			error(
+				"image file does not match journal file '%s'"
+				" at cylinder %d, head %d; cannot resume",
+				journal->name,
+				t / dp->heads,
+				t % dp->heads);
+			res = FALSE;
+			break;
+		}
+		if(mp != (PMANIFEST) NULL) manifest_track(mp, buf, (ULONG) len);
+	}
+	free_track(dp, buf);
+	if(res == TRUE) {
+		if(fseek(fp, (LONG) t*dp->sectors*BLKSIZE, SEEK_SET) != 0) {
+			error("cannot position image file");
+			return(FALSE);
+		}
+		res = journal_disk(journal, dp);
+	}
+
+	return(res);
+}
+
+
+/*
+ * Write a track to the image file. This is called by the track
+ * pipeline, possibly on a separate thread, so any compression is done
+ * there. A hole is skipped over, except that the last byte of the image
+ * is always written, so that the file has the right length; in a
+ * compressed image, or one going to the standard output, a hole is
+ * simply written as zeros.
+ * Returns TRUE on success, FALSE on a write error.
+ *
+ */
+
+static BOOL write_image(PTRACK t, PVOID arg)
+{	PSTREAM sp = (PSTREAM) arg;	/* Image file */
+	LONG len = (LONG) t->count*BLKSIZE;
+	ULONG start;
+	BOOL ok;
+
+	if(t->count == 0) return(TRUE);
+
+	if(t->hole == TRUE) {
+		if(sp->codec == CODEC_NONE && piped == FALSE) {
+			if(t->last == TRUE) len--;
+			if(fseek(sp->fp, len, SEEK_CUR) != 0) return(FALSE);
+			if(t->last == TRUE && fputc('\0', sp->fp) == EOF)
+				return(FALSE);
+			return(TRUE);
+		}
+		memset(t->buf, '\0', (size_t) len);
+	}
+
+	start = clock_us();
+	ok = write_stream(sp, t->buf, (ULONG) len);/* Write image track */
+	if(timing != (PTIMING) NULL)
+		time_op(
+			timing,
+			TM_FILE,
+			start,
+			ok == TRUE ? NO_ERROR : ERROR_WRITE_FAULT);
+	if(ok == FALSE) return(FALSE);
+	if(journal != (PJOURNAL) NULL) {	/* Record it once it is out */
+		if(fflush(sp->fp) != 0) return(FALSE);
+		journal_track(journal, t->buf);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a track to the image being added to the pack file. This is called
+ * by the track pipeline, possibly on a separate thread, so the hashing
+ * and compression are done there. A hole is stored as zeros, which
+ * take almost no room, and only once.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL write_packed(PTRACK t, PVOID arg)
+{	PPACK pk = (PPACK) arg;		/* Pack file */
+	ULONG len = (ULONG) t->count*BLKSIZE;
+	ULONG start;
+	BOOL ok;
+
+	if(t->count == 0) return(TRUE);
+
+	if(t->hole == TRUE) memset(t->buf, '\0', (size_t) len);
+
+	start = clock_us();
+	ok = add_track(pk, t->buf, len);
+	if(timing != (PTIMING) NULL)
+		time_op(
+			timing,
+			TM_FILE,
+			start,
+			ok == TRUE ? NO_ERROR : ERROR_WRITE_FAULT);
+
+	return(ok);
+}
+
+
 /*
  * Output an error message, possibly with parameters
  *
  */
 
-static VOID error(PUCHAR mes, ...)
+VOID error(PUCHAR mes, ...)
 {	va_list ap;
 
 	fprintf(stderr, "%s: ", progname);
@@ -659,7 +1574,6 @@ static VOID usage(VOID)
 }
 
 /*
- * End of file: rawrite.c
+ * End of file: raread.c
  *
  */
-
\ No newline at end of file
@@ -0,0 +1,291 @@
+/*
+ * File: recover.c
+ *
+ * Diskette raw image utilities
+ *
+ * Recovery of damaged tracks
+ *
+ */
+
+/*
+ * When a whole track cannot be read, it is first retried a few times;
+ * diskette read errors are often transient. If it still fails, the track
+ * is read a sector at a time (with the same number of retries for each
+ * sector), so that only the sectors that are really bad are lost. Those
+ * are filled with a marker pattern, so that they can be recognised in the
+ * image, and remembered for the final report.
+ *
+ * A damaged diskette can take a very long time to read this way, so an
+ * overall time limit may be set for the diskette. Once that has passed,
+ * failing tracks are no longer retried or read by sectors, but are simply
+ * marked bad in their entirety; the rest of the diskette is still read.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diskio.h"
+#include "recover.h"
+
+/* Forward references */
+
+static	INT	compare_bad(const void *, const void *);
+static	BOOL	in_time(PRECOVERY);
+static	BOOL	mark_bad(PRECOVERY, PDISK, UINT, UINT, UINT, PUCHAR, APIRET);
+
+
+/*
+ * Prepare for recovery of a diskette, just as reading it begins.
+ *
+ */
+
+VOID init_recovery(PRECOVERY rp, UINT retries, ULONG budget)
+{	memset(rp, 0, sizeof(RECOVERY));
+	rp->retries = retries;
+	rp->budget = budget;
+	rp->start = (ULONG) time((time_t *) NULL);
+}
+
+
+/*
+ * Free any storage used for recovery of a diskette.
+ *
+ */
+
+VOID end_recovery(PRECOVERY rp)
+{	if(rp->bad != (PBADSECT) NULL) free((PBADSECT) rp->bad);
+	rp->bad = (PBADSECT) NULL;
+	rp->nbad = rp->maxbad = 0;
+}
+
+
+/*
+ * Recover a track whose reading failed with error code 'rc'. On return,
+ * the buffer holds the track, with any bad sectors filled with the marker.
+ * Returns NO_ERROR unless the error is one that no amount of retrying
+ * could help (such as the diskette being removed), in which case that
+ * error is returned.
+ *
+ */
+
+APIRET recover_track(PRECOVERY rp, PDISK dp, UINT cyl, UINT head, PUCHAR buf,
+			APIRET rc)
+{	UINT i;
+	APIRET trc;			/* Result of retry */
+	UCHAR state[MAXSECTORS];	/* State of each sector */
+
+	if(fatal_error(rc) == TRUE) return(rc);
+	rp->tracks++;
+
+	for(i = 0; i < rp->retries && in_time(rp) == TRUE; i++) {
+		trc = read_track(dp, cyl, head, buf);
+		if(trc == NO_ERROR || fatal_error(trc) == TRUE) return(trc);
+		rc = trc;
+	}
+
+	memset(state, SS_BAD, dp->sectors);
+
+	return(recover_sectors(rp, dp, cyl, head, buf, state, rc));
+}
+
+
+/*
+ * Read those sectors of a track that are not yet known to be good ('state'
+ * holds one state character for each sector) a sector at a time, each
+ * with retries, and update their state. The sectors that still cannot be
+ * read are filled with the marker and remembered as bad; 'rc' is the
+ * error recorded for any that are not tried because time has run out.
+ * Returns NO_ERROR, or an error that makes retrying pointless.
+ *
+ */
+
+APIRET recover_sectors(PRECOVERY rp, PDISK dp, UINT cyl, UINT head, PUCHAR buf,
+			PUCHAR state, APIRET rc)
+{	UINT i, s;
+	APIRET src;			/* Result for current sector */
+
+	for(s = 0; s < dp->sectors; s++) {
+		if(state[s] == SS_GOOD) continue;
+		src = rc;
+		for(i = 0; i <= rp->retries && in_time(rp) == TRUE; i++) {
+			src = read_sector(dp, cyl, head, s, buf + s*BLKSIZE);
+			if(src == NO_ERROR) break;
+			if(fatal_error(src) == TRUE) return(src);
+		}
+		if(src == NO_ERROR) {
+			state[s] = SS_GOOD;
+			continue;
+		}
+		state[s] = SS_BAD;
+		if(mark_bad(rp, dp, cyl, head, s, buf + s*BLKSIZE, src) == FALSE)
+			return(ERROR_NOT_ENOUGH_MEMORY);
+	}
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Fill a sector buffer with the bad sector marker.
+ *
+ */
+
+VOID fill_bad(PUCHAR buf)
+{	UINT i;
+
+	for(i = 0; i < BLKSIZE; i++)
+		buf[i] = BADMARK[i % (sizeof(BADMARK) - 1)];
+}
+
+
+/*
+ * Report the sectors that could not be recovered, if any, in the order
+ * they lie on the diskette; tracks need not have been recovered in that
+ * order. Sectors are numbered from one, as on the diskette itself.
+ *
+ */
+
+VOID report_recovery(PRECOVERY rp)
+{	UINT i, j;
+	PBADSECT bp, ep;
+
+	if(rp->tracks == 0) return;
+	if(rp->nbad == 0) {
+		error("%d damaged tracks recovered in full", rp->tracks);
+		return;
+	}
+
+	error(
+		"%d sectors on %d damaged tracks could not be read;"
+		" filled with '%s'",
+		rp->nbad,
+		rp->tracks,
+		BADMARK);
+	qsort(
+		(PVOID) rp->bad,
+		(size_t) rp->nbad,
+		sizeof(BADSECT),
+		compare_bad);
+	for(i = 0; i < rp->nbad; i = j) {	/* Runs of sectors on a track */
+		bp = &rp->bad[i];
+		for(j = i + 1; j < rp->nbad; j++) {
+			ep = &rp->bad[j];
+			if(ep->cyl != bp->cyl || ep->head != bp->head ||
+			   ep->sector != bp->sector + (j - i) || ep->rc != bp->rc)
+				break;
+		}
+		ep = &rp->bad[j-1];
+		if(ep == bp) {
+			error(
+				"    cylinder %d, head %d, sector %d; rc=%d",
+				bp->cyl,
+				bp->head,
+				bp->sector + 1,
+				bp->rc);
+		} else {
+			error(
+				"    cylinder %d, head %d, sectors %d-%d; rc=%d",
+				bp->cyl,
+				bp->head,
+				bp->sector + 1,
+				ep->sector + 1,
+				bp->rc);
+		}
+	}
+	if(rp->expired == TRUE)
+		error("time limit reached; later tracks were not retried");
+}
+
+
+/*
+ * Check for an error that is not a problem with the data on the diskette,
+ * so that there is no point in retrying.
+ *
+ */
+
+BOOL fatal_error(APIRET rc)
+{	switch(rc) {
+		case ERROR_NOT_READY:
+		case ERROR_DISK_CHANGE:
+		case ERROR_NOT_ENOUGH_MEMORY:
+			return(TRUE);
+
+		default:
+			return(FALSE);
+	}
+}
+
+
+/*
+ * Compare two bad sectors, for sorting into the order they lie on the
+ * diskette.
+ *
+ */
+
+static INT compare_bad(const void *a, const void *b)
+{	const BADSECT *x = (const BADSECT *) a;
+	const BADSECT *y = (const BADSECT *) b;
+
+	if(x->cyl != y->cyl) return(x->cyl < y->cyl ? -1 : 1);
+	if(x->head != y->head) return(x->head < y->head ? -1 : 1);
+
+	return(x->sector < y->sector ? -1 : x->sector > y->sector ? 1 : 0);
+}
+
+
+/*
+ * Check whether there is still time for recovery.
+ *
+ */
+
+static BOOL in_time(PRECOVERY rp)
+{	if(rp->budget != 0 && rp->expired == FALSE &&
+	   (ULONG) time((time_t *) NULL) - rp->start >= rp->budget)
+		rp->expired = TRUE;
+
+	return(rp->expired == TRUE ? FALSE : TRUE);
+}
+
+
+/*
+ * Fill a bad sector with the marker, and add it to the table of bad
+ * sectors.
+ * Returns TRUE on success, FALSE if the table cannot be extended.
+ *
+ */
+
+static BOOL mark_bad(PRECOVERY rp, PDISK dp, UINT cyl, UINT head, UINT sector,
+			PUCHAR buf, APIRET rc)
+{	PBADSECT bp;
+
+	fill_bad(buf);
+
+	if(rp->nbad == rp->maxbad) {
+		bp = (PBADSECT) realloc(
+				rp->bad,
+				(rp->maxbad + dp->sectors)*sizeof(BADSECT));
+		if(bp == (PBADSECT) NULL) {
+			error("cannot allocate memory for bad sector table");
+			return(FALSE);
+		}
+		rp->bad = bp;
+		rp->maxbad += dp->sectors;
+	}
+	bp = &rp->bad[rp->nbad++];
+	bp->cyl = cyl;
+	bp->head = head;
+	bp->sector = sector;
+	bp->rc = rc;
+
+	return(TRUE);
+}
+
+/*
+ * End of file: recover.c
+ *
+ */
@@ -0,0 +1,64 @@
+/*
+ * File: recover.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for recovery of damaged tracks
+ *
+ */
+
+#ifndef	_RECOVER_H
+#define	_RECOVER_H
+
+/* Miscellaneous definitions */
+
+#define	DEFRETRIES	3		/* Default retries of a failing read */
+#define	MAXRETRIES	100		/* Maximum retries of a failing read */
+#define	BADMARK		"** BAD SECTOR **"/* Fill for unreadable sectors */
+#define	MAXSECTORS	(MAXTRACK/BLKSIZE)/* Most sectors on a track */
+
+/* States of a sector being recovered */
+
+#define	SS_UNTRIED	'?'		/* Not yet read */
+#define	SS_GOOD		'+'		/* Read successfully */
+#define	SS_BAD		'-'		/* Could not be read */
+
+/* A sector that could not be read */
+
+typedef	struct _BADSECT {
+	UINT		cyl;		/* Cylinder */
+	UINT		head;		/* Head */
+	UINT		sector;		/* Sector, from zero */
+	APIRET		rc;		/* Error from last attempt */
+} BADSECT, *PBADSECT;
+
+/* State of recovery for one diskette */
+
+typedef	struct _RECOVERY {
+	UINT		retries;	/* Retries of a failing read */
+	ULONG		budget;		/* Seconds allowed, or 0 for no limit */
+	ULONG		start;		/* Time reading started */
+	BOOL		expired;	/* Time allowed has run out */
+	UINT		tracks;		/* Tracks needing recovery */
+	UINT		nbad;		/* Number of bad sectors */
+	UINT		maxbad;		/* Size of table of bad sectors */
+	PBADSECT	bad;		/* Table of bad sectors */
+} RECOVERY, *PRECOVERY;
+
+/* External references */
+
+extern	VOID	end_recovery(PRECOVERY);
+extern	BOOL	fatal_error(APIRET);
+extern	VOID	fill_bad(PUCHAR);
+extern	VOID	init_recovery(PRECOVERY, UINT, ULONG);
+extern	APIRET	recover_sectors(PRECOVERY, PDISK, UINT, UINT, PUCHAR, PUCHAR,
+			APIRET);
+extern	APIRET	recover_track(PRECOVERY, PDISK, UINT, UINT, PUCHAR, APIRET);
+extern	VOID	report_recovery(PRECOVERY);
+
+#endif
+
+/*
+ * End of file: recover.h
+ *
+ */
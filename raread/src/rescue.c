@@ -0,0 +1,455 @@
+/*
+ * File: rescue.c
+ *
+ * Creates raw diskette image from a diskette
+ *
+ * Multi-pass rescue of damaged diskettes
+ *
+ */
+
+/*
+ * Reading a damaged diskette in one go wastes a great deal of time: a
+ * single bad track can take minutes of retries, and if the run has to be
+ * abandoned, everything must be read again. Instead, the state of every
+ * sector (untried, good or bad) is kept in a map file alongside the image,
+ * and the image is built up over several runs:
+ *
+ *	- each run first reads every track that has never been tried, once
+ *	  only; a track that fails is marked bad, and skipped;
+ *	- if recovery is wanted, it then goes back over the sectors that are
+ *	  not yet good, reading them one at a time, with retries (and within
+ *	  any time limit).
+ *
+ * So a first run without recovery quickly copies everything that can be
+ * copied easily; later runs, perhaps with more retries or in a different
+ * drive, work only on what is left. The map is rewritten after each track,
+ * so a run can be stopped at any time and resumed. Sectors not yet read
+ * are filled with the bad sector marker in the image.
+ *
+ * The map file is text:
+ *
+ *	geometry <cylinders> <heads> <sectors>
+ *	track <cylinder> <head> <states>
+ *	...
+ *
+ * with one character for each sector of a track: '?' (untried), '+' (good)
+ * or '-' (bad). Lines starting with '#' are comments.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskio.h"
+#include "elevator.h"
+#include "recover.h"
+#include "rescue.h"
+#include "timing.h"
+
+/* Miscellaneous definitions */
+
+#define	MAXLINE		100		/* Longest line in map file */
+
+/* Forward references */
+
+static	VOID	close_map(PRESMAP);
+static	UINT	count_state(PRESMAP, UINT, UCHAR);
+static	BOOL	load_map(PRESMAP, FILE *);
+static	PRESMAP	open_map(PUCHAR, PDISK);
+static	VOID	read_error(UINT, PDISK, APIRET);
+static	VOID	report_map(PRESMAP);
+static	BOOL	save_map(PRESMAP);
+static	BOOL	write_sectors(FILE *, PRESMAP, UINT, PUCHAR, PUCHAR);
+
+
+/*
+ * Rescue a diskette into an image file, using the map file 'mapname'.
+ * The image file must be open for update; the diskette geometry must
+ * already be set. If 'recover' is FALSE, only tracks never tried before
+ * are read.
+ * Returns TRUE if every sector has now been read, else FALSE.
+ *
+ */
+
+BOOL rescue_disk(FILE *fp, PDISK dp, PUCHAR mapname, PRECOVERY rp, BOOL recover)
+{	APIRET rc = NO_ERROR;
+	PRESMAP mp;			/* Rescue map */
+	PUCHAR buf;			/* Track buffer */
+	PUCHAR st;			/* States for current track */
+	UCHAR old[MAXSECTORS];		/* States before this attempt */
+	UINT ntracks = dp->cyls*dp->heads;
+	PUINT work;			/* Tracks to do in this pass */
+	UINT nwork;			/* Number of these */
+	UINT cyl = 0;			/* Cylinder the heads are on */
+	UINT t, s, i;
+	BOOL res = TRUE;
+
+	mp = open_map(mapname, dp);
+	if(mp == (PRESMAP) NULL)
+		return(FALSE);
+	buf = alloc_track(dp);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for track buffer");
+		close_map(mp);
+		return(FALSE);
+	}
+	work = (PUINT) malloc(ntracks*sizeof(UINT));
+	if(work == (PUINT) NULL) {
+		error("cannot allocate memory for track list");
+		free_track(dp, buf);
+		close_map(mp);
+		return(FALSE);
+	}
+
+	/* First pass; read each track never tried before, just once. A track
+	   that fails is left to the second pass, rather than retried at once,
+	   so that the heads are not held up. */
+
+	for(nwork = 0, t = 0; t < ntracks; t++) {
+		if(count_state(mp, t, SS_UNTRIED) == dp->sectors)
+			work[nwork++] = t;
+	}
+	order_tracks(work, nwork, dp->heads, cyl);
+
+	for(i = 0; i < nwork && res == TRUE; i++) {
+		t = work[i];
+		cyl = t / dp->heads;
+		show_progress(t / dp->heads, t % dp->heads);
+
+		st = mp->state + t*dp->sectors;
+		memcpy(old, st, dp->sectors);
+		rc = read_track(dp, t / dp->heads, t % dp->heads, buf);
+		if(rc == NO_ERROR) {
+			memset(st, SS_GOOD, dp->sectors);
+		} else if(fatal_error(rc) == FALSE) {
+			for(s = 0; s < dp->sectors; s++)
+				fill_bad(buf + s*BLKSIZE);
+			memset(st, SS_BAD, dp->sectors);
+		} else {
+			read_error(t, dp, rc);
+			res = FALSE;
+			break;
+		}
+		if(write_sectors(fp, mp, t, old, buf) == FALSE ||
+		   save_map(mp) == FALSE)
+			res = FALSE;
+	}
+
+	/* Then, if wanted, go back over the sectors not yet read, starting
+	   from where the first pass finished */
+
+	for(nwork = 0, t = 0; t < ntracks && recover == TRUE; t++) {
+		if(count_state(mp, t, SS_GOOD) != dp->sectors)
+			work[nwork++] = t;
+	}
+	order_tracks(work, nwork, dp->heads, cyl);
+
+	for(i = 0; i < nwork && res == TRUE; i++) {
+		t = work[i];
+		cyl = t / dp->heads;
+		show_progress(t / dp->heads, t % dp->heads);
+
+		st = mp->state + t*dp->sectors;
+		memcpy(old, st, dp->sectors);
+		rp->tracks++;
+		rc = recover_sectors(
+			rp,
+			dp,
+			t / dp->heads,
+			t % dp->heads,
+			buf,
+			st,
+			ERROR_READ_FAULT);
+		if(rc != NO_ERROR) {	/* Leave the track as it was */
+			memcpy(st, old, dp->sectors);
+			read_error(t, dp, rc);
+			res = FALSE;
+			break;
+		}
+		if(write_sectors(fp, mp, t, old, buf) == FALSE ||
+		   save_map(mp) == FALSE)
+			res = FALSE;
+	}
+
+	end_progress();
+	report_recovery(rp);
+	report_map(mp);
+	if(count_state(mp, ntracks, SS_GOOD) != ntracks*dp->sectors)
+		res = FALSE;
+
+	free((PUINT) work);
+	free_track(dp, buf);
+	close_map(mp);
+
+	return(res);
+}
+
+
+/*
+ * Report an error that stops the reading of track 't'.
+ *
+ */
+
+static VOID read_error(UINT t, PDISK dp, APIRET rc)
+{	error(
+		"\nerror reading cylinder %d, head %d; rc=%d",
+		t / dp->heads,
+		t % dp->heads,
+		rc);
+}
+
+
+/*
+ * Write to the image those sectors of track 't' that were not already
+ * good ('old' gives their previous states); these are either newly read
+ * or filled with the bad sector marker. The image file is flushed, so that
+ * the map is never ahead of the image.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL write_sectors(FILE *fp, PRESMAP mp, UINT t, PUCHAR old, PUCHAR buf)
+{	UINT s;
+	LONG off;
+
+	for(s = 0; s < mp->sectors; s++) {
+		if(old[s] == SS_GOOD) continue;
+		off = ((LONG) t*mp->sectors + s)*BLKSIZE;
+		if(fseek(fp, off, SEEK_SET) != 0 ||
+		   fwrite(buf + s*BLKSIZE, BLKSIZE, 1, fp) != 1) {
+			error("\nerror writing image file");
+			return(FALSE);
+		}
+	}
+	if(fflush(fp) != 0) {
+		error("\nerror writing image file");
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Count the sectors of track 't' that are in state 'state'. If 't' is the
+ * number of tracks, the whole diskette is counted.
+ *
+ */
+
+static UINT count_state(PRESMAP mp, UINT t, UCHAR state)
+{	PUCHAR p = mp->state + t*mp->sectors;
+	UINT n = mp->sectors;
+	UINT count = 0;
+
+	if(t == mp->cyls*mp->heads) {
+		p = mp->state;
+		n *= t;
+	}
+	while(n-- != 0)
+		if(*p++ == state) count++;
+
+	return(count);
+}
+
+
+/*
+ * Report on the state of the diskette after a run.
+ *
+ */
+
+static VOID report_map(PRESMAP mp)
+{	UINT ntracks = mp->cyls*mp->heads;
+	UINT good = count_state(mp, ntracks, SS_GOOD);
+	UINT bad = count_state(mp, ntracks, SS_BAD);
+	UINT untried = count_state(mp, ntracks, SS_UNTRIED);
+	UINT t, n = 0;
+
+	for(t = 0; t < ntracks; t++)
+		if(count_state(mp, t, SS_GOOD) != mp->sectors) n++;
+
+	error(
+		"%d sectors good, %d bad, %d untried",
+		good,
+		bad,
+		untried);
+	if(n != 0) {
+		error(
+			"%d tracks still to be recovered; see map file '%s'",
+			n,
+			mp->name);
+	}
+}
+
+
+/*
+ * Open the map file 'name'. If it exists, it is loaded, and must match
+ * the diskette geometry; otherwise, it is created, with every sector
+ * untried.
+ * Returns a pointer to the map, or NULL on failure (already reported).
+ *
+ */
+
+static PRESMAP open_map(PUCHAR name, PDISK dp)
+{	PRESMAP mp;
+	FILE *fp;
+	UINT n = dp->cyls*dp->heads*dp->sectors;
+
+	mp = (PRESMAP) calloc(1, sizeof(RESMAP));
+	if(mp != (PRESMAP) NULL) {
+		mp->state = (PUCHAR) malloc(n);
+		if(mp->state == (PUCHAR) NULL) {
+			free((PRESMAP) mp);
+			mp = (PRESMAP) NULL;
+		}
+	}
+	if(mp == (PRESMAP) NULL) {
+		error("cannot allocate memory for map");
+		return((PRESMAP) NULL);
+	}
+	mp->name = name;
+	mp->cyls = dp->cyls;
+	mp->heads = dp->heads;
+	mp->sectors = dp->sectors;
+	memset(mp->state, SS_UNTRIED, n);
+
+	fp = fopen(name, "r+");
+	if(fp != (FILE *) NULL) {
+		if(load_map(mp, fp) == FALSE) {
+			(VOID) fclose(fp);
+			free((PUCHAR) mp->state);
+			free((PRESMAP) mp);
+			return((PRESMAP) NULL);
+		}
+	} else {
+		fp = fopen(name, "w+");
+		if(fp == (FILE *) NULL) {
+			error("cannot create map file '%s'", name);
+			free((PUCHAR) mp->state);
+			free((PRESMAP) mp);
+			return((PRESMAP) NULL);
+		}
+	}
+	mp->fp = fp;
+
+	return(mp);
+}
+
+
+/*
+ * Load an existing map file.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL load_map(PRESMAP mp, FILE *fp)
+{	UCHAR line[MAXLINE];
+	UCHAR states[MAXLINE];
+	UINT cyls, heads, sectors;
+	UINT cyl, head;
+	BOOL geometry = FALSE;		/* TRUE when geometry line seen */
+	UINT lineno = 0;
+	UINT s;
+
+	while(fgets(line, MAXLINE, fp) != (char *) NULL) {
+		lineno++;
+		if(line[0] == '#' || line[0] == '\n') continue;
+		if(sscanf(line, "geometry %u %u %u", &cyls, &heads, &sectors) == 3) {
+			if(cyls != mp->cyls || heads != mp->heads ||
+			   sectors != mp->sectors) {
+				error(
+					"map file '%s' is for a diskette with"
+					" %d cylinders, %d heads, %d sectors"
+					" per track",
+					mp->name,
+					cyls,
+					heads,
+					sectors);
+				return(FALSE);
+			}
+			geometry = TRUE;
+			continue;
+		}
+		if(geometry == TRUE &&
+		   sscanf(line, "track %u %u %s", &cyl, &head, states) == 3 &&
+		   cyl < mp->cyls && head < mp->heads &&
+		   strlen(states) == mp->sectors) {
+			for(s = 0; s < mp->sectors; s++) {
+				if(states[s] != SS_UNTRIED &&
+				   states[s] != SS_GOOD &&
+				   states[s] != SS_BAD) break;
+			}
+			if(s == mp->sectors) {
+				memcpy(
+					mp->state +
+					 (cyl*mp->heads + head)*mp->sectors,
+					states,
+					mp->sectors);
+				continue;
+			}
+		}
+		error("map file '%s' is invalid at line %d", mp->name, lineno);
+		return(FALSE);
+	}
+	if(geometry == FALSE) {
+		error("map file '%s' is invalid; no geometry", mp->name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Rewrite the map file with the current states.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL save_map(PRESMAP mp)
+{	UINT t;
+
+	rewind(mp->fp);
+	fprintf(mp->fp, "# Diskette rescue map, written by %s\n", progname);
+	fprintf(
+		mp->fp,
+		"geometry %u %u %u\n",
+		mp->cyls,
+		mp->heads,
+		mp->sectors);
+	for(t = 0; t < mp->cyls*mp->heads; t++) {
+		fprintf(
+			mp->fp,
+			"track %2u %u %.*s\n",
+			t / mp->heads,
+			t % mp->heads,
+			(INT) mp->sectors,
+			mp->state + t*mp->sectors);
+	}
+	if(fflush(mp->fp) != 0 || ferror(mp->fp)) {
+		error("\nerror writing map file '%s'", mp->name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Close a map file, and free the map.
+ *
+ */
+
+static VOID close_map(PRESMAP mp)
+{	if(fclose(mp->fp) != 0)
+		error("error writing map file '%s'", mp->name);
+	free((PUCHAR) mp->state);
+	free((PRESMAP) mp);
+}
+
+/*
+ * End of file: rescue.c
+ *
+ */
@@ -0,0 +1,33 @@
+/*
+ * File: rescue.h
+ *
+ * Creates raw diskette image from a diskette
+ *
+ * Definitions for multi-pass rescue of damaged diskettes
+ *
+ */
+
+#ifndef	_RESCUE_H
+#define	_RESCUE_H
+
+/* Rescue map for a diskette; one state character per sector */
+
+typedef	struct _RESMAP {
+	FILE		*fp;		/* Map file */
+	PUCHAR		name;		/* Name of map file */
+	UINT		cyls;		/* Number of cylinders */
+	UINT		heads;		/* Number of heads */
+	UINT		sectors;	/* Sectors per track */
+	PUCHAR		state;		/* State of each sector */
+} RESMAP, *PRESMAP;
+
+/* External references */
+
+extern	BOOL	rescue_disk(FILE *, PDISK, PUCHAR, PRECOVERY, BOOL);
+
+#endif
+
+/*
+ * End of file: rescue.h
+ *
+ */
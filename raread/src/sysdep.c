@@ -0,0 +1,360 @@
+/*
+ * File: sysdep.c
+ *
+ * Diskette raw image utilities
+ *
+ * System dependent support routines
+ *
+ */
+
+#include "sysdep.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef	LINUX
+#include <errno.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#ifdef	THREADS
+#include <process.h>
+#endif
+#endif
+
+/* Miscellaneous definitions */
+
+#define	THREADSTACK	65536		/* Stack size for new threads */
+
+#ifdef	LINUX
+
+/* Type definitions */
+
+typedef	struct _THRARG {		/* Start information for a thread */
+	VOID		(*fn)(PVOID);	/* Thread function */
+	PVOID		arg;		/* Argument for thread function */
+} THRARG, *PTHRARG;
+
+/* Forward references */
+
+static	PVOID	thread_start(PVOID);
+
+
+/*
+ * Convert a string to lower case, in place.
+ * Supplied by the OS/2 C libraries, but not by glibc.
+ *
+ */
+
+char *strlwr(char *s)
+{	char *p;
+
+	for(p = s; *p != '\0'; p++)
+		*p = (char) tolower((UCHAR) *p);
+
+	return(s);
+}
+
+
+/*
+ * Convert a string to upper case, in place.
+ *
+ */
+
+char *strupr(char *s)
+{	char *p;
+
+	for(p = s; *p != '\0'; p++)
+		*p = (char) toupper((UCHAR) *p);
+
+	return(s);
+}
+
+
+/*
+ * Start a new thread, running the function 'fn' with argument 'arg'.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL start_thread(PTID tid, VOID (*fn)(PVOID), PVOID arg)
+{	PTHRARG ta;
+	pthread_attr_t attr;
+	INT rc;
+
+	ta = (PTHRARG) malloc(sizeof(THRARG));
+	if(ta == (PTHRARG) NULL) return(FALSE);
+	ta->fn = fn;
+	ta->arg = arg;
+
+	(VOID) pthread_attr_init(&attr);
+	(VOID) pthread_attr_setstacksize(&attr, THREADSTACK);
+	rc = pthread_create(tid, &attr, thread_start, (PVOID) ta);
+	(VOID) pthread_attr_destroy(&attr);
+	if(rc != 0) {
+		free((PTHRARG) ta);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Common entry point for new threads; adapts the calling convention.
+ *
+ */
+
+static PVOID thread_start(PVOID arg)
+{	THRARG ta = *(PTHRARG) arg;
+
+	free((PTHRARG) arg);
+	ta.fn(ta.arg);
+
+	return((PVOID) NULL);
+}
+
+
+/*
+ * Wait for a thread to terminate.
+ *
+ */
+
+VOID wait_thread(TID tid)
+{	(VOID) pthread_join(tid, (PVOID *) NULL);
+}
+
+
+/*
+ * Create a counting semaphore with the given initial count.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL create_sem(PSEM sem, UINT count)
+{	return(sem_init(sem, 0, count) == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Delete a counting semaphore.
+ *
+ */
+
+VOID delete_sem(PSEM sem)
+{	(VOID) sem_destroy(sem);
+}
+
+
+/*
+ * Increment a counting semaphore, releasing one waiter if any.
+ *
+ */
+
+VOID post_sem(PSEM sem)
+{	(VOID) sem_post(sem);
+}
+
+
+/*
+ * Wait until a counting semaphore is non-zero, then decrement it.
+ *
+ */
+
+VOID wait_sem(PSEM sem)
+{	while(sem_wait(sem) != 0 && errno == EINTR)
+		;
+}
+
+
+/*
+ * Suspend the calling thread for 'ms' milliseconds.
+ *
+ */
+
+VOID sleep_ms(ULONG ms)
+{	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+}
+
+#else
+
+#ifdef	THREADS
+
+/*
+ * Start a new thread, running the function 'fn' with argument 'arg'.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL start_thread(PTID tid, VOID (*fn)(PVOID), PVOID arg)
+{	INT t;
+
+	t = _beginthread(fn, (PVOID) NULL, THREADSTACK, arg);
+	if(t == -1) return(FALSE);
+	*tid = (TID) t;
+
+	return(TRUE);
+}
+
+
+/*
+ * Wait for a thread to terminate.
+ *
+ */
+
+VOID wait_thread(TID tid)
+{	(VOID) DosWaitThread(&tid, DCWW_WAIT);
+}
+
+
+/*
+ * Create a counting semaphore with the given initial count.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL create_sem(PSEM sem, UINT count)
+{	if(DosCreateMutexSem((PSZ) NULL, &sem->hmtx, 0, FALSE) != 0)
+		return(FALSE);
+	if(DosCreateEventSem((PSZ) NULL, &sem->hev, 0, FALSE) != 0) {
+		(VOID) DosCloseMutexSem(sem->hmtx);
+		return(FALSE);
+	}
+	sem->count = count;
+
+	return(TRUE);
+}
+
+
+/*
+ * Delete a counting semaphore.
+ *
+ */
+
+VOID delete_sem(PSEM sem)
+{	(VOID) DosCloseEventSem(sem->hev);
+	(VOID) DosCloseMutexSem(sem->hmtx);
+}
+
+
+/*
+ * Increment a counting semaphore, releasing one waiter if any.
+ *
+ */
+
+VOID post_sem(PSEM sem)
+{	(VOID) DosRequestMutexSem(sem->hmtx, SEM_INDEFINITE_WAIT);
+	sem->count++;
+	(VOID) DosPostEventSem(sem->hev);
+	(VOID) DosReleaseMutexSem(sem->hmtx);
+}
+
+
+/*
+ * Wait until a counting semaphore is non-zero, then decrement it.
+ * The event semaphore is reset while the mutex is held, so a post
+ * that happens before the wait begins is not lost.
+ *
+ */
+
+VOID wait_sem(PSEM sem)
+{	ULONG posts;
+
+	for(;;) {
+		(VOID) DosRequestMutexSem(sem->hmtx, SEM_INDEFINITE_WAIT);
+		if(sem->count != 0) {
+			sem->count--;
+			(VOID) DosReleaseMutexSem(sem->hmtx);
+			return;
+		}
+		(VOID) DosResetEventSem(sem->hev, &posts);
+		(VOID) DosReleaseMutexSem(sem->hmtx);
+		(VOID) DosWaitEventSem(sem->hev, SEM_INDEFINITE_WAIT);
+	}
+}
+
+
+/*
+ * Suspend the calling thread for 'ms' milliseconds.
+ *
+ */
+
+VOID sleep_ms(ULONG ms)
+{	(VOID) DosSleep(ms);
+}
+
+#endif
+
+#endif
+
+
+/*
+ * Return a clock reading in microseconds, for timing operations; only
+ * differences between readings are meaningful, and the clock wraps round
+ * after about 71 minutes. Under OS/2 the resolution is that of the system
+ * timer, and in the 16-bit version that of the C library clock.
+ *
+ */
+
+ULONG clock_us(VOID)
+{
+#ifdef	LINUX
+	struct timespec ts;
+
+	(VOID) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return((ULONG) ts.tv_sec*1000000UL + (ULONG) (ts.tv_nsec / 1000));
+#else
+#ifdef	DUAL
+	return((ULONG) clock() * (1000000L / CLOCKS_PER_SEC));
+#else
+	ULONG ms;
+
+	(VOID) DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof(ULONG));
+
+	return(ms*1000UL);
+#endif
+#endif
+}
+
+
+/*
+ * Set an open file (given by its handle) to binary mode, so that image
+ * data can be passed through the standard input or output unchanged.
+ * There is no distinction under Linux.
+ *
+ */
+
+VOID binary_mode(INT fd)
+{
+#ifndef	LINUX
+	(VOID) setmode(fd, O_BINARY);
+#endif
+}
+
+
+/*
+ * Cut an open file (given by its handle) short, at 'size' bytes.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL truncate_file(INT fd, ULONG size)
+{
+#ifdef	LINUX
+	return(ftruncate(fd, (off_t) size) == 0 ? TRUE : FALSE);
+#else
+	return(chsize(fd, (LONG) size) == 0 ? TRUE : FALSE);
+#endif
+}
+
+/*
+ * End of file: sysdep.c
+ *
+ */
@@ -0,0 +1,134 @@
+/*
+ * File: sysdep.h
+ *
+ * Diskette raw image utilities
+ *
+ * System dependent definitions
+ *
+ */
+
+/*
+ * The utilities are written to the OS/2 API. When built for OS/2 (in either
+ * 32-bit or 16-bit dual mode) the real toolkit header is used. When built
+ * for Linux (LINUX defined), the small subset of OS/2 types and error codes
+ * used by the programs is supplied here, so that the main code can remain
+ * unchanged.
+ *
+ */
+
+#ifndef	_SYSDEP_H
+#define	_SYSDEP_H
+
+#ifdef	LINUX
+
+#define	_GNU_SOURCE			/* For O_DIRECT */
+
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define	VOID		void
+
+typedef	unsigned char	UCHAR, *PUCHAR;
+typedef	unsigned short	USHORT, *PUSHORT;
+typedef	long		LONG, *PLONG;
+typedef	unsigned long	ULONG, *PULONG;
+typedef	int		INT, *PINT;
+typedef	unsigned int	UINT, *PUINT;
+typedef	int		BOOL;
+typedef	void		*PVOID;
+typedef	int		HFILE;
+typedef	ULONG		APIRET;
+
+#define	FALSE		0
+#define	TRUE		1
+
+/* OS/2 error codes used by the programs */
+
+#define	NO_ERROR		0
+#define	ERROR_PATH_NOT_FOUND	3
+#define	ERROR_ACCESS_DENIED	5
+#define	ERROR_NOT_ENOUGH_MEMORY	8
+#define	ERROR_INVALID_DRIVE	15
+#define	ERROR_WRITE_PROTECT	19
+#define	ERROR_NOT_READY		21
+#define	ERROR_CRC		23
+#define	ERROR_SECTOR_NOT_FOUND	27
+#define	ERROR_WRITE_FAULT	29
+#define	ERROR_READ_FAULT	30
+#define	ERROR_INVALID_PARAMETER	87
+#define	ERROR_DISK_CHANGE	107
+#define	ERROR_DRIVE_LOCKED	108
+
+#define	PATHSEP		'/'		/* Path component separator */
+
+extern	char	*strlwr(char *);
+extern	char	*strupr(char *);
+
+/* Threads and semaphores */
+
+#define	THREADS				/* Threads are available */
+
+typedef	sem_t		SEM, *PSEM;	/* Counting semaphore */
+typedef	pthread_t	TID, *PTID;	/* Thread identifier */
+
+#else
+
+#define	INCL_DOSDEVICES
+#define	INCL_DOSERRORS
+#define	INCL_DOSFILEMGR
+#define	INCL_DOSDEVIOCTL
+#ifndef	DUAL
+#define	INCL_DOSPROCESS
+#define	INCL_DOSSEMAPHORES
+#define	INCL_DOSMISC
+#endif
+#include <os2.h>
+
+#define	PATHSEP		'\\'		/* Path component separator */
+
+#ifdef	DUAL
+#define	APIRET		USHORT
+#else
+
+/* Threads and semaphores. OS/2 has no counting semaphore, so one is
+   built from a mutex and an event semaphore. */
+
+#define	THREADS				/* Threads are available */
+
+typedef	struct _SEM {
+	HMTX		hmtx;		/* Protects count */
+	HEV		hev;		/* Posted when count becomes non-zero */
+	ULONG		count;		/* Current count */
+} SEM, *PSEM;
+
+#endif
+
+#endif
+
+#ifdef	THREADS
+extern	BOOL	create_sem(PSEM, UINT);
+extern	VOID	delete_sem(PSEM);
+extern	VOID	post_sem(PSEM);
+extern	VOID	sleep_ms(ULONG);
+extern	BOOL	start_thread(PTID, VOID (*)(PVOID), PVOID);
+extern	VOID	wait_sem(PSEM);
+extern	VOID	wait_thread(TID);
+#endif
+
+extern	VOID	binary_mode(INT);
+extern	ULONG	clock_us(VOID);
+extern	BOOL	truncate_file(INT, ULONG);
+
+/* Supplied by each program */
+
+extern	PUCHAR	progname;		/* Pointer to program name */
+
+extern	VOID	error(PUCHAR, ...);
+
+#endif
+
+/*
+ * End of file: sysdep.h
+ *
+ */
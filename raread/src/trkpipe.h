@@ -0,0 +1,78 @@
+/*
+ * File: trkpipe.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for the track pipeline
+ *
+ */
+
+#ifndef	_TRKPIPE_H
+#define	_TRKPIPE_H
+
+/* Miscellaneous definitions */
+
+#define	MAXBUFS		16		/* Maximum number of track buffers */
+
+#ifdef	THREADS
+#define	DEFBUFS		2		/* Default number of track buffers */
+#define	PIPEBUFS	8		/* Default when image file is a pipe */
+#else
+#define	DEFBUFS		1		/* No overlap without threads */
+#define	PIPEBUFS	1
+#endif
+
+#define	TP_SOURCE	0		/* Worker fills tracks */
+#define	TP_SINK		1		/* Worker empties tracks */
+
+/* One track buffer, passed between the main thread and the worker */
+
+typedef	struct _TRACK {
+	PUCHAR		buf;		/* Track data */
+	UINT		sectors;	/* Capacity of buffer in sectors */
+	UINT		count;		/* Number of valid sectors */
+	BOOL		hole;		/* TRUE if sectors not read; skip them */
+	BOOL		last;		/* TRUE if no more tracks follow */
+	BOOL		error;		/* TRUE if worker failed on this track */
+} TRACK, *PTRACK;
+
+/* Function called by the worker for each track */
+
+typedef	BOOL	(*PTRKFN)(PTRACK, PVOID);
+
+/* The pipeline itself */
+
+typedef	struct _TRKPIPE {
+	PDISK		dp;		/* Disk that buffers are for */
+	UINT		depth;		/* Number of track buffers */
+	PTRACK		slot;		/* Ring of track buffers */
+	UINT		in;		/* Next slot to be filled */
+	UINT		out;		/* Next slot to be emptied */
+	INT		dir;		/* TP_SOURCE or TP_SINK */
+	PTRKFN		fn;		/* Worker function */
+	PVOID		arg;		/* Argument for worker function */
+	BOOL		ended;		/* Main thread has seen or sent last */
+	volatile BOOL	stop;		/* Main thread wants worker to stop */
+	volatile BOOL	failed;		/* Sink worker function has failed */
+#ifdef	THREADS
+	BOOL		threaded;	/* TRUE if a worker thread is running */
+	TID		tid;		/* Worker thread */
+	SEM		empty;		/* Counts empty slots */
+	SEM		full;		/* Counts full slots */
+#endif
+} TRKPIPE, *PTRKPIPE;
+
+/* External references */
+
+extern	BOOL		close_pipe(PTRKPIPE);
+extern	PTRKPIPE	open_pipe(PDISK, UINT, INT, PTRKFN, PVOID);
+extern	BOOL		pipe_failed(PTRKPIPE);
+extern	PTRACK		pipe_get(PTRKPIPE);
+extern	VOID		pipe_put(PTRKPIPE, PTRACK);
+
+#endif
+
+/*
+ * End of file: trkpipe.h
+ *
+ */
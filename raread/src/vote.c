@@ -0,0 +1,331 @@
+/*
+ * File: vote.c
+ *
+ * Creates raw diskette image from a diskette
+ *
+ * Reconstruction of sectors by voting
+ *
+ */
+
+/*
+ * A marginal diskette can give different data for the same sector on
+ * different reads, or in different drives. Given several reads of each
+ * track (either made here, by reading each track several times, or taken
+ * from several images captured earlier), each sector is chosen as follows:
+ *
+ *	- only reads that passed the controller's CRC check are considered,
+ *	  if there are any; otherwise, any read that returned data;
+ *	- if most of those agree, their data is used;
+ *	- if there is no majority among three or more, the sector is rebuilt
+ *	  by taking the commonest value of each byte in turn;
+ *	- otherwise one of the reads is taken, and the sector is uncertain.
+ *
+ * In a captured image, a sector filled with the bad sector marker is taken
+ * as a failed read, and any other as a good one. A per-sector report of
+ * the outcome, and of how many reads agreed, may be written to a file.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskio.h"
+#include "recover.h"
+#include "vote.h"
+
+/* Forward references */
+
+static	BOOL	is_bad(PUCHAR);
+static	VOID	rebuild(PVOTE, PUINT, UINT, UINT, PUCHAR);
+static	UINT	vote_sector(PVOTE, UINT, BOOL, PUCHAR, PUINT, PUINT);
+
+/* Local storage */
+
+static	const	PUCHAR	outcome[] = {	/* Names of outcomes, for report */
+	"good",
+	"majority",
+	"rebuilt",
+	"uncertain",
+	"bad"
+};
+
+
+/*
+ * Prepare for voting with 'reads' reads of each track, writing a report to
+ * the file 'report' (if not NULL).
+ * Returns a pointer to the voting state, or NULL on failure (already
+ * reported).
+ *
+ */
+
+PVOTE open_vote(UINT reads, PUCHAR report)
+{	PVOTE vp;
+	UINT i;
+
+	vp = (PVOTE) calloc(1, sizeof(VOTE));
+	if(vp == (PVOTE) NULL) {
+		error("cannot allocate memory for voting");
+		return((PVOTE) NULL);
+	}
+	vp->reads = reads;
+	for(i = 0; i < reads; i++) {
+		vp->buf[i] = alloc_buffer(MAXTRACK);
+		if(vp->buf[i] == (PUCHAR) NULL) {
+			error("cannot allocate memory for track buffers");
+			(VOID) close_vote(vp);
+			return((PVOTE) NULL);
+		}
+	}
+
+	if(report != (PUCHAR) NULL) {
+		vp->rfp = fopen(report, "w");
+		if(vp->rfp == (FILE *) NULL) {
+			error("cannot create report file '%s'", report);
+			(VOID) close_vote(vp);
+			return((PVOTE) NULL);
+		}
+		vp->report = report;
+		fprintf(
+			vp->rfp,
+			"# Sector confidence report, written by %s\n"
+			"# cylinder head sector agreeing/reads crc outcome\n",
+			progname);
+	}
+
+	return(vp);
+}
+
+
+/*
+ * Finish voting, closing the report file and freeing the state.
+ * Returns TRUE on success, FALSE if the report could not be written.
+ *
+ */
+
+BOOL close_vote(PVOTE vp)
+{	BOOL res = TRUE;
+	UINT i;
+
+	if(vp->rfp != (FILE *) NULL &&
+	   (ferror(vp->rfp) || fclose(vp->rfp) != 0)) {
+		error("error writing report file '%s'", vp->report);
+		res = FALSE;
+	}
+	for(i = 0; i < vp->reads; i++)
+		if(vp->buf[i] != (PUCHAR) NULL) free_buffer(vp->buf[i]);
+	free((PVOTE) vp);
+
+	return(res);
+}
+
+
+/*
+ * Report the outcome of voting.
+ *
+ */
+
+VOID report_vote(PVOTE vp)
+{	error(
+		"%d sectors agreed in every read, %d by majority, %d rebuilt,"
+		" %d uncertain, %d unreadable",
+		vp->count[VS_GOOD],
+		vp->count[VS_MAJORITY],
+		vp->count[VS_REBUILT],
+		vp->count[VS_UNCERTAIN],
+		vp->count[VS_BAD]);
+}
+
+/*
+ * Read a track the set number of times, and build the best version of it
+ * in 'out'. Any copy of the track the system keeps is dropped before each
+ * read, so that every read really comes from the diskette; otherwise they
+ * would all agree, whatever the diskette holds. Where a whole track read
+ * fails, the sectors are read singly, so that the good ones can still be
+ * told from the bad.
+ * Returns NO_ERROR, or an error that makes further reading pointless.
+ *
+ */
+
+APIRET read_vote(PVOTE vp, PDISK dp, UINT cyl, UINT head, PUCHAR out)
+{	APIRET rc;
+	UINT i, s;
+	PUCHAR p;
+
+	for(i = 0; i < vp->reads; i++) {
+		rc = uncache_track(dp, cyl, head);
+		if(rc != NO_ERROR) return(rc);
+		rc = read_track(dp, cyl, head, vp->buf[i]);
+		if(rc == NO_ERROR) {
+			memset(vp->ok[i], TRUE, dp->sectors);
+			continue;
+		}
+		if(fatal_error(rc) == TRUE) return(rc);
+		for(s = 0; s < dp->sectors; s++) {
+			p = vp->buf[i] + s*BLKSIZE;
+			fill_bad(p);		/* In case nothing is read */
+			rc = read_sector(dp, cyl, head, s, p);
+			if(rc != NO_ERROR && fatal_error(rc) == TRUE)
+				return(rc);
+			vp->ok[i][s] = rc == NO_ERROR ? TRUE : FALSE;
+		}
+	}
+	merge_track(vp, cyl, head, dp->sectors, out);
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Set the 'ok' flags for read 'i' of a track that was taken from a
+ * captured image. Sectors holding the bad sector marker are taken to have
+ * failed; any others to have been read successfully.
+ *
+ */
+
+VOID capture_track(PVOTE vp, UINT i, UINT sectors)
+{	UINT s;
+
+	for(s = 0; s < sectors; s++)
+		vp->ok[i][s] = is_bad(vp->buf[i] + s*BLKSIZE) == TRUE ? FALSE : TRUE;
+}
+
+
+/*
+ * Build the best version of a track in 'out', from the reads in the track
+ * buffers (with their 'ok' flags set), and add it to the report.
+ *
+ */
+
+VOID merge_track(PVOTE vp, UINT cyl, UINT head, UINT sectors, PUCHAR out)
+{	UINT i, s, res;
+	UINT agree, pool;		/* Agreeing reads, and reads considered */
+	BOOL crc;			/* TRUE if any read passed CRC check */
+
+	for(s = 0; s < sectors; s++) {
+		crc = FALSE;
+		for(i = 0; i < vp->reads; i++)
+			if(vp->ok[i][s] == TRUE) crc = TRUE;
+		res = vote_sector(vp, s, crc, out + s*BLKSIZE, &agree, &pool);
+		vp->count[res]++;
+		if(vp->rfp != (FILE *) NULL) {
+			fprintf(
+				vp->rfp,
+				"%2d %d %2d %d/%d %s %s\n",
+				cyl,
+				head,
+				s + 1,
+				agree,
+				pool,
+				crc == TRUE ? "crc" : "nocrc",
+				outcome[res]);
+		}
+	}
+}
+
+
+/*
+ * Vote on sector 's', putting the result in 'out' and setting the number
+ * of reads that agreed with it, and the number considered. If 'crc' is
+ * TRUE, only the reads that passed the CRC check are considered.
+ * Returns the outcome.
+ *
+ */
+
+static UINT vote_sector(PVOTE vp, UINT s, BOOL crc, PUCHAR out, PUINT pagree,
+			PUINT ppool)
+{	UINT use[MAXREADS];		/* Reads to be considered */
+	UINT n = 0;
+	UINT i, j, same, best = 0, besti = 0;
+	ULONG off = (ULONG) s*BLKSIZE;
+
+	for(i = 0; i < vp->reads; i++) {
+		if(crc == TRUE ? vp->ok[i][s] == TRUE :
+				 is_bad(vp->buf[i] + off) == FALSE)
+			use[n++] = i;
+	}
+
+	*ppool = n;
+	if(n == 0) {
+		*pagree = 0;
+		fill_bad(out);
+		return(VS_BAD);
+	}
+
+	/* Find the largest group of identical reads */
+
+	for(i = 0; i < n; i++) {
+		same = 0;
+		for(j = 0; j < n; j++) {
+			if(memcmp(vp->buf[use[i]] + off, vp->buf[use[j]] + off,
+				  BLKSIZE) == 0)
+				same++;
+		}
+		if(same > best) {
+			best = same;
+			besti = use[i];
+		}
+	}
+	*pagree = best;
+
+	if(best*2 > n) {
+		memcpy(out, vp->buf[besti] + off, BLKSIZE);
+		return(best == n ? VS_GOOD : VS_MAJORITY);
+	}
+	if(n >= 3) {
+		rebuild(vp, use, n, s, out);
+		return(VS_REBUILT);
+	}
+	memcpy(out, vp->buf[besti] + off, BLKSIZE);
+
+	return(VS_UNCERTAIN);
+}
+
+
+/*
+ * Rebuild sector 's' from 'n' disagreeing reads, by taking the commonest
+ * value of each byte.
+ *
+ */
+
+static VOID rebuild(PVOTE vp, PUINT use, UINT n, UINT s, PUCHAR out)
+{	UINT b, i, j, same, best;
+	ULONG off = (ULONG) s*BLKSIZE;
+	UCHAR c;
+
+	for(b = 0; b < BLKSIZE; b++) {
+		best = 0;
+		for(i = 0; i < n; i++) {
+			c = vp->buf[use[i]][off+b];
+			same = 0;
+			for(j = 0; j < n; j++)
+				if(vp->buf[use[j]][off+b] == c) same++;
+			if(same > best) {
+				best = same;
+				out[b] = c;
+			}
+		}
+	}
+}
+
+
+/*
+ * Check whether a sector holds the bad sector marker.
+ *
+ */
+
+static BOOL is_bad(PUCHAR p)
+{	UCHAR mark[BLKSIZE];
+
+	fill_bad(mark);
+
+	return(memcmp(p, mark, BLKSIZE) == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * End of file: vote.c
+ *
+ */
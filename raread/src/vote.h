@@ -0,0 +1,51 @@
+/*
+ * File: vote.h
+ *
+ * Creates raw diskette image from a diskette
+ *
+ * Definitions for reconstruction of sectors by voting
+ *
+ */
+
+#ifndef	_VOTE_H
+#define	_VOTE_H
+
+/* Miscellaneous definitions */
+
+#define	MAXREADS	9		/* Most reads of each sector */
+
+/* Outcome of the vote for a sector */
+
+#define	VS_GOOD		0		/* Every read agreed */
+#define	VS_MAJORITY	1		/* Most reads agreed */
+#define	VS_REBUILT	2		/* Rebuilt byte by byte */
+#define	VS_UNCERTAIN	3		/* No agreement; one read chosen */
+#define	VS_BAD		4		/* No usable read */
+#define	VS_COUNT	5		/* Number of outcomes */
+
+/* Voting state */
+
+typedef	struct _VOTE {
+	UINT		reads;		/* Number of reads of each sector */
+	PUCHAR		buf[MAXREADS];	/* Track buffer for each read */
+	UCHAR		ok[MAXREADS][MAXSECTORS];/* TRUE if sector read OK */
+	FILE		*rfp;		/* Report file, or NULL */
+	PUCHAR		report;		/* Name of report file */
+	UINT		count[VS_COUNT];/* Sectors with each outcome */
+} VOTE, *PVOTE;
+
+/* External references */
+
+extern	VOID	capture_track(PVOTE, UINT, UINT);
+extern	BOOL	close_vote(PVOTE);
+extern	VOID	merge_track(PVOTE, UINT, UINT, UINT, PUCHAR);
+extern	PVOTE	open_vote(UINT, PUCHAR);
+extern	APIRET	read_vote(PVOTE, PDISK, UINT, UINT, PUCHAR);
+extern	VOID	report_vote(PVOTE);
+
+#endif
+
+/*
+ * End of file: vote.h
+ *
+ */
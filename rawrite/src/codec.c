@@ -0,0 +1,669 @@
+/*
+ * File: codec.c
+ *
+ * Diskette raw image utilities
+ *
+ * Reading and writing of (possibly compressed) image files
+ *
+ */
+
+/*
+ * Image files may be compressed with gzip or (where the library is
+ * available) Zstandard. The compression method of an input file is found
+ * from its magic number; an output file is compressed only on request.
+ * All compression and decompression is done by the stream functions, so
+ * that when these are called by the track pipeline, the codec runs on the
+ * pipeline's own thread rather than holding up the diskette.
+ *
+ * Build with ZLIB defined for gzip, and ZSTD defined for Zstandard.
+ * Without either, uncompressed files are simply passed through.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef	ZLIB
+#include <zlib.h>
+#endif
+#ifdef	ZSTD
+#include <zstd.h>
+#endif
+
+#include "codec.h"
+
+/* Miscellaneous definitions */
+
+#define	ZBUFSIZE	32768		/* Size of compressed data buffer */
+#define	GZTRAILER	8		/* Size of gzip trailer */
+
+#if	defined(ZLIB) || defined(ZSTD)
+#define	COMPRESS			/* Some compression available */
+#endif
+
+/* Type definitions */
+
+typedef	struct _CODEC {			/* Description of a method */
+	PUCHAR		name;		/* Name, as used on command line */
+	UCHAR		magic[4];	/* Magic number */
+	UINT		mlen;		/* Length of magic number */
+	BOOL		avail;		/* TRUE if supported by this version */
+} CODEC, *PCODEC;
+
+/* Forward references */
+
+static	BOOL	fill_buffer(PSTREAM);
+#ifdef	COMPRESS
+static	BOOL	flush_buffer(PSTREAM);
+#endif
+static	BOOL	init_codec(PSTREAM, ULONG);
+static	VOID	input_size(PSTREAM);
+static	ULONG	read_codec(PSTREAM, PUCHAR, ULONG);
+
+/* Local storage */
+
+static	const	CODEC codecs[] = {	/* Indexed by CODEC_xxx */
+	{ "none", { 0 }, 0, TRUE },
+	{ "gzip", { 0x1f, 0x8b }, 2,
+#ifdef	ZLIB
+		TRUE },
+#else
+		FALSE },
+#endif
+	{ "zstd", { 0x28, 0xb5, 0x2f, 0xfd }, 4,
+#ifdef	ZSTD
+		TRUE }
+#else
+		FALSE }
+#endif
+};
+
+#define	NCODECS		(sizeof(codecs)/sizeof(CODEC))
+
+
+/*
+ * Look up a compression method by name.
+ * Returns the method, or -1 if it is not known or not supported.
+ *
+ */
+
+INT find_codec(PUCHAR name)
+{	INT i;
+
+	for(i = 0; i < NCODECS; i++) {
+		if(strcmp(name, codecs[i].name) == 0)
+			return(codecs[i].avail == TRUE ? i : -1);
+	}
+
+	return(-1);
+}
+
+
+/*
+ * Open a stream for reading an image file, which has already been opened
+ * in binary mode. Any compression is detected from the magic number.
+ * Returns pointer to the stream, or NULL on failure.
+ *
+ */
+
+PSTREAM open_instream(FILE *fp)
+{	PSTREAM sp;
+	INT i;
+
+	sp = (PSTREAM) calloc(1, sizeof(STREAM));
+	if(sp == (PSTREAM) NULL) {
+		error("cannot allocate memory for image stream");
+		return((PSTREAM) NULL);
+	}
+	sp->buf = (PUCHAR) malloc(ZBUFSIZE);
+	if(sp->buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for image stream");
+		free((PSTREAM) sp);
+		return((PSTREAM) NULL);
+	}
+	sp->fp = fp;
+	sp->codec = CODEC_NONE;
+
+	/* Read the first block, and look for a magic number */
+
+	(VOID) fill_buffer(sp);
+	if(sp->error == TRUE) {
+		error("error reading image file");
+		(VOID) close_stream(sp);
+		return((PSTREAM) NULL);
+	}
+	for(i = CODEC_NONE + 1; i < NCODECS; i++) {
+		if(sp->len >= codecs[i].mlen &&
+		   memcmp(sp->buf, codecs[i].magic, codecs[i].mlen) == 0) {
+			sp->codec = i;
+			break;
+		}
+	}
+	if(codecs[sp->codec].avail == FALSE) {
+		error(
+			"image file is compressed with %s, which is not"
+			" supported by this version",
+			codecs[sp->codec].name);
+		(VOID) close_stream(sp);
+		return((PSTREAM) NULL);
+	}
+
+	input_size(sp);
+	if(init_codec(sp, NOSIZE) == FALSE) {
+		error("cannot initialise %s decompression", codecs[sp->codec].name);
+		(VOID) close_stream(sp);
+		return((PSTREAM) NULL);
+	}
+
+	return(sp);
+}
+
+
+/*
+ * Open a stream for writing an image file, which has already been opened
+ * in binary mode, compressing with the given method. 'size' is the total
+ * amount of data that will be written, or NOSIZE if not known.
+ * Returns pointer to the stream, or NULL on failure.
+ *
+ */
+
+PSTREAM open_outstream(FILE *fp, INT codec, ULONG size)
+{	PSTREAM sp;
+
+	sp = (PSTREAM) calloc(1, sizeof(STREAM));
+	if(sp == (PSTREAM) NULL) {
+		error("cannot allocate memory for image stream");
+		return((PSTREAM) NULL);
+	}
+	sp->fp = fp;
+	sp->codec = codec;
+	sp->write = TRUE;
+	sp->size = size;
+	if(codec != CODEC_NONE) {
+		sp->buf = (PUCHAR) malloc(ZBUFSIZE);
+		if(sp->buf == (PUCHAR) NULL) {
+			error("cannot allocate memory for image stream");
+			free((PSTREAM) sp);
+			return((PSTREAM) NULL);
+		}
+	}
+
+	if(init_codec(sp, size) == FALSE) {
+		error("cannot initialise %s compression", codecs[codec].name);
+		(VOID) close_stream(sp);
+		return((PSTREAM) NULL);
+	}
+
+	return(sp);
+}
+
+
+/*
+ * Work out the uncompressed size of an input file, if possible. For a
+ * gzip file this is in the trailer (assuming just one member); for a
+ * Zstandard file it is usually in the frame header.
+ *
+ */
+
+static VOID input_size(PSTREAM sp)
+{	struct stat statbuf;		/* Image file status buffer */
+#ifdef	ZLIB
+	UCHAR trailer[GZTRAILER];	/* gzip CRC and size */
+#endif
+#ifdef	ZSTD
+	unsigned long long n;
+#endif
+	BOOL regular;
+
+	sp->size = NOSIZE;
+	regular = fstat(fileno(sp->fp), &statbuf) == 0 &&
+			(statbuf.st_mode & S_IFMT) == S_IFREG ? TRUE : FALSE;
+
+	switch(sp->codec) {
+		case CODEC_NONE:
+			if(regular == TRUE) sp->size = (ULONG) statbuf.st_size;
+			break;
+
+#ifdef	ZLIB
+		case CODEC_GZIP:
+			if(regular == FALSE || statbuf.st_size < GZTRAILER)
+				break;
+			if(fseek(sp->fp, -GZTRAILER, SEEK_END) == 0 &&
+			   fread(trailer, 1, GZTRAILER, sp->fp) == GZTRAILER) {
+				sp->size = (ULONG) trailer[4] |
+					   ((ULONG) trailer[5] << 8) |
+					   ((ULONG) trailer[6] << 16) |
+					   ((ULONG) trailer[7] << 24);
+			}
+			if(fseek(sp->fp, (long) sp->len, SEEK_SET) != 0)
+				sp->error = TRUE;
+			break;
+#endif
+
+#ifdef	ZSTD
+		case CODEC_ZSTD:
+			n = ZSTD_getFrameContentSize(sp->buf, sp->len);
+			if(n != ZSTD_CONTENTSIZE_UNKNOWN &&
+			   n != ZSTD_CONTENTSIZE_ERROR)
+				sp->size = (ULONG) n;
+			break;
+#endif
+	}
+}
+
+
+/*
+ * Set up the codec state for a stream.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+static BOOL init_codec(PSTREAM sp, ULONG size)
+{
+#ifdef	ZLIB
+	z_stream *zs;
+#endif
+
+	switch(sp->codec) {
+#ifdef	ZLIB
+		case CODEC_GZIP:
+			zs = (z_stream *) calloc(1, sizeof(z_stream));
+			if(zs == (z_stream *) NULL) return(FALSE);
+			sp->state = (PVOID) zs;
+			if(sp->write == TRUE) {
+				if(deflateInit2(
+					zs,
+					Z_DEFAULT_COMPRESSION,
+					Z_DEFLATED,
+					MAX_WBITS + 16,	/* gzip format */
+					8,
+					Z_DEFAULT_STRATEGY) != Z_OK) break;
+			} else {
+				if(inflateInit2(zs, MAX_WBITS + 16) != Z_OK) break;
+			}
+			return(TRUE);
+#endif
+
+#ifdef	ZSTD
+		case CODEC_ZSTD:
+			if(sp->write == TRUE) {
+				sp->state = (PVOID) ZSTD_createCCtx();
+				if(sp->state == (PVOID) NULL) break;
+				if(size != NOSIZE)
+					(VOID) ZSTD_CCtx_setPledgedSrcSize(
+						(ZSTD_CCtx *) sp->state,
+						(unsigned long long) size);
+			} else {
+				sp->state = (PVOID) ZSTD_createDCtx();
+				if(sp->state == (PVOID) NULL) break;
+			}
+			return(TRUE);
+#endif
+
+		default:
+			return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Read up to 'len' bytes of (uncompressed) data from a stream. Any data
+ * read ahead by peek_stream is returned first.
+ * Returns the number of bytes read; if this is less than 'len', the end
+ * of the data has been reached ('eof' set) or an error has occurred
+ * ('error' set).
+ *
+ */
+
+ULONG read_stream(PSTREAM sp, PUCHAR data, ULONG len)
+{	ULONG got = 0;
+
+	if(sp->ppos < sp->plen) {	/* Read ahead earlier */
+		got = (ULONG) (sp->plen - sp->ppos);
+		if(got > len) got = len;
+		memcpy(data, sp->peek + sp->ppos, (size_t) got);
+		sp->ppos += (UINT) got;
+	}
+
+	return(got + read_codec(sp, data + got, len - got));
+}
+
+
+/*
+ * Read ahead up to 'len' bytes of (uncompressed) data from the start of
+ * a stream, before anything else is read, without using them up; they
+ * are returned again by the reads that follow. This allows the boot
+ * sector of an image to be looked at even when the image file cannot
+ * be read twice, as when it is a pipe.
+ * Returns the number of bytes read, as for read_stream.
+ *
+ */
+
+ULONG peek_stream(PSTREAM sp, PUCHAR data, ULONG len)
+{	if(sp->peek != (PUCHAR) NULL) return(0L);	/* Only once */
+
+	sp->peek = (PUCHAR) malloc((size_t) len);
+	if(sp->peek == (PUCHAR) NULL) return(0L);
+	sp->plen = (UINT) read_codec(sp, sp->peek, len);
+	sp->ppos = 0;
+	memcpy(data, sp->peek, (size_t) sp->plen);
+
+	return((ULONG) sp->plen);
+}
+
+
+/*
+ * Read up to 'len' bytes of (uncompressed) data from the stream itself,
+ * decompressing as needed.
+ * Returns as for read_stream.
+ *
+ */
+
+static ULONG read_codec(PSTREAM sp, PUCHAR data, ULONG len)
+{	ULONG got = 0;
+	UINT n;
+#ifdef	ZLIB
+	z_stream *zs;
+	INT rc;
+#endif
+#ifdef	ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t zrc;
+#endif
+
+	if(sp->eof == TRUE || sp->error == TRUE) return(0L);
+
+	switch(sp->codec) {
+		case CODEC_NONE:
+			n = (UINT) (sp->len - sp->pos);	/* Left from magic check */
+			if(n > len) n = (UINT) len;
+			memcpy(data, sp->buf + sp->pos, n);
+			sp->pos += n;
+			got = n;
+			if(got < len)
+				got += (ULONG) fread(
+						data + got,
+						1,
+						(size_t) (len - got),
+						sp->fp);
+			if(ferror(sp->fp)) sp->error = TRUE;
+			break;
+
+#ifdef	ZLIB
+		case CODEC_GZIP:
+			zs = (z_stream *) sp->state;
+			zs->next_out = data;
+			zs->avail_out = (uInt) len;
+			while(zs->avail_out != 0) {
+				if(sp->pos == sp->len &&
+				   fill_buffer(sp) == FALSE) break;
+				if(sp->ended == TRUE) {	/* Another member */
+					if(inflateReset(zs) != Z_OK) {
+						sp->error = TRUE;
+						break;
+					}
+					sp->ended = FALSE;
+				}
+				zs->next_in = sp->buf + sp->pos;
+				zs->avail_in = sp->len - sp->pos;
+				rc = inflate(zs, Z_NO_FLUSH);
+				sp->pos = sp->len - zs->avail_in;
+				if(rc == Z_STREAM_END) {
+					sp->ended = TRUE;
+				} else if(rc != Z_OK) {
+					sp->error = TRUE;
+					break;
+				}
+			}
+			got = len - zs->avail_out;
+			break;
+#endif
+
+#ifdef	ZSTD
+		case CODEC_ZSTD:
+			out.dst = data;
+			out.size = len;
+			out.pos = 0;
+			while(out.pos < out.size) {
+				if(sp->pos == sp->len &&
+				   fill_buffer(sp) == FALSE) break;
+				in.src = sp->buf;
+				in.size = sp->len;
+				in.pos = sp->pos;
+				zrc = ZSTD_decompressStream(
+					(ZSTD_DCtx *) sp->state,
+					&out,
+					&in);
+				sp->pos = (UINT) in.pos;
+				if(ZSTD_isError(zrc)) {
+					sp->error = TRUE;
+					break;
+				}
+				sp->ended = zrc == 0 ? TRUE : FALSE;
+			}
+			got = (ULONG) out.pos;
+			break;
+#endif
+	}
+
+	if(got < len && sp->error == FALSE) {
+		sp->eof = TRUE;
+		if(sp->codec != CODEC_NONE && sp->ended == FALSE)
+			sp->error = TRUE;	/* Truncated */
+	}
+
+	return(got);
+}
+
+
+/*
+ * Write 'len' bytes of (uncompressed) data to a stream.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+BOOL write_stream(PSTREAM sp, PUCHAR data, ULONG len)
+{
+#ifdef	ZLIB
+	z_stream *zs;
+#endif
+#ifdef	ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+#endif
+
+	if(sp->error == TRUE) return(FALSE);
+
+	switch(sp->codec) {
+		case CODEC_NONE:
+			if(fwrite(data, 1, (size_t) len, sp->fp) != len)
+				sp->error = TRUE;
+			break;
+
+#ifdef	ZLIB
+		case CODEC_GZIP:
+			zs = (z_stream *) sp->state;
+			zs->next_in = data;
+			zs->avail_in = (uInt) len;
+			while(zs->avail_in != 0) {
+				zs->next_out = sp->buf + sp->len;
+				zs->avail_out = ZBUFSIZE - sp->len;
+				if(deflate(zs, Z_NO_FLUSH) != Z_OK) {
+					sp->error = TRUE;
+					break;
+				}
+				sp->len = ZBUFSIZE - zs->avail_out;
+				if(sp->len == ZBUFSIZE &&
+				   flush_buffer(sp) == FALSE) break;
+			}
+			break;
+#endif
+
+#ifdef	ZSTD
+		case CODEC_ZSTD:
+			in.src = data;
+			in.size = len;
+			in.pos = 0;
+			while(in.pos < in.size) {
+				out.dst = sp->buf;
+				out.size = ZBUFSIZE;
+				out.pos = sp->len;
+				if(ZSTD_isError(ZSTD_compressStream2(
+						(ZSTD_CCtx *) sp->state,
+						&out,
+						&in,
+						ZSTD_e_continue))) {
+					sp->error = TRUE;
+					break;
+				}
+				sp->len = (UINT) out.pos;
+				if(sp->len == ZBUFSIZE &&
+				   flush_buffer(sp) == FALSE) break;
+			}
+			break;
+#endif
+	}
+
+	return(sp->error == TRUE ? FALSE : TRUE);
+}
+
+
+/*
+ * Close a stream, completing any compressed output. The underlying file
+ * is flushed, but not closed.
+ * Returns TRUE if there were no errors on the stream, else FALSE.
+ *
+ */
+
+BOOL close_stream(PSTREAM sp)
+{	BOOL res;
+#ifdef	ZLIB
+	z_stream *zs;
+	INT rc;
+#endif
+#ifdef	ZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t zrc;
+#endif
+
+	switch(sp->codec) {
+#ifdef	ZLIB
+		case CODEC_GZIP:
+			zs = (z_stream *) sp->state;
+			if(zs == (z_stream *) NULL) break;
+			if(sp->write == TRUE) {
+				while(sp->error == FALSE) {
+					zs->next_in = (PUCHAR) NULL;
+					zs->avail_in = 0;
+					zs->next_out = sp->buf + sp->len;
+					zs->avail_out = ZBUFSIZE - sp->len;
+					rc = deflate(zs, Z_FINISH);
+					sp->len = ZBUFSIZE - zs->avail_out;
+					if(rc != Z_OK && rc != Z_STREAM_END)
+						sp->error = TRUE;
+					else if(flush_buffer(sp) == FALSE)
+						break;
+					if(rc == Z_STREAM_END) break;
+				}
+				(VOID) deflateEnd(zs);
+			} else {
+				(VOID) inflateEnd(zs);
+			}
+			free((PVOID) zs);
+			break;
+#endif
+
+#ifdef	ZSTD
+		case CODEC_ZSTD:
+			if(sp->state == (PVOID) NULL) break;
+			if(sp->write == TRUE) {
+				in.src = (PVOID) NULL;
+				in.size = 0;
+				in.pos = 0;
+				while(sp->error == FALSE) {
+					out.dst = sp->buf;
+					out.size = ZBUFSIZE;
+					out.pos = sp->len;
+					zrc = ZSTD_compressStream2(
+						(ZSTD_CCtx *) sp->state,
+						&out,
+						&in,
+						ZSTD_e_end);
+					sp->len = (UINT) out.pos;
+					if(ZSTD_isError(zrc))
+						sp->error = TRUE;
+					else if(flush_buffer(sp) == FALSE)
+						break;
+					if(zrc == 0) break;
+				}
+				(VOID) ZSTD_freeCCtx((ZSTD_CCtx *) sp->state);
+			} else {
+				(VOID) ZSTD_freeDCtx((ZSTD_DCtx *) sp->state);
+			}
+			break;
+#endif
+	}
+
+	if(sp->write == TRUE && fflush(sp->fp) != 0) sp->error = TRUE;
+
+	res = sp->error == TRUE ? FALSE : TRUE;
+	if(sp->buf != (PUCHAR) NULL) free((PUCHAR) sp->buf);
+	if(sp->peek != (PUCHAR) NULL) free((PUCHAR) sp->peek);
+	free((PSTREAM) sp);
+
+	return(res);
+}
+
+
+/*
+ * Refill the buffer of an input stream from the file.
+ * Returns TRUE if any data was read, else FALSE ('error' is set if there
+ * was an error).
+ *
+ */
+
+static BOOL fill_buffer(PSTREAM sp)
+{	size_t n;
+
+	n = fread(sp->buf, 1, ZBUFSIZE, sp->fp);
+	if(ferror(sp->fp)) sp->error = TRUE;
+	sp->len = (UINT) n;
+	sp->pos = 0;
+
+	return(n != 0 ? TRUE : FALSE);
+}
+
+
+#ifdef	COMPRESS
+
+/*
+ * Write out the contents of the buffer of an output stream.
+ * Returns TRUE on success, else FALSE (and 'error' is set).
+ *
+ */
+
+static BOOL flush_buffer(PSTREAM sp)
+{	if(sp->len != 0 &&
+	   fwrite(sp->buf, 1, sp->len, sp->fp) != sp->len) {
+		sp->error = TRUE;
+		return(FALSE);
+	}
+	sp->len = 0;
+
+	return(TRUE);
+}
+
+#endif
+
+/*
+ * End of file: codec.c
+ *
+ */
@@ -0,0 +1,55 @@
+/*
+ * File: codec.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for (possibly compressed) image file streams
+ *
+ */
+
+#ifndef	_CODEC_H
+#define	_CODEC_H
+
+/* Compression methods */
+
+#define	CODEC_NONE	0		/* Not compressed */
+#define	CODEC_GZIP	1		/* gzip (deflate) */
+#define	CODEC_ZSTD	2		/* Zstandard */
+
+#define	NOSIZE		((ULONG) -1)	/* Uncompressed size not known */
+
+/* An image file being read or written, possibly compressed */
+
+typedef	struct _STREAM {
+	FILE		*fp;		/* Underlying file */
+	INT		codec;		/* Compression method */
+	BOOL		write;		/* TRUE if writing */
+	ULONG		size;		/* Uncompressed size, or NOSIZE */
+	PUCHAR		buf;		/* Compressed data buffer */
+	UINT		len;		/* Number of bytes in buffer */
+	UINT		pos;		/* Next byte to be used from buffer */
+	BOOL		ended;		/* Codec at end of compressed data */
+	BOOL		eof;		/* All data has been read */
+	BOOL		error;		/* File error, or bad compressed data */
+	PVOID		state;		/* Codec state */
+	PUCHAR		peek;		/* Data read ahead, or NULL */
+	UINT		plen;		/* Number of bytes read ahead */
+	UINT		ppos;		/* Next byte to be used from these */
+} STREAM, *PSTREAM;
+
+/* External references */
+
+extern	BOOL	close_stream(PSTREAM);
+extern	INT	find_codec(PUCHAR);
+extern	PSTREAM	open_instream(FILE *);
+extern	PSTREAM	open_outstream(FILE *, INT, ULONG);
+extern	ULONG	peek_stream(PSTREAM, PUCHAR, ULONG);
+extern	ULONG	read_stream(PSTREAM, PUCHAR, ULONG);
+extern	BOOL	write_stream(PSTREAM, PUCHAR, ULONG);
+
+#endif
+
+/*
+ * End of file: codec.h
+ *
+ */
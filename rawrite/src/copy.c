@@ -0,0 +1,163 @@
+/*
+ * File: copy.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Copying a diskette into an image in memory
+ *
+ */
+
+/*
+ * A diskette is copied by reading every track of it into an image in
+ * memory, which is written to the targets in the usual way. The image
+ * starts empty, and the writers wait for each track to arrive before
+ * writing it; so when the source and the targets are in different drives,
+ * the reading runs on its own thread and overlaps the writing. Tracks
+ * that cannot be read are recovered as far as possible, just as by
+ * 'raread -r'.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "diskio.h"
+#include "fat.h"
+#include "hash.h"
+#include "journal.h"
+#include "manifest.h"
+#include "recover.h"
+#include "timing.h"
+#include "verify.h"
+#include "rawrite.h"
+#include "copy.h"
+
+/* Forward references */
+
+static	VOID	copy_thread(PVOID);
+
+
+/*
+ * Read the BIOS parameter block from the boot sector of the diskette
+ * in a drive, as a guide to its geometry. The first sector can be read
+ * whatever the real number of sectors per track, so the smallest is
+ * assumed for now.
+ * Returns 'bp' if a FAT file system was found, else NULL.
+ *
+ */
+
+PBPB disk_bpb(PDISK dp, PBPB bp)
+{	PUCHAR buf;
+	BOOL fat = FALSE;
+
+	buf = alloc_buffer(BLKSIZE);
+	if(buf == (PUCHAR) NULL) return((PBPB) NULL);
+	if(set_geometry(dp, CYLS, HEADS, 9) == TRUE &&
+	   read_sector(dp, 0, 0, 0, buf) == NO_ERROR)
+		fat = read_bpb(buf, bp);
+	free_buffer(buf);
+
+	return(fat == TRUE ? bp : (PBPB) NULL);
+}
+
+
+/*
+ * Read the source diskette into the image, one track at a time, making
+ * each track available to the writers as soon as it has been read.
+ * Returns TRUE on success; on failure the image is marked as broken, and
+ * the error and failing track are left in the copy structure. If told to
+ * stop, the image is marked as broken but no error is recorded.
+ *
+ */
+
+BOOL fill_image(PCOPY cp)
+{	PDISK dp = cp->dp;
+	PIMAGE im = cp->im;
+	ULONG tlen = dp->sectors*BLKSIZE;
+	UINT t;
+	UINT tracks = (UINT) (im->size / tlen);
+
+	cp->rc = NO_ERROR;
+	for(t = 0; t < tracks && cp->stop == FALSE; t++) {
+		if(cp->progress == TRUE) {
+			show_progress(t / dp->heads, t % dp->heads);
+		}
+		cp->rc = read_track(
+				dp,
+				t / dp->heads,
+				t % dp->heads,
+				im->data + t*tlen);
+		if(cp->rc != NO_ERROR)
+			cp->rc = recover_track(
+					&cp->rec,
+					dp,
+					t / dp->heads,
+					t % dp->heads,
+					im->data + t*tlen,
+					cp->rc);
+		if(cp->rc != NO_ERROR) break;
+		post_image(im, tlen);
+	}
+	if(cp->progress == TRUE) end_progress();
+	cp->track = t;
+	if(t < tracks)			/* Failed or stopped */
+		post_image(im, 0);
+
+	return(cp->rc == NO_ERROR ? TRUE : FALSE);
+}
+
+
+#ifdef	THREADS
+
+/*
+ * Start reading the source diskette into the image on a separate thread.
+ * Returns TRUE if the thread was started, else FALSE.
+ *
+ */
+
+BOOL start_copy(PCOPY cp)
+{	if(start_thread(&cp->tid, copy_thread, (PVOID) cp) == TRUE)
+		return(TRUE);
+
+	error("cannot start reader for source drive");
+	cp->tid = (TID) 0;
+
+	return(FALSE);
+}
+
+
+/*
+ * Wait for the reader thread to finish. This is done once all the writers
+ * have finished, so if the reader is still going there is nobody left to
+ * use the tracks; it is told to give up.
+ * Returns TRUE unless there was an error reading the source.
+ *
+ */
+
+BOOL end_copy(PCOPY cp)
+{	cp->stop = TRUE;
+	if(cp->tid != (TID) 0) wait_thread(cp->tid);
+
+	return(cp->rc == NO_ERROR ? TRUE : FALSE);
+}
+
+
+/*
+ * Reader thread for the source diskette.
+ *
+ */
+
+static VOID copy_thread(PVOID arg)
+{	(VOID) fill_image((PCOPY) arg);
+}
+
+#endif
+
+/*
+ * End of file: copy.c
+ *
+ */
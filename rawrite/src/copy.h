@@ -0,0 +1,40 @@
+/*
+ * File: copy.h
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Definitions for copying a diskette through memory
+ *
+ */
+
+#ifndef	_COPY_H
+#define	_COPY_H
+
+/* A source diskette being read into an image in memory */
+
+typedef	struct _COPY {
+	PDISK		dp;		/* Source disk; geometry must be set */
+	PIMAGE		im;		/* Image being filled */
+	RECOVERY	rec;		/* Recovery of damaged tracks */
+	BOOL		progress;	/* Display each track as it is read */
+	volatile BOOL	stop;		/* Set to make the reader give up */
+	UINT		track;		/* Track that failed */
+	APIRET		rc;		/* Result of reading */
+#ifdef	THREADS
+	TID		tid;		/* Reader thread */
+#endif
+} COPY, *PCOPY;
+
+/* External references */
+
+extern	PBPB	disk_bpb(PDISK, PBPB);
+extern	BOOL	end_copy(PCOPY);
+extern	BOOL	fill_image(PCOPY);
+extern	BOOL	start_copy(PCOPY);
+
+#endif
+
+/*
+ * End of file: copy.h
+ *
+ */
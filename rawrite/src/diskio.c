@@ -0,0 +1,1293 @@
+/*
+ * File: diskio.c
+ *
+ * Diskette raw image utilities
+ *
+ * Diskette device layer
+ *
+ */
+
+/*
+ * All access to the diskette goes through this module. Under OS/2 (and DOS,
+ * for the dual mode version) the drive is opened with OPEN_FLAGS_DASD, locked
+ * with DSK_LOCKDRIVE and transferred a track at a time with DSK_READTRACK and
+ * DSK_WRITETRACK.
+ *
+ * Under Linux the 'drive' may be a diskette device (e.g. /dev/fd0), any
+ * other block device such as a USB diskette drive, or a plain image file.
+ * The traditional drive names A: and B: are accepted as synonyms for
+ * /dev/fd0 and /dev/fd1. Block devices are opened exclusively, which takes
+ * the place of DSK_LOCKDRIVE; plain files are locked with flock. Where the
+ * device permits, O_DIRECT is used, so that each track is transferred with
+ * a single system call directly from an aligned track buffer, with no copy
+ * through the page cache.
+ *
+ * Tracks may also be formatted, just before they are written. Under OS/2
+ * this is done with DSK_FORMATVERIFY, after telling the driver what kind
+ * of medium to expect; under Linux, a real diskette drive is given the
+ * parameters for the density with FDSETPRM, and each track formatted with
+ * FDFMTTRK. Plain files, and other block devices, need no formatting.
+ *
+ * Also under Linux, a drive name beginning 'emu:' gives an emulated drive,
+ * backed by an image file but with the timing and faults of a real one
+ * (see emulate.c).
+ *
+ * If a timing has been attached to the disk, every transfer and format is
+ * timed (see timing.c).
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef	LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/fd.h>
+#include <linux/fs.h>
+#endif
+
+#include "diskio.h"
+#ifdef	LINUX
+#include "emulate.h"
+#endif
+#include "timing.h"
+
+/* Forward references */
+
+static	VOID	open_error(PUCHAR, APIRET, BOOL);
+static	APIRET	format_io(PDISK, UINT, UINT);
+static	APIRET	start_format(PDISK);
+#ifdef	LINUX
+static	APIRET	map_errno(INT, BOOL);
+static	PDISK	open_path(PUCHAR, PUCHAR, BOOL);
+static	APIRET	track_io(PDISK, UINT, UINT, UINT, UINT, PUCHAR, BOOL);
+static	UINT	size_type(off_t);
+#else
+static	APIRET	track_io(PDISK, UINT, UINT, UINT, UINT, PUCHAR, USHORT);
+#endif
+
+
+/*
+ * Report a failure to open a drive, given an OS/2 style error code.
+ *
+ */
+
+static VOID open_error(PUCHAR drive, APIRET rc, BOOL write)
+{	switch(rc) {
+		case ERROR_NOT_READY:
+			error("drive %s is not ready", drive);
+			break;
+
+		case ERROR_PATH_NOT_FOUND:
+			error("%s is not a valid drive name", drive);
+			break;
+
+		case ERROR_DISK_CHANGE:
+		case ERROR_INVALID_DRIVE:
+			error("drive %s does not exist", drive);
+			break;
+
+		case ERROR_DRIVE_LOCKED:
+			error("drive %s is in use", drive);
+			break;
+
+		case ERROR_ACCESS_DENIED:
+			error(
+				"access to drive %s denied%s",
+				drive,
+				write == TRUE ? " (may be read-only)" : "");
+			break;
+
+		default:
+			error(
+				"can't open drive %s, rc = %d",
+				drive,
+				rc);
+	}
+}
+
+#ifdef	LINUX
+
+/*
+ * Perform open actions for the disk
+ * Returns pointer to disk structure if disk was successfully opened,
+ * otherwise NULL.
+ *
+ */
+
+PDISK open_disk(PUCHAR drive, BOOL write)
+{	PDISK dp;			/* Disk structure */
+	PEMULATOR ep;			/* Emulated drive */
+
+	/* An emulated drive is opened as its image file */
+
+	if(strncmp(drive, EMUPREFIX, strlen(EMUPREFIX)) == 0) {
+		ep = new_emulator(drive + strlen(EMUPREFIX));
+		if(ep == (PEMULATOR) NULL) return((PDISK) NULL);
+		dp = open_path(drive, ep->path, write);
+		if(dp == (PDISK) NULL) {
+			free_emulator(ep);
+			return((PDISK) NULL);
+		}
+		if(dp->blkdev == TRUE) {
+			error("drive %s must use an image file", drive);
+			close_disk(dp);
+			free_emulator(ep);
+			return((PDISK) NULL);
+		}
+		dp->emu = ep;
+		return(dp);
+	}
+
+	/* Map the traditional drive names onto the diskette devices */
+
+	if(strcmp(drive, "a:") == 0 || strcmp(drive, "A:") == 0)
+		return(open_path(drive, "/dev/fd0", write));
+	if(strcmp(drive, "b:") == 0 || strcmp(drive, "B:") == 0)
+		return(open_path(drive, "/dev/fd1", write));
+
+	return(open_path(drive, drive, write));
+}
+
+
+/*
+ * Open the device or file 'path' for the drive named 'drive'.
+ * Returns pointer to disk structure if it was successfully opened,
+ * otherwise NULL.
+ *
+ */
+
+static PDISK open_path(PUCHAR drive, PUCHAR path, BOOL write)
+{	PDISK dp;			/* Disk structure */
+	struct stat statbuf;		/* Device status buffer */
+	INT flags;			/* For open */
+	INT fd;				/* Handle for disk */
+	INT ssize;			/* Logical sector size */
+	BOOL direct = TRUE;		/* Using O_DIRECT */
+
+	if(stat(path, &statbuf) != 0) {
+		open_error(drive, map_errno(errno, write), write);
+		return((PDISK) NULL);
+	}
+	if(!S_ISBLK(statbuf.st_mode) && !S_ISREG(statbuf.st_mode)) {
+		error("drive %s is not a valid diskette drive", drive);
+		return((PDISK) NULL);
+	}
+
+	/* Open the disk. An exclusive open of a block device fails if it
+	   is mounted or otherwise in use, which is the nearest equivalent
+	   of locking the drive. */
+
+	flags = write == TRUE ? O_RDWR : O_RDONLY;
+	if(S_ISBLK(statbuf.st_mode)) flags |= O_EXCL;
+
+	fd = open(path, flags | O_DIRECT);
+	if(fd < 0 && errno == EINVAL) {	/* File system can't do O_DIRECT */
+		direct = FALSE;
+		fd = open(path, flags);
+	}
+	if(fd < 0) {
+		open_error(drive, map_errno(errno, write), write);
+		return((PDISK) NULL);
+	}
+
+	/* Lock a plain file against access by other processes */
+
+	if(S_ISREG(statbuf.st_mode) && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		error("drive %s is locked", drive);
+		(VOID) close(fd);
+		return((PDISK) NULL);
+	}
+
+	dp = (PDISK) calloc(1, sizeof(DISK));
+	if(dp == (PDISK) NULL) {
+		error("cannot allocate memory for drive %s", drive);
+		(VOID) close(fd);
+		return((PDISK) NULL);
+	}
+	dp->drive = drive;
+	dp->hf = fd;
+	dp->write = write;
+	dp->blkdev = S_ISBLK(statbuf.st_mode) ? TRUE : FALSE;
+	dp->direct = direct;
+
+	/* Transfers are always in whole 512 byte sectors */
+
+	if(dp->blkdev == TRUE && ioctl(fd, BLKSSZGET, &ssize) == 0 &&
+	   ssize != BLKSIZE) {
+		error(
+			"drive %s has %d byte sectors; %d required",
+			drive,
+			ssize,
+			BLKSIZE);
+		close_disk(dp);
+		return((PDISK) NULL);
+	}
+
+	return(dp);
+}
+
+
+/*
+ * Perform close actions for the disk
+ *
+ */
+
+VOID close_disk(PDISK dp)
+{	if(dp->formatting == TRUE && dp->canformat == TRUE)
+		(VOID) ioctl(dp->hf, FDFMTEND, 0);
+	if(dp->write == TRUE && fsync(dp->hf) != 0)
+		error("can't flush drive, rc = %d", map_errno(errno, TRUE));
+
+	/* Closing the handle also releases the exclusive open or lock */
+
+	if(close(dp->hf) != 0)
+		error("can't close drive, rc = %d", map_errno(errno, FALSE));
+
+	while(dp->nspare != 0) free_buffer(dp->spare[--dp->nspare]);
+	if(dp->emu != (PEMULATOR) NULL) free_emulator(dp->emu);
+	free((PDISK) dp);
+}
+
+
+/*
+ * Prepare for another diskette to be put in the drive, which stays open.
+ * Anything written is flushed to the old diskette, anything the system
+ * holds from it is discarded, and the geometry must be set again.
+ *
+ */
+
+APIRET change_disk(PDISK dp)
+{	if(dp->formatting == TRUE && dp->canformat == TRUE)
+		(VOID) ioctl(dp->hf, FDFMTEND, 0);
+	dp->formatting = FALSE;
+	if(dp->write == TRUE && fsync(dp->hf) != 0)
+		return(map_errno(errno, TRUE));
+
+	if(dp->blkdev == TRUE) {	/* Either may fail; no matter */
+		(VOID) ioctl(dp->hf, FDFLUSH, 0);
+		(VOID) ioctl(dp->hf, BLKFLSBUF, 0);
+	}
+	dp->cyls = 0;
+	dp->heads = 0;
+	dp->sectors = 0;
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Sense the type of media in the drive.
+ * Sets *type to TY_UNKNOWN if this cannot be determined.
+ *
+ */
+
+APIRET sense_disk(PDISK dp, PUINT type)
+{	struct floppy_struct fs;	/* Diskette parameters */
+	struct stat statbuf;		/* File status buffer */
+	unsigned long long size;	/* Device size */
+
+	*type = TY_UNKNOWN;
+
+	if(dp->blkdev == TRUE) {
+		if(ioctl(dp->hf, FDGETPRM, &fs) == 0) {	/* Real diskette */
+			switch(fs.sect) {
+				case 9:
+					*type = TY_DD;
+					break;
+
+				case 18:
+					*type = TY_HD;
+					break;
+
+				case 36:
+					*type = TY_ED;
+					break;
+			}
+			return(NO_ERROR);
+		}
+		if(ioctl(dp->hf, BLKGETSIZE64, &size) != 0)
+			return(map_errno(errno, FALSE));
+		*type = size_type((off_t) size);
+	} else {
+		if(fstat(dp->hf, &statbuf) != 0)
+			return(map_errno(errno, FALSE));
+		*type = size_type(statbuf.st_size);
+	}
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Deduce diskette type from the exact size of a device or file.
+ *
+ */
+
+static UINT size_type(off_t size)
+{	switch(size) {
+		case DD_MAX:
+			return(TY_DD);
+
+		case HD_MAX:
+			return(TY_HD);
+
+		case ED_MAX:
+			return(TY_ED);
+
+		default:
+			return(TY_UNKNOWN);
+	}
+}
+
+
+/*
+ * Set the geometry to be used for subsequent track transfers.
+ *
+ */
+
+BOOL set_geometry(PDISK dp, UINT cyls, UINT heads, UINT sectors)
+{	if(dp->formatting == TRUE && dp->canformat == TRUE)
+		(VOID) ioctl(dp->hf, FDFMTEND, 0);
+	dp->formatting = FALSE;		/* Must be set up again */
+	dp->cyls = cyls;
+	dp->heads = heads;
+	dp->sectors = sectors;
+
+	return(TRUE);
+}
+
+
+/*
+ * Prepare for formatting tracks with the current geometry. A real
+ * diskette drive is given the standard parameters for a 3.5 inch diskette
+ * of the density implied by the number of sectors per track. Anything else
+ * is left alone, and its tracks will not be formatted.
+ *
+ */
+
+static APIRET start_format(PDISK dp)
+{	struct floppy_struct fs;	/* Diskette parameters */
+
+	dp->formatting = TRUE;
+	dp->canformat = FALSE;
+	if(dp->blkdev == FALSE || ioctl(dp->hf, FDGETPRM, &fs) != 0)
+		return(NO_ERROR);	/* Not a diskette drive */
+
+	fs.size = dp->cyls*dp->heads*dp->sectors;
+	fs.sect = dp->sectors;
+	fs.head = dp->heads;
+	fs.track = dp->cyls;
+	fs.stretch = 0;
+	switch(dp->sectors) {
+		case 9:			/* 720K */
+			fs.gap = 0x2a;
+			fs.rate = 0x02;
+			fs.spec1 = 0xdf;
+			fs.fmt_gap = 0x50;
+			break;
+
+		case 18:		/* 1.44MB */
+			fs.gap = 0x1b;
+			fs.rate = 0x00;
+			fs.spec1 = 0xcf;
+			fs.fmt_gap = 0x6c;
+			break;
+
+		case 36:		/* 2.88MB (perpendicular) */
+			fs.gap = 0x1b;
+			fs.rate = 0x43;
+			fs.spec1 = 0xaf;
+			fs.fmt_gap = 0x54;
+			break;
+
+		default:
+			return(ERROR_INVALID_PARAMETER);
+	}
+	fs.name = (const char *) NULL;
+
+	if(ioctl(dp->hf, FDSETPRM, &fs) != 0 ||
+	   ioctl(dp->hf, FDFMTBEG, 0) != 0)
+		return(map_errno(errno, TRUE));
+	dp->canformat = TRUE;
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Format one track, ready to be written, with the current geometry.
+ * Does nothing if the disk cannot be formatted (see start_format).
+ *
+ */
+
+static APIRET format_io(PDISK dp, UINT cyl, UINT head)
+{	APIRET rc;
+	struct format_descr fd;		/* Track to be formatted */
+
+	if(dp->emu != (PEMULATOR) NULL)
+		return(emulate_format(dp->emu, cyl, dp->sectors));
+
+	if(dp->formatting == FALSE) {
+		rc = start_format(dp);
+		if(rc != NO_ERROR) return(rc);
+	}
+	if(dp->canformat == FALSE) return(NO_ERROR);
+
+	fd.device = 0;
+	fd.head = head;
+	fd.track = cyl;
+	if(ioctl(dp->hf, FDFMTTRK, &fd) != 0)
+		return(map_errno(errno, TRUE));
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Allocate a buffer of 'len' bytes, suitably aligned for transfers to and
+ * from the disk. Buffers are page aligned; this satisfies O_DIRECT for any
+ * logical sector size we are likely to meet, and any whole number of
+ * sectors into such a buffer is also suitably aligned.
+ *
+ */
+
+PUCHAR alloc_buffer(ULONG len)
+{	PVOID buf;
+
+	if(posix_memalign(&buf, (size_t) sysconf(_SC_PAGESIZE), len) != 0)
+		return((PUCHAR) NULL);
+
+	return((PUCHAR) buf);
+}
+
+
+/*
+ * Free a buffer allocated by alloc_buffer.
+ *
+ */
+
+VOID free_buffer(PUCHAR buf)
+{	free((PVOID) buf);
+}
+
+
+/*
+ * Transfer 'count' sectors of a track, starting at sector 'first' (from
+ * zero), between the disk and a buffer.
+ *
+ */
+
+static APIRET track_io(PDISK dp, UINT cyl, UINT head, UINT first, UINT count,
+			PUCHAR buf, BOOL write)
+{	size_t len = count*BLKSIZE;
+	off_t off = (((off_t) cyl*dp->heads + head)*dp->sectors + first)*BLKSIZE;
+	ssize_t n;
+	INT flags;
+	APIRET rc;
+
+	if(dp->emu != (PEMULATOR) NULL) {
+		rc = emulate_io(
+			dp->emu,
+			cyl,
+			head,
+			first,
+			count,
+			dp->sectors,
+			write);
+		if(rc != NO_ERROR) return(rc);
+	}
+
+	for(;;) {
+		if(write == TRUE)
+			n = pwrite(dp->hf, buf, len, off);
+		else
+			n = pread(dp->hf, buf, len, off);
+		if(n == (ssize_t) len) return(NO_ERROR);
+		if(n >= 0) return(ERROR_SECTOR_NOT_FOUND);	/* Off the end */
+
+		/* Some file systems accept O_DIRECT at open time but then
+		   reject transfers that are not aligned to their own block
+		   size. Fall back to buffered I/O and try again. */
+
+		if(errno != EINVAL || dp->direct == FALSE)
+			return(map_errno(errno, write));
+		flags = fcntl(dp->hf, F_GETFL);
+		if(flags < 0 || fcntl(dp->hf, F_SETFL, flags & ~O_DIRECT) != 0)
+			return(map_errno(errno, write));
+		dp->direct = FALSE;
+	}
+}
+
+
+/*
+ * Map a Linux error number onto the nearest OS/2 error code.
+ *
+ */
+
+static APIRET map_errno(INT err, BOOL write)
+{	switch(err) {
+		case ENOENT:
+		case ENODEV:
+			return(ERROR_INVALID_DRIVE);
+
+		case ENOTDIR:
+		case ENAMETOOLONG:
+			return(ERROR_PATH_NOT_FOUND);
+
+		case ENOMEDIUM:
+		case ENXIO:
+			return(ERROR_NOT_READY);
+
+		case EBUSY:
+		case EWOULDBLOCK:
+			return(ERROR_DRIVE_LOCKED);
+
+		case EROFS:
+		case EACCES:
+		case EPERM:
+			return(write == TRUE ? ERROR_WRITE_PROTECT :
+					       ERROR_ACCESS_DENIED);
+
+		case ENOSPC:
+			return(ERROR_SECTOR_NOT_FOUND);
+
+		case ENOMEM:
+			return(ERROR_NOT_ENOUGH_MEMORY);
+
+		case EINVAL:
+			return(ERROR_INVALID_PARAMETER);
+
+		default:
+			return(write == TRUE ? ERROR_WRITE_FAULT :
+					       ERROR_READ_FAULT);
+	}
+}
+
+#else
+
+/*
+ * Perform open actions for the disk
+ * Returns pointer to disk structure if disk was successfully opened,
+ * otherwise NULL.
+ *
+ */
+
+PDISK open_disk(PUCHAR drive, BOOL write)
+{	APIRET rc;
+	PDISK dp;			/* Disk structure */
+	UCHAR dbuf[36];			/* DosDevIOCtl data buffer */
+	UCHAR parblk[2] = { 0, 0};	/* DosDevIOCtl parameter block */
+#ifdef DUAL
+	USHORT action;			/* For returned action taken */
+	USHORT openflags;		/* For DosOpen */
+#else
+	ULONG action;			/* For returned action taken */
+	ULONG openflags;		/* For DosOpen */
+	ULONG plen = sizeof(parblk);	/* Input/output length for parameters */
+	ULONG dlen = sizeof(dbuf);	/* Input/output length for data */
+#endif
+	HFILE dfd;			/* Handle for disk */
+
+	/* Open the disk */
+
+	openflags = (write == TRUE ? OPEN_ACCESS_READWRITE :
+				     OPEN_ACCESS_READONLY) |
+		    OPEN_FLAGS_DASD |
+#ifndef	DUAL
+		    OPEN_FLAGS_FAIL_ON_ERROR |
+#endif
+		    OPEN_SHARE_DENYREADWRITE;
+#ifdef	DUAL
+	if(_osmode == OS2_MODE)
+		openflags |= OPEN_FLAGS_FAIL_ON_ERROR;
+#endif
+
+	rc = DosOpen(
+		drive,			/* drive name */
+		&dfd,			/* to return handle */
+		&action,		/* to return action taken */
+		0L,			/* file size - not used */
+		0,			/* file attribute - not used */
+		OPEN_ACTION_OPEN_IF_EXISTS |
+		OPEN_ACTION_FAIL_IF_NEW,/* open action */
+		openflags,		/* open flags */
+#ifdef	DUAL
+		0L);			/* reserved - must be zero */
+#else
+		(PEAOP2) 0);		/* extended attributes - not used */
+#endif
+
+	if(rc != 0) {
+		open_error(drive, rc, write);
+		return((PDISK) NULL);
+	}
+
+	/* Check that we are dealing with the right kind of media */
+
+#ifdef DUAL
+	if(_osmode == OS2_MODE) {
+		rc = DosDevIOCtl(
+			&dbuf,		/* data block */
+			parblk,		/* parameter block */
+			DSK_GETDEVICEPARAMS,/* device function - get device details */
+			IOCTL_DISK,	/* device category - logical drive */
+			dfd);		/* handle from DosOpen */
+	} else {
+		rc = 0;
+	}
+#else
+	rc = DosDevIOCtl(
+		dfd,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_GETDEVICEPARAMS,	/* device function - get device details */
+		parblk,			/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		&dbuf,			/* data block */
+		dlen,			/* input length of data block */
+		&dlen);			/* output length of data block */
+#endif
+
+	if(rc != 0) {
+		error(
+			"cannot get device details for %s, rc = %d",
+			drive,
+			rc);
+		(VOID) DosClose(dfd);
+		return((PDISK) NULL);
+	}
+
+#ifdef	DUAL
+	if(_osmode == OS2_MODE) {
+#endif
+		if(dbuf[33] != 2 && dbuf[33] != 7 && dbuf[33] != 9) {
+			error("drive %s is not a valid diskette drive", drive);
+			(VOID) DosClose(dfd);
+			return((PDISK) NULL);
+		}
+#ifdef	DUAL
+	}
+#endif
+
+	/* Lock the disk against access by other processes */
+
+#ifdef	DUAL
+	rc = DosDevIOCtl(
+		&dbuf,			/* data block */
+		parblk,			/* parameter block */
+		DSK_LOCKDRIVE,		/* device function - lock drive */
+		IOCTL_DISK,		/* device category - logical drive */
+		dfd);			/* handle from DosOpen */
+#else
+	plen = 1;			/* Re-initialise */
+	dlen = 1;
+
+	rc = DosDevIOCtl(
+		dfd,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_LOCKDRIVE,		/* device function - lock drive */
+		parblk,			/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		&dbuf,			/* data block */
+		dlen,			/* input length of data block */
+		&dlen);			/* output length of data block */
+#endif
+
+	if(rc != 0) {
+		switch(rc) {
+			case ERROR_DRIVE_LOCKED:
+				error("drive %s is locked", drive);
+				break;
+
+			default:
+				error(
+					"can't lock drive %s, rc = %d",
+					drive,
+					rc);
+		}
+		(VOID) DosClose(dfd);
+		return((PDISK) NULL);
+	}
+
+	dp = (PDISK) calloc(1, sizeof(DISK));
+	if(dp == (PDISK) NULL) {
+		error("cannot allocate memory for drive %s", drive);
+		(VOID) DosClose(dfd);
+		return((PDISK) NULL);
+	}
+	dp->drive = drive;
+	dp->hf = dfd;
+	dp->write = write;
+
+	return(dp);
+}
+
+
+/*
+ * Perform close actions for the disk
+ *
+ */
+
+VOID close_disk(PDISK dp)
+{	APIRET rc;
+	UCHAR dbuf;			/* DosDevIOCtl data buffer */
+	UCHAR parblk = 0;		/* DosDevIOCtl parameter block */
+#ifndef	DUAL
+	ULONG plen = sizeof(parblk);	/* Output length for parameters */
+	ULONG dlen = sizeof(dbuf);	/* Output length for data */
+#endif
+
+	/* Unlock the disk to allow access by other processes */
+
+#ifdef	DUAL
+	rc = DosDevIOCtl(
+		&dbuf,			/* data block */
+		&parblk,		/* parameter block */
+		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
+		IOCTL_DISK,		/* device category - logical drive */
+		dp->hf);		/* handle from DosOpen */
+#else
+	rc = DosDevIOCtl(
+		dp->hf,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
+		&parblk,		/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		&dbuf,			/* data block */
+		sizeof(dbuf),		/* input length of data block */
+		&dlen);			/* output length of data block */
+#endif
+
+	if(rc != 0)
+		error("can't unlock drive, rc = %d", rc);
+
+	/* Close the disk */
+
+	rc = DosClose(dp->hf);
+	if(rc != 0)
+		error("can't close drive, rc = %d", rc);
+
+	if(dp->parblk != (PTRACKLAYOUT) NULL)
+		free((PTRACKLAYOUT) dp->parblk);
+	if(dp->fmtblk != (PTRACKFORMAT) NULL)
+		free((PTRACKFORMAT) dp->fmtblk);
+	while(dp->nspare != 0) free_buffer(dp->spare[--dp->nspare]);
+	free((PDISK) dp);
+}
+
+
+/*
+ * Prepare for another diskette to be put in the drive, which stays open
+ * and locked. Transfers are not cached, and the driver notices the change
+ * of diskette for itself; only the geometry must be set again.
+ *
+ */
+
+APIRET change_disk(PDISK dp)
+{	dp->formatting = FALSE;
+	dp->cyls = 0;
+	dp->heads = 0;
+	dp->sectors = 0;
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Sense the type of media in the drive.
+ * Sets *type to TY_UNKNOWN if this cannot be determined.
+ *
+ */
+
+APIRET sense_disk(PDISK dp, PUINT type)
+{	UCHAR dpb;			/* DosDevIOCtl data buffer */
+#ifndef	DUAL
+	APIRET rc;
+	UCHAR mspar = 0;		/* DosDevIOCTL parameter block */
+	ULONG plen;			/* Length for parameters */
+	ULONG dlen;			/* Length for data */
+#endif
+
+#ifdef	DUAL
+	dpb = 0;			/* Cannot sense media */
+#else
+	plen = sizeof(mspar);
+	dlen = sizeof(dpb);
+	rc = DosDevIOCtl(
+		dp->hf,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_QUERYMEDIASENSE,	/* device function - get media type */
+		&mspar,			/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		&dpb,			/* data block */
+		dlen,			/* input length of data block */
+		&dlen);			/* output length of data block */
+
+	if(rc != 0) return(rc);
+#endif
+
+	switch(dpb) {
+		default:
+		case 0:
+			*type = TY_UNKNOWN;
+			break;
+
+		case 1:
+			*type = TY_DD;
+			break;
+
+		case 2:
+			*type = TY_HD;
+			break;
+
+		case 3:
+			*type = TY_ED;
+			break;
+	}
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Set the geometry to be used for subsequent track transfers.
+ * The parameter block and track table are built once here, rather than
+ * for every track.
+ *
+ */
+
+BOOL set_geometry(PDISK dp, UINT cyls, UINT heads, UINT sectors)
+{	UINT i;
+
+	if(dp->parblk != (PTRACKLAYOUT) NULL)
+		free((PTRACKLAYOUT) dp->parblk);
+
+	dp->plen = sizeof(TRACKLAYOUT)+(sectors-1)*sizeof(USHORT)*2;
+	dp->parblk = (PTRACKLAYOUT) malloc(dp->plen);
+	if(dp->parblk == (PTRACKLAYOUT) NULL) {
+		error("cannot allocate memory for track table");
+		return(FALSE);
+	}
+
+	dp->cyls = cyls;
+	dp->heads = heads;
+	dp->sectors = sectors;
+	dp->formatting = FALSE;		/* Must be set up again */
+
+	dp->parblk->bCommand = 1;	/* Contiguous track */
+	dp->parblk->usFirstSector = 0;
+	dp->parblk->cSectors = (USHORT) sectors;
+
+	for(i = 1; i <= (USHORT) sectors; i++) {
+		dp->parblk->TrackTable[i-1].usSectorNumber = i;
+		dp->parblk->TrackTable[i-1].usSectorSize = BLKSIZE;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Prepare for formatting tracks with the current geometry. The driver is
+ * told to expect a medium of the density implied by the number of sectors
+ * per track, with the standard layout for a 3.5 inch diskette of that
+ * density, and the parameter block for formatting is built.
+ *
+ */
+
+static APIRET start_format(PDISK dp)
+{	APIRET rc;
+	BIOSPARAMETERBLOCK bpb;		/* Device parameters */
+	UCHAR parblk[2];		/* DosDevIOCtl parameter block */
+#ifndef	DUAL
+	ULONG plen;			/* Length for parameters */
+	ULONG dlen;			/* Length for data */
+#endif
+
+	/* Start from the current parameters, so that the details of the
+	   drive itself are kept */
+
+	parblk[0] = 1;			/* Current BPB for medium */
+	parblk[1] = 0;
+#ifdef	DUAL
+	rc = DosDevIOCtl(
+		(PVOID) &bpb,		/* data block */
+		parblk,			/* parameter block */
+		DSK_GETDEVICEPARAMS,	/* device function - get parameters */
+		IOCTL_DISK,		/* device category - logical drive */
+		dp->hf);		/* handle from DosOpen */
+#else
+	plen = sizeof(parblk);
+	dlen = sizeof(bpb);
+	rc = DosDevIOCtl(
+		dp->hf,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_GETDEVICEPARAMS,	/* device function - get parameters */
+		parblk,			/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		(PVOID) &bpb,		/* data block */
+		dlen,			/* input length of data block */
+		&dlen);			/* output length of data block */
+#endif
+	if(rc != 0) return(rc);
+
+	bpb.usBytesPerSector = BLKSIZE;
+	bpb.usReservedSectors = 1;
+	bpb.cFATs = 2;
+	bpb.cSectors = (USHORT) (dp->cyls*dp->heads*dp->sectors);
+	bpb.usSectorsPerTrack = (USHORT) dp->sectors;
+	bpb.cHeads = (USHORT) dp->heads;
+	bpb.cHiddenSectors = 0L;
+	bpb.cLargeSectors = 0L;
+	switch(dp->sectors) {
+		case 9:			/* 720K */
+			bpb.bSectorsPerCluster = 2;
+			bpb.cRootEntries = 112;
+			bpb.bMedia = 0xf9;
+			bpb.usSectorsPerFAT = 3;
+			break;
+
+		case 18:		/* 1.44MB */
+			bpb.bSectorsPerCluster = 1;
+			bpb.cRootEntries = 224;
+			bpb.bMedia = 0xf0;
+			bpb.usSectorsPerFAT = 9;
+			break;
+
+		case 36:		/* 2.88MB */
+			bpb.bSectorsPerCluster = 2;
+			bpb.cRootEntries = 240;
+			bpb.bMedia = 0xf0;
+			bpb.usSectorsPerFAT = 9;
+			break;
+
+		default:
+			return(ERROR_INVALID_PARAMETER);
+	}
+
+	parblk[0] = 2;			/* Change BPB for medium */
+#ifdef	DUAL
+	rc = DosDevIOCtl(
+		(PVOID) &bpb,		/* data block */
+		parblk,			/* parameter block */
+		DSK_SETDEVICEPARAMS,	/* device function - set parameters */
+		IOCTL_DISK,		/* device category - logical drive */
+		dp->hf);		/* handle from DosOpen */
+#else
+	plen = sizeof(parblk);
+	dlen = sizeof(bpb);
+	rc = DosDevIOCtl(
+		dp->hf,			/* handle from DosOpen */
+		IOCTL_DISK,		/* device category - logical drive */
+		DSK_SETDEVICEPARAMS,	/* device function - set parameters */
+		parblk,			/* parameter block */
+		plen,			/* input length of parameter block */
+		&plen,			/* output length of parameter block */
+		(PVOID) &bpb,		/* data block */
+		dlen,			/* input length of data block */
+		&dlen);			/* output length of data block */
+#endif
+	if(rc != 0) return(rc);
+
+	/* Build the parameter block for formatting; the cylinder and head in
+	   each sector ID are filled in for each track */
+
+	if(dp->fmtblk != (PTRACKFORMAT) NULL)
+		free((PTRACKFORMAT) dp->fmtblk);
+	dp->flen = sizeof(TRACKFORMAT)+(dp->sectors-1)*sizeof(UCHAR)*4;
+	dp->fmtblk = (PTRACKFORMAT) malloc(dp->flen);
+	if(dp->fmtblk == (PTRACKFORMAT) NULL)
+		return(ERROR_NOT_ENOUGH_MEMORY);
+	dp->fmtblk->bCommand = 0;	/* Single track */
+	dp->fmtblk->cSectors = (USHORT) dp->sectors;
+	dp->formatting = TRUE;
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Format one track, ready to be written, with the current geometry.
+ *
+ */
+
+static APIRET format_io(PDISK dp, UINT cyl, UINT head)
+{	APIRET rc;
+	UINT i;
+	UCHAR dbuf = 0;			/* DosDevIOCtl data buffer */
+#ifndef	DUAL
+	ULONG plen;			/* Length for parameters */
+	ULONG dlen = sizeof(dbuf);	/* Length for data */
+#endif
+
+	if(dp->formatting == FALSE) {
+		rc = start_format(dp);
+		if(rc != NO_ERROR) return(rc);
+	}
+
+	dp->fmtblk->usHead = (USHORT) head;
+	dp->fmtblk->usCylinder = (USHORT) cyl;
+	for(i = 0; i < dp->sectors; i++) {	/* Size code 2 is 512 bytes */
+		dp->fmtblk->FormatTrackTable[i].bCylinder = (BYTE) cyl;
+		dp->fmtblk->FormatTrackTable[i].bHead = (BYTE) head;
+		dp->fmtblk->FormatTrackTable[i].idSector = (BYTE) (i + 1);
+		dp->fmtblk->FormatTrackTable[i].bBytesSector = 2;
+	}
+
+#ifdef	DUAL
+	return(DosDevIOCtl(
+		(PVOID) &dbuf,
+		(PVOID) dp->fmtblk,
+		DSK_FORMATVERIFY,
+		IOCTL_DISK,
+		dp->hf));
+#else
+	plen = dp->flen;
+
+	return(DosDevIOCtl(
+		dp->hf,
+		IOCTL_DISK,
+		DSK_FORMATVERIFY,
+		(PVOID) dp->fmtblk,
+		plen,
+		&plen,
+		(PVOID) &dbuf,
+		dlen,
+		&dlen));
+#endif
+}
+
+
+/*
+ * Allocate a buffer of 'len' bytes for transfers to and from the disk.
+ * No particular alignment is needed.
+ *
+ */
+
+PUCHAR alloc_buffer(ULONG len)
+{
+#ifdef	DUAL
+	return((PUCHAR) malloc((INT) len));
+#else
+	return((PUCHAR) malloc(len));
+#endif
+}
+
+
+/*
+ * Free a buffer allocated by alloc_buffer.
+ *
+ */
+
+VOID free_buffer(PUCHAR buf)
+{	free((PUCHAR) buf);
+}
+
+
+/*
+ * Transfer 'count' sectors of a track, starting at sector 'first' (from
+ * zero), between the disk and a buffer.
+ *
+ */
+
+static APIRET track_io(PDISK dp, UINT cyl, UINT head, UINT first, UINT count,
+			PUCHAR buf, USHORT fn)
+{
+#ifdef	DUAL
+	dp->parblk->usHead = (USHORT) head;
+	dp->parblk->usCylinder = (USHORT) cyl;
+	dp->parblk->usFirstSector = (USHORT) first;
+	dp->parblk->cSectors = (USHORT) count;
+
+	return(DosDevIOCtl(
+		(PVOID) buf,
+		(PVOID) dp->parblk,
+		fn,
+		IOCTL_DISK,
+		dp->hf));
+#else
+	ULONG plen = dp->plen;		/* Length for parameters */
+	ULONG dlen = count*BLKSIZE;	/* Length for data */
+
+	dp->parblk->usHead = (USHORT) head;
+	dp->parblk->usCylinder = (USHORT) cyl;
+	dp->parblk->usFirstSector = (USHORT) first;
+	dp->parblk->cSectors = (USHORT) count;
+
+	return(DosDevIOCtl(
+		dp->hf,
+		IOCTL_DISK,
+		fn,
+		(PVOID) dp->parblk,
+		plen,
+		&plen,
+		(PVOID) buf,
+		dlen,
+		&dlen));
+#endif
+}
+
+#endif
+
+
+/*
+ * Allocate a buffer big enough for one track. Buffers are kept when freed,
+ * and used again, so that a drive kept open for a series of diskettes
+ * does not need new ones for each diskette. They are all big enough for
+ * the largest track, as the next diskette may be of a different type.
+ *
+ */
+
+PUCHAR alloc_track(PDISK dp)
+{	if(dp->nspare != 0) return(dp->spare[--dp->nspare]);
+
+	return(alloc_buffer(MAXTRACK));
+}
+
+
+/*
+ * Free a track buffer allocated by alloc_track; it is kept for reuse
+ * until the disk is closed.
+ *
+ */
+
+VOID free_track(PDISK dp, PUCHAR buf)
+{	if(dp->nspare < MAXSPARE)
+		dp->spare[dp->nspare++] = buf;
+	else
+		free_buffer(buf);
+}
+
+
+/*
+ * Read one whole track from the disk.
+ *
+ */
+
+APIRET read_track(PDISK dp, UINT cyl, UINT head, PUCHAR buf)
+{	ULONG start = clock_us();
+	APIRET rc;
+
+#ifdef	LINUX
+	rc = track_io(dp, cyl, head, 0, dp->sectors, buf, FALSE);
+#else
+	rc = track_io(dp, cyl, head, 0, dp->sectors, buf, DSK_READTRACK);
+#endif
+	if(dp->tm != (PTIMING) NULL) time_op(dp->tm, TM_READ, start, rc);
+
+	return(rc);
+}
+
+
+/*
+ * Read a single sector (numbered from zero) of a track from the disk. This
+ * is slow, but allows the good sectors of a damaged track to be recovered.
+ *
+ */
+
+APIRET read_sector(PDISK dp, UINT cyl, UINT head, UINT sector, PUCHAR buf)
+{	ULONG start = clock_us();
+	APIRET rc;
+
+#ifdef	LINUX
+	rc = track_io(dp, cyl, head, sector, 1, buf, FALSE);
+#else
+	rc = track_io(dp, cyl, head, sector, 1, buf, DSK_READTRACK);
+#endif
+	if(dp->tm != (PTIMING) NULL) time_op(dp->tm, TM_SECTOR, start, rc);
+
+	return(rc);
+}
+
+
+/*
+ * Write one whole track to the disk.
+ *
+ */
+
+APIRET write_track(PDISK dp, UINT cyl, UINT head, PUCHAR buf)
+{	ULONG start = clock_us();
+	APIRET rc;
+
+#ifdef	LINUX
+	rc = track_io(dp, cyl, head, 0, dp->sectors, buf, TRUE);
+#else
+	rc = track_io(dp, cyl, head, 0, dp->sectors, buf, DSK_WRITETRACK);
+#endif
+	if(dp->tm != (PTIMING) NULL) time_op(dp->tm, TM_WRITE, start, rc);
+
+	return(rc);
+}
+
+
+/*
+ * Format one track, ready to be written, with the current geometry.
+ *
+ */
+
+APIRET format_track(PDISK dp, UINT cyl, UINT head)
+{	ULONG start = clock_us();
+	APIRET rc;
+
+	rc = format_io(dp, cyl, head);
+	if(dp->tm != (PTIMING) NULL) time_op(dp->tm, TM_FORMAT, start, rc);
+
+	return(rc);
+}
+
+
+/*
+ * Make sure that the next read of a track comes from the disk, and not
+ * from any copy held by the system. Under Linux, the floppy driver keeps
+ * the last track it read in a buffer of its own, even with O_DIRECT, so
+ * that is always flushed (as is that of an emulated drive). Without
+ * O_DIRECT, anything written is flushed out to the disk as well, and the
+ * cached copy dropped (for a block device, the whole device's).
+ *
+ */
+
+APIRET uncache_track(PDISK dp, UINT cyl, UINT head)
+{
+#ifdef	LINUX
+	off_t tlen = (off_t) dp->sectors*BLKSIZE;
+	INT err;
+
+	if(dp->emu != (PEMULATOR) NULL) emulate_flush(dp->emu);
+	if(dp->blkdev == TRUE)		/* Fails if not a floppy; no matter */
+		(VOID) ioctl(dp->hf, FDFLUSH, 0);
+	if(dp->direct == TRUE) return(NO_ERROR);
+	if(dp->write == TRUE && fdatasync(dp->hf) != 0)
+		return(map_errno(errno, TRUE));
+	if(dp->blkdev == TRUE) {
+		if(ioctl(dp->hf, BLKFLSBUF, 0) != 0)
+			return(map_errno(errno, FALSE));
+	} else {
+		err = posix_fadvise(
+			dp->hf,
+			((off_t) cyl*dp->heads + head)*tlen,
+			tlen,
+			POSIX_FADV_DONTNEED);
+		if(err != 0) return(map_errno(err, FALSE));
+	}
+#endif
+
+	return(NO_ERROR);
+}
+
+/*
+ * End of file: diskio.c
+ *
+ */
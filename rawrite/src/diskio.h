@@ -0,0 +1,87 @@
+/*
+ * File: diskio.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for the diskette device layer
+ *
+ */
+
+#ifndef	_DISKIO_H
+#define	_DISKIO_H
+
+/* Miscellaneous definitions */
+
+#ifdef	DUAL
+#define	BLKSIZE		512L		/* Number of bytes in a disk block */
+#define	DD_MAX		720L*2L*BLKSIZE	/* Maximum size of 720K image */
+#define	HD_MAX		1440L*2L*BLKSIZE/* Maximum size of 1.44MB image */
+#else
+#define	BLKSIZE		512		/* Number of bytes in a disk block */
+#define	DD_MAX		720*2*BLKSIZE	/* Maximum size of 720K image */
+#define	HD_MAX		1440*2*BLKSIZE	/* Maximum size of 1.44MB image */
+#endif
+#define	ED_MAX		(2*HD_MAX)	/* Maximum size of 2.88MB image */
+#define	MAXTRACK	(36*BLKSIZE)	/* Size of largest (ED) track */
+#define	MAXSPARE	17		/* Track buffers kept for reuse */
+
+#define	TY_UNKNOWN	0		/* Diskette type unknown */
+#define	TY_DD		1		/* DD diskette specified */
+#define	TY_HD		2		/* HD diskette specified */
+#define	TY_ED		3		/* ED diskette specified */
+
+/* Structure describing an open diskette (or, on Linux, a device or file
+   standing in for one). Geometry is zero until set_geometry is called. */
+
+typedef	struct _DISK {
+	PUCHAR		drive;		/* Drive name, for messages */
+	HFILE		hf;		/* Handle for disk */
+	BOOL		write;		/* TRUE if opened for writing */
+	UINT		cyls;		/* Number of cylinders */
+	UINT		heads;		/* Number of heads */
+	UINT		sectors;	/* Sectors per track */
+	PUCHAR		spare[MAXSPARE];/* Freed track buffers, for reuse */
+	UINT		nspare;		/* Number of these */
+	BOOL		formatting;	/* Set up for formatting tracks */
+	struct _TIMING	*tm;		/* Timing of calls, or NULL */
+#ifdef	LINUX
+	BOOL		blkdev;		/* TRUE if a block device */
+	BOOL		direct;		/* TRUE if using O_DIRECT */
+	BOOL		canformat;	/* TRUE if tracks can be formatted */
+	struct _EMULATOR *emu;		/* Emulated drive, or NULL */
+#else
+	PTRACKLAYOUT	parblk;		/* DosDevIOCtl parameter block */
+	PTRACKFORMAT	fmtblk;		/* Parameter block for formatting */
+#ifdef	DUAL
+	UINT		plen;		/* Length of parameter block */
+	UINT		flen;		/* Length of format parameter block */
+#else
+	ULONG		plen;		/* Length of parameter block */
+	ULONG		flen;		/* Length of format parameter block */
+#endif
+#endif
+} DISK, *PDISK;
+
+/* External references */
+
+extern	PUCHAR	alloc_buffer(ULONG);
+extern	PUCHAR	alloc_track(PDISK);
+extern	APIRET	change_disk(PDISK);
+extern	VOID	close_disk(PDISK);
+extern	VOID	free_buffer(PUCHAR);
+extern	APIRET	format_track(PDISK, UINT, UINT);
+extern	VOID	free_track(PDISK, PUCHAR);
+extern	PDISK	open_disk(PUCHAR, BOOL);
+extern	APIRET	read_sector(PDISK, UINT, UINT, UINT, PUCHAR);
+extern	APIRET	read_track(PDISK, UINT, UINT, PUCHAR);
+extern	APIRET	sense_disk(PDISK, PUINT);
+extern	BOOL	set_geometry(PDISK, UINT, UINT, UINT);
+extern	APIRET	uncache_track(PDISK, UINT, UINT);
+extern	APIRET	write_track(PDISK, UINT, UINT, PUCHAR);
+
+#endif
+
+/*
+ * End of file: diskio.h
+ *
+ */
@@ -0,0 +1,424 @@
+/*
+ * File: emulate.c
+ *
+ * Diskette raw image utilities
+ *
+ * Emulated diskette drive, for testing and benchmarking (Linux only)
+ *
+ */
+
+/*
+ * A drive name of the form
+ *
+ *	emu:file[,option]...
+ *
+ * gives an emulated drive, which holds the image file 'file' as its
+ * diskette. The file is read and written as for any other plain file
+ * standing in for a drive, but each transfer first takes the time a real
+ * 3.5 inch drive would take, and may fail as a real drive might. This
+ * allows changes to the track pipeline, retries and the like to be
+ * measured and tested without diskette hardware.
+ *
+ * The heads move at 'step' milliseconds per cylinder, then take 'settle'
+ * milliseconds to settle; changing heads costs nothing. The diskette turns
+ * at 'rpm' revolutions per minute, with its sectors spread evenly round
+ * the track from the index hole, and its position is taken from the
+ * clock, so time spent between transfers is not free: a transfer starts
+ * only when its first sector comes round, and takes as long as its
+ * sectors take to pass the heads. Formatting a track starts at the index
+ * and takes a full revolution.
+ *
+ * The options are:
+ *
+ *	rpm=n		rotational speed (default 300; 0 for no delays)
+ *	step=n		step time per cylinder in ms (default 3)
+ *	settle=n	head settling time in ms (default 15)
+ *	fast		no delays at all; the same as rpm=0,step=0,settle=0
+ *	wp		the write protect tab is set
+ *	change=n	operation n (from 1) reports that the diskette has
+ *			been changed
+ *	bad=c.h.s	sector s (from 1) of cylinder c, head h, can never
+ *			be read; may be given several times
+ *	faults=n	about one sector transfer in n fails at random
+ *	seed=n		start for the random faults, so that a run can be
+ *			repeated exactly (default 1)
+ *	cache		the drive keeps the outcome of the last track read,
+ *			failed sectors as well as good ones, and gives it
+ *			again for any later read of that track, until it is
+ *			flushed (see emulate_flush) or the track is written;
+ *			this stands for the Linux floppy driver's track
+ *			buffer, and for the system's cache
+ *
+ * A read stops at the first sector that fails, with ERROR_CRC; a write
+ * with a random fault fails with ERROR_WRITE_FAULT, and writes nothing.
+ * Writing a bad sector succeeds, but it still cannot be read back.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulate.h"
+
+/* Forward references */
+
+static	BOOL	get_number(PUCHAR, ULONG, PULONG);
+static	BOOL	is_bad(PEMULATOR, UINT, UINT, UINT);
+static	VOID	keep_track(PEMULATOR, UINT, UINT, UINT, UINT, APIRET, BOOL);
+static	BOOL	kept(PEMULATOR, UINT, UINT, UINT, UINT, APIRET *);
+static	VOID	move_heads(PEMULATOR, UINT, UINT, UINT, UINT);
+static	ULONG	random_number(PEMULATOR);
+static	BOOL	set_option(PEMULATOR, PUCHAR);
+
+
+/*
+ * Set up an emulated drive from 'spec', the drive name without the
+ * prefix; that is, the name of the image file and any options.
+ * Returns pointer to the emulator, or NULL on failure (already reported).
+ *
+ */
+
+PEMULATOR new_emulator(PUCHAR spec)
+{	PEMULATOR ep;
+	PUCHAR p, q;
+
+	ep = (PEMULATOR) calloc(1, sizeof(EMULATOR));
+	if(ep == (PEMULATOR) NULL) {
+		error("cannot allocate memory for emulated drive");
+		return((PEMULATOR) NULL);
+	}
+	ep->path = (PUCHAR) malloc(strlen(spec) + 1);
+	if(ep->path == (PUCHAR) NULL) {
+		error("cannot allocate memory for emulated drive");
+		free((PEMULATOR) ep);
+		return((PEMULATOR) NULL);
+	}
+	strcpy(ep->path, spec);
+	ep->rpm = DEFRPM;
+	ep->step = DEFSTEP;
+	ep->settle = DEFSETTLE;
+	ep->seed = 1;
+
+	/* Split off the options, and apply each in turn */
+
+	p = strchr(ep->path, ',');
+	if(p != (PUCHAR) NULL) *p++ = '\0';
+	while(p != (PUCHAR) NULL) {
+		q = strchr(p, ',');
+		if(q != (PUCHAR) NULL) *q++ = '\0';
+		if(set_option(ep, p) == FALSE) {
+			error("invalid emulated drive option '%s'", p);
+			free_emulator(ep);
+			return((PEMULATOR) NULL);
+		}
+		p = q;
+	}
+	if(ep->path[0] == '\0') {
+		error("no image file given for emulated drive");
+		free_emulator(ep);
+		return((PEMULATOR) NULL);
+	}
+
+	return(ep);
+}
+
+
+/*
+ * Apply one option to an emulated drive.
+ * Returns TRUE on success, FALSE if the option is not valid.
+ *
+ */
+
+static BOOL set_option(PEMULATOR ep, PUCHAR opt)
+{	ULONG n, c, h, s;
+	PUCHAR p;
+
+	if(strcmp(opt, "wp") == 0) {
+		ep->protect = TRUE;
+		return(TRUE);
+	}
+	if(strcmp(opt, "cache") == 0) {
+		ep->cache = TRUE;
+		return(TRUE);
+	}
+	if(strcmp(opt, "fast") == 0) {
+		ep->rpm = 0;
+		ep->step = 0;
+		ep->settle = 0;
+		return(TRUE);
+	}
+	if(strncmp(opt, "rpm=", 4) == 0) {
+		if(get_number(opt + 4, 10000L, &n) == FALSE) return(FALSE);
+		ep->rpm = (UINT) n;
+		return(TRUE);
+	}
+	if(strncmp(opt, "step=", 5) == 0) {
+		if(get_number(opt + 5, 1000L, &n) == FALSE) return(FALSE);
+		ep->step = (UINT) n;
+		return(TRUE);
+	}
+	if(strncmp(opt, "settle=", 7) == 0) {
+		if(get_number(opt + 7, 1000L, &n) == FALSE) return(FALSE);
+		ep->settle = (UINT) n;
+		return(TRUE);
+	}
+	if(strncmp(opt, "change=", 7) == 0) {
+		return(get_number(opt + 7, 0xffffffffL, &ep->change));
+	}
+	if(strncmp(opt, "faults=", 7) == 0) {
+		return(get_number(opt + 7, 0xffffffffL, &ep->faults));
+	}
+	if(strncmp(opt, "seed=", 5) == 0) {
+		if(get_number(opt + 5, 0xffffffffL, &ep->seed) == FALSE)
+			return(FALSE);
+		if(ep->seed == 0) ep->seed = 1;	/* Generator sticks at zero */
+		return(TRUE);
+	}
+	if(strncmp(opt, "bad=", 4) == 0) {
+		if(ep->nbad == MAXEMUBAD) return(FALSE);
+
+		/* Split 'c.h.s' into its three numbers */
+
+		opt += 4;
+		p = strchr(opt, '.');
+		if(p == (PUCHAR) NULL) return(FALSE);
+		*p++ = '\0';
+		if(get_number(opt, 255L, &c) == FALSE) return(FALSE);
+		opt = p;
+		p = strchr(opt, '.');
+		if(p == (PUCHAR) NULL) return(FALSE);
+		*p++ = '\0';
+		if(get_number(opt, 1L, &h) == FALSE ||
+		   get_number(p, 255L, &s) == FALSE || s == 0)
+			return(FALSE);
+		ep->bad[ep->nbad].cyl = (UINT) c;
+		ep->bad[ep->nbad].head = (UINT) h;
+		ep->bad[ep->nbad].sector = (UINT) s - 1;
+		ep->nbad++;
+		return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Convert the decimal number in 's', which must be no more than 'max'.
+ * Returns TRUE on success, FALSE if it is not a valid number.
+ *
+ */
+
+static BOOL get_number(PUCHAR s, ULONG max, PULONG val)
+{	PUCHAR end;
+
+	if(*s < '0' || *s > '9') return(FALSE);
+	*val = strtoul(s, (char **) &end, 10);
+	if(*end != '\0' || *val > max) return(FALSE);
+
+	return(TRUE);
+}
+
+
+/*
+ * Close down an emulated drive.
+ *
+ */
+
+VOID free_emulator(PEMULATOR ep)
+{	free((PUCHAR) ep->path);
+	free((PEMULATOR) ep);
+}
+
+
+/*
+ * Emulate the transfer of 'count' sectors of a track, starting at sector
+ * 'first' (from zero), on a diskette with 'sectors' sectors per track. The
+ * time is taken, then the result of the transfer returned; the caller
+ * does the transfer itself if this is NO_ERROR.
+ *
+ */
+
+APIRET emulate_io(PEMULATOR ep, UINT cyl, UINT head, UINT first, UINT count,
+			UINT sectors, BOOL write)
+{	APIRET rc = NO_ERROR;
+	UINT n;
+
+	if(++ep->ops == ep->change) return(ERROR_DISK_CHANGE);
+	if(write == TRUE && ep->protect == TRUE) return(ERROR_WRITE_PROTECT);
+	if(write == FALSE && kept(ep, cyl, head, first, count, &rc) == TRUE)
+		return(rc);		/* No need to go to the diskette */
+
+	/* Find the first sector that fails, if any; the transfer stops
+	   once it has passed the heads */
+
+	for(n = 0; n < count && rc == NO_ERROR; n++) {
+		if(write == FALSE && is_bad(ep, cyl, head, first + n) == TRUE)
+			rc = ERROR_CRC;
+		else if(ep->faults != 0 &&
+			random_number(ep) % ep->faults == 0)
+			rc = write == TRUE ? ERROR_WRITE_FAULT : ERROR_CRC;
+	}
+	move_heads(ep, cyl, first, n, sectors);
+	if(ep->cache == TRUE) keep_track(ep, cyl, head, first, n, rc, write);
+
+	return(rc);
+}
+
+
+/*
+ * Drop any track kept by an emulated drive, so that the next read goes to
+ * the diskette.
+ *
+ */
+
+VOID emulate_flush(PEMULATOR ep)
+{	ep->cached = FALSE;
+}
+
+
+/*
+ * Emulate formatting a track on cylinder 'cyl', with 'sectors' sectors.
+ * There is nothing to do to the image file.
+ *
+ */
+
+APIRET emulate_format(PEMULATOR ep, UINT cyl, UINT sectors)
+{	if(++ep->ops == ep->change) return(ERROR_DISK_CHANGE);
+	if(ep->protect == TRUE) return(ERROR_WRITE_PROTECT);
+
+	if(ep->cached == TRUE && cyl == ep->ccyl) ep->cached = FALSE;
+	move_heads(ep, cyl, 0, sectors, sectors);
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Take the time needed to move the heads to cylinder 'cyl', wait for
+ * sector 'first' to come round, and let 'count' sectors pass the heads.
+ *
+ */
+
+static VOID move_heads(PEMULATOR ep, UINT cyl, UINT first, UINT count,
+			UINT sectors)
+{	ULONG delay = 0;		/* In microseconds */
+	ULONG rev, pos;
+
+	if(cyl != ep->cyl) {
+		delay = (ULONG) (cyl > ep->cyl ? cyl - ep->cyl : ep->cyl - cyl);
+		delay = (delay*ep->step + ep->settle) * 1000L;
+		ep->cyl = cyl;
+	}
+	if(ep->rpm != 0 && sectors != 0) {
+		rev = 60000000L / ep->rpm;
+		pos = (clock_us() + delay) % rev;
+		delay += (rev / sectors * first + rev - pos) % rev;
+		delay += rev / sectors * count;
+	}
+	if(delay >= 500L) sleep_ms((delay + 500L) / 1000L);
+}
+
+
+/*
+ * Note the outcome of a transfer of 'count' sectors from sector 'first'
+ * of a track, the last of which failed if 'rc' is not NO_ERROR. A read
+ * adds to what is kept of the track, starting afresh for a new one; a
+ * write to the kept track drops it.
+ *
+ */
+
+static VOID keep_track(PEMULATOR ep, UINT cyl, UINT head, UINT first,
+			UINT count, APIRET rc, BOOL write)
+{	UINT n;
+
+	if(ep->cached == TRUE && (cyl != ep->ccyl || head != ep->chead)) {
+		if(write == TRUE) return;
+		ep->cached = FALSE;
+	}
+	if(write == TRUE || first + count > MAXEMUSECT) {
+		ep->cached = FALSE;
+		return;
+	}
+	if(ep->cached == FALSE) {
+		memset(ep->cstate, CS_NONE, MAXEMUSECT);
+		ep->cached = TRUE;
+		ep->ccyl = cyl;
+		ep->chead = head;
+	}
+	for(n = 0; n < count; n++)
+		ep->cstate[first + n] =
+			n == count - 1 && rc != NO_ERROR ? CS_BAD : CS_GOOD;
+}
+
+
+/*
+ * Check whether a read of 'count' sectors from sector 'first' of a track
+ * can be answered from the track kept; that is, whether all of them are
+ * kept, or all up to one that failed. If so, its result is left in 'rc'.
+ * Returns TRUE if the read can be answered, else FALSE.
+ *
+ */
+
+static BOOL kept(PEMULATOR ep, UINT cyl, UINT head, UINT first, UINT count,
+			APIRET *rc)
+{	UINT n;
+
+	if(ep->cached == FALSE || cyl != ep->ccyl || head != ep->chead ||
+	   first + count > MAXEMUSECT)
+		return(FALSE);
+
+	for(n = 0; n < count; n++) {
+		if(ep->cstate[first + n] == CS_NONE) return(FALSE);
+		if(ep->cstate[first + n] == CS_BAD) {
+			*rc = ERROR_CRC;
+			return(TRUE);
+		}
+	}
+	*rc = NO_ERROR;
+
+	return(TRUE);
+}
+
+
+/*
+ * Check whether a sector is one of the bad ones.
+ *
+ */
+
+static BOOL is_bad(PEMULATOR ep, UINT cyl, UINT head, UINT sector)
+{	UINT i;
+
+	for(i = 0; i < ep->nbad; i++) {
+		if(ep->bad[i].cyl == cyl && ep->bad[i].head == head &&
+		   ep->bad[i].sector == sector)
+			return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Return the next number from a simple 32-bit xorshift generator; this is
+ * the same on every system, so a given seed always gives the same faults.
+ *
+ */
+
+static ULONG random_number(PEMULATOR ep)
+{	ULONG x = ep->seed;
+
+	x ^= (x << 13) & 0xffffffffL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xffffffffL;
+	ep->seed = x;
+
+	return(x);
+}
+
+/*
+ * End of file: emulate.c
+ *
+ */
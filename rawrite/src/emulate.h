@@ -0,0 +1,72 @@
+/*
+ * File: emulate.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for the emulated diskette drive
+ *
+ */
+
+#ifndef	_EMULATE_H
+#define	_EMULATE_H
+
+/* Miscellaneous definitions */
+
+#define	EMUPREFIX	"emu:"		/* Drive name prefix for emulation */
+#define	MAXEMUBAD	64		/* Maximum bad sectors given */
+#define	MAXEMUSECT	36		/* Most sectors on a track */
+
+#define	DEFRPM		300		/* Default rotational speed */
+#define	DEFSTEP		3		/* Default step time (ms/cylinder) */
+#define	DEFSETTLE	15		/* Default head settling time (ms) */
+
+/* Kept outcome of a sector (see the 'cache' option) */
+
+#define	CS_NONE		0		/* Not kept */
+#define	CS_GOOD		1		/* Read successfully */
+#define	CS_BAD		2		/* Failed */
+
+/* A sector that can never be read */
+
+typedef	struct _EMUBAD {
+	UINT		cyl;		/* Cylinder */
+	UINT		head;		/* Head */
+	UINT		sector;		/* Sector, from zero */
+} EMUBAD, *PEMUBAD;
+
+/* State of an emulated drive */
+
+typedef	struct _EMULATOR {
+	PUCHAR		path;		/* Backing image file */
+	UINT		rpm;		/* Rotational speed, or 0 for none */
+	UINT		step;		/* Step time per cylinder (ms) */
+	UINT		settle;		/* Head settling time (ms) */
+	BOOL		protect;	/* Write protect tab set */
+	ULONG		change;		/* Operation reporting a change, or 0 */
+	ULONG		faults;		/* 1 in this many sectors fail, or 0 */
+	ULONG		seed;		/* State of random number generator */
+	ULONG		ops;		/* Operations so far */
+	UINT		cyl;		/* Cylinder the heads are on */
+	BOOL		cache;		/* Keeps the last track read */
+	BOOL		cached;		/* A track is being kept */
+	UINT		ccyl;		/* Its cylinder */
+	UINT		chead;		/* Its head */
+	UCHAR		cstate[MAXEMUSECT];/* Kept outcome of each sector */
+	UINT		nbad;		/* Number of bad sectors */
+	EMUBAD		bad[MAXEMUBAD];	/* Bad sectors */
+} EMULATOR, *PEMULATOR;
+
+/* External references */
+
+extern	VOID	emulate_flush(PEMULATOR);
+extern	APIRET	emulate_format(PEMULATOR, UINT, UINT);
+extern	APIRET	emulate_io(PEMULATOR, UINT, UINT, UINT, UINT, UINT, BOOL);
+extern	VOID	free_emulator(PEMULATOR);
+extern	PEMULATOR new_emulator(PUCHAR);
+
+#endif
+
+/*
+ * End of file: emulate.h
+ *
+ */
@@ -0,0 +1,195 @@
+/*
+ * File: fanout.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Writing one image to several drives at once
+ *
+ */
+
+/*
+ * The image is read once, into memory, and each target drive is given its
+ * own writer thread which takes tracks straight from that shared copy.
+ * Drives therefore proceed at their own pace, and a failure on one drive
+ * (e.g. a write protected diskette) drops only that drive; the others
+ * carry on. The main thread just displays progress and reports results.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "codec.h"
+#include "diskio.h"
+#include "hash.h"
+#include "journal.h"
+#include "manifest.h"
+#include "verify.h"
+#include "rawrite.h"
+
+#ifdef	THREADS
+
+/* Forward references */
+
+static	VOID	report_target(PTARGET);
+static	VOID	show_status(PTARGET, UINT);
+static	VOID	target_thread(PVOID);
+
+
+/*
+ * Write the image to all targets that are still open. Each target's
+ * geometry must already have been set.
+ * Returns TRUE if every target was written successfully, else FALSE.
+ *
+ */
+
+BOOL write_targets(PTARGET tg, UINT ntg)
+{	PTARGET tp;
+	UINT i;
+	UINT active;			/* Writers still running */
+	UINT good = 0;			/* Targets written successfully */
+
+	for(i = 0; i < ntg; i++) {
+		tp = &tg[i];
+		if(tp->dp == (PDISK) NULL) {
+			tp->done = TRUE;
+			tp->reported = TRUE;
+			continue;
+		}
+		init_target(tp);
+
+		if(start_thread(&tp->tid, target_thread, (PVOID) tp) == FALSE) {
+			error("cannot start writer for drive %s", tp->drive);
+			tp->done = TRUE;
+			tp->reported = TRUE;
+			tp->rc = ERROR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
+	/* Show progress until all the writers have finished */
+
+	do {
+		active = 0;
+		for(i = 0; i < ntg; i++) {
+			tp = &tg[i];
+			if(tp->done == FALSE) {
+				active++;
+			} else if(tp->reported == FALSE) {
+				fputc('\n', stdout);
+				fflush(stdout);
+				report_target(tp);
+			}
+		}
+		show_status(tg, ntg);
+		if(active != 0) sleep_ms(STATUSMS);
+	} while(active != 0);
+	fputc('\n', stdout);
+	fflush(stdout);
+
+	/* Tidy up */
+
+	for(i = 0; i < ntg; i++) {
+		tp = &tg[i];
+		if(tp->dp == (PDISK) NULL) continue;
+		if(tp->tid != (TID) 0) wait_thread(tp->tid);	/* Started */
+		if(tp->rc == NO_ERROR) good++;
+	}
+
+	error("%d of %d diskettes written", good, ntg);
+
+	return(good == ntg ? TRUE : FALSE);
+}
+
+
+/*
+ * Writer thread for one target.
+ *
+ */
+
+static VOID target_thread(PVOID arg)
+{	(VOID) write_target((PTARGET) arg, FALSE);
+}
+
+
+/*
+ * Report the final result for one target.
+ *
+ */
+
+static VOID report_target(PTARGET tp)
+{	PDISK dp = tp->dp;
+
+	tp->reported = TRUE;
+	if(tp->vp != (PVERIFY) NULL) report_verify(tp->vp, tp->drive);
+	if(tp->rc == NO_ERROR) {
+		if(tp->diff == TRUE || tp->map != (PUCHAR) NULL) {
+			error(
+				"drive %s: %d of %d tracks did not need writing",
+				tp->drive,
+				tp->skipped,
+				tp->tracks);
+		}
+		return;
+	}
+
+	if(tp->rc == ERROR_WRITE_PROTECT) {
+		error("drive %s: diskette is write protected", tp->drive);
+	} else if(tp->im->broken == TRUE && tp->rc == ERROR_READ_FAULT) {
+		error("drive %s: source could not be read", tp->drive);
+	} else if(tp->rc == ERROR_CRC) {
+		error(
+			"drive %s: cylinder %d, head %d could not be written"
+			" correctly",
+			tp->drive,
+			tp->track / dp->heads,
+			tp->track % dp->heads);
+	} else {
+		error(
+			"drive %s: error writing cylinder %d, head %d",
+			tp->drive,
+			tp->track / dp->heads,
+			tp->track % dp->heads);
+	}
+}
+
+
+/*
+ * Display a single status line showing the progress of every target.
+ *
+ */
+
+static VOID show_status(PTARGET tg, UINT ntg)
+{	PTARGET tp;
+	UINT i;
+
+	fprintf(stdout, "%s:", progname);
+	for(i = 0; i < ntg; i++) {
+		tp = &tg[i];
+		if(tp->dp == (PDISK) NULL) continue;
+		if(tp->done == TRUE) {
+			fprintf(
+				stdout,
+				" %s %s",
+				tp->drive,
+				tp->rc == NO_ERROR ? "done " : "FAIL ");
+		} else {
+			fprintf(
+				stdout,
+				" %s %2d/%1d",
+				tp->drive,
+				tp->track / tp->dp->heads,
+				tp->track % tp->dp->heads);
+		}
+	}
+	fputc('\r', stdout);
+	fflush(stdout);
+}
+
+#endif
+
+/*
+ * End of file: fanout.c
+ *
+ */
@@ -0,0 +1,42 @@
+/*
+ * File: fat.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for decoding FAT file systems
+ *
+ */
+
+#ifndef	_FAT_H
+#define	_FAT_H
+
+/* Layout of a FAT file system, from the BIOS parameter block */
+
+typedef	struct _BPB {
+	UINT		spc;		/* Sectors per cluster */
+	UINT		reserved;	/* Reserved sectors (inc. boot sector) */
+	UINT		nfats;		/* Number of FATs */
+	UINT		fatsecs;	/* Sectors per FAT */
+	UINT		rootsecs;	/* Sectors in root directory */
+	UINT		sectors;	/* Sectors per track */
+	UINT		heads;		/* Number of heads */
+	ULONG		total;		/* Total sectors */
+	ULONG		datasec;	/* First sector of first cluster */
+	ULONG		clusters;	/* Number of data clusters */
+} BPB, *PBPB;
+
+/* Size of one FAT, in bytes */
+
+#define	FATSIZE(bp)	((ULONG) (bp)->fatsecs*BLKSIZE)
+
+/* External references */
+
+extern	PUCHAR	fat_tracks(PUCHAR, PBPB, UINT, UINT);
+extern	BOOL	read_bpb(PUCHAR, PBPB);
+
+#endif
+
+/*
+ * End of file: fat.h
+ *
+ */
@@ -0,0 +1,289 @@
+/*
+ * File: image.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Whole image handling
+ *
+ */
+
+/*
+ * Where the system allows it, the image file is memory mapped and tracks
+ * are handed to the device layer as views straight into the mapping; there
+ * is no copy through stdio, and no clearing of a track buffer for every
+ * track. Only a final partial track needs a (single, small) padded copy.
+ * Elsewhere (or if the image is compressed) the image is simply read into
+ * memory in one go.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef	MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "codec.h"
+#include "diskio.h"
+#include "hash.h"
+#include "journal.h"
+#include "manifest.h"
+#include "verify.h"
+#include "rawrite.h"
+
+/* Forward references */
+
+static	BOOL	read_image(PIMAGE, PSTREAM);
+
+
+/*
+ * Load a complete image file. At most the capacity of the largest
+ * diskette is used; anything beyond that could never be written.
+ * Returns pointer to the image, or NULL on failure.
+ *
+ */
+
+PIMAGE load_image(PSTREAM sp)
+{	PIMAGE im;
+#ifdef	MMAP
+	struct stat statbuf;		/* Image file status buffer */
+	PVOID p;
+#endif
+
+	im = (PIMAGE) calloc(1, sizeof(IMAGE));
+	if(im == (PIMAGE) NULL) {
+		error("cannot allocate memory for image");
+		return((PIMAGE) NULL);
+	}
+
+#ifdef	MMAP
+	if(sp->codec == CODEC_NONE &&
+	   fstat(fileno(sp->fp), &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+	   statbuf.st_size != 0) {
+		im->size = statbuf.st_size > ED_MAX ?
+				ED_MAX : (ULONG) statbuf.st_size;
+		p = mmap(
+			(PVOID) NULL,
+			im->size,
+			PROT_READ,
+			MAP_PRIVATE,
+			fileno(sp->fp),
+			0);
+		if(p != MAP_FAILED) {
+			(VOID) madvise(p, im->size, MADV_SEQUENTIAL);
+			im->data = (PUCHAR) p;
+			im->mapped = TRUE;
+		}
+	}
+	if(im->mapped == FALSE)
+#endif
+	{
+		if(read_image(im, sp) == FALSE) {
+			free((PIMAGE) im);
+			return((PIMAGE) NULL);
+		}
+	}
+
+	/* Make the padded copy of any final partial track. An empty image
+	   still writes one (blank) track. */
+
+	im->full = (im->size / MAXTRACK) * MAXTRACK;
+	if(im->full != im->size || im->size == 0) {
+		im->tail = alloc_buffer(MAXTRACK);
+		if(im->tail == (PUCHAR) NULL) {
+			error("cannot allocate memory for image");
+			free_image(im);
+			return((PIMAGE) NULL);
+		}
+		memcpy(im->tail, im->data + im->full, im->size - im->full);
+		memset(im->tail + (im->size - im->full), '\0',
+			MAXTRACK - (im->size - im->full));
+	}
+	im->avail = im->size;
+
+	return(im);
+}
+
+
+/*
+ * Create an empty image of 'size' bytes, which must be a whole number of
+ * tracks, to be filled in later while up to 'writers' targets wait for
+ * it (see wait_image). With no writers, the image must be complete before
+ * any writing starts.
+ * Returns pointer to the image, or NULL on failure.
+ *
+ */
+
+PIMAGE new_image(ULONG size, UINT writers)
+{	PIMAGE im;
+	UINT i;
+
+	im = (PIMAGE) calloc(1, sizeof(IMAGE));
+	if(im == (PIMAGE) NULL) {
+		error("cannot allocate memory for image");
+		return((PIMAGE) NULL);
+	}
+	im->size = size;
+	im->full = size;
+	im->data = alloc_buffer(size);
+	if(im->data == (PUCHAR) NULL) {
+		error("cannot allocate memory for image");
+		free_image(im);
+		return((PIMAGE) NULL);
+	}
+	if(writers == 0) return(im);
+
+	if(create_sem(&im->lock, 1) == FALSE) {
+		error("cannot create semaphore for image");
+		free_image(im);
+		return((PIMAGE) NULL);
+	}
+	im->ready = (PSEM) calloc(writers, sizeof(SEM));
+	if(im->ready == (PSEM) NULL) {
+		error("cannot allocate memory for image");
+		delete_sem(&im->lock);
+		free_image(im);
+		return((PIMAGE) NULL);
+	}
+	for(i = 0; i < writers; i++) {
+		if(create_sem(&im->ready[i], 0) == FALSE) {
+			error("cannot create semaphore for image");
+			free_image(im);
+			return((PIMAGE) NULL);
+		}
+		im->writers++;
+	}
+
+	return(im);
+}
+
+
+/*
+ * Record that 'len' more bytes of an image are present or, if 'len' is
+ * zero, that filling it has failed, and tell every writer. The change is
+ * made under the image lock, so that a writer that sees it also sees the
+ * data that was filled in before it.
+ *
+ */
+
+VOID post_image(PIMAGE im, ULONG len)
+{	UINT i;
+
+	wait_sem(&im->lock);
+	if(len == 0)
+		im->broken = TRUE;
+	else
+		im->avail += len;
+	post_sem(&im->lock);
+
+	for(i = 0; i < im->writers; i++)
+		post_sem(&im->ready[i]);
+}
+
+
+/*
+ * Wait, as writer 'n', until the first 'len' bytes of an image are
+ * present; a final partial track only needs the rest of the image.
+ * Progress is always read under the image lock, even when no waiting is
+ * needed. Posts left over from tracks that were already there just cost
+ * a recheck.
+ * Returns TRUE when they are, or FALSE if filling the image has failed.
+ *
+ */
+
+BOOL wait_image(PIMAGE im, ULONG len, UINT n)
+{	ULONG avail;
+	BOOL broken;
+
+	if(len > im->size) len = im->size;
+	if(im->writers == 0) return(TRUE);	/* Complete before writing */
+
+	for(;;) {
+		wait_sem(&im->lock);
+		avail = im->avail;
+		broken = im->broken;
+		post_sem(&im->lock);
+		if(avail >= len) return(TRUE);
+		if(broken == TRUE) return(FALSE);
+		wait_sem(&im->ready[n]);
+	}
+}
+
+
+/*
+ * Read a complete image file into memory, when it cannot be mapped.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+static BOOL read_image(PIMAGE im, PSTREAM sp)
+{	ULONG n;
+
+	im->data = alloc_buffer(ED_MAX);
+	if(im->data == (PUCHAR) NULL) {
+		error("cannot allocate memory for image");
+		return(FALSE);
+	}
+
+	n = read_stream(sp, im->data, ED_MAX);
+	if(sp->error == TRUE) {
+		error("error reading image file");
+		free_buffer(im->data);
+		return(FALSE);
+	}
+	im->size = n;
+
+	return(TRUE);
+}
+
+
+/*
+ * Return a pointer to track 't' of the image, for a track length of
+ * 'tlen' bytes.
+ *
+ */
+
+PUCHAR image_track(PIMAGE im, ULONG tlen, UINT t)
+{	ULONG off = (ULONG) t*tlen;
+
+	if(off + tlen <= im->full) return(im->data + off);
+
+	return(im->tail + (off - im->full));
+}
+
+
+/*
+ * Free an image loaded by load_image.
+ *
+ */
+
+VOID free_image(PIMAGE im)
+{	UINT i;
+
+#ifdef	MMAP
+	if(im->mapped == TRUE)
+		(VOID) munmap((PVOID) im->data, im->size);
+	else
+#endif
+	if(im->data != (PUCHAR) NULL)
+		free_buffer(im->data);
+	if(im->tail != (PUCHAR) NULL)
+		free_buffer(im->tail);
+	if(im->ready != (PSEM) NULL) {
+		for(i = 0; i < im->writers; i++)
+			delete_sem(&im->ready[i]);
+		free((PSEM) im->ready);
+		delete_sem(&im->lock);
+	}
+	free((PIMAGE) im);
+}
+
+/*
+ * End of file: image.c
+ *
+ */
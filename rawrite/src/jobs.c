@@ -0,0 +1,483 @@
+/*
+ * File: jobs.c
+ *
+ * Diskette raw image utilities
+ *
+ * Job files
+ *
+ */
+
+/*
+ * A job file lists a series of diskettes to be done in one run, so that
+ * the drive is opened and locked only once, and track buffers are kept
+ * from one diskette to the next. There is one job on each line:
+ *
+ *	[-d|-h|-e] [-m manifest] imagefile
+ *
+ * giving the image file to be written to (or read from) the diskette, and
+ * optionally the diskette type and a manifest file for that diskette alone.
+ * Blank lines, and lines starting with '#', are ignored. The whole file is
+ * checked before any diskette is touched.
+ *
+ * Where threads are available, several drives may share the one queue of
+ * jobs. Each drive has its own thread, which takes the next job from the
+ * queue whenever it finishes one; so a slow drive, or one spending a long
+ * time on a damaged diskette, simply does fewer of the jobs while the
+ * others carry on. Only the taking of a job (and asking the operator for
+ * its diskette) is done under the queue lock.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskio.h"
+#include "jobs.h"
+
+/* Miscellaneous definitions */
+
+#define	MAXLINE		256		/* Longest line in job file */
+#define	SEPS		" \t\r\n"	/* Separators between words */
+
+/* Forward references */
+
+static	PUCHAR	copy_string(PUCHAR);
+#ifdef	THREADS
+static	VOID	drive_thread(PVOID);
+#endif
+static	BOOL	parse_job(PJOB, PUCHAR, PUCHAR);
+static	VOID	run_drive(PJOBDRIVE);
+static	PJOB	take_job(PJOBDRIVE, BOOL);
+
+
+/*
+ * Read the job file 'name', setting *count to the number of jobs. Jobs
+ * not giving a diskette type are given 'type'.
+ * Returns a pointer to the first job, or NULL on failure (already
+ * reported); an empty job file is an error.
+ *
+ */
+
+PJOB read_jobs(PUCHAR name, INT type, PUINT count)
+{	FILE *fp;
+	UCHAR line[MAXLINE];
+	PUCHAR p;
+	PJOB first = (PJOB) NULL;
+	PJOB last = (PJOB) NULL;
+	PJOB jp;
+	UINT lineno = 0;
+	BOOL ok = TRUE;
+
+	*count = 0;
+	fp = fopen(name, "r");
+	if(fp == (FILE *) NULL) {
+		error("cannot open job file '%s'", name);
+		return((PJOB) NULL);
+	}
+
+	while(ok == TRUE && fgets(line, MAXLINE, fp) != (char *) NULL) {
+		lineno++;
+		if(strchr(line, '\n') == (char *) NULL && !feof(fp)) {
+			error(
+				"job file '%s', line %u: line too long",
+				name,
+				lineno);
+			ok = FALSE;
+			break;
+		}
+		p = line + strspn(line, SEPS);
+		if(*p == '\0' || *p == '#') continue;
+
+		jp = (PJOB) calloc(1, sizeof(JOB));
+		if(jp == (PJOB) NULL) {
+			error("cannot allocate memory for job");
+			ok = FALSE;
+			break;
+		}
+		jp->line = lineno;
+		jp->number = ++*count;
+		if(last == (PJOB) NULL)
+			first = jp;
+		else
+			last->next = jp;
+		last = jp;
+
+		ok = parse_job(jp, p, name);
+		if(jp->type == TY_UNKNOWN) jp->type = type;
+	}
+	if(ferror(fp)) {
+		error("error reading job file '%s'", name);
+		ok = FALSE;
+	}
+	fclose(fp);
+
+	if(ok == TRUE && first == (PJOB) NULL) {
+		error("job file '%s' contains no jobs", name);
+		ok = FALSE;
+	}
+	if(ok == FALSE) {
+		free_jobs(first);
+		return((PJOB) NULL);
+	}
+
+	return(first);
+}
+
+
+/*
+ * Decode one line 'p' of the job file 'name' into the job 'jp'.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL parse_job(PJOB jp, PUCHAR p, PUCHAR name)
+{	PUCHAR w;
+	PUCHAR v;
+
+	jp->type = TY_UNKNOWN;
+
+	for(w = strtok(p, SEPS); w != (PUCHAR) NULL;
+	    w = strtok((PUCHAR) NULL, SEPS)) {
+		if(w[0] != '-' || w[1] == '\0') {
+			if(jp->file != (PUCHAR) NULL) {
+				error(
+					"job file '%s', line %u: more than"
+					" one image file",
+					name,
+					jp->line);
+				return(FALSE);
+			}
+			jp->file = copy_string(w);
+			if(jp->file == (PUCHAR) NULL) return(FALSE);
+			continue;
+		}
+
+		switch(w[1]) {
+			case 'D':
+			case 'd':
+				jp->type = TY_DD;
+				break;
+
+			case 'H':
+			case 'h':
+				jp->type = TY_HD;
+				break;
+
+			case 'E':
+			case 'e':
+				jp->type = TY_ED;
+				break;
+
+			case 'M':
+			case 'm':
+				v = w[2] != '\0' ? &w[2] :
+					(PUCHAR) strtok((PUCHAR) NULL, SEPS);
+				if(v == (PUCHAR) NULL) {
+					error(
+						"job file '%s', line %u: no"
+						" manifest file given",
+						name,
+						jp->line);
+					return(FALSE);
+				}
+				if(jp->manifest != (PUCHAR) NULL)
+					free((PUCHAR) jp->manifest);
+				jp->manifest = copy_string(v);
+				if(jp->manifest == (PUCHAR) NULL) return(FALSE);
+				break;
+
+			default:
+				error(
+					"job file '%s', line %u: unknown"
+					" flag '%s'",
+					name,
+					jp->line,
+					w);
+				return(FALSE);
+		}
+	}
+
+	if(jp->file == (PUCHAR) NULL) {
+		error("job file '%s', line %u: no image file", name, jp->line);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Make a copy of a string, reporting any failure.
+ *
+ */
+
+static PUCHAR copy_string(PUCHAR s)
+{	PUCHAR p;
+
+	p = (PUCHAR) malloc(strlen(s) + 1);
+	if(p == (PUCHAR) NULL) {
+		error("cannot allocate memory for job");
+		return((PUCHAR) NULL);
+	}
+
+	return(strcpy(p, s));
+}
+
+
+/*
+ * Free a list of jobs.
+ *
+ */
+
+VOID free_jobs(PJOB jp)
+{	PJOB next;
+
+	while(jp != (PJOB) NULL) {
+		next = jp->next;
+		if(jp->file != (PUCHAR) NULL) free((PUCHAR) jp->file);
+		if(jp->manifest != (PUCHAR) NULL) free((PUCHAR) jp->manifest);
+		free((PJOB) jp);
+		jp = next;
+	}
+}
+
+
+/*
+ * Do the jobs starting at 'first' ('count' of them in all), sharing them
+ * between the drives listed in 'drives', which are opened for writing if
+ * 'write' is TRUE. Each job is done by calling 'fn'. A drive that cannot be
+ * opened is left out, and a job that fails does not stop the rest. With a
+ * single drive, the first diskette should already be in the drive.
+ * Returns TRUE if every job was done successfully, else FALSE.
+ *
+ */
+
+BOOL run_jobs(PJOB first, UINT count, PUCHAR drives[], UINT ndrives,
+		BOOL write, PJOBFN fn)
+{	JOBQUEUE q;			/* The shared queue */
+	JOBDRIVE jd[MAXDRIVES];		/* The drives */
+	PJOBDRIVE jdp;
+	UINT i;
+	UINT open = 0;			/* Drives opened */
+	UINT done = 0;			/* Jobs done successfully */
+	UINT failed = 0;		/* Jobs that failed */
+
+	memset(&q, 0, sizeof(JOBQUEUE));
+	q.next = first;
+	q.count = count;
+	q.fn = fn;
+	memset(jd, 0, sizeof(jd));
+
+	for(i = 0; i < ndrives; i++) {
+		jdp = &jd[i];
+		jdp->drive = drives[i];
+		jdp->qp = &q;
+		jdp->dp = open_disk(drives[i], write);
+		if(jdp->dp != (PDISK) NULL) open++;
+	}
+	if(open == 0)
+		return(FALSE);
+
+	q.prompt = open > 1 ? TRUE : FALSE;
+#ifdef	THREADS
+	if(open > 1) {
+		if(create_sem(&q.lock, 1) == TRUE)
+			q.threaded = TRUE;
+		else
+			error("cannot create semaphore; using one drive");
+	}
+	if(q.threaded == TRUE) {	/* Each drive takes its own jobs */
+		for(i = 0; i < ndrives; i++) {
+			jdp = &jd[i];
+			if(jdp->dp == (PDISK) NULL) continue;
+			if(start_thread(&jdp->tid, drive_thread, (PVOID) jdp) ==
+			   FALSE) {
+				error(
+					"cannot start thread for drive %s",
+					jdp->drive);
+				jdp->tid = (TID) 0;
+			}
+		}
+		for(i = 0; i < ndrives; i++) {
+			if(jd[i].tid != (TID) 0) wait_thread(jd[i].tid);
+		}
+		delete_sem(&q.lock);
+	} else
+#endif
+	for(i = 0; i < ndrives; i++) {
+		if(jd[i].dp != (PDISK) NULL) run_drive(&jd[i]);
+	}
+
+	/* Report on each drive, and tidy up */
+
+	for(i = 0; i < ndrives; i++) {
+		jdp = &jd[i];
+		if(jdp->dp == (PDISK) NULL) continue;
+		if(jdp->ms != 0) {
+			error(
+				"drive %s: %d jobs done, %d failed; %lu KB"
+				" in %lu.%03lu seconds (%lu KB/s)",
+				jdp->drive,
+				jdp->done,
+				jdp->failed,
+				jdp->kbytes,
+				jdp->ms / 1000L,
+				jdp->ms % 1000L,
+				jdp->kbytes*1000L / jdp->ms);
+		} else {
+			error(
+				"drive %s: %d jobs done, %d failed; %lu KB",
+				jdp->drive,
+				jdp->done,
+				jdp->failed,
+				jdp->kbytes);
+		}
+		done += jdp->done;
+		failed += jdp->failed;
+		close_disk(jdp->dp);
+	}
+	error(
+		"%d of %d jobs done successfully, %d failed",
+		done,
+		count,
+		failed);
+
+	return(done == count ? TRUE : FALSE);
+}
+
+#ifdef	THREADS
+
+/*
+ * Thread for one drive.
+ *
+ */
+
+static VOID drive_thread(PVOID arg)
+{	run_drive((PJOBDRIVE) arg);
+}
+
+#endif
+
+
+/*
+ * Do jobs on one drive, until there are none left. The time for each job
+ * is counted from when it has been taken, and its diskette inserted.
+ *
+ */
+
+static VOID run_drive(PJOBDRIVE jdp)
+{	APIRET rc;
+	PDISK dp = jdp->dp;
+	PJOB jp;
+	ULONG start;			/* Time job started (us) */
+	ULONG kbytes;			/* Size of diskette */
+	BOOL first = TRUE;		/* First job on this drive */
+	BOOL res;
+
+	for(;;) {
+		jp = take_job(jdp, first);
+		if(jp == (PJOB) NULL) break;
+		first = FALSE;
+
+		error(
+			"drive %s: job %d of %d, image file '%s'",
+			jdp->drive,
+			jp->number,
+			jdp->qp->count,
+			jp->file);
+		start = clock_us();
+		res = (*jdp->qp->fn)(jp, dp);
+		kbytes = (ULONG) dp->cyls*dp->heads*dp->sectors*BLKSIZE / 1024;
+
+		rc = change_disk(dp);	/* Flushes this diskette */
+		if(rc != NO_ERROR) {
+			error(
+				"drive %s: error writing diskette, rc = %d",
+				jdp->drive,
+				rc);
+			res = FALSE;
+		}
+		jdp->ms += (clock_us() - start) / 1000L;
+		if(res == TRUE) {
+			jdp->done++;
+			jdp->kbytes += kbytes;
+		} else {
+			jdp->failed++;
+			error(
+				"drive %s: job %d ('%s') failed",
+				jdp->drive,
+				jp->number,
+				jp->file);
+		}
+	}
+}
+
+
+/*
+ * Take the next job from the queue, for the drive 'jdp'. Unless this is
+ * the first job on the only drive, the operator is asked for its diskette.
+ * Returns a pointer to the job, or NULL if there are no more (or the
+ * operator has asked to stop).
+ *
+ */
+
+static PJOB take_job(PJOBDRIVE jdp, BOOL first)
+{	PJOBQUEUE qp = jdp->qp;
+	PJOB jp;
+
+#ifdef	THREADS
+	if(qp->threaded == TRUE) wait_sem(&qp->lock);
+#endif
+	jp = qp->stop == TRUE ? (PJOB) NULL : qp->next;
+	if(jp != (PJOB) NULL) {
+		if((first == FALSE || qp->prompt == TRUE) &&
+		   ask_disk("diskette", jp->file, jdp->drive) == FALSE) {
+			qp->stop = TRUE;
+			jp = (PJOB) NULL;
+		} else {
+			qp->next = jp->next;
+		}
+	}
+#ifdef	THREADS
+	if(qp->threaded == TRUE) post_sem(&qp->lock);
+#endif
+
+	return(jp);
+}
+
+
+/*
+ * Ask the operator to put a diskette ('what', for file 'name' if that is
+ * not NULL) in 'drive', and wait until this has been done. Returns TRUE
+ * to go on, or FALSE if the operator asks to stop (or there is no more
+ * input).
+ *
+ */
+
+BOOL ask_disk(PUCHAR what, PUCHAR name, PUCHAR drive)
+{	UCHAR line[MAXLINE];
+
+	fprintf(stderr, "%s: insert %s", progname, what);
+	if(name != (PUCHAR) NULL) fprintf(stderr, " for '%s'", name);
+	fprintf(
+		stderr,
+		" in drive %s, then press Enter (or Q to stop): ",
+		drive);
+	fflush(stderr);
+
+	if(fgets(line, MAXLINE, stdin) == (char *) NULL) {
+		fputc('\n', stderr);
+		return(FALSE);
+	}
+	if(line[0] == 'Q' || line[0] == 'q') return(FALSE);
+
+	return(TRUE);
+}
+
+/*
+ * End of file: jobs.c
+ *
+ */
@@ -0,0 +1,382 @@
+/*
+ * File: journal.c
+ *
+ * Diskette raw image utilities
+ *
+ * Transfer journals, for resuming interrupted transfers
+ *
+ */
+
+/*
+ * When a transfer may need to be resumed, a journal is kept beside the
+ * image file, with the same name but the extension '.jnl'. It records the
+ * geometry and the direction of the transfer, and then the CRC32C of each
+ * track as it is completed:
+ *
+ *	journal <read|write> <cylinders> <heads> <sectors>
+ *	track <cylinder> <head> <crc32c>
+ *	...
+ *
+ * Each line is flushed as soon as it is written, so after an interruption
+ * the journal shows how far the transfer got (a final line cut short is
+ * ignored, and cut off before the journal is added to). The CRCs between
+ * them act as a hash of the part of the image already done: on resuming,
+ * that part of the image is checked against them, and so is the last
+ * track done on the diskette, before carrying on from the first track not
+ * done. The journal is removed once the transfer is complete.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskio.h"
+#include "hash.h"
+#include "journal.h"
+
+/* Miscellaneous definitions */
+
+#define	MAXLINE		80		/* Longest line in journal */
+
+/* Forward references */
+
+static	BOOL	alloc_crc(PJOURNAL);
+static	BOOL	read_journal(PJOURNAL, FILE *);
+
+/* Local storage */
+
+static	const	PUCHAR dirname[] = { "read", "write" };
+
+
+/*
+ * Load the journal for the image file 'image', for a transfer in direction
+ * 'dir'. If there is no journal yet, an empty one is returned, showing no
+ * tracks done.
+ * Returns pointer to the journal, or NULL on failure (already reported).
+ *
+ */
+
+PJOURNAL load_journal(PUCHAR image, INT dir)
+{	PJOURNAL jp;
+	PUCHAR p;
+	FILE *fp;
+	size_t n;
+
+	/* The journal name is the image name, with its extension (if any)
+	   replaced */
+
+	p = strrchr(image, '.');
+	n = p != (PUCHAR) NULL && strchr(p, PATHSEP) == (char *) NULL ?
+		(size_t) (p - image) : strlen(image);
+
+	jp = (PJOURNAL) calloc(1, sizeof(JOURNAL));
+	if(jp != (PJOURNAL) NULL) {
+		jp->name = (PUCHAR) malloc(n + sizeof(JNEXT));
+		if(jp->name == (PUCHAR) NULL) {
+			free((PJOURNAL) jp);
+			jp = (PJOURNAL) NULL;
+		}
+	}
+	if(jp == (PJOURNAL) NULL) {
+		error("cannot allocate memory for journal");
+		return((PJOURNAL) NULL);
+	}
+	memcpy(jp->name, image, n);
+	strcpy(jp->name + n, JNEXT);
+	jp->dir = dir;
+
+	fp = fopen(jp->name, "r");
+	if(fp != (FILE *) NULL) {
+		if(read_journal(jp, fp) == FALSE) {
+			(VOID) fclose(fp);
+			(VOID) end_journal(jp, FALSE);
+			return((PJOURNAL) NULL);
+		}
+		(VOID) fclose(fp);
+	}
+
+	return(jp);
+}
+
+
+/*
+ * Read an existing journal file, noting where its last complete line
+ * ends.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL read_journal(PJOURNAL jp, FILE *fp)
+{	UCHAR line[MAXLINE];
+	UCHAR dir[MAXLINE];
+	UINT cyl, head;
+	ULONG crc;
+	UINT lineno = 0;
+
+	while(fgets(line, MAXLINE, fp) != (char *) NULL) {
+		lineno++;
+		if(strchr(line, '\n') == (char *) NULL)
+			break;			/* Cut short; ignore */
+		jp->length = (ULONG) ftell(fp);
+		if(line[0] == '#' || line[0] == '\n') continue;
+		if(jp->cyls == 0 &&
+		   sscanf(
+			line,
+			"journal %s %u %u %u",
+			dir,
+			&jp->cyls,
+			&jp->heads,
+			&jp->sectors) == 4) {
+			if(strcmp(dir, dirname[jp->dir]) != 0) {
+				error(
+					"journal file '%s' is not for a %s;"
+					" delete it to start again",
+					jp->name,
+					jp->dir == JN_READ ? "read" : "write");
+				return(FALSE);
+			}
+			if(jp->cyls == 0 || jp->heads == 0 ||
+			   jp->sectors == 0 ||
+			   jp->sectors > MAXTRACK/BLKSIZE) {
+				jp->cyls = 0;
+				break;
+			}
+			if(alloc_crc(jp) == FALSE)
+				return(FALSE);
+			continue;
+		}
+		if(jp->cyls != 0 &&
+		   sscanf(line, "track %u %u %lx", &cyl, &head, &crc) == 3 &&
+		   jp->done < jp->cyls*jp->heads &&
+		   cyl*jp->heads + head == jp->done) {
+			jp->crc[jp->done++] = (WORD32) crc;
+			continue;
+		}
+		error(
+			"journal file '%s' is invalid at line %d;"
+			" delete it to start again",
+			jp->name,
+			lineno);
+		return(FALSE);
+	}
+	if(jp->cyls == 0) {
+		error(
+			"journal file '%s' is invalid;"
+			" delete it to start again",
+			jp->name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Allocate the table of track CRCs, once the geometry is known.
+ *
+ */
+
+static BOOL alloc_crc(PJOURNAL jp)
+{	jp->crc = (WORD32 *) calloc(jp->cyls*jp->heads, sizeof(WORD32));
+	if(jp->crc == (WORD32 *) NULL) {
+		error("cannot allocate memory for journal");
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Return the diskette type recorded in a journal, or TY_UNKNOWN if no
+ * tracks have been done yet.
+ *
+ */
+
+INT journal_type(PJOURNAL jp)
+{	if(jp->done == 0) return(TY_UNKNOWN);
+
+	switch(jp->sectors) {
+		case 9:
+			return(TY_DD);
+
+		case 18:
+			return(TY_HD);
+
+		default:
+			return(TY_ED);
+	}
+}
+
+
+/*
+ * Start (or carry on) recording in the journal, for a transfer to or from
+ * a disk whose geometry has been set. If tracks have already been done,
+ * the geometry must be the same, and any line cut short at the end of the
+ * journal is removed, so that the next one does not run on from it.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL start_journal(PJOURNAL jp, PDISK dp)
+{	if(jp->done != 0) {
+		if(dp->cyls != jp->cyls || dp->heads != jp->heads ||
+		   dp->sectors != jp->sectors) {
+			error(
+				"journal file '%s' is for a diskette with"
+				" %d cylinders, %d heads, %d sectors per track",
+				jp->name,
+				jp->cyls,
+				jp->heads,
+				jp->sectors);
+			return(FALSE);
+		}
+		jp->fp = fopen(jp->name, "a");
+		if(jp->fp != (FILE *) NULL &&
+		   truncate_file(fileno(jp->fp), jp->length) == FALSE) {
+			(VOID) fclose(jp->fp);
+			jp->fp = (FILE *) NULL;
+		}
+	} else {
+		if(jp->crc != (WORD32 *) NULL) free((WORD32 *) jp->crc);
+		jp->cyls = dp->cyls;
+		jp->heads = dp->heads;
+		jp->sectors = dp->sectors;
+		if(alloc_crc(jp) == FALSE)
+			return(FALSE);
+		jp->fp = fopen(jp->name, "w");
+		if(jp->fp != (FILE *) NULL) {
+			fprintf(
+				jp->fp,
+				"# Diskette transfer journal, written by %s\n",
+				progname);
+			fprintf(
+				jp->fp,
+				"journal %s %u %u %u\n",
+				dirname[jp->dir],
+				jp->cyls,
+				jp->heads,
+				jp->sectors);
+		}
+	}
+	if(jp->fp == (FILE *) NULL || fflush(jp->fp) != 0) {
+		error("cannot write journal file '%s'", jp->name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Record the next track as completed; 'buf' holds its data. A failure to
+ * write the journal is reported once, and the transfer carries on.
+ *
+ */
+
+VOID journal_track(PJOURNAL jp, PUCHAR buf)
+{	UINT t = jp->done;
+	WORD32 crc;
+
+	if(jp->fp == (FILE *) NULL || t >= jp->cyls*jp->heads) return;
+
+	crc = crc32c(0, buf, (ULONG) jp->sectors*BLKSIZE);
+	jp->crc[jp->done++] = crc;
+	if(jp->failed == TRUE) return;
+
+	fprintf(
+		jp->fp,
+		"track %u %u %08lx\n",
+		t / jp->heads,
+		t % jp->heads,
+		(ULONG) crc);
+	if(fflush(jp->fp) != 0 || ferror(jp->fp)) {
+		error("\nerror writing journal file '%s'", jp->name);
+		jp->failed = TRUE;
+	}
+}
+
+
+/*
+ * Check that track 't' (already done) holds the data recorded in the
+ * journal; 'buf' holds its data.
+ * Returns TRUE if it does, else FALSE.
+ *
+ */
+
+BOOL journal_match(PJOURNAL jp, UINT t, PUCHAR buf)
+{	return(t < jp->done &&
+	       crc32c(0, buf, (ULONG) jp->sectors*BLKSIZE) == jp->crc[t] ?
+		TRUE : FALSE);
+}
+
+
+/*
+ * Check that the diskette in a drive (with its geometry set) is the one
+ * the journal was made for, by reading the last track done and checking
+ * it against the journal. Nothing is checked if no tracks have been done.
+ * If all is well, the point at which the transfer resumes is shown.
+ * Returns TRUE if all is well, FALSE if not (already reported).
+ *
+ */
+
+BOOL journal_disk(PJOURNAL jp, PDISK dp)
+{	PUCHAR buf;
+	UINT t;
+	BOOL res;
+
+	if(jp->done == 0) return(TRUE);
+
+	buf = alloc_track(dp);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for track buffer");
+		return(FALSE);
+	}
+	t = jp->done - 1;
+	res = read_track(dp, t / dp->heads, t % dp->heads, buf) == NO_ERROR &&
+	      journal_match(jp, t, buf) == TRUE ? TRUE : FALSE;
+	free_track(dp, buf);
+	if(res == FALSE) {
+		error(
+			"diskette in drive %s does not match journal file '%s';"
+			" cannot resume",
+			dp->drive,
+			jp->name);
+	} else if(jp->done < jp->cyls*jp->heads) {
+		error(
+			"resuming at cylinder %d, head %d",
+			jp->done / jp->heads,
+			jp->done % jp->heads);
+	}
+
+	return(res);
+}
+
+
+/*
+ * Close and free a journal. If 'complete' is TRUE, the transfer is done,
+ * and the journal file is removed.
+ * Returns TRUE on success, FALSE if the journal could not be written.
+ *
+ */
+
+BOOL end_journal(PJOURNAL jp, BOOL complete)
+{	BOOL res = jp->failed == TRUE ? FALSE : TRUE;
+
+	if(jp->fp != (FILE *) NULL && fclose(jp->fp) != 0) res = FALSE;
+	if(complete == TRUE && jp->fp != (FILE *) NULL)
+		(VOID) remove(jp->name);
+	if(jp->crc != (WORD32 *) NULL) free((WORD32 *) jp->crc);
+	free((PUCHAR) jp->name);
+	free((PJOURNAL) jp);
+
+	return(res);
+}
+
+/*
+ * End of file: journal.c
+ *
+ */
@@ -0,0 +1,133 @@
+/*
+ * File: manifest.c
+ *
+ * Diskette raw image utilities
+ *
+ * Track hash manifests
+ *
+ */
+
+/*
+ * A manifest is a small text file, kept alongside an image, that records
+ * the diskette geometry and the CRC32C and SHA-256 of every track, and of
+ * the image as a whole. The hashes are computed on the track buffers as
+ * they pass through, so no extra reading of the image or the diskette is
+ * needed. The format is:
+ *
+ *	geometry <cylinders> <heads> <sectors>
+ *	track <cylinder> <head> <crc32c> <sha256>
+ *	...
+ *	image <tracks> <crc32c> <sha256>
+ *
+ * with the CRC as eight hex digits and the SHA-256 as 64. Lines starting
+ * with '#' are comments.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "manifest.h"
+
+/* Forward references */
+
+static	VOID	put_hashes(PMANIFEST, WORD32, PSHA256);
+
+
+/*
+ * Create the manifest file 'name' for a diskette with the given geometry.
+ * Returns a pointer to the manifest, or NULL on failure (already reported).
+ *
+ */
+
+PMANIFEST open_manifest(PUCHAR name, UINT cyls, UINT heads, UINT sectors)
+{	PMANIFEST mp;
+
+	mp = (PMANIFEST) calloc(1, sizeof(MANIFEST));
+	if(mp == (PMANIFEST) NULL) {
+		error("cannot allocate memory for manifest");
+		return((PMANIFEST) NULL);
+	}
+
+	mp->fp = fopen(name, "w");
+	if(mp->fp == (FILE *) NULL) {
+		error("cannot create manifest file '%s'", name);
+		free((PMANIFEST) mp);
+		return((PMANIFEST) NULL);
+	}
+	mp->name = name;
+	mp->heads = heads;
+	sha256_init(&mp->sha);
+
+	fprintf(mp->fp, "# Diskette image manifest, written by %s\n", progname);
+	fprintf(mp->fp, "geometry %u %u %u\n", cyls, heads, sectors);
+
+	return(mp);
+}
+
+
+/*
+ * Add the next track, 'len' bytes at 'buf', to the manifest.
+ *
+ */
+
+VOID manifest_track(PMANIFEST mp, PUCHAR buf, ULONG len)
+{	SHA256 sha;
+
+	sha256_init(&sha);
+	sha256_update(&sha, buf, len);
+	sha256_update(&mp->sha, buf, len);
+	mp->crc = crc32c(mp->crc, buf, len);
+
+	fprintf(mp->fp, "track %u %u",
+		mp->tracks / mp->heads, mp->tracks % mp->heads);
+	put_hashes(mp, crc32c(0, buf, len), &sha);
+	mp->tracks++;
+}
+
+
+/*
+ * Write the whole image hashes and close the manifest.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL close_manifest(PMANIFEST mp)
+{	BOOL res = TRUE;
+
+	fprintf(mp->fp, "image %u", mp->tracks);
+	put_hashes(mp, mp->crc, &mp->sha);
+
+	if(ferror(mp->fp) || fclose(mp->fp) != 0) {
+		error("error writing manifest file '%s'", mp->name);
+		res = FALSE;
+	}
+	free((PMANIFEST) mp);
+
+	return(res);
+}
+
+
+/*
+ * Finish off a manifest line with a CRC and a (completed) SHA-256.
+ *
+ */
+
+static VOID put_hashes(PMANIFEST mp, WORD32 crc, PSHA256 sp)
+{	UCHAR digest[SHA256LEN];
+	INT i;
+
+	sha256_final(sp, digest);
+
+	fprintf(mp->fp, " %08lx ", (ULONG) crc);
+	for(i = 0; i < SHA256LEN; i++)
+		fprintf(mp->fp, "%02x", digest[i]);
+	fputc('\n', mp->fp);
+}
+
+/*
+ * End of file: manifest.c
+ *
+ */
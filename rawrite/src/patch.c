@@ -0,0 +1,442 @@
+/*
+ * File: patch.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Patches turning one image into another
+ *
+ */
+
+/*
+ * A patch holds only the sectors that differ between a base image and a
+ * new one, so that an updated boot diskette can be sent out as a few
+ * kilobytes rather than a whole image, and written by rewriting only the
+ * tracks that have changed. The result is only right if the diskette
+ * really does hold the base image, so the patch also carries the CRC32C
+ * of every track of the base, and the SHA-256 of both images; the
+ * diskette is read and checked in full before anything is written to it.
+ *
+ * The file is the eight characters 'RAWPTCH1' followed by:
+ *
+ *	sectors	4 bytes		sectors per track
+ *	tracks	4 bytes		tracks in each image
+ *	changed	4 bytes		number of changed tracks
+ *	base	32 bytes	SHA-256 of the base image
+ *	result	32 bytes	SHA-256 of the new image
+ *	crc	4 bytes		CRC32C of each track of the base image
+ *
+ * then, for each changed track in order:
+ *
+ *	track	4 bytes		track number
+ *	map	5 bytes		a bit for each sector (bit n%8 of byte n/8 for
+ *				sector n), set if the sector has changed
+ *	data	512 bytes	the new contents of each changed sector
+ *
+ * and finally the CRC32C of everything before it, with numbers least
+ * significant byte first. Where gzip is available the whole file is
+ * compressed with it; either kind is read back.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "diskio.h"
+#include "hash.h"
+#include "journal.h"
+#include "manifest.h"
+#include "verify.h"
+#include "rawrite.h"
+#include "patch.h"
+
+/* Miscellaneous definitions */
+
+#define	PATCHMAGIC	"RAWPTCH1"	/* Start of every patch file */
+#define	MAGICLEN	8		/* Length of this */
+#define	HDRLEN		12		/* Length of numbers after it */
+
+#define	CHANGED(m, s)	(((m)[(s)/8] >> ((s)%8)) & 1)
+
+/* Forward references */
+
+static	BOOL	get_data(PSTREAM, WORD32 *, PUCHAR, ULONG);
+static	UINT	image_sectors(PIMAGE, PUCHAR);
+static	PIMAGE	open_image(PUCHAR);
+static	BOOL	put_data(PSTREAM, WORD32 *, PUCHAR, ULONG);
+
+
+/*
+ * Make a patch file 'name' turning the image file 'oldname' into the
+ * image file 'newname'. Both must be whole images of the same kind of
+ * diskette.
+ * Returns TRUE on success, else FALSE.
+ *
+ */
+
+BOOL make_patch(PUCHAR oldname, PUCHAR newname, PUCHAR name)
+{	PIMAGE old, new;		/* The two images */
+	FILE *fp;			/* Patch file */
+	PSTREAM sp;			/* Stream for writing it */
+	SHA256 ctx;			/* For hashing the images */
+	UCHAR buf[SHA256LEN];		/* Header, hash, or track number */
+	UCHAR map[MAPLEN];		/* Map of changed sectors */
+	WORD32 crc = 0;			/* CRC32C of file so far */
+	PUCHAR po, pn;			/* Old and new track */
+	ULONG tlen;			/* Bytes per track */
+	UINT sectors, tracks;
+	UINT changed = 0;		/* Tracks changed */
+	UINT nsect = 0;			/* Sectors changed */
+	UINT t, s;
+	INT codec;
+	BOOL res = TRUE;
+
+	old = open_image(oldname);
+	if(old == (PIMAGE) NULL)
+		return(FALSE);
+	new = open_image(newname);
+	if(new == (PIMAGE) NULL) {
+		free_image(old);
+		return(FALSE);
+	}
+	sectors = image_sectors(old, oldname);
+	if(sectors != 0 && new->size != old->size) {
+		error(
+			"image files '%s' and '%s' are not the same size",
+			oldname,
+			newname);
+		sectors = 0;
+	}
+	if(sectors == 0) {
+		free_image(old);
+		free_image(new);
+		return(FALSE);
+	}
+	tlen = (ULONG) sectors*BLKSIZE;
+	tracks = CYLS*HEADS;
+	for(t = 0; t < tracks; t++) {
+		if(memcmp(old->data + t*tlen, new->data + t*tlen,
+			(size_t) tlen) != 0)
+			changed++;
+	}
+
+	/* Write the header, the hashes of the two images, and the CRC32C
+	   of each track of the base */
+
+	fp = fopen(name, "wb");
+	if(fp == (FILE *) NULL) {
+		error("cannot create patch file '%s'", name);
+		free_image(old);
+		free_image(new);
+		return(FALSE);
+	}
+	codec = find_codec("gzip");
+	sp = open_outstream(fp, codec < 0 ? CODEC_NONE : codec, NOSIZE);
+	if(sp == (PSTREAM) NULL) {
+		fclose(fp);
+		free_image(old);
+		free_image(new);
+		return(FALSE);
+	}
+	put_word(buf, (WORD32) sectors);
+	put_word(buf + 4, (WORD32) tracks);
+	put_word(buf + 8, (WORD32) changed);
+	res = put_data(sp, &crc, PATCHMAGIC, MAGICLEN) &&
+		put_data(sp, &crc, buf, HDRLEN);
+	sha256_init(&ctx);
+	sha256_update(&ctx, old->data, old->size);
+	sha256_final(&ctx, buf);
+	res = res && put_data(sp, &crc, buf, SHA256LEN);
+	sha256_init(&ctx);
+	sha256_update(&ctx, new->data, new->size);
+	sha256_final(&ctx, buf);
+	res = res && put_data(sp, &crc, buf, SHA256LEN);
+	for(t = 0; t < tracks && res == TRUE; t++) {
+		put_word(buf, crc32c(0, old->data + t*tlen, tlen));
+		res = put_data(sp, &crc, buf, 4);
+	}
+
+	/* Then the changed sectors of each changed track */
+
+	for(t = 0; t < tracks && res == TRUE; t++) {
+		po = old->data + t*tlen;
+		pn = new->data + t*tlen;
+		if(memcmp(po, pn, (size_t) tlen) == 0) continue;
+		memset(map, '\0', MAPLEN);
+		for(s = 0; s < sectors; s++) {
+			if(memcmp(po + s*BLKSIZE, pn + s*BLKSIZE,
+				BLKSIZE) != 0)
+				map[s/8] |= (UCHAR) (1 << (s%8));
+		}
+		put_word(buf, (WORD32) t);
+		res = put_data(sp, &crc, buf, 4) &&
+			put_data(sp, &crc, map, MAPLEN);
+		for(s = 0; s < sectors && res == TRUE; s++) {
+			if(CHANGED(map, s) == 0) continue;
+			res = put_data(sp, &crc, pn + s*BLKSIZE, BLKSIZE);
+			nsect++;
+		}
+	}
+	put_word(buf, crc);
+	res = res && write_stream(sp, buf, 4);
+	if(close_stream(sp) == FALSE) res = FALSE;
+	if(res == TRUE)
+		error(
+			"%d of %d tracks changed (%d sectors); patch file"
+			" is %ld bytes",
+			changed,
+			tracks,
+			nsect,
+			ftell(fp));
+	if(fclose(fp) != 0) res = FALSE;
+	if(res == FALSE)
+		error("error writing patch file '%s'", name);
+	free_image(old);
+	free_image(new);
+
+	return(res);
+}
+
+
+/*
+ * Load a patch file, checking that it is complete and undamaged.
+ * Returns pointer to the patch, or NULL on failure.
+ *
+ */
+
+PPATCH load_patch(PUCHAR name)
+{	FILE *fp;			/* Patch file */
+	PSTREAM sp;			/* Stream for reading it */
+	PPATCH pp;
+	PCHANGE cp;
+	UCHAR buf[HDRLEN];		/* Header, CRC or track number */
+	WORD32 crc = 0;			/* CRC32C of file so far */
+	UINT i, s, n;
+	BOOL res;
+
+	fp = fopen(name, "rb");
+	if(fp == (FILE *) NULL) {
+		error("cannot open patch file '%s'", name);
+		return((PPATCH) NULL);
+	}
+	sp = open_instream(fp);		/* Detects any compression */
+	if(sp == (PSTREAM) NULL) {
+		fclose(fp);
+		return((PPATCH) NULL);
+	}
+	if(get_data(sp, &crc, buf, MAGICLEN) == FALSE ||
+	   memcmp(buf, PATCHMAGIC, MAGICLEN) != 0) {
+		error("'%s' is not a patch file", name);
+		(VOID) close_stream(sp);
+		fclose(fp);
+		return((PPATCH) NULL);
+	}
+	pp = (PPATCH) calloc(1, sizeof(PATCH));
+	if(pp == (PPATCH) NULL) {
+		error("cannot allocate memory for patch");
+		(VOID) close_stream(sp);
+		fclose(fp);
+		return((PPATCH) NULL);
+	}
+
+	/* Read the header and the hashes of the base image */
+
+	res = get_data(sp, &crc, buf, HDRLEN);
+	if(res == TRUE) {
+		pp->sectors = (UINT) get_word(buf);
+		pp->tracks = (UINT) get_word(buf + 4);
+		pp->changed = (UINT) get_word(buf + 8);
+		if((pp->sectors != 9 && pp->sectors != 18 &&
+		    pp->sectors != 36) ||
+		   pp->tracks != CYLS*HEADS || pp->changed > pp->tracks)
+			res = FALSE;
+	}
+	if(res == TRUE) {
+		pp->crc = (WORD32 *) calloc(pp->tracks, sizeof(WORD32));
+		pp->change = (PCHANGE) calloc(pp->changed + 1, sizeof(CHANGE));
+		if(pp->crc == (WORD32 *) NULL || pp->change == (PCHANGE) NULL) {
+			error("cannot allocate memory for patch");
+			free_patch(pp);
+			(VOID) close_stream(sp);
+			fclose(fp);
+			return((PPATCH) NULL);
+		}
+		res = get_data(sp, &crc, pp->base, SHA256LEN) &&
+			get_data(sp, &crc, pp->result, SHA256LEN);
+	}
+	for(i = 0; i < pp->tracks && res == TRUE; i++) {
+		res = get_data(sp, &crc, buf, 4);
+		pp->crc[i] = get_word(buf);
+	}
+
+	/* Read the changed tracks; each must be later than the last, and
+	   have at least one changed sector and none beyond the end */
+
+	for(i = 0; i < pp->changed && res == TRUE; i++) {
+		cp = &pp->change[i];
+		res = get_data(sp, &crc, buf, 4) &&
+			get_data(sp, &crc, cp->map, MAPLEN);
+		if(res == FALSE) break;
+		cp->track = (UINT) get_word(buf);
+		if(cp->track >= pp->tracks ||
+		   (i > 0 && cp->track <= pp->change[i-1].track)) {
+			res = FALSE;
+			break;
+		}
+		for(s = n = 0; s < MAPLEN*8; s++) {
+			if(CHANGED(cp->map, s) == 0) continue;
+			if(s >= pp->sectors) res = FALSE;
+			n++;
+		}
+		if(n == 0 || res == FALSE) {
+			res = FALSE;
+			break;
+		}
+		cp->data = (PUCHAR) malloc((size_t) (n*BLKSIZE));
+		if(cp->data == (PUCHAR) NULL) {
+			error("cannot allocate memory for patch");
+			free_patch(pp);
+			(VOID) close_stream(sp);
+			fclose(fp);
+			return((PPATCH) NULL);
+		}
+		res = get_data(sp, &crc, cp->data, (ULONG) n*BLKSIZE);
+	}
+	if(res == TRUE)
+		res = read_stream(sp, buf, 4) == 4 && get_word(buf) == crc;
+	(VOID) close_stream(sp);
+	fclose(fp);
+
+	if(res == FALSE) {
+		error("patch file '%s' is damaged", name);
+		free_patch(pp);
+		return((PPATCH) NULL);
+	}
+
+	return(pp);
+}
+
+
+/*
+ * Apply a changed track of a patch to the contents of that track, in
+ * 'buf', replacing the sectors that have changed.
+ *
+ */
+
+VOID apply_change(PPATCH pp, PCHANGE cp, PUCHAR buf)
+{	PUCHAR p = cp->data;
+	UINT s;
+
+	for(s = 0; s < pp->sectors; s++) {
+		if(CHANGED(cp->map, s) == 0) continue;
+		memcpy(buf + s*BLKSIZE, p, BLKSIZE);
+		p += BLKSIZE;
+	}
+}
+
+
+/*
+ * Free a patch, and everything in it.
+ *
+ */
+
+VOID free_patch(PPATCH pp)
+{	UINT i;
+
+	if(pp->change != (PCHANGE) NULL) {
+		for(i = 0; i < pp->changed; i++) {
+			if(pp->change[i].data != (PUCHAR) NULL)
+				free((PUCHAR) pp->change[i].data);
+		}
+		free((PCHANGE) pp->change);
+	}
+	if(pp->crc != (WORD32 *) NULL) free((WORD32 *) pp->crc);
+	free((PPATCH) pp);
+}
+
+
+/*
+ * Open and load an image file.
+ * Returns pointer to the image, or NULL on failure.
+ *
+ */
+
+static PIMAGE open_image(PUCHAR name)
+{	FILE *fp;
+	PSTREAM sp;
+	PIMAGE im;
+
+	fp = fopen(name, "rb");
+	if(fp == (FILE *) NULL) {
+		error("cannot open file '%s'", name);
+		return((PIMAGE) NULL);
+	}
+	sp = open_instream(fp);		/* Detects any compression */
+	im = sp == (PSTREAM) NULL ? (PIMAGE) NULL : load_image(sp);
+	if(sp != (PSTREAM) NULL) (VOID) close_stream(sp);
+	fclose(fp);
+
+	return(im);
+}
+
+
+/*
+ * Work out the sectors per track of an image, which must fill a whole
+ * diskette.
+ * Returns the sectors per track, or 0 (reported) if not a whole image.
+ *
+ */
+
+static UINT image_sectors(PIMAGE im, PUCHAR name)
+{	switch(im->size) {
+		case DD_MAX:
+			return(9);
+
+		case HD_MAX:
+			return(18);
+
+		case ED_MAX:
+			return(36);
+	}
+	error(
+		"image file '%s' is not a whole 720K, 1.44MB or 2.88MB image",
+		name);
+
+	return(0);
+}
+
+
+/*
+ * Write data to a patch file, adding it to the running CRC32C.
+ * Returns TRUE on success, else FALSE.
+ *
+ */
+
+static BOOL put_data(PSTREAM sp, WORD32 *crc, PUCHAR buf, ULONG len)
+{	*crc = crc32c(*crc, buf, len);
+
+	return(write_stream(sp, buf, len));
+}
+
+
+/*
+ * Read data from a patch file, adding it to the running CRC32C.
+ * Returns TRUE if all of it was there, else FALSE.
+ *
+ */
+
+static BOOL get_data(PSTREAM sp, WORD32 *crc, PUCHAR buf, ULONG len)
+{	if(read_stream(sp, buf, len) != len)
+		return(FALSE);
+	*crc = crc32c(*crc, buf, len);
+
+	return(TRUE);
+}
+
+/*
+ * End of file: patch.c
+ *
+ */
@@ -0,0 +1,50 @@
+/*
+ * File: patch.h
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Definitions for image patches
+ *
+ */
+
+#ifndef	_PATCH_H
+#define	_PATCH_H
+
+/* Miscellaneous definitions */
+
+#define	MAPLEN		((MAXTRACK/BLKSIZE + 7)/8)/* Bytes in sector map */
+
+/* A changed track in a patch */
+
+typedef	struct _CHANGE {
+	UINT		track;		/* Track number */
+	UCHAR		map[MAPLEN];	/* Bit set for each changed sector */
+	PUCHAR		data;		/* New data for changed sectors */
+} CHANGE, *PCHANGE;
+
+/* A patch, turning a base image into a new one */
+
+typedef	struct _PATCH {
+	UINT		sectors;	/* Sectors per track */
+	UINT		tracks;		/* Tracks in image */
+	UINT		changed;	/* Number of changed tracks */
+	UCHAR		base[SHA256LEN];/* SHA-256 of base image */
+	UCHAR		result[SHA256LEN];/* SHA-256 of new image */
+	WORD32		*crc;		/* CRC32C of each track of base */
+	PCHANGE		change;		/* Changed tracks, in order */
+	PUCHAR		data;		/* Data for all changed sectors */
+} PATCH, *PPATCH;
+
+/* External references */
+
+extern	VOID	apply_change(PPATCH, PCHANGE, PUCHAR);
+extern	VOID	free_patch(PPATCH);
+extern	PPATCH	load_patch(PUCHAR);
+extern	BOOL	make_patch(PUCHAR, PUCHAR, PUCHAR);
+
+#endif
+
+/*
+ * End of file: patch.h
+ *
+ */
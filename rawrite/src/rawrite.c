@@ -5,7 +5,7 @@
  *
  * OS/2 version; works with 720KB, 1.44MB and 2.88MB diskettes
  *
- * Can be built as 16 bit bound executable
+ * Can be built as 16 bit bound executable, or for Linux
  *
  * Bob Eager   June 2000
  *
@@ -14,7 +14,7 @@
 /* Program version information */
 
 #define	VERSION		2
-#define	EDIT		0
+#define	EDIT		20
 
 #define	AUTHOR		"Bob Eager (rde@tavi.co.uk)"
 
@@ -26,25 +26,67 @@
  *	1.2	- Fixed media sense broken by version 1.1.
  *		- Added author contact information to help text.
  *	2.0	- First dual mode capable version.
+ *	2.1	- Diskette access moved to a separate device layer.
+ *		- Linux version, using O_DIRECT on diskette and other
+ *		  block devices, or plain files.
+ *	2.2	- Optional overlap of image file reading with diskette
+ *		  writing (-b flag).
+ *	2.3	- Several drives may be written at once from one copy
+ *		  of the image.
+ *	2.4	- In the Linux version, the image file is memory mapped
+ *		  where possible, and tracks are written directly from it.
+ *	2.5	- Added --diff flag, to write only tracks that differ
+ *		  from the image.
+ *	2.6	- Added --sparse flag, to write only the tracks in use by
+ *		  the FAT file system in the image.
+ *		- Geometry taken from the image boot sector if it cannot
+ *		  be sensed.
+ *	2.7	- Image files compressed with gzip or zstd are detected
+ *		  and decompressed while writing.
+ *	2.8	- Added -m flag, to write a manifest of track hashes.
+ *	2.9	- Added -j flag, to write a series of diskettes listed in
+ *		  a job file without reopening the drive.
+ *	2.10	- Several drives may be given with -j; each takes the next
+ *		  job when it is free.
+ *	2.11	- Added --copy, to copy a diskette to one or more others
+ *		  through memory, with optional --verify.
+ *	2.12	- Added --verify and -r flags, to read back each track as
+ *		  soon as it is written, and rewrite it if it is wrong.
+ *	2.13	- Added --format flag, to format each track just before it
+ *		  is written.
+ *	2.14	- Added --resume flag, to keep a journal of the tracks
+ *		  written, and carry on from it after an interruption.
+ *	2.15	- An image file of '-' is read from the standard input,
+ *		  with the geometry taken from its boot sector if need be.
+ *	2.16	- Added --stats flag, to time each operation and write a
+ *		  report in JSON; progress display limited in rate.
+ *	2.17	- Added emulated drives (Linux), with realistic timing
+ *		  and injected faults, for testing without hardware.
+ *	2.18	- Added benchmark (bench.sh); --stats report gives
+ *		  processor time.
+ *	2.19	- Added --pack flag, to write an image held in a pack file
+ *		  made by raread.
+ *	2.20	- Added --mkpatch and --patch flags, to make a patch
+ *		  between two images and apply it to a diskette.
  *
  */
 
 #ifdef	DUAL
 #define	MODE		"16-bit dual mode"
 #define	NOTMODE		"32-bit OS/2-only"
-#define	APIRET		USHORT
+#else
+#ifdef	LINUX
+#define	MODE		"Linux"
+#define	NOTMODE		"OS/2"
 #else
 #define	MODE		"32-bit"
 #define	NOTMODE		"16-bit dual mode (DOS and OS/2)"
 #endif
+#endif
 
 /* Includes */
 
-#define	INCL_DOSDEVICES
-#define	INCL_DOSERRORS
-#define	INCL_DOSFILEMGR
-#define	INCL_DOSDEVIOCTL
-#include <os2.h>
+#include "sysdep.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,49 +96,172 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-/* Miscellaneous definitions */
-
-#ifdef	DUAL
-#define	BLKSIZE		512L		/* Number of bytes in a disk block */
-#define	DD_MAX		720L*2L*BLKSIZE	/* Maximum size of 720K image */
-#define	HD_MAX		1440L*2L*BLKSIZE/* Maximum size of 1.44MB image */
-#else
-#define	BLKSIZE		512		/* Number of bytes in a disk block */
-#define	DD_MAX		720*2*BLKSIZE	/* Maximum size of 720K image */
-#define	HD_MAX		1440*2*BLKSIZE	/* Maximum size of 1.44MB image */
+#include "codec.h"
+#include "diskio.h"
+#include "fat.h"
+#include "hash.h"
+#include "jobs.h"
+#include "journal.h"
+#include "manifest.h"
+#include "recover.h"
+#include "timing.h"
+#include "trkpipe.h"
+#include "verify.h"
+#include "rawrite.h"
+#ifdef	THREADS
+#include "copy.h"
+#include "pack.h"
+#include "patch.h"
 #endif
 
-#define	TY_UNKNOWN	0		/* Diskette type unknown */
-#define	TY_DD		1		/* DD diskette specified */
-#define	TY_HD		2		/* HD diskette specified */
-#define	TY_ED		3		/* ED diskette specified */
-
 /* Forward references */
 
-static	VOID	close_disk(HFILE);
-static	VOID	error(PUCHAR, ...);
-static	HFILE	open_disk(PUCHAR);
-static	BOOL	process_disk(FILE *, HFILE, INT);
+static	BOOL	check_drive(PUCHAR);
+static	PUCHAR	flag_value(INT, PUCHAR [], PINT);
+#ifndef	DUAL
+static	BOOL	get_geometry(ULONG, PDISK, INT, PBPB, PUINT);
+static	PBPB	image_bpb(PIMAGE, PBPB);
+static	BOOL	in_memory(PSTREAM);
+static	BOOL	target_geometry(ULONG, PTARGET, INT, PBPB);
+static	BOOL	target_manifest(PTARGET, PUCHAR);
+#else
+static	BOOL	get_geometry(ULONG, PDISK, INT, PUINT);
+#endif
+static	BOOL	process_disk(PSTREAM, PDISK, INT, PUCHAR);
+#ifndef	DUAL
+static	BOOL	process_image(PSTREAM, PDISK, INT, PUCHAR);
+#endif
+static	BOOL	process_jobs(PUCHAR [], UINT, INT);
+#ifdef	THREADS
+static	BOOL	process_copy(PUCHAR, PUCHAR [], UINT, INT);
+static	BOOL	process_pack(PUCHAR, PUCHAR [], UINT, INT);
+static	BOOL	process_patch(PUCHAR);
+static	BOOL	process_targets(PSTREAM, PUCHAR [], UINT, INT);
+#endif
+static	BOOL	read_image(PTRACK, PVOID);
+#ifndef	DUAL
+static	BOOL	resume_target(PTARGET);
+#endif
 static	VOID	usage(VOID);
+#ifdef	THREADS
+static	BOOL	write_drives(PIMAGE, PBPB, PUCHAR [], UINT, INT);
+#endif
+static	BOOL	write_job(PJOB, PDISK);
 
 /* Local storage */
 
-static	PUCHAR	progname;		/* Pointer to program name */
+PUCHAR	progname;			/* Pointer to program name */
+static	UINT	nbufs = 0;		/* Track buffers, or 0 for default */
+static	BOOL	diff = FALSE;		/* Only write changed tracks */
+static	BOOL	format = FALSE;		/* Format tracks before writing */
+static	PUCHAR	manifest = (PUCHAR) NULL;/* Name of manifest file, if any */
+static	PUCHAR	jobfile = (PUCHAR) NULL;/* Name of job file, if any */
+static	BOOL	quiet = FALSE;		/* No progress display */
+static	BOOL	verify = FALSE;		/* Verify each track written */
+static	UINT	rewrites = DEFREWRITES;	/* Rewrites of a bad track */
+static	BOOL	resume = FALSE;		/* Resume an interrupted write */
+static	PJOURNAL journal = (PJOURNAL) NULL;/* Journal of tracks written */
+static	PUCHAR	statsfile = (PUCHAR) NULL;/* Name of report file, if any */
+static	PTIMING	timing = (PTIMING) NULL;/* Timing of run, if wanted */
+#ifndef	DUAL
+static	BOOL	sparse = FALSE;		/* Only write tracks in use */
+#endif
+#ifdef	THREADS
+static	PUCHAR	source = (PUCHAR) NULL;	/* Drive to be copied, if any */
+static	PUCHAR	packfile = (PUCHAR) NULL;/* Name of pack file, if any */
+static	PUCHAR	patchfile = (PUCHAR) NULL;/* Name of patch file, if any */
+static	BOOL	mkpatch = FALSE;	/* Make a patch file */
+#endif
 
 /* Help text */
 
 static	const	PUCHAR helpinfo[] = {
 "%s: write 3.5 inch diskette from image file",
-"Synopsis: %s [-dhe] imagefile drive",
+#ifdef	THREADS
+"Synopsis: %s [-dhe] [-b buffers] [-m manifest] [-r rewrites] [--diff]",
+"                [--format] [--resume] [--sparse] [--stats file]",
+"                [--verify] imagefile drive...",
+"          %s -j jobfile [-dhe] [-b buffers] [-r rewrites] [--diff]",
+"                [--format] [--sparse] [--verify] drive...",
+"          %s --copy src [-dhe] [-m manifest] [-r rewrites] [--diff]",
+"                [--format] [--verify] drive...",
+"          %s --pack file [-dhe] [-m manifest] [-r rewrites] [--diff]",
+"                [--format] [--sparse] [--verify] image drive...",
+"          %s --patch file [-r rewrites] [--stats file] [--verify] drive",
+"          %s --mkpatch oldimage newimage patchfile",
+#else
+"Synopsis: %s [-dhe] [-m manifest] [-r rewrites] [--diff] [--format]",
+"                [--resume] [--stats file] [--verify] imagefile drive",
+"          %s -j jobfile [-dhe] [-r rewrites] [--diff] [--format]",
+"                [--verify] drive",
+#endif
 " where:",
 "    -d           forces DD (720K) diskette type",
 "    -h           forces HD (1.44MB) diskette type",
 "    -e           forces ED (2.88MB) diskette type",
-"    imagefile    is the name of the file containing the diskette image",
+#ifdef	THREADS
+"    -b buffers   sets the number of track buffers (default 2); with more",
+"                 than one, the image file is read while the diskette is",
+"                 being written (default 8 from the standard input)",
+#ifdef	MMAP
+"                 (not used if the image file can be memory mapped)",
+#endif
+#endif
+"    -j jobfile   writes a series of diskettes, one for each line of",
+"                 'jobfile', keeping the drive open throughout",
+#ifdef	THREADS
+"                 (with several drives, each takes the next job when free)",
+#endif
+"    -m manifest  writes the CRC32C and SHA-256 of each track, and of the",
+"                 whole image, to the file 'manifest'",
+"    -r rewrites  sets the number of times a track that does not verify",
+"                 is rewritten (default 2); implies --verify",
+"    --diff       reads each track first, and writes only those tracks",
+"                 that differ from the image",
+#ifdef	THREADS
+"    --copy src   copies the diskette in drive 'src' to each drive,",
+"                 through memory, instead of writing an image file; if",
+"                 'src' is also the (only) drive, the diskettes are",
+"                 changed part way",
+"    --pack file  writes the image called 'image' in the pack file 'file'",
+"                 (made by raread --pack), instead of an image file",
+"    --patch file applies the patch file 'file' to the diskette in the",
+"                 drive, which must hold the image the patch was made",
+"                 from; only the tracks that change are written",
+"    --mkpatch    makes a patch file turning 'oldimage' into 'newimage'",
+#endif
+"    --format     formats each track just before writing it, so that new",
+"                 or wrongly formatted diskettes are prepared as they are",
+"                 written",
+"    --resume     keeps a journal of the tracks written, so that an",
+"                 interrupted run can be resumed by giving the same",
+"                 command again (one drive only)",
+"    --stats file times each diskette and image file operation, and",
+"                 writes the counts, errors and times to 'file' in JSON",
+"                 at the end (one drive only)",
+"    --verify     reads back each track as soon as it is written, and",
+"                 rewrites it if its CRC does not match the data written",
+#ifndef	DUAL
+"    --sparse     writes only those tracks in use by the FAT file system",
+"                 in the image; for freshly formatted diskettes only",
+#endif
+"    imagefile    is the name of the file containing the diskette image,",
+"                 or '-' to read it from the standard input",
+#ifdef	LINUX
+"    drive        is the drive (a: or b:), device or file to be written to",
+#else
 "    drive        is the drive to be written to",
+#endif
+#ifdef	THREADS
+"                 (several drives may be given; all are written at once)",
+#endif
 " ",
 "Examples:  %s boot.img a:",
 "           %s -e bigboot.img a:",
+#ifdef	THREADS
+"           %s boot.img a: b:",
+"           %s --copy a: b:",
+#endif
 " ",
 "If the diskette size is not specified,"
 #ifndef DUAL
@@ -117,17 +282,20 @@ static	const	PUCHAR helpinfo[] = {
 
 VOID main(INT argc, PUCHAR argv[])
 {	FILE *fp;			/* File pointer for image file */
+	PSTREAM sp;			/* Stream for reading image file */
 	INT q = 1;			/* First real arg index */
 	PUCHAR p;			/* Temporary */
 	PUCHAR file;			/* Pointer to image file name */
-	PUCHAR drv;			/* Pointer to original drive name */
-	UCHAR drive[3];			/* Drive name */
-	HFILE dfd;			/* Disk file handle */
+	PUCHAR drive;			/* Drive name */
+	UINT ndrives;			/* Number of drives to be written */
+	UINT i;
+	PDISK dp;			/* Disk being written */
 	UINT type = TY_UNKNOWN;		/* Diskette type */
+	BOOL ok;
 
 	/* Derive program name for use in messages */
 
-	progname = strrchr(argv[0], '\\');
+	progname = strrchr(argv[0], PATHSEP);
 	if(progname != (PUCHAR) NULL)
 		progname++;
 	else
@@ -138,14 +306,8 @@ VOID main(INT argc, PUCHAR argv[])
 
 	/* Check and parse arguments */
 
-	if(argc < 3 || argc > 4) {
-		usage();
-		exit(EXIT_FAILURE);
-	}
-
-	if(argv[1][0] == '-') {		/* Flag */
-		q++;
-		switch(argv[1][1]) {
+	while(q < argc && argv[q][0] == '-' && argv[q][1] != '\0') {
+		switch(argv[q][1]) {	/* Flag */
 			case 'D':
 			case 'd':
 				type = TY_DD;
@@ -160,291 +322,450 @@ VOID main(INT argc, PUCHAR argv[])
 			case 'e':
 				type = TY_ED;
 				break;
+#ifdef	THREADS
+
+			case 'B':
+			case 'b':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				nbufs = atoi(p);
+				if(nbufs < 1 || nbufs > MAXBUFS) {
+					error(
+						"number of buffers must be"
+						" between 1 and %d",
+						MAXBUFS);
+					exit(EXIT_FAILURE);
+				}
+				break;
+#endif
+
+			case 'J':
+			case 'j':
+				jobfile = flag_value(argc, argv, &q);
+				if(jobfile == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'R':
+			case 'r':
+				p = flag_value(argc, argv, &q);
+				if(p == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				rewrites = atoi(p);
+				if(rewrites > MAXREWRITES) {
+					error(
+						"number of rewrites must be"
+						" between 0 and %d",
+						MAXREWRITES);
+					exit(EXIT_FAILURE);
+				}
+				verify = TRUE;
+				break;
+
+			case 'M':
+			case 'm':
+				manifest = flag_value(argc, argv, &q);
+				if(manifest == (PUCHAR) NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case '-':		/* Long flag */
+				if(strcmp(argv[q], "--diff") == 0) {
+					diff = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--format") == 0) {
+					format = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--resume") == 0) {
+					resume = TRUE;
+					break;
+				}
+				if(strcmp(argv[q], "--stats") == 0 &&
+				   q + 1 < argc) {
+					statsfile = argv[++q];
+					break;
+				}
+#ifndef	DUAL
+				if(strcmp(argv[q], "--sparse") == 0) {
+					sparse = TRUE;
+					break;
+				}
+#endif
+#ifdef	THREADS
+				if(strcmp(argv[q], "--copy") == 0 &&
+				   q + 1 < argc) {
+					source = argv[++q];
+					break;
+				}
+				if(strcmp(argv[q], "--pack") == 0 &&
+				   q + 1 < argc) {
+					packfile = argv[++q];
+					break;
+				}
+				if(strcmp(argv[q], "--patch") == 0 &&
+				   q + 1 < argc) {
+					patchfile = argv[++q];
+					break;
+				}
+				if(strcmp(argv[q], "--mkpatch") == 0) {
+					mkpatch = TRUE;
+					break;
+				}
+#endif
+				if(strcmp(argv[q], "--verify") == 0) {
+					verify = TRUE;
+					break;
+				}
+				usage();
+				exit(EXIT_FAILURE);
 
 			default:
 				usage();
 				exit(EXIT_FAILURE);
 		}
+		q++;
 	}
-	file = argv[q];
 
-	/* Check and open image file */
-
-	fp = fopen(file, "rb");
-	if(fp == (FILE *) NULL) {
-		error("cannot open file '%s'", file);
+#ifndef	DUAL
+	if(format == TRUE && (diff == TRUE || sparse == TRUE)) {
+		error("--format cannot be used with --diff or --sparse");
+#else
+	if(format == TRUE && diff == TRUE) {
+		error("--format cannot be used with --diff");
+#endif
 		exit(EXIT_FAILURE);
 	}
 
-	/* Check and open diskette */
-
-	drv = argv[q+1];
-	if ((strlen(drv) != 2) ||
-		!isalpha(drv[0]) ||
-		(drv[1] != ':')) {
-		usage();
+#ifdef	THREADS
+	if(resume == TRUE &&
+	   (jobfile != (PUCHAR) NULL || source != (PUCHAR) NULL ||
+	    sparse == TRUE)) {
+		error("--resume cannot be used with -j, --copy or --sparse");
+#else
+	if(resume == TRUE && jobfile != (PUCHAR) NULL) {
+		error("--resume cannot be used with -j");
+#endif
 		exit(EXIT_FAILURE);
 	}
-	strcpy(drive, drv);
-	(void) strupr(drive);
-
-	dfd = open_disk(drive);
-	if(dfd == (HFILE) NULL)
-		exit(EXIT_FAILURE);
-
-	/* Write the image */
 
-	if(process_disk(fp, dfd, type) == FALSE)	/* Write the disk */
+#ifdef	THREADS
+	if(statsfile != (PUCHAR) NULL &&
+	   (jobfile != (PUCHAR) NULL || source != (PUCHAR) NULL)) {
+		error("--stats cannot be used with -j or --copy");
+#else
+	if(statsfile != (PUCHAR) NULL && jobfile != (PUCHAR) NULL) {
+		error("--stats cannot be used with -j");
+#endif
 		exit(EXIT_FAILURE);
+	}
 
-	/* Tidy up and exit */
-
-	close_disk(dfd);		/* Close the drive */
+#ifdef	THREADS
+	if(mkpatch == TRUE) {		/* Make a patch file */
+		if(argc - q != 3) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		if(jobfile != (PUCHAR) NULL || source != (PUCHAR) NULL ||
+		   packfile != (PUCHAR) NULL || patchfile != (PUCHAR) NULL) {
+			error(
+				"--mkpatch cannot be used with -j, --copy,"
+				" --pack or --patch");
+			exit(EXIT_FAILURE);
+		}
+		if(make_patch(argv[q], argv[q+1], argv[q+2]) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-	exit(EXIT_SUCCESS);
-}
+	if(source != (PUCHAR) NULL) {	/* Copy a diskette */
+		ndrives = argc - q;
+		if(ndrives < 1 || ndrives > MAXTARGETS ||
+		   check_drive(source) == FALSE) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		for(i = 0; i < ndrives; i++) {
+			if(check_drive(argv[q+i]) == FALSE) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(jobfile != (PUCHAR) NULL || packfile != (PUCHAR) NULL ||
+		   patchfile != (PUCHAR) NULL || sparse == TRUE) {
+			error(
+				"--copy cannot be used with -j, --pack, --patch"
+				" or --sparse");
+			exit(EXIT_FAILURE);
+		}
+		if(process_copy(source, &argv[q], ndrives, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
+	if(packfile != (PUCHAR) NULL) {	/* Write an image from a pack */
+		ndrives = argc - q - 1;
+		if(ndrives < 1 || ndrives > MAXTARGETS) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		for(i = 0; i < ndrives; i++) {
+			if(check_drive(argv[q+1+i]) == FALSE) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(jobfile != (PUCHAR) NULL || patchfile != (PUCHAR) NULL ||
+		   resume == TRUE || statsfile != (PUCHAR) NULL) {
+			error(
+				"--pack cannot be used with -j, --patch,"
+				" --resume or --stats");
+			exit(EXIT_FAILURE);
+		}
+		if(process_pack(argv[q], &argv[q+1], ndrives, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-/*
- * Perform open actions for the disk
- * Returns handle if disk was successfully opened, otherwise NULL.
- *
- */
+	if(patchfile != (PUCHAR) NULL) {/* Apply a patch file */
+		if(argc - q != 1 || check_drive(argv[q]) == FALSE) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		if(jobfile != (PUCHAR) NULL || manifest != (PUCHAR) NULL ||
+		   diff == TRUE || format == TRUE || resume == TRUE ||
+		   sparse == TRUE) {
+			error(
+				"--patch cannot be used with -j, -m, --diff,"
+				" --format, --resume or --sparse");
+			exit(EXIT_FAILURE);
+		}
+		if(statsfile != (PUCHAR) NULL) {
+			timing = open_timing();
+			if(timing == (PTIMING) NULL)
+				exit(EXIT_FAILURE);
+		}
+		if(process_patch(argv[q]) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-static HFILE open_disk(PUCHAR drive)
-{	APIRET rc;
-	UCHAR dbuf[36];			/* DosDevIOCtl data buffer */
-	UCHAR parblk[2] = { 0, 0};	/* DosDevIOCtl parameter block */
-#ifdef DUAL
-	USHORT action;			/* For returned action taken */
-	USHORT openflags;		/* For DosOpen */
+#endif
+	if(jobfile != (PUCHAR) NULL) {	/* A series of diskettes */
+		ndrives = argc - q;
+#ifdef	THREADS
+		if(ndrives < 1 || ndrives > MAXDRIVES) {
 #else
-	ULONG action;			/* For returned action taken */
-	ULONG openflags;		/* For DosOpen */
-	ULONG plen = sizeof(parblk);	/* Input/output length for parameters */
-	ULONG dlen = sizeof(dbuf);	/* Input/output length for data */
+		if(ndrives != 1) {
 #endif
-	HFILE dfd;			/* Handle for disk */
-
-	/* Open the disk */
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		for(i = 0; i < ndrives; i++) {
+			if(check_drive(argv[q+i]) == FALSE) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(manifest != (PUCHAR) NULL) {
+			error(
+				"-m cannot be used with -j; give a manifest"
+				" for each job instead");
+			exit(EXIT_FAILURE);
+		}
+		if(process_jobs(&argv[q], ndrives, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
 
-	openflags = OPEN_ACCESS_READWRITE |
-		    OPEN_FLAGS_DASD |
-#ifndef	DUAL
-		    OPEN_FLAGS_FAIL_ON_ERROR |
-#endif
-		    OPEN_SHARE_DENYREADWRITE;
-#ifdef	DUAL
-	if(_osmode == OS2_MODE)
-		openflags |= OPEN_FLAGS_FAIL_ON_ERROR;
-#endif
-
-	rc = DosOpen(
-		drive,			/* drive name */
-		&dfd,			/* to return handle */
-		&action,		/* to return action taken */
-		0L,			/* file size - not used */
-		0,			/* file attribute - not used */
-		OPEN_ACTION_OPEN_IF_EXISTS |
-		OPEN_ACTION_FAIL_IF_NEW,/* open action */
-		openflags,		/* open flags */
-#ifdef	DUAL
-		0L);			/* reserved - must be zero */
+	ndrives = argc - q - 1;
+#ifdef	THREADS
+	if(ndrives < 1 || ndrives > MAXTARGETS) {
 #else
-		(PEAOP2) 0);		/* extended attributes - not used */
+	if(ndrives != 1) {
 #endif
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	file = argv[q];
 
-	if(rc != 0) {
-		switch(rc) {
-			case ERROR_NOT_READY:
-				error("drive %s is not ready", drive);
-				break;
+	/* Check and open image file; '-' is the standard input, in which case
+	   more track buffers are used by default, to smooth out the flow */
 
-			case ERROR_PATH_NOT_FOUND:
-				error("%s is not a valid drive name", drive);
-				break;
+	if(strcmp(file, "-") == 0) {
+		binary_mode(fileno(stdin));
+		fp = stdin;
+		if(nbufs == 0) nbufs = PIPEBUFS;
+	} else {
+		fp = fopen(file, "rb");
+	}
+	if(fp == (FILE *) NULL) {
+		error("cannot open file '%s'", file);
+		exit(EXIT_FAILURE);
+	}
+	sp = open_instream(fp);		/* Detects any compression */
+	if(sp == (PSTREAM) NULL)
+		exit(EXIT_FAILURE);
 
-			case ERROR_DISK_CHANGE:
-			case ERROR_INVALID_DRIVE:
-				error("drive %s does not exist", drive);
-				break;
+	/* Check drive names */
 
-			case ERROR_DRIVE_LOCKED:
-				error("drive %s is in use", drive);
-				break;
+	for(i = 0; i < ndrives; i++) {
+		if(check_drive(argv[q+1+i]) == FALSE) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
 
-			case ERROR_ACCESS_DENIED:
-				error(
-					"access to drive %s denied "
-					"(may be read-only)",
-					drive);
-				break;
+	/* Load any journal, which fixes the diskette type if a previous run
+	   got under way */
 
-			default:
+	if(resume == TRUE) {
+		if(ndrives > 1 || fp == stdin) {
+			error(
+				"--resume can only be used with one drive, and"
+				" a named image file");
+			exit(EXIT_FAILURE);
+		}
+		journal = load_journal(file, JN_WRITE);
+		if(journal == (PJOURNAL) NULL)
+			exit(EXIT_FAILURE);
+		i = journal_type(journal);
+		if(i != TY_UNKNOWN) {
+			if(type != TY_UNKNOWN && type != i) {
 				error(
-					"can't open drive %s, rc = %d",
-					drive,
-					rc);
+					"diskette type does not match journal"
+					" file '%s'",
+					journal->name);
+				exit(EXIT_FAILURE);
+			}
+			type = i;
 		}
-		return((HFILE) NULL);
 	}
 
-	/* Check that we are dealing with the right kind of media */
+	/* Start timing if a report is wanted; the clock starts here */
 
-#ifdef DUAL
-	rc = DosDevIOCtl(
-		&dbuf,			/* data block */
-		&parblk,		/* parameter block */
-		DSK_GETDEVICEPARAMS,	/* device function - get device details */
-		IOCTL_DISK,		/* device category - logical drive */
-		dfd);			/* handle from DosOpen */
-#else
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_GETDEVICEPARAMS,	/* device function - get device details */
-		&parblk,		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		dlen,			/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
-		
-	if(rc != 0) {
-		error(
-			"cannot get device details for %s, rc = %d",
-			drive,
-			rc);
-		(VOID) DosClose(dfd);
-		return((HFILE) NULL);
+	if(statsfile != (PUCHAR) NULL) {
+		if(ndrives > 1) {
+			error("--stats can only be used with one drive");
+			exit(EXIT_FAILURE);
+		}
+		timing = open_timing();
+		if(timing == (PTIMING) NULL)
+			exit(EXIT_FAILURE);
 	}
 
-	if(dbuf[33] != 2 && dbuf[33] != 7 && dbuf[33] != 9) {
-		error("drive %s is not a valid diskette drive", drive);
-		(VOID) DosClose(dfd);
-		return((HFILE) NULL);
+#ifdef	THREADS
+	if(ndrives > 1) {		/* Write several drives at once */
+		if(process_targets(sp, &argv[q+1], ndrives, type) == FALSE)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
 	}
+#endif
 
-	/* Lock the disk against access by other processes */
+	/* Open diskette */
 
-#ifdef	DUAL
-	rc = DosDevIOCtl(
-		&dbuf,			/* data block */
-		&parblk,		/* parameter block */
-		DSK_LOCKDRIVE,		/* device function - lock drive */
-		IOCTL_DISK,		/* device category - logical drive */
-		dfd);			/* handle from DosOpen */
-#else
-	plen = 1;			/* Re-initialise */
-	dlen = 1;
-
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_LOCKDRIVE,		/* device function - lock drive */
-		&parblk,		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		dlen,			/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
-
-	if(rc != 0) {
-		switch(rc) {
-			case ERROR_DRIVE_LOCKED:
-				error("drive %s is locked", drive);
-				break;
+	drive = argv[q+1];
+	dp = open_disk(drive, TRUE);
+	if(dp == (PDISK) NULL)
+		exit(EXIT_FAILURE);
+	dp->tm = timing;
 
-			default:
-				error(
-					"can't lock drive %s, rc = %d",
-					drive,
-					rc);
-		}
-		(VOID) DosClose(dfd);
-		return((HFILE) NULL);
-	}
+	/* Write the image; from memory if possible */
+
+#ifndef	DUAL
+	if(in_memory(sp) == TRUE)
+		ok = process_image(sp, dp, type, manifest);
+	else
+#endif
+	ok = process_disk(sp, dp, type, manifest);
+	if(journal != (PJOURNAL) NULL && end_journal(journal, ok) == FALSE)
+		ok = FALSE;
+	if(timing != (PTIMING) NULL &&
+	   write_timing(
+		timing,
+		statsfile,
+		dp,
+		file,
+		nbufs == 0 ? DEFBUFS : nbufs,
+		ok) == FALSE)
+		ok = FALSE;
+	if(ok == FALSE)
+		exit(EXIT_FAILURE);
 
-	return(dfd);
+	/* Tidy up and exit */
+
+	close_disk(dp);			/* Close the drive */
+
+	exit(EXIT_SUCCESS);
 }
 
 
 /*
- * Perform close actions for the disk
+ * Check a drive name, converting it to upper case.
+ * Returns TRUE if valid, else FALSE.
  *
  */
 
-static VOID close_disk(HFILE dfd)
-{	APIRET rc;
-	UCHAR dbuf;			/* DosDevIOCtl data buffer */
-	UCHAR parblk = 0;		/* DosDevIOCtl parameter block */
-#ifndef	DUAL
-	ULONG plen = sizeof(parblk);	/* Output length for parameters */
-	ULONG dlen = sizeof(dbuf);	/* Output length for data */
+static BOOL check_drive(PUCHAR drv)
+{
+#ifdef	LINUX
+	return(drv[0] != '\0' ? TRUE : FALSE);	/* Any device or file name */
+#else
+	if ((strlen(drv) != 2) ||
+		!isalpha(drv[0]) ||
+		(drv[1] != ':')) {
+		return(FALSE);
+	}
+	(void) strupr(drv);
+
+	return(TRUE);
 #endif
+}
 
-	/* Unlock the disk to allow access by other processes */
 
-#ifdef	DUAL
-	rc = DosDevIOCtl(
-		&dbuf,			/* data block */
-		&parblk,		/* parameter block */
-		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
-		IOCTL_DISK,		/* device category - logical drive */
-		dfd);			/* handle from DosOpen */
-#else
-	rc = DosDevIOCtl(
-		dfd,			/* handle from DosOpen */
-		IOCTL_DISK,		/* device category - logical drive */
-		DSK_UNLOCKDRIVE,	/* device function - unlock drive */
-		&parblk,		/* parameter block */
-		plen,			/* input length of parameter block */
-		&plen,			/* output length of parameter block */
-		&dbuf,			/* data block */
-		sizeof(dbuf),		/* input length of data block */
-		&dlen);			/* output length of data block */
-#endif
-
-	if(rc != 0)
-		error("can't unlock drive, rc = %d", rc);
-
-	/* Close the disk */
-
-	rc = DosClose(dfd);
-	if(rc != 0)
-		error("can't close drive, rc = %d", rc);
+/*
+ * Get the value for a flag that requires one. This may be attached to the
+ * flag itself, or be the next argument, in which case the argument index
+ * is advanced. Returns NULL if there is no value.
+ *
+ */
+
+static PUCHAR flag_value(INT argc, PUCHAR argv[], PINT q)
+{	if(argv[*q][2] != '\0') return(&argv[*q][2]);
+	if(*q + 1 >= argc) return((PUCHAR) NULL);
+
+	return(argv[++*q]);
 }
 
 
 /*
- * Process the disk. This simply means that tracks are copied from the
- * image file to successive tracks and heads.
+ * Work out the number of sectors per track for a diskette, from the type
+ * flag, from a media sense or, failing that, from the BIOS parameter block
+ * of the image (if known) or the size of the image (if known; 'size' is
+ * NOSIZE if not).
+ * Returns TRUE on success, FALSE on failure.
  *
  */
 
-static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
-{	APIRET rc;
-	UINT i;
-	size_t n;
-	UINT curcyl, curhead;		/* Current position while writing */
-	UINT cyls, heads, sectors;	/* Drive geometry */
-	UCHAR dpb;			/* DosDevIOCtl data buffer */
-	PTRACKLAYOUT parblk;		/* DosDevIOCtl parameter block */ 
-#ifdef	DUAL
-	UINT plen;			/* Length for parameters */
+#ifndef	DUAL
+static BOOL get_geometry(ULONG size, PDISK dp, INT type, PBPB bp, PUINT psectors)
 #else
-	UCHAR mspar = 0;		/* DosDevIOCTL parameter block */
-	ULONG plen;			/* Length for parameters */
-	ULONG dlen;			/* Length for data */
+static BOOL get_geometry(ULONG size, PDISK dp, INT type, PUINT psectors)
 #endif
-	struct stat statbuf;		/* Input file status buffer */
-	PUCHAR buf;			/* Pointer to track buffer */
-	BOOL res = TRUE;		/* Final function result */
+{	APIRET rc;
+	UINT sectors;			/* Sectors per track */
+	UINT mtype;			/* Sensed media type */
 
-	cyls = 80;			/* Always this */
-	heads = 2;			/* Always this */
 	switch(type) {
 		case TY_DD:
 			sectors = 9;
@@ -458,63 +779,109 @@ static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
 			sectors = 36;
 			break;
 
+		default:
 		case TY_UNKNOWN:
-			if(fstat(fileno(fp), &statbuf) != 0) {
-				error(
-					"cannot get information about"
-					" image file");
-					return(FALSE);
-			}
-#ifdef	DUAL
-			dpb = 0;			/* Cannot sense media */
-#else
-			plen = sizeof(mspar);
-			dlen = sizeof(dpb);
-			rc = DosDevIOCtl(
-				dfd,			/* handle from DosOpen */
-				IOCTL_DISK,		/* device category - logical drive */
-				DSK_QUERYMEDIASENSE,	/* device function - get media type */
-				&mspar,			/* parameter block */
-				plen,			/* input length of parameter block */
-				&plen,			/* output length of parameter block */
-				&dpb,			/* data block */
-				dlen,			/* input length of data block */
-				&dlen);			/* output length of data block */
-
+			rc = sense_disk(dp, &mtype);
 			if(rc != 0) {
 				error("cannot get media sense information"
 				", rc = %d",
 				rc);
 				return(FALSE);
 			}
-#endif
-			switch(dpb) {
+			switch(mtype) {
 				default:
-				case 0:			/* Need to guess media size */
-					if(statbuf.st_size > HD_MAX) {
+				case TY_UNKNOWN:	/* Need to guess media size */
+#ifndef	DUAL
+					if(bp != (PBPB) NULL &&
+					   bp->heads == HEADS &&
+					   (bp->sectors == 9 ||
+					    bp->sectors == 18 ||
+					    bp->sectors == 36)) {
+						sectors = bp->sectors;
+						break;
+					}
+#endif
+					if(size == NOSIZE) {
+						error(
+							"cannot determine diskette"
+							" size; use -d, -e or -h"
+							" flag");
+						return(FALSE);
+					}
+					if(size > HD_MAX) {
 						sectors = 36;
 						break;
 					}
-					if(statbuf.st_size > DD_MAX) {
+					if(size > DD_MAX) {
 						sectors = 18;
 						break;
 					}
 					sectors = 9;
 					break;
 
-				case 1:
+				case TY_DD:
 					sectors = 9;
 					break;
 
-				case 2:
+				case TY_HD:
 					sectors = 18;
 					break;
 
-				case 3:
+				case TY_ED:
 					sectors = 36;
 					break;
 			}
 	}
+	*psectors = sectors;
+
+	return(TRUE);
+}
+
+
+/*
+ * Process the disk. This simply means that tracks are copied from the
+ * image file to successive tracks and heads. The image file is read by
+ * the track pipeline, so that with more than one buffer the next track
+ * is being read while the current one is written. If the diskette type
+ * is not known, the boot sector is read ahead to help find it, since
+ * the image may be coming from a pipe and cannot be looked at twice.
+ * When resuming, the tracks already written are checked against the
+ * journal as they are read, and writing carries on after them.
+ *
+ */
+
+static BOOL process_disk(PSTREAM sp, PDISK dp, INT type, PUCHAR mname)
+{	APIRET rc;
+	UINT curcyl, curhead;		/* Current position while writing */
+	UINT cyls, heads, sectors;	/* Drive geometry */
+	PTRKPIPE pp;			/* Pipeline reading image file */
+	PTRACK t;			/* Current track */
+	PUCHAR cur = (PUCHAR) NULL;	/* Current diskette contents */
+	PMANIFEST mp = (PMANIFEST) NULL;/* Manifest being built */
+	PVERIFY vp = (PVERIFY) NULL;	/* Verification, if wanted */
+	UINT tracks = 0;		/* Tracks processed */
+	UINT skipped = 0;		/* Tracks found to be unchanged */
+	UINT first = 0;			/* First track not already written */
+	BOOL last;			/* TRUE if last track of image */
+	BOOL res = TRUE;		/* Final function result */
+#ifndef	DUAL
+	UCHAR boot[BLKSIZE];		/* Boot sector, read ahead */
+	BPB bpb;			/* File system layout */
+	PBPB bp = (PBPB) NULL;
+#endif
+
+	cyls = 80;			/* Always this */
+	heads = 2;			/* Always this */
+#ifndef	DUAL
+	if(type == TY_UNKNOWN &&
+	   peek_stream(sp, boot, BLKSIZE) == BLKSIZE &&
+	   read_bpb(boot, &bpb) == TRUE)
+		bp = &bpb;
+	if(get_geometry(sp->size, dp, type, bp, &sectors) == FALSE)
+#else
+	if(get_geometry(sp->size, dp, type, &sectors) == FALSE)
+#endif
+		return(FALSE);
 	error(
 		"%d cylinders, %d heads, %d sectors per track",
 		cyls, heads, sectors);
@@ -522,25 +889,42 @@ static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
 	/* We now have the file, and the diskette geometry. Write the image
 	   to the diskette. */
 
-	/* First allocate the parameter block and track table, as well
-	   as the track buffer. */
+	/* First set up the geometry (which builds the track table), and
+	   start the pipeline that reads the image file. */
 
-	plen = sizeof(TRACKLAYOUT)+(sectors-1)*sizeof(USHORT)*2;
-	parblk = (PTRACKLAYOUT) malloc(plen);
-	if(parblk == (PTRACKLAYOUT) NULL) {
-		error("cannot allocate memory for track table");
+	if(set_geometry(dp, cyls, heads, sectors) == FALSE)
 		return(FALSE);
+	if(journal != (PJOURNAL) NULL) {
+		if(start_journal(journal, dp) == FALSE ||
+		   journal_disk(journal, dp) == FALSE)
+			return(FALSE);
+		first = journal->done;
 	}
-#ifdef	DUAL
-	buf = (PUCHAR) malloc((INT) (sectors*BLKSIZE));
-#else
-	buf = (PUCHAR) malloc(sectors*BLKSIZE);
-#endif
-	if(buf == (PUCHAR) NULL) {
-		error("cannot allocate memory for track buffer");
-		free((PTRACKLAYOUT) parblk);
+	if(mname != (PUCHAR) NULL) {
+		mp = open_manifest(mname, cyls, heads, sectors);
+		if(mp == (PMANIFEST) NULL)
+			return(FALSE);
+	}
+	if(verify == TRUE) {
+		vp = open_verify(dp, rewrites);
+		if(vp == (PVERIFY) NULL) {
+			if(mp != (PMANIFEST) NULL) (VOID) close_manifest(mp);
+			return(FALSE);
+		}
+	}
+	pp = open_pipe(
+		dp,
+		nbufs == 0 ? DEFBUFS : nbufs,
+		TP_SOURCE,
+		read_image,
+		(PVOID) sp);
+	if(pp == (PTRKPIPE) NULL) {
+		if(mp != (PMANIFEST) NULL) (VOID) close_manifest(mp);
+		if(vp != (PVERIFY) NULL) close_verify(vp, dp);
 		return(FALSE);
 	}
+	if(diff == TRUE)
+		cur = alloc_track(dp);	/* Just write everything if no memory */
 
 	/* Now enter the main writing loop. A whole track is done
 	   at a time. */
@@ -549,62 +933,69 @@ static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
 	curhead = 0;
 
 	for(;;) {
-#ifdef	DUAL
-		memset(buf, '\0', (INT) (sectors*BLKSIZE));/* In case of short read */
-		n = fread(buf, (INT) BLKSIZE, sectors, fp);/* Read a track */
-#else
-		memset(buf, '\0', sectors*BLKSIZE);	/* In case of short read */
-		n = fread(buf, BLKSIZE, sectors, fp);	/* Read a track */
-#endif
-		if((n != sectors) && ferror(fp)) {
+		t = pipe_get(pp);		/* Next track of image */
+		if(t->error == TRUE) {
 			error("error reading image file");
 			res = FALSE;
 			break;
 		}
+		last = t->last;
 
-		parblk->bCommand = 1;		/* Write contiguous track */
-		parblk->usHead = (USHORT) curhead;
-		parblk->usCylinder = (USHORT) curcyl;
-		parblk->usFirstSector = 0;
-		parblk->cSectors = (USHORT) sectors;
-
-		for(i = 1; i <= (USHORT) sectors; i++) {
-			parblk->TrackTable[i-1].usSectorNumber = i;
-			parblk->TrackTable[i-1].usSectorSize = BLKSIZE;
+		if(quiet == FALSE) {
+			show_progress(curcyl, curhead);
 		}
 
-		fprintf(
-			stdout,
-			"%s: cyl: %2d; head: %1d\r",
-			progname,
-			curcyl,
-			curhead);
-		fflush(stdout);
-
-#ifdef	DUAL
-		rc = DosDevIOCtl(
-			(PVOID) buf,
-			(PVOID) parblk,
-			DSK_WRITETRACK,
-			IOCTL_DISK,
-			dfd);
-#else
-		dlen = sectors*BLKSIZE;
-		rc = DosDevIOCtl(
-			dfd,
-			IOCTL_DISK,
-			DSK_WRITETRACK,
-			(PVOID) parblk,
-			plen,
-			&plen,
-			(PVOID) buf,
-			dlen,
-			&dlen);
-#endif
-
+		tracks++;
+		if(tracks <= first) {		/* Written before resuming */
+			if(journal_match(
+				journal,
+				tracks - 1,
+				t->buf) == FALSE) {
+				error(
+					"\nimage file does not match journal"
+					" file '%s' at cylinder %d, head %d;"
+					" cannot resume",
+					journal->name,
+					curcyl,
+					curhead);
+				pipe_put(pp, t);
+				res = FALSE;
+				break;
+			}
+			rc = NO_ERROR;
+		} else if(cur != (PUCHAR) NULL &&
+		   read_track(dp, curcyl, curhead, cur) == NO_ERROR &&
+		   memcmp(cur, t->buf, (size_t) (sectors*BLKSIZE)) == 0) {
+			skipped++;
+			rc = NO_ERROR;
+		} else {
+			rc = format == FALSE ? NO_ERROR :
+				format_track(dp, curcyl, curhead);
+			if(rc == NO_ERROR)
+				rc = write_track(dp, curcyl, curhead, t->buf);
+			if(rc == NO_ERROR && vp != (PVERIFY) NULL)
+				rc = verify_track(
+						vp,
+						dp,
+						curcyl,
+						curhead,
+						t->buf);
+		}
+		if(rc == NO_ERROR && mp != (PMANIFEST) NULL)
+			manifest_track(mp, t->buf, sectors*BLKSIZE);
+		if(rc == NO_ERROR && journal != (PJOURNAL) NULL &&
+		   tracks > first)
+			journal_track(journal, t->buf);
+		pipe_put(pp, t);
 		if(rc != 0) {
 			if(rc == ERROR_WRITE_PROTECT) {
 				error("\ndiskette is write protected");
+			} else if(rc == ERROR_CRC) {
+				error(
+					"\ncylinder %d, head %d could not be"
+					" written correctly",
+					curcyl,
+					curhead);
 			} else {
 				error(
 					"\nerror writing cylinder %d, head %d",
@@ -621,23 +1012,741 @@ static BOOL process_disk(FILE *fp, HFILE dfd, INT type)
 			curcyl++;
 		}
 		if(curcyl >= cyls) break;
-		if(feof(fp)) break;
+		if(last == TRUE) break;
+	}
+	if(res == TRUE) {
+		if(quiet == FALSE) end_progress();
+		if(diff == TRUE) {
+			error(
+				"%d of %d tracks did not need writing",
+				skipped,
+				tracks);
+		}
+	}
+
+	if(vp != (PVERIFY) NULL) {
+		report_verify(vp, (PUCHAR) NULL);
+		close_verify(vp, dp);
+	}
+	(VOID) close_pipe(pp);
+	if(cur != (PUCHAR) NULL) free_track(dp, cur);
+	if(mp != (PMANIFEST) NULL && close_manifest(mp) == FALSE)
+		res = FALSE;
+
+	return(res);
+}
+
+
+/*
+ * Write a series of diskettes, as listed in the job file, using the
+ * drives given. Each drive is opened and locked only once, and track
+ * buffers are kept from one diskette to the next; see jobs.c.
+ * Returns TRUE if every job was done successfully, else FALSE.
+ *
+ */
+
+static BOOL process_jobs(PUCHAR drives[], UINT ndrives, INT type)
+{	PJOB first;			/* Jobs to be done */
+	UINT count;			/* Number of jobs */
+	BOOL res;
+
+	first = read_jobs(jobfile, type, &count);
+	if(first == (PJOB) NULL)
+		return(FALSE);
+
+	quiet = ndrives > 1 ? TRUE : FALSE;	/* Displays would be mixed */
+	res = run_jobs(first, count, drives, ndrives, TRUE, write_job);
+	free_jobs(first);
+
+	return(res);
+}
+
+
+/*
+ * Do one job from the job file; write the diskette in 'dp' from the image
+ * file named in the job. This may be called from several threads at once.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL write_job(PJOB jp, PDISK dp)
+{	FILE *fp;			/* File pointer for image file */
+	PSTREAM sp;			/* Stream for reading image file */
+	BOOL res = FALSE;
+
+	fp = fopen(jp->file, "rb");
+	if(fp == (FILE *) NULL) {
+		error("cannot open file '%s'", jp->file);
+		return(FALSE);
+	}
+
+	sp = open_instream(fp);
+	if(sp != (PSTREAM) NULL) {
+#ifndef	DUAL
+		if(in_memory(sp) == TRUE)
+			res = process_image(sp, dp, jp->type, jp->manifest);
+		else
+#endif
+		res = process_disk(sp, dp, jp->type, jp->manifest);
+		(VOID) close_stream(sp);
+	}
+	fclose(fp);
+
+	return(res);
+}
+
+
+#ifndef	DUAL
+
+/*
+ * Decide whether the image should be held in memory and written from
+ * there, rather than read a track at a time. This is done if the image
+ * file can be memory mapped, or if its file system must be examined.
+ * A compressed image is better decompressed by the track pipeline.
+ *
+ */
+
+static BOOL in_memory(PSTREAM sp)
+{
+#ifdef	MMAP
+	struct stat statbuf;		/* Image file status buffer */
+
+	if(sp->codec == CODEC_NONE &&
+	   fstat(fileno(sp->fp), &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+		return(TRUE);
+#endif
+
+	return(sparse);
+}
+
+
+/*
+ * Decode the BIOS parameter block of an image, if it has one.
+ * Returns 'bp' on success, or NULL if there is no FAT file system; this
+ * is an error (and is reported) if only tracks in use are to be written.
+ *
+ */
+
+static PBPB image_bpb(PIMAGE im, PBPB bp)
+{	if(im->size >= BLKSIZE && read_bpb(im->data, bp) == TRUE &&
+	   bp->reserved*BLKSIZE + FATSIZE(bp) <= im->size)
+		return(bp);
+
+	if(sparse == TRUE)
+		error("image does not contain a FAT file system; cannot use --sparse");
+
+	return((PBPB) NULL);
+}
+
+
+/*
+ * Process the disk, for an image held in memory. The tracks are written
+ * directly from the image (or from the mapping of the image file), so
+ * there is no copying and no need for the track pipeline.
+ *
+ */
+
+static BOOL process_image(PSTREAM sp, PDISK dp, INT type, PUCHAR mname)
+{	TARGET tg;			/* The single target */
+	BPB bpb;			/* File system layout */
+	PBPB bp;
+	BOOL res = FALSE;
+
+	memset(&tg, 0, sizeof(TARGET));
+	tg.drive = dp->drive;
+	tg.dp = dp;
+	tg.diff = diff;
+	tg.format = format;
+	tg.im = load_image(sp);
+	if(tg.im == (PIMAGE) NULL)
+		return(FALSE);
+	bp = image_bpb(tg.im, &bpb);
+
+	if((bp != (PBPB) NULL || sparse == FALSE) &&
+	   target_geometry(tg.im->size, &tg, type, bp) == TRUE &&
+	   target_manifest(&tg, mname) == TRUE &&
+	   (journal == (PJOURNAL) NULL || resume_target(&tg) == TRUE)) {
+		error(
+			"%d cylinders, %d heads, %d sectors per track",
+			dp->cyls, dp->heads, dp->sectors);
+		init_target(&tg);
+
+		res = write_target(&tg, quiet == TRUE ? FALSE : TRUE);
+		if(res == TRUE) {
+			if(quiet == FALSE) end_progress();
+			if(diff == TRUE || sparse == TRUE) {
+				error(
+					"%d of %d tracks did not need writing",
+					tg.skipped,
+					tg.tracks);
+			}
+		} else if(tg.rc == ERROR_WRITE_PROTECT) {
+			error("\ndiskette is write protected");
+		} else if(tg.rc == ERROR_CRC) {
+			error(
+				"\ncylinder %d, head %d could not be written"
+				" correctly",
+				tg.track / dp->heads,
+				tg.track % dp->heads);
+		} else {
+			error(
+				"\nerror writing cylinder %d, head %d",
+				tg.track / dp->heads,
+				tg.track % dp->heads);
+		}
+		if(tg.vp != (PVERIFY) NULL) report_verify(tg.vp, (PUCHAR) NULL);
+	}
+
+	if(tg.vp != (PVERIFY) NULL) close_verify(tg.vp, dp);
+	if(tg.mp != (PMANIFEST) NULL && close_manifest(tg.mp) == FALSE)
+		res = FALSE;
+	if(tg.map != (PUCHAR) NULL) free((PUCHAR) tg.map);
+	free_image(tg.im);
+
+	return(res);
+}
+
+
+/*
+ * Set the geometry of a target drive and, if only the tracks in use are
+ * to be written, build the map of those tracks. Verification is also
+ * prepared, if wanted.
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+static BOOL target_geometry(ULONG size, PTARGET tp, INT type, PBPB bp)
+{	UINT sectors;			/* Sectors per track */
+
+	if(get_geometry(size, tp->dp, type, bp, &sectors) == FALSE ||
+	   set_geometry(tp->dp, CYLS, HEADS, sectors) == FALSE)
+		return(FALSE);
+
+	if(sparse == TRUE) {
+		tp->map = fat_tracks(
+				tp->im->data + bp->reserved*BLKSIZE,
+				bp,
+				sectors,
+				CYLS*HEADS);
+		if(tp->map == (PUCHAR) NULL) {
+			error("cannot allocate memory for track map");
+			return(FALSE);
+		}
+	}
+	if(verify == TRUE) {
+		tp->vp = open_verify(tp->dp, rewrites);
+		if(tp->vp == (PVERIFY) NULL)
+			return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Start the journal for a target drive (whose geometry must be set). If
+ * an earlier run was interrupted, check the tracks it wrote against the
+ * image and the diskette, and arrange for writing to carry on after them.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+static BOOL resume_target(PTARGET tp)
+{	PDISK dp = tp->dp;
+	ULONG tlen = dp->sectors*BLKSIZE;
+	UINT t;
+
+	if(start_journal(journal, dp) == FALSE)
+		return(FALSE);
+	for(t = 0; t < journal->done; t++) {
+		if((ULONG) t*tlen >= tp->im->size ||
+		   journal_match(
+			journal,
+			t,
+			image_track(tp->im, tlen, t)) == FALSE) {
+			error(
+				"image file does not match journal file '%s'"
+				" at cylinder %d, head %d; cannot resume",
+				journal->name,
+				t / dp->heads,
+				t % dp->heads);
+			return(FALSE);
+		}
+	}
+	if(journal_disk(journal, dp) == FALSE)
+		return(FALSE);
+	tp->jp = journal;
+	tp->first = journal->done;
+
+	return(TRUE);
+}
+
+
+/*
+ * Start the manifest, if one is wanted, for the image as written to a
+ * target drive (whose geometry must be set).
+ * Returns TRUE on success, FALSE on failure.
+ *
+ */
+
+static BOOL target_manifest(PTARGET tp, PUCHAR mname)
+{	if(mname == (PUCHAR) NULL) return(TRUE);
+
+	tp->mp = open_manifest(
+			mname,
+			tp->dp->cyls,
+			tp->dp->heads,
+			tp->dp->sectors);
+
+	return(tp->mp != (PMANIFEST) NULL ? TRUE : FALSE);
+}
+
+#endif
+
+
+#ifdef	THREADS
+
+/*
+ * Process several disks at once. The image is read into memory just once,
+ * and then written to all of the drives in parallel.
+ * Returns TRUE only if every drive was written successfully.
+ *
+ */
+
+static BOOL process_targets(PSTREAM sp, PUCHAR drives[], UINT ndrives, INT type)
+{	PIMAGE im;			/* Image in memory */
+	BPB bpb;			/* File system layout */
+	PBPB bp;
+	BOOL res;
+
+	im = load_image(sp);
+	if(im == (PIMAGE) NULL)
+		return(FALSE);
+	bp = image_bpb(im, &bpb);
+	res = bp == (PBPB) NULL && sparse == TRUE ?
+		FALSE : write_drives(im, bp, drives, ndrives, type);
+	free_image(im);
+
+	return(res);
+}
+
+
+/*
+ * Copy the diskette in drive 'src' to one or more target drives, through
+ * an image in memory; the targets get the geometry of the source. If the
+ * source is also a target, it must be the only one; the whole source is
+ * read first, and the operator is then asked to change diskettes.
+ * Otherwise the source is read on a separate thread while the targets
+ * are written.
+ * Returns TRUE only if the source was read in full and every target was
+ * written successfully.
+ *
+ */
+
+static BOOL process_copy(PUCHAR src, PUCHAR drives[], UINT ndrives, INT type)
+{	COPY cp;			/* The source being copied */
+	BPB bpb;			/* File system layout of source */
+	UINT sectors;			/* Sectors per track */
+	UINT i;
+	BOOL swap = FALSE;		/* Source is also the target */
+	BOOL res;
+
+	for(i = 0; i < ndrives; i++)
+		if(strcmp(drives[i], src) == 0) swap = TRUE;
+	if(swap == TRUE && ndrives != 1) {
+		error("source drive %s cannot be one of several targets", src);
+		return(FALSE);
+	}
+
+	memset(&cp, 0, sizeof(COPY));
+	cp.dp = open_disk(src, FALSE);
+	if(cp.dp == (PDISK) NULL)
+		return(FALSE);
+	if(get_geometry(
+		NOSIZE,
+		cp.dp,
+		type,
+		type == TY_UNKNOWN ? disk_bpb(cp.dp, &bpb) : (PBPB) NULL,
+		&sectors) == FALSE ||
+	   set_geometry(cp.dp, CYLS, HEADS, sectors) == FALSE) {
+		close_disk(cp.dp);
+		return(FALSE);
 	}
-	if(res == TRUE) fputc('\n', stdout);
+	error(
+		"source drive %s: %d cylinders, %d heads, %d sectors per track",
+		src,
+		CYLS,
+		HEADS,
+		sectors);
+	cp.im = new_image((ULONG) CYLS*HEADS*sectors*BLKSIZE, ndrives);
+	if(cp.im == (PIMAGE) NULL) {
+		close_disk(cp.dp);
+		return(FALSE);
+	}
+	type = sectors == 9 ? TY_DD : sectors == 18 ? TY_HD : TY_ED;
+	init_recovery(&cp.rec, DEFRETRIES, 0L);
+
+	if(swap == TRUE) {		/* Read it all, then change diskettes */
+		cp.progress = quiet == TRUE ? FALSE : TRUE;
+		(VOID) fill_image(&cp);
+		close_disk(cp.dp);
+		cp.dp = (PDISK) NULL;
+		res = cp.rc == NO_ERROR &&
+		      ask_disk("target diskette", (PUCHAR) NULL, src) == TRUE ?
+			TRUE : FALSE;
+		if(res == TRUE)
+			res = write_drives(cp.im, (PBPB) NULL, drives, 1, type);
+	} else {			/* Read and write together */
+		res = start_copy(&cp) == TRUE &&
+		      write_drives(cp.im, (PBPB) NULL, drives, ndrives, type) ==
+			TRUE ? TRUE : FALSE;
+		(VOID) end_copy(&cp);
+		close_disk(cp.dp);
+	}
+
+	if(cp.rc != NO_ERROR) {
+		error(
+			"error reading source cylinder %d, head %d; rc=%d",
+			cp.track / HEADS,
+			cp.track % HEADS,
+			cp.rc);
+		res = FALSE;
+	}
+	report_recovery(&cp.rec);
+	if(cp.rec.nbad != 0) res = FALSE;	/* Copies are incomplete */
+	end_recovery(&cp.rec);
+	free_image(cp.im);
+
+	return(res);
+}
+
+
+/*
+ * Write the image called 'name' in the pack file to one or more drives.
+ * The image is read from the pack into memory, each track being checked
+ * against its hash as it comes; this takes only a few milliseconds, so
+ * there is no point in overlapping it with the writing. The targets get
+ * the geometry of the image, unless it is forced.
+ * Returns TRUE only if the image was read in full and every drive was
+ * written successfully.
+ *
+ */
 
-	free((PUCHAR) buf);
-	free((PTRACKLAYOUT) parblk);
+static BOOL process_pack(PUCHAR name, PUCHAR drives[], UINT ndrives, INT type)
+{	PPACK pk;			/* The pack file */
+	PPKIMAGE ip;			/* The image in it */
+	PIMAGE im;			/* Image in memory */
+	BPB bpb;			/* File system layout */
+	PBPB bp;
+	ULONG tlen;			/* Bytes per track */
+	UINT t;
+	BOOL res = TRUE;
+
+	pk = open_pack(packfile, FALSE);
+	if(pk == (PPACK) NULL)
+		return(FALSE);
+	ip = find_packed(pk, name);
+	if(ip == (PPKIMAGE) NULL) {
+		error(
+			"there is no image '%s' in pack file '%s'",
+			name,
+			packfile);
+		(VOID) close_pack(pk);
+		return(FALSE);
+	}
+	tlen = (ULONG) ip->sectors*BLKSIZE;
+	im = new_image((ULONG) ip->tracks*tlen, 0);
+	if(im == (PIMAGE) NULL) {
+		(VOID) close_pack(pk);
+		return(FALSE);
+	}
+	for(t = 0; t < ip->tracks && res == TRUE; t++)
+		res = packed_track(pk, ip, t, im->data + t*tlen);
+	im->avail = im->size;
+	if(type == TY_UNKNOWN)
+		type = ip->sectors == 9 ? TY_DD :
+			ip->sectors == 18 ? TY_HD : TY_ED;
+	(VOID) close_pack(pk);
+
+	if(res == TRUE) {
+		bp = image_bpb(im, &bpb);
+		res = bp == (PBPB) NULL && sparse == TRUE ?
+			FALSE : write_drives(im, bp, drives, ndrives, type);
+	}
+	free_image(im);
 
 	return(res);
 }
 
 
+/*
+ * Apply the patch file to the diskette in a drive. The whole diskette is
+ * read into memory first, and every track checked against the base image
+ * the patch was made from; only if the diskette holds exactly that image
+ * is anything written, and then only the tracks that change. The patched
+ * image is checked against the hash in the patch before writing begins.
+ * Returns TRUE on success, else FALSE.
+ *
+ */
+
+static BOOL process_patch(PUCHAR drive)
+{	APIRET rc;
+	PPATCH pp;			/* The patch */
+	PDISK dp;			/* Diskette being patched */
+	PVERIFY vp = (PVERIFY) NULL;	/* Verification, if wanted */
+	PUCHAR buf;			/* Contents of diskette */
+	PUCHAR p;			/* Current track */
+	SHA256 ctx;			/* For hashing the contents */
+	UCHAR sha[SHA256LEN];
+	ULONG tlen;			/* Bytes per track */
+	UINT cyl, head;
+	UINT i, t;
+	BOOL res = TRUE;
+
+	pp = load_patch(patchfile);
+	if(pp == (PPATCH) NULL)
+		return(FALSE);
+	tlen = (ULONG) pp->sectors*BLKSIZE;
+	buf = alloc_buffer(pp->tracks*tlen);
+	if(buf == (PUCHAR) NULL) {
+		error("cannot allocate memory for image");
+		free_patch(pp);
+		return(FALSE);
+	}
+	dp = open_disk(drive, TRUE);
+	if(dp == (PDISK) NULL) {
+		free_buffer(buf);
+		free_patch(pp);
+		return(FALSE);
+	}
+	dp->tm = timing;
+	error(
+		"%d cylinders, %d heads, %d sectors per track",
+		CYLS,
+		HEADS,
+		pp->sectors);
+	if(set_geometry(dp, CYLS, HEADS, pp->sectors) == FALSE)
+		res = FALSE;
+
+	/* Read the whole diskette, checking each track against the base */
+
+	for(t = 0; t < pp->tracks && res == TRUE; t++) {
+		cyl = t / HEADS;
+		head = t % HEADS;
+		if(quiet == FALSE) {
+			show_progress(cyl, head);
+		}
+		p = buf + t*tlen;
+		rc = read_track(dp, cyl, head, p);
+		if(rc != NO_ERROR) {
+			error(
+				"\nerror reading cylinder %d, head %d",
+				cyl,
+				head);
+			res = FALSE;
+		} else if(crc32c(0, p, tlen) != pp->crc[t]) {
+			error(
+				"\ncylinder %d, head %d does not match the"
+				" image patch file '%s' was made from",
+				cyl,
+				head,
+				patchfile);
+			res = FALSE;
+		}
+	}
+	if(res == TRUE) {
+		if(quiet == FALSE) end_progress();
+		sha256_init(&ctx);
+		sha256_update(&ctx, buf, pp->tracks*tlen);
+		sha256_final(&ctx, sha);
+		if(memcmp(sha, pp->base, SHA256LEN) != 0) {
+			error(
+				"diskette does not hold the image patch file"
+				" '%s' was made from",
+				patchfile);
+			res = FALSE;
+		}
+	}
+
+	/* Patch the image in memory, and check the result */
+
+	if(res == TRUE) {
+		for(i = 0; i < pp->changed; i++)
+			apply_change(
+				pp,
+				&pp->change[i],
+				buf + pp->change[i].track*tlen);
+		sha256_init(&ctx);
+		sha256_update(&ctx, buf, pp->tracks*tlen);
+		sha256_final(&ctx, sha);
+		if(memcmp(sha, pp->result, SHA256LEN) != 0) {
+			error("patch file '%s' is damaged", patchfile);
+			res = FALSE;
+		}
+	}
+	if(res == TRUE && verify == TRUE) {
+		vp = open_verify(dp, rewrites);
+		if(vp == (PVERIFY) NULL) res = FALSE;
+	}
+
+	/* Write the tracks that change */
+
+	for(i = 0; i < pp->changed && res == TRUE; i++) {
+		t = pp->change[i].track;
+		cyl = t / HEADS;
+		head = t % HEADS;
+		if(quiet == FALSE) {
+			show_progress(cyl, head);
+		}
+		p = buf + t*tlen;
+		rc = write_track(dp, cyl, head, p);
+		if(rc == NO_ERROR && vp != (PVERIFY) NULL)
+			rc = verify_track(vp, dp, cyl, head, p);
+		if(rc == ERROR_WRITE_PROTECT) {
+			error("\ndiskette is write protected");
+		} else if(rc == ERROR_CRC) {
+			error(
+				"\ncylinder %d, head %d could not be"
+				" written correctly",
+				cyl,
+				head);
+		} else if(rc != NO_ERROR) {
+			error(
+				"\nerror writing cylinder %d, head %d",
+				cyl,
+				head);
+		}
+		if(rc != NO_ERROR) res = FALSE;
+	}
+	if(res == TRUE) {
+		if(quiet == FALSE && pp->changed != 0) end_progress();
+		error(
+			"%d of %d tracks needed writing",
+			pp->changed,
+			pp->tracks);
+	}
+
+	if(vp != (PVERIFY) NULL) {
+		report_verify(vp, (PUCHAR) NULL);
+		close_verify(vp, dp);
+	}
+	if(timing != (PTIMING) NULL &&
+	   write_timing(timing, statsfile, dp, patchfile, 1, res) == FALSE)
+		res = FALSE;
+	close_disk(dp);
+	free_buffer(buf);
+	free_patch(pp);
+
+	return(res);
+}
+
+
+/*
+ * Write an image in memory to several drives at once. A drive that cannot
+ * be opened, or that fails part way, is dropped without affecting the
+ * others. Any manifest is built as the first drive opened is written.
+ * Returns TRUE only if every drive was written successfully.
+ *
+ */
+
+static BOOL write_drives(PIMAGE im, PBPB bp, PUCHAR drives[], UINT ndrives,
+			INT type)
+{	PTARGET tg;			/* Table of targets */
+	PTARGET tp;
+	UINT i;
+	UINT open = 0;			/* Number of drives opened */
+	BOOL res;
+
+	tg = (PTARGET) calloc(ndrives, sizeof(TARGET));
+	if(tg == (PTARGET) NULL) {
+		error("cannot allocate memory for drive table");
+		return(FALSE);
+	}
+
+	for(i = 0; i < ndrives; i++) {
+		tp = &tg[i];
+		tp->drive = drives[i];
+		tp->im = im;
+		tp->writer = i;
+		tp->diff = diff;
+		tp->format = format;
+		tp->dp = open_disk(tp->drive, TRUE);
+		if(tp->dp == (PDISK) NULL) continue;
+		if(target_geometry(im->size, tp, type, bp) == FALSE) {
+			close_disk(tp->dp);
+			tp->dp = (PDISK) NULL;
+			continue;
+		}
+		error(
+			"drive %s: %d cylinders, %d heads, %d sectors per track",
+			tp->drive,
+			tp->dp->cyls,
+			tp->dp->heads,
+			tp->dp->sectors);
+		if(open++ == 0 && target_manifest(tp, manifest) == FALSE) {
+			open = 0;		/* Give up altogether */
+			break;
+		}
+	}
+
+	res = open == 0 ? FALSE : write_targets(tg, ndrives);
+
+	for(i = 0; i < ndrives; i++) {
+		if(tg[i].mp != (PMANIFEST) NULL &&
+		   close_manifest(tg[i].mp) == FALSE)
+			res = FALSE;
+		if(tg[i].vp != (PVERIFY) NULL) close_verify(tg[i].vp, tg[i].dp);
+		if(tg[i].dp != (PDISK) NULL) close_disk(tg[i].dp);
+		if(tg[i].map != (PUCHAR) NULL) free((PUCHAR) tg[i].map);
+	}
+	free((PTARGET) tg);
+
+	return(res);
+}
+
+#endif
+
+
+/*
+ * Read the next track from the image file. This is called by the track
+ * pipeline, possibly on a separate thread.
+ * Returns TRUE on success, FALSE on a read error.
+ *
+ */
+
+static BOOL read_image(PTRACK t, PVOID arg)
+{	PSTREAM sp = (PSTREAM) arg;	/* Image file */
+	ULONG start = clock_us();
+	ULONG n;
+
+#ifdef	DUAL
+	memset(t->buf, '\0', (INT) (t->sectors*BLKSIZE));/* In case of short read */
+#else
+	memset(t->buf, '\0', t->sectors*BLKSIZE);/* In case of short read */
+#endif
+	n = read_stream(sp, t->buf, t->sectors*BLKSIZE);/* Read a track */
+	if(timing != (PTIMING) NULL)
+		time_op(
+			timing,
+			TM_FILE,
+			start,
+			sp->error == TRUE ? ERROR_READ_FAULT : NO_ERROR);
+	if(sp->error == TRUE)
+		return(FALSE);
+
+	t->count = (UINT) (n / BLKSIZE);
+	if(sp->eof == TRUE) t->last = TRUE;
+
+	return(TRUE);
+}
+
+
 /*
  * Output an error message, possibly with parameters
  *
  */
 
-static VOID error(PUCHAR mes, ...)
+VOID error(PUCHAR mes, ...)
 {	va_list ap;
 
 	fprintf(stderr, "%s: ", progname);
@@ -689,4 +1798,3 @@ static VOID usage(VOID)
  * End of file: rawrite.c
  *
  */
-
\ No newline at end of file
@@ -0,0 +1,85 @@
+/*
+ * File: rawrite.h
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Common header file
+ *
+ */
+
+#ifndef	_RAWRITE_H
+#define	_RAWRITE_H
+
+/* Miscellaneous definitions */
+
+#define	CYLS		80		/* Cylinders on a 3.5 inch diskette */
+#define	HEADS		2		/* Heads on a 3.5 inch diskette */
+#define	MAXTARGETS	26		/* Maximum number of target drives */
+#define	STATUSMS	250		/* Interval between status updates */
+
+/* A complete image file, held in memory (mapped where possible). Tracks
+   are written directly from the image data, except for any final partial
+   track. Because the largest track is a multiple of every smaller one,
+   that is handled by keeping just one zero padded copy of the last partial
+   largest track.
+   When a diskette is being copied, the image starts empty and is filled
+   one track at a time while it is being written; 'avail' shows how much
+   is there so far, and is only looked at under 'lock'. Each writer has a
+   semaphore that is posted as each track arrives. */
+
+typedef	struct _IMAGE {
+	PUCHAR		data;		/* Image data */
+	ULONG		size;		/* Number of bytes from image file */
+	ULONG		full;		/* Bytes usable directly from data */
+	PUCHAR		tail;		/* Padded remainder, or NULL */
+	BOOL		mapped;		/* TRUE if data is a file mapping */
+	ULONG		avail;		/* Bytes present so far */
+	BOOL		broken;		/* Filling has failed */
+	SEM		lock;		/* Guards avail and broken */
+	PSEM		ready;		/* One per writer, posted per track */
+	UINT		writers;	/* Number of these */
+} IMAGE, *PIMAGE;
+
+/* A target drive being written from an image */
+
+typedef	struct _TARGET {
+	PUCHAR		drive;		/* Drive name */
+	PDISK		dp;		/* Open disk, or NULL if dropped */
+	PIMAGE		im;		/* Image being written */
+	UINT		tracks;		/* Number of tracks to write */
+	volatile UINT	track;		/* Track currently being written */
+	volatile BOOL	done;		/* Writer has finished */
+	BOOL		reported;	/* Result has been reported */
+	BOOL		diff;		/* Only write tracks that differ */
+	BOOL		format;		/* Format each track before writing */
+	PVERIFY		vp;		/* Verification, or NULL */
+	PUCHAR		map;		/* Bitmap of tracks in use, or NULL */
+	UINT		skipped;	/* Tracks not needing to be written */
+	PMANIFEST	mp;		/* Manifest to be built, or NULL */
+	PJOURNAL	jp;		/* Journal of tracks written, or NULL */
+	UINT		first;		/* First track not already written */
+	UINT		writer;		/* Its semaphore in the image */
+	APIRET		rc;		/* Result of writing */
+#ifdef	THREADS
+	TID		tid;		/* Writer thread */
+#endif
+} TARGET, *PTARGET;
+
+/* External references */
+
+extern	VOID	free_image(PIMAGE);
+extern	PUCHAR	image_track(PIMAGE, ULONG, UINT);
+extern	VOID	init_target(PTARGET);
+extern	PIMAGE	load_image(PSTREAM);
+extern	PIMAGE	new_image(ULONG, UINT);
+extern	VOID	post_image(PIMAGE, ULONG);
+extern	BOOL	wait_image(PIMAGE, ULONG, UINT);
+extern	BOOL	write_target(PTARGET, BOOL);
+extern	BOOL	write_targets(PTARGET, UINT);
+
+#endif
+
+/*
+ * End of file: rawrite.h
+ *
+ */
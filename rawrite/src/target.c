@@ -0,0 +1,138 @@
+/*
+ * File: target.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Writing an image in memory to a target drive
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "diskio.h"
+#include "hash.h"
+#include "journal.h"
+#include "manifest.h"
+#include "timing.h"
+#include "verify.h"
+#include "rawrite.h"
+
+
+/*
+ * Prepare a target for writing; its drive must be open, and its geometry
+ * set. Works out how many tracks of the image need to be written.
+ *
+ */
+
+VOID init_target(PTARGET tp)
+{	PDISK dp = tp->dp;
+	ULONG tlen = dp->sectors*BLKSIZE;
+
+	tp->tracks = (UINT) ((tp->im->size + tlen - 1) / tlen);
+	if(tp->tracks == 0) tp->tracks = 1;
+	if(tp->tracks > dp->cyls*dp->heads)
+		tp->tracks = dp->cyls*dp->heads;
+	tp->track = 0;
+	tp->done = FALSE;
+	tp->reported = FALSE;
+	tp->skipped = 0;
+	tp->rc = NO_ERROR;
+}
+
+
+/*
+ * Write the image to a target. Each track is written directly from the
+ * image. If 'progress' is TRUE, the current position is displayed as
+ * each track is written.
+ * If the target's 'diff' flag is set, each track is read first, and only
+ * written if it differs from the image; reading is much quicker than
+ * writing. A track that cannot be read is simply written.
+ * If the target has a map of the tracks in use, the others are skipped.
+ * If the target's 'format' flag is set, each track is formatted just
+ * before it is written.
+ * If the target has a manifest, every track of the image is added to it.
+ * If the image is still being filled, each track is waited for.
+ * If the target has verification, every track written is read back at
+ * once, and rewritten if need be; a track that cannot be written
+ * correctly fails with ERROR_CRC.
+ * Tracks before the target's 'first' track were written by an earlier,
+ * interrupted run, and are not written again. If the target has a
+ * journal, each track is recorded in it once done.
+ * Returns TRUE on success; on failure, the error code is left in the
+ * target, and the failing track in its 'track' field.
+ *
+ */
+
+BOOL write_target(PTARGET tp, BOOL progress)
+{	PDISK dp = tp->dp;
+	ULONG tlen = dp->sectors*BLKSIZE;
+	UINT t;
+	PUCHAR src;			/* Track data from image */
+	PUCHAR cur = (PUCHAR) NULL;	/* Current diskette contents */
+
+	if(tp->diff == TRUE)
+		cur = alloc_track(dp);	/* Just write everything if no memory */
+
+	for(t = 0; t < tp->tracks; t++) {
+		tp->track = t;
+		if(wait_image(
+			tp->im,
+			(ULONG) (t + 1)*tlen,
+			tp->writer) == FALSE) {
+			tp->rc = ERROR_READ_FAULT;
+			break;
+		}
+		src = image_track(tp->im, tlen, t);
+		if(t < tp->first) {		/* Written before resuming */
+			if(tp->mp != (PMANIFEST) NULL)
+				manifest_track(tp->mp, src, tlen);
+			continue;
+		}
+		if(progress == TRUE) {
+			show_progress(t / dp->heads, t % dp->heads);
+		}
+		if(tp->map != (PUCHAR) NULL &&
+		   (tp->map[t/8] & (1 << (t%8))) == 0) {
+			tp->skipped++;
+		} else if(cur != (PUCHAR) NULL &&
+		   read_track(dp, t / dp->heads, t % dp->heads, cur) == NO_ERROR &&
+		   memcmp(cur, src, (size_t) tlen) == 0) {
+			tp->skipped++;
+		} else {
+			tp->rc = tp->format == FALSE ? NO_ERROR :
+				format_track(dp, t / dp->heads, t % dp->heads);
+			if(tp->rc == NO_ERROR)
+				tp->rc = write_track(
+						dp,
+						t / dp->heads,
+						t % dp->heads,
+						src);
+			if(tp->rc == NO_ERROR && tp->vp != (PVERIFY) NULL)
+				tp->rc = verify_track(
+						tp->vp,
+						dp,
+						t / dp->heads,
+						t % dp->heads,
+						src);
+			if(tp->rc != NO_ERROR) break;
+		}
+		if(tp->mp != (PMANIFEST) NULL)
+			manifest_track(tp->mp, src, tlen);
+		if(tp->jp != (PJOURNAL) NULL)
+			journal_track(tp->jp, src);
+	}
+	if(cur != (PUCHAR) NULL) free_track(dp, cur);
+	tp->done = TRUE;
+
+	return(tp->rc == NO_ERROR ? TRUE : FALSE);
+}
+
+/*
+ * End of file: target.c
+ *
+ */
@@ -0,0 +1,251 @@
+/*
+ * File: timing.c
+ *
+ * Diskette raw image utilities
+ *
+ * Timing of diskette and image file operations, and progress display
+ *
+ */
+
+/*
+ * When a run is being timed, each call to the diskette (through diskio.c)
+ * and each transfer of a track to or from the image file is timed, and
+ * the time added to the totals for that kind of operation, along with a
+ * histogram of the times taken. Failed calls are counted too; each one
+ * leads to a retry, a rewrite, or the end of the run. At the end, the
+ * figures are written to a report file in JSON, for use by other
+ * programs (such as the benchmark script, bench.sh), along with the
+ * elapsed time and the processor time used by the whole run:
+ *
+ *	{
+ *	  "program": "rawrite",
+ *	  "drive": "A:",
+ *	  ...
+ *	  "operations": {
+ *	    "write_track": { "count": 160, "errors": 0, ... },
+ *	    ...
+ *	  }
+ *	}
+ *
+ * The progress display is also handled here. It is updated no more than
+ * a few times a second, so that it costs little when the output is
+ * redirected.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diskio.h"
+#include "timing.h"
+
+/* Forward references */
+
+static	VOID	json_string(FILE *, PUCHAR);
+
+/* Local storage */
+
+static	const	PUCHAR opname[] = {	/* Indexed by TM_xxx */
+	"read_track",
+	"read_sector",
+	"write_track",
+	"format_track",
+	"image_file"
+};
+
+static	ULONG	lastshown;		/* Clock when progress last shown */
+static	BOOL	pending = FALSE;	/* Position not yet shown */
+static	UINT	lastcyl, lasthead;	/* Last position given */
+
+
+/*
+ * Start timing a run.
+ * Returns pointer to the timing, or NULL on failure (already reported).
+ *
+ */
+
+PTIMING open_timing(VOID)
+{	PTIMING tm;
+
+	tm = (PTIMING) calloc(1, sizeof(TIMING));
+	if(tm == (PTIMING) NULL) {
+		error("cannot allocate memory for timing");
+		return((PTIMING) NULL);
+	}
+	tm->start = clock_us();
+	tm->cpu = (ULONG) clock();
+
+	return(tm);
+}
+
+
+/*
+ * Record an operation of kind 'op', which started when the clock read
+ * 'start' and gave result 'rc'.
+ *
+ */
+
+VOID time_op(PTIMING tm, INT op, ULONG start, APIRET rc)
+{	PTIMES tp = &tm->op[op];
+	ULONG us = clock_us() - start;
+	ULONG limit = 1000L;		/* Top of first bucket */
+	INT i;
+
+	tp->count++;
+	if(rc != NO_ERROR) tp->errors++;
+	tp->total += us;
+	if(us > tp->max) tp->max = us;
+	for(i = 0; i < NBUCKETS - 1 && us >= limit; i++)
+		limit *= 2;
+	tp->hist[i]++;
+}
+
+
+/*
+ * Write the report for a timed run to the file 'name', in JSON. The run
+ * was on the disk 'dp' (with its geometry set), using image file 'image'
+ * and 'nbufs' track buffers, and its result was 'ok'.
+ * Returns TRUE on success, FALSE on failure (already reported).
+ *
+ */
+
+BOOL write_timing(PTIMING tm, PUCHAR name, PDISK dp, PUCHAR image,
+			UINT nbufs, BOOL ok)
+{	FILE *fp;
+	PTIMES tp;
+	PUCHAR sep = "";
+	ULONG us;
+	INT i, j;
+
+	fp = fopen(name, "w");
+	if(fp == (FILE *) NULL) {
+		error("cannot create report file '%s'", name);
+		return(FALSE);
+	}
+
+	fprintf(fp, "{\n  \"program\": \"%s\",\n  \"drive\": ", progname);
+	json_string(fp, dp->drive);
+	fprintf(fp, ",\n  \"image\": ");
+	json_string(fp, image);
+	fprintf(
+		fp,
+		",\n  \"geometry\": { \"cylinders\": %u, \"heads\": %u,"
+		" \"sectors\": %u },\n",
+		dp->cyls,
+		dp->heads,
+		dp->sectors);
+	fprintf(fp, "  \"buffers\": %u,\n", nbufs);
+	fprintf(fp, "  \"result\": \"%s\",\n", ok == TRUE ? "ok" : "failed");
+	us = clock_us() - tm->start;
+	fprintf(fp, "  \"elapsed_ms\": %lu.%03lu,\n", us / 1000L, us % 1000L);
+	us = ((ULONG) clock() - tm->cpu) * (1000000L / CLOCKS_PER_SEC);
+	fprintf(fp, "  \"cpu_ms\": %lu.%03lu,\n", us / 1000L, us % 1000L);
+	fprintf(fp, "  \"histogram_limits_ms\": [");
+	for(i = 0; i < NBUCKETS - 1; i++)
+		fprintf(fp, "%s%lu", i == 0 ? "" : ", ", (ULONG) 1 << i);
+	fprintf(fp, "],\n  \"operations\": {");
+
+	for(i = 0; i < NTIMES; i++) {
+		tp = &tm->op[i];
+		if(tp->count == 0) continue;
+		fprintf(
+			fp,
+			"%s\n    \"%s\": {\n"
+			"      \"count\": %lu,\n"
+			"      \"errors\": %lu,\n"
+			"      \"total_ms\": %lu.%03lu,\n"
+			"      \"mean_ms\": %lu.%03lu,\n"
+			"      \"max_ms\": %lu.%03lu,\n"
+			"      \"histogram\": [",
+			sep,
+			opname[i],
+			tp->count,
+			tp->errors,
+			tp->total / 1000L, tp->total % 1000L,
+			tp->total / tp->count / 1000L,
+			tp->total / tp->count % 1000L,
+			tp->max / 1000L, tp->max % 1000L);
+		for(j = 0; j < NBUCKETS; j++)
+			fprintf(fp, "%s%lu", j == 0 ? "" : ", ", tp->hist[j]);
+		fprintf(fp, "]\n    }");
+		sep = ",";
+	}
+	fprintf(fp, "\n  }\n}\n");
+
+	if(fclose(fp) != 0) {
+		error("error writing report file '%s'", name);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Write a string to a JSON file, quoted. Path names may contain
+ * backslashes, which must be escaped.
+ *
+ */
+
+static VOID json_string(FILE *fp, PUCHAR s)
+{	fputc('"', fp);
+	for(; *s != '\0'; s++) {
+		if(*s == '"' || *s == '\\') fputc('\\', fp);
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+
+/*
+ * Show the position reached, if the display has not been updated too
+ * recently; otherwise just remember it.
+ *
+ */
+
+VOID show_progress(UINT cyl, UINT head)
+{	ULONG now = clock_us();
+
+	lastcyl = cyl;
+	lasthead = head;
+	if(lastshown != 0 && now - lastshown < PROGRESSUS) {
+		pending = TRUE;
+		return;
+	}
+
+	fprintf(stdout, "%s: cyl: %2d; head: %1d\r", progname, cyl, head);
+	fflush(stdout);
+	lastshown = now;
+	pending = FALSE;
+}
+
+
+/*
+ * Finish the progress display, first showing the last position given if
+ * it has not been shown yet.
+ *
+ */
+
+VOID end_progress(VOID)
+{	if(pending == TRUE) {
+		fprintf(
+			stdout,
+			"%s: cyl: %2d; head: %1d\r",
+			progname,
+			lastcyl,
+			lasthead);
+		pending = FALSE;
+	}
+	fputc('\n', stdout);
+	fflush(stdout);
+	lastshown = 0;
+}
+
+/*
+ * End of file: timing.c
+ *
+ */
@@ -0,0 +1,60 @@
+/*
+ * File: timing.h
+ *
+ * Diskette raw image utilities
+ *
+ * Definitions for timing of diskette and image file operations
+ *
+ */
+
+#ifndef	_TIMING_H
+#define	_TIMING_H
+
+/* Miscellaneous definitions */
+
+#define	NBUCKETS	12		/* Buckets in latency histogram */
+#define	PROGRESSUS	250000L		/* Least time between displays */
+
+/* Operations timed */
+
+#define	TM_READ		0		/* Read whole track */
+#define	TM_SECTOR	1		/* Read single sector */
+#define	TM_WRITE	2		/* Write whole track */
+#define	TM_FORMAT	3		/* Format track */
+#define	TM_FILE		4		/* Image file transfer of one track */
+#define	NTIMES		5		/* Number of operations timed */
+
+/* Times taken by one kind of operation. Bucket 'i' of the histogram
+   counts operations taking less than 2**i milliseconds; the last bucket
+   counts all the rest. */
+
+typedef	struct _TIMES {
+	ULONG		count;		/* Number of operations */
+	ULONG		errors;		/* Number that failed */
+	ULONG		total;		/* Total time, in microseconds */
+	ULONG		max;		/* Longest time, in microseconds */
+	ULONG		hist[NBUCKETS];	/* Latency histogram */
+} TIMES, *PTIMES;
+
+/* Timing of a whole run */
+
+typedef	struct _TIMING {
+	ULONG		start;		/* Clock when run started */
+	ULONG		cpu;		/* Processor time when run started */
+	TIMES		op[NTIMES];	/* Times for each operation */
+} TIMING, *PTIMING;
+
+/* External references */
+
+extern	VOID	end_progress(VOID);
+extern	PTIMING	open_timing(VOID);
+extern	VOID	show_progress(UINT, UINT);
+extern	VOID	time_op(PTIMING, INT, ULONG, APIRET);
+extern	BOOL	write_timing(PTIMING, PUCHAR, PDISK, PUCHAR, UINT, BOOL);
+
+#endif
+
+/*
+ * End of file: timing.h
+ *
+ */
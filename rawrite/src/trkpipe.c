@@ -0,0 +1,323 @@
+/*
+ * File: trkpipe.c
+ *
+ * Diskette raw image utilities
+ *
+ * Track pipeline
+ *
+ */
+
+/*
+ * The pipeline lets transfers to and from the image file overlap with
+ * transfers to and from the diskette. It holds a ring of track buffers,
+ * and a worker thread that runs a caller-supplied function on each one.
+ *
+ * In a source pipeline (TP_SOURCE) the worker fills tracks (e.g. from the
+ * image file) ahead of the main thread, which takes them with pipe_get,
+ * writes them to the diskette, and hands them back with pipe_put. In a sink
+ * pipeline (TP_SINK) the main thread takes empty tracks with pipe_get, fills
+ * them (e.g. from the diskette) and passes them to the worker with pipe_put.
+ *
+ * With one buffer, or where threads are not available, there is no worker
+ * thread and the function is simply called inline; the behaviour is then
+ * exactly that of the original sequential loop.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diskio.h"
+#include "trkpipe.h"
+
+/* Forward references */
+
+static	VOID	free_pipe(PTRKPIPE);
+#ifdef	THREADS
+static	VOID	sink_thread(PVOID);
+static	VOID	source_thread(PVOID);
+#endif
+
+
+/*
+ * Create a pipeline of 'depth' track buffers for the disk 'dp', and
+ * start its worker. Returns pointer to the pipeline, or NULL on failure.
+ *
+ */
+
+PTRKPIPE open_pipe(PDISK dp, UINT depth, INT dir, PTRKFN fn, PVOID arg)
+{	PTRKPIPE pp;
+	UINT i;
+
+#ifndef	THREADS
+	depth = 1;			/* No point in more */
+#endif
+	pp = (PTRKPIPE) calloc(1, sizeof(TRKPIPE));
+	if(pp == (PTRKPIPE) NULL) {
+		error("cannot allocate memory for track pipeline");
+		return((PTRKPIPE) NULL);
+	}
+	pp->slot = (PTRACK) calloc(depth, sizeof(TRACK));
+	if(pp->slot == (PTRACK) NULL) {
+		error("cannot allocate memory for track pipeline");
+		free((PTRKPIPE) pp);
+		return((PTRKPIPE) NULL);
+	}
+	pp->dp = dp;
+	pp->depth = depth;
+	pp->dir = dir;
+	pp->fn = fn;
+	pp->arg = arg;
+
+	for(i = 0; i < depth; i++) {
+		pp->slot[i].sectors = dp->sectors;
+		pp->slot[i].buf = alloc_track(dp);
+		if(pp->slot[i].buf == (PUCHAR) NULL) {
+			error("cannot allocate memory for track buffer");
+			free_pipe(pp);
+			return((PTRKPIPE) NULL);
+		}
+	}
+
+#ifdef	THREADS
+	if(depth > 1) {
+		if(create_sem(&pp->empty, depth) == FALSE) {
+			error("cannot create semaphore");
+			free_pipe(pp);
+			return((PTRKPIPE) NULL);
+		}
+		if(create_sem(&pp->full, 0) == FALSE) {
+			error("cannot create semaphore");
+			delete_sem(&pp->empty);
+			free_pipe(pp);
+			return((PTRKPIPE) NULL);
+		}
+		pp->threaded = start_thread(
+				&pp->tid,
+				dir == TP_SOURCE ? source_thread : sink_thread,
+				(PVOID) pp);
+		if(pp->threaded == FALSE) {	/* Carry on without overlap */
+			delete_sem(&pp->full);
+			delete_sem(&pp->empty);
+		}
+	}
+#endif
+
+	return(pp);
+}
+
+
+/*
+ * Shut down a pipeline. For a sink, any tracks still queued are passed to
+ * the worker first. For a source, the worker is told to stop, and any
+ * tracks it has already filled are discarded.
+ * Returns FALSE if the worker function failed on any track, else TRUE.
+ *
+ */
+
+BOOL close_pipe(PTRKPIPE pp)
+{	PTRACK t;
+	BOOL res;
+
+	if(pp->dir == TP_SINK) {
+		if(pp->ended == FALSE) {	/* Send end marker */
+			t = pipe_get(pp);
+			t->last = TRUE;
+			pipe_put(pp, t);
+		}
+	} else {
+#ifdef	THREADS
+		pp->stop = TRUE;
+		while(pp->threaded == TRUE && pp->ended == FALSE) {
+			t = pipe_get(pp);
+			pipe_put(pp, t);
+		}
+#endif
+	}
+
+#ifdef	THREADS
+	if(pp->threaded == TRUE) {
+		wait_thread(pp->tid);
+		delete_sem(&pp->full);
+		delete_sem(&pp->empty);
+	}
+#endif
+	res = pp->failed == TRUE ? FALSE : TRUE;
+	free_pipe(pp);
+
+	return(res);
+}
+
+
+/*
+ * Free the buffers and control block of a pipeline.
+ *
+ */
+
+static VOID free_pipe(PTRKPIPE pp)
+{	UINT i;
+
+	for(i = 0; i < pp->depth; i++) {
+		if(pp->slot[i].buf != (PUCHAR) NULL)
+			free_track(pp->dp, pp->slot[i].buf);
+	}
+	free((PTRACK) pp->slot);
+	free((PTRKPIPE) pp);
+}
+
+
+/*
+ * Returns TRUE if the worker of a sink pipeline has failed; the main
+ * thread should then stop producing tracks.
+ *
+ */
+
+BOOL pipe_failed(PTRKPIPE pp)
+{	return(pp->failed);
+}
+
+
+/*
+ * Get the next track from the pipeline. For a source, this is the next
+ * filled track (the 'error' and 'last' flags should be checked); for a
+ * sink it is an empty track to be filled.
+ *
+ */
+
+PTRACK pipe_get(PTRKPIPE pp)
+{	PTRACK t;
+
+	if(pp->dir == TP_SOURCE) {
+#ifdef	THREADS
+		if(pp->threaded == TRUE) {
+			wait_sem(&pp->full);
+			t = &pp->slot[pp->out];
+		} else
+#endif
+		{
+			t = &pp->slot[0];
+			t->count = 0;
+			t->last = FALSE;
+			t->error = FALSE;
+			t->hole = FALSE;
+			if(pp->fn(t, pp->arg) == FALSE) {
+				t->error = TRUE;
+				t->last = TRUE;
+			}
+		}
+		if(t->last == TRUE) pp->ended = TRUE;
+	} else {
+#ifdef	THREADS
+		if(pp->threaded == TRUE) {
+			wait_sem(&pp->empty);
+			t = &pp->slot[pp->in];
+		} else
+#endif
+			t = &pp->slot[0];
+		t->count = 0;
+		t->last = FALSE;
+		t->error = FALSE;
+		t->hole = FALSE;
+	}
+
+	return(t);
+}
+
+
+/*
+ * Return a track to the pipeline. For a source, the track has been used
+ * and may be refilled; for a sink, the track has been filled and is passed
+ * on to the worker. The caller must not touch the track afterwards.
+ *
+ */
+
+VOID pipe_put(PTRKPIPE pp, PTRACK t)
+{	if(pp->dir == TP_SOURCE) {
+#ifdef	THREADS
+		if(pp->threaded == TRUE) {
+			pp->out = (pp->out + 1) % pp->depth;
+			post_sem(&pp->empty);
+		}
+#endif
+	} else {
+		if(t->last == TRUE) pp->ended = TRUE;
+#ifdef	THREADS
+		if(pp->threaded == TRUE) {
+			pp->in = (pp->in + 1) % pp->depth;
+			post_sem(&pp->full);
+		} else
+#endif
+		if(pp->failed == FALSE && pp->fn(t, pp->arg) == FALSE)
+			pp->failed = TRUE;
+	}
+}
+
+#ifdef	THREADS
+
+/*
+ * Worker thread for a source pipeline. Fills tracks in ring order until
+ * the worker function marks one as the last, fails, or the main thread
+ * asks it to stop.
+ *
+ */
+
+static VOID source_thread(PVOID arg)
+{	PTRKPIPE pp = (PTRKPIPE) arg;
+	PTRACK t;
+	UINT i = 0;
+	BOOL last;
+
+	for(;;) {
+		wait_sem(&pp->empty);
+		t = &pp->slot[i];
+		t->count = 0;
+		t->last = FALSE;
+		t->error = FALSE;
+		t->hole = FALSE;
+		if(pp->stop == TRUE) {
+			t->last = TRUE;
+		} else if(pp->fn(t, pp->arg) == FALSE) {
+			t->error = TRUE;
+			t->last = TRUE;
+		}
+		last = t->last;
+		post_sem(&pp->full);
+		if(last == TRUE) break;
+		i = (i + 1) % pp->depth;
+	}
+}
+
+
+/*
+ * Worker thread for a sink pipeline. Empties tracks in ring order until
+ * one marked as the last has been processed. After a failure, remaining
+ * tracks are discarded.
+ *
+ */
+
+static VOID sink_thread(PVOID arg)
+{	PTRKPIPE pp = (PTRKPIPE) arg;
+	PTRACK t;
+	UINT i = 0;
+	BOOL last;
+
+	for(;;) {
+		wait_sem(&pp->full);
+		t = &pp->slot[i];
+		if(pp->failed == FALSE && pp->fn(t, pp->arg) == FALSE)
+			pp->failed = TRUE;
+		last = t->last;
+		post_sem(&pp->empty);
+		if(last == TRUE) break;
+		i = (i + 1) % pp->depth;
+	}
+}
+
+#endif
+
+/*
+ * End of file: trkpipe.c
+ *
+ */
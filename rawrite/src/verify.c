@@ -0,0 +1,180 @@
+/*
+ * File: verify.c
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Read-after-write verification
+ *
+ */
+
+/*
+ * A diskette drive reports success once a track has been sent to the
+ * diskette, not once it is known to be readable. When verification is
+ * wanted, each track is therefore read back as soon as it has been
+ * written, while the head is still on the cylinder, and the CRC32C of
+ * what was read is compared with that of the data written. This costs
+ * a revolution or so per track, rather than a second pass over the whole
+ * diskette with all its seeking; and where the image is read through the
+ * track pipeline, the next track is being read while the check is done.
+ * A track that does not read back correctly is rewritten and checked
+ * again, up to a set number of times. Any copy of the track the system
+ * keeps (under Linux, the floppy driver's track buffer, and the cache
+ * when O_DIRECT cannot be used) is dropped before each read, so that the
+ * check really is of the diskette.
+ *
+ */
+
+#include "sysdep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskio.h"
+#include "hash.h"
+#include "verify.h"
+
+
+/*
+ * Prepare to verify the tracks written to a diskette, whose geometry must
+ * already be set. A track that does not read back correctly is rewritten
+ * up to 'rewrites' times.
+ * Returns pointer to the verification state, or NULL on failure.
+ *
+ */
+
+PVERIFY open_verify(PDISK dp, UINT rewrites)
+{	PVERIFY vp;
+	UINT tracks = dp->cyls*dp->heads;
+
+	vp = (PVERIFY) calloc(1, sizeof(VERIFY));
+	if(vp != (PVERIFY) NULL) {
+		vp->result = (PUCHAR) malloc(tracks);
+		vp->buf = alloc_track(dp);
+		if(vp->result == (PUCHAR) NULL || vp->buf == (PUCHAR) NULL) {
+			close_verify(vp, dp);
+			vp = (PVERIFY) NULL;
+		}
+	}
+	if(vp == (PVERIFY) NULL) {
+		error("cannot allocate memory for verification");
+		return((PVERIFY) NULL);
+	}
+	memset(vp->result, VR_UNCHECKED, tracks);
+	vp->rewrites = rewrites;
+	vp->cyls = dp->cyls;
+	vp->heads = dp->heads;
+
+	return(vp);
+}
+
+
+/*
+ * Verify a track that has just been written from 'src', rewriting it if
+ * it does not read back correctly.
+ * Returns NO_ERROR if the track is good, ERROR_CRC if it is still wrong
+ * after every rewrite, or the error from a failed rewrite or from failing
+ * to get past the system's cache.
+ *
+ */
+
+APIRET verify_track(PVERIFY vp, PDISK dp, UINT cyl, UINT head, PUCHAR src)
+{	ULONG tlen = dp->sectors*BLKSIZE;
+	WORD32 want;			/* CRC of data written */
+	APIRET rc;
+	UINT n;				/* Rewrites so far */
+	PUCHAR res = &vp->result[cyl*vp->heads + head];
+
+	want = crc32c(0, src, tlen);
+	vp->verified++;
+
+	for(n = 0; ; n++) {
+		rc = uncache_track(dp, cyl, head);
+		if(rc != NO_ERROR) {		/* Cannot check it at all */
+			*res = VR_FAILED;
+			vp->failed++;
+			return(rc);
+		}
+		rc = read_track(dp, cyl, head, vp->buf);
+		if(rc == NO_ERROR && crc32c(0, vp->buf, tlen) == want) break;
+		if(n >= vp->rewrites) {
+			*res = VR_FAILED;
+			vp->failed++;
+			return(ERROR_CRC);
+		}
+		rc = write_track(dp, cyl, head, src);
+		if(rc != NO_ERROR) {
+			*res = VR_FAILED;
+			vp->failed++;
+			return(rc);
+		}
+	}
+
+	if(n == 0) {
+		*res = VR_GOOD;
+	} else {
+		*res = (UCHAR) ('0' + n);
+		vp->rewritten++;
+	}
+
+	return(NO_ERROR);
+}
+
+
+/*
+ * Report the result of verification, with the result for every track
+ * laid out as a map. 'drive' is the name of the drive, or NULL if there
+ * is only one.
+ *
+ */
+
+VOID report_verify(PVERIFY vp, PUCHAR drive)
+{	UINT c, n;
+	PUCHAR lead = drive == (PUCHAR) NULL ? "" : "drive ";
+	PUCHAR name = drive == (PUCHAR) NULL ? (PUCHAR) "" : drive;
+	PUCHAR sep = drive == (PUCHAR) NULL ? "" : ": ";
+
+	error(
+		"%s%s%s%d tracks verified; %d needed rewriting, %d failed",
+		lead, name, sep,
+		vp->verified,
+		vp->rewritten,
+		vp->failed);
+	if(vp->verified == 0) return;
+
+	error(
+		"%s%s%sby track ('%c' good, '1'-'%d' rewrites, '%c' failed,"
+		" '%c' not written):",
+		lead, name, sep,
+		VR_GOOD,
+		MAXREWRITES,
+		VR_FAILED,
+		VR_UNCHECKED);
+	for(c = 0; c < vp->cyls; c += MAPCYLS) {
+		n = vp->cyls - c < MAPCYLS ? vp->cyls - c : MAPCYLS;
+		error(
+			"%s%s%s  cylinders %2d-%2d  %.*s",
+			lead, name, sep,
+			c,
+			c + n - 1,
+			n*vp->heads,
+			&vp->result[c*vp->heads]);
+	}
+}
+
+
+/*
+ * Free the verification state for a diskette.
+ *
+ */
+
+VOID close_verify(PVERIFY vp, PDISK dp)
+{	if(vp->buf != (PUCHAR) NULL) free_track(dp, vp->buf);
+	if(vp->result != (PUCHAR) NULL) free((PUCHAR) vp->result);
+	free((PVERIFY) vp);
+}
+
+/*
+ * End of file: verify.c
+ *
+ */
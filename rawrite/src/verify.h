@@ -0,0 +1,51 @@
+/*
+ * File: verify.h
+ *
+ * Write raw diskette image to a diskette
+ *
+ * Definitions for read-after-write verification
+ *
+ */
+
+#ifndef	_VERIFY_H
+#define	_VERIFY_H
+
+/* Miscellaneous definitions */
+
+#define	DEFREWRITES	2		/* Default rewrites of a bad track */
+#define	MAXREWRITES	9		/* Maximum rewrites of a bad track */
+#define	MAPCYLS		20		/* Cylinders per line of report */
+
+/* Verification results for each track; a track that was good after
+   rewriting is shown by the number of rewrites needed, '1' to '9' */
+
+#define	VR_UNCHECKED	'.'		/* Not written, so not checked */
+#define	VR_GOOD		'+'		/* Read back correctly first time */
+#define	VR_FAILED	'-'		/* Still wrong after every rewrite */
+
+/* Verification of one diskette */
+
+typedef	struct _VERIFY {
+	UINT		rewrites;	/* Rewrites allowed for a bad track */
+	UINT		cyls;		/* Cylinders on diskette */
+	UINT		heads;		/* Heads on diskette */
+	PUCHAR		result;		/* Result for each track */
+	PUCHAR		buf;		/* Buffer for reading back */
+	UINT		verified;	/* Tracks checked */
+	UINT		rewritten;	/* Tracks that needed rewriting */
+	UINT		failed;		/* Tracks that could not be fixed */
+} VERIFY, *PVERIFY;
+
+/* External references */
+
+extern	VOID	close_verify(PVERIFY, PDISK);
+extern	PVERIFY	open_verify(PDISK, UINT);
+extern	VOID	report_verify(PVERIFY, PUCHAR);
+extern	APIRET	verify_track(PVERIFY, PDISK, UINT, UINT, PUCHAR);
+
+#endif
+
+/*
+ * End of file: verify.h
+ *
+ */